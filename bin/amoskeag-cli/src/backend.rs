@@ -1,5 +1,6 @@
 //! Backend type selection and execution
 
+use amoskeag::backend::bytecode::BytecodeBackend;
 use amoskeag::{evaluate, AmoskeagValue as Value, CompiledProgram};
 use anyhow::{bail, Result};
 use std::collections::HashMap;
@@ -9,6 +10,7 @@ use std::collections::HashMap;
 pub enum BackendType {
     #[default]
     Interpreter,
+    Bytecode,
     #[cfg(feature = "jit")]
     Jit,
 }
@@ -26,6 +28,7 @@ impl BackendType {
 
         match s.to_lowercase().as_str() {
             "interpreter" | "interp" => Ok(BackendType::Interpreter),
+            "bytecode" | "vm" => Ok(BackendType::Bytecode),
             #[cfg(feature = "jit")]
             "jit" => Ok(BackendType::Jit),
             #[cfg(not(feature = "jit"))]
@@ -33,7 +36,7 @@ impl BackendType {
                 "JIT backend not available. This is an enterprise feature. Contact support for access."
             ),
             _ => bail!(
-                "Unknown backend: {}. Available backends: interpreter{}",
+                "Unknown backend: {}. Available backends: interpreter, bytecode{}",
                 s,
                 if cfg!(feature = "jit") { ", jit" } else { "" }
             ),
@@ -45,6 +48,7 @@ impl BackendType {
     pub fn name(&self) -> &'static str {
         match self {
             BackendType::Interpreter => "interpreter",
+            BackendType::Bytecode => "bytecode",
             #[cfg(feature = "jit")]
             BackendType::Jit => "jit",
         }
@@ -54,9 +58,9 @@ impl BackendType {
     #[must_use]
     pub fn available_backends() -> &'static str {
         if cfg!(feature = "jit") {
-            "interpreter, jit"
+            "interpreter, bytecode, jit"
         } else {
-            "interpreter"
+            "interpreter, bytecode"
         }
     }
 }
@@ -73,6 +77,12 @@ pub fn evaluate_with_backend(
 ) -> Result<Value> {
     match backend_type {
         BackendType::Interpreter => evaluate(program, data).map_err(|e| anyhow::anyhow!("{}", e)),
+        BackendType::Bytecode => {
+            let bytecode = BytecodeBackend::new()
+                .compile_program(program)
+                .map_err(|e| anyhow::anyhow!("{}", e))?;
+            bytecode.run(data).map_err(|e| anyhow::anyhow!("{}", e))
+        }
         #[cfg(feature = "jit")]
         BackendType::Jit => {
             // JIT backend requires enterprise amoskeag-jit crate (not available in open-source version)
@@ -108,6 +118,27 @@ mod tests {
         ));
     }
 
+    #[test]
+    fn test_backend_from_str_bytecode() {
+        assert!(matches!(
+            BackendType::from_str("bytecode"),
+            Ok(BackendType::Bytecode)
+        ));
+        assert!(matches!(
+            BackendType::from_str("VM"),
+            Ok(BackendType::Bytecode)
+        ));
+        assert_eq!(BackendType::Bytecode.name(), "bytecode");
+    }
+
+    #[test]
+    fn test_evaluate_with_bytecode_backend() {
+        let program = amoskeag::compile("let x = 2 in x * 21", &[]).unwrap();
+        let result =
+            evaluate_with_backend(&program, &HashMap::new(), &BackendType::Bytecode).unwrap();
+        assert_eq!(result, Value::Number(42.0));
+    }
+
     #[test]
     fn test_backend_from_str_unknown() {
         assert!(BackendType::from_str("unknown").is_err());
@@ -0,0 +1,193 @@
+//! Streaming NDJSON batch evaluation
+//!
+//! `amoskeag batch` compiles a program once and evaluates it against every
+//! record of an NDJSON stream. Lines are read one window at a time. Worker
+//! threads parse, evaluate, and serialize the records of a window in
+//! parallel, and the results are written in input order before the next
+//! window is read, so memory use is bounded by the window, not the input.
+//!
+//! Only the fields the program reads are decoded; the rest of each record
+//! is skipped.
+//!
+//! Each non-blank input line produces one output line: `{"result": ...}`
+//! on success, or `{"error": "..."}` when the line isn't a JSON object or
+//! its evaluation fails. A bad record never stops the batch.
+
+use crate::json::{parse_json_data_projected, value_to_json};
+use amoskeag::{evaluate, parallel_map_with, CompiledProgram};
+use anyhow::{bail, Context, Result};
+use std::io::{BufRead, Read, Write};
+
+/// Number of lines a worker claims at a time
+const CHUNK_SIZE: usize = 64;
+
+/// Number of chunks per worker in a window
+const CHUNKS_PER_WORKER: usize = 4;
+
+/// Maximum length of one input line in bytes (10 MB)
+const MAX_LINE_SIZE: u64 = 10 * 1024 * 1024;
+
+/// Counts of records processed by a batch
+#[derive(Debug, Default, PartialEq)]
+pub struct BatchSummary {
+    pub records: usize,
+    pub errors: usize,
+}
+
+/// Evaluate `program` against every NDJSON record of `input` on `workers`
+/// threads, writing one NDJSON result per record to `output`
+///
+/// # Errors
+/// Returns an error if reading the input or writing the output fails, or if
+/// an input line is longer than `MAX_LINE_SIZE`.
+pub fn run_batch<R: BufRead, W: Write>(
+    program: &CompiledProgram,
+    mut input: R,
+    mut output: W,
+    workers: usize,
+) -> Result<BatchSummary> {
+    let workers = workers.max(1);
+    let window = workers * CHUNK_SIZE * CHUNKS_PER_WORKER;
+    let mut summary = BatchSummary::default();
+    let mut lines = Vec::with_capacity(window);
+    let mut line_number = 0;
+
+    loop {
+        lines.clear();
+        line_number = read_window(&mut input, window, &mut lines, line_number)?;
+        if lines.is_empty() {
+            break;
+        }
+
+        for (result, ok) in evaluate_lines(program, &lines, workers) {
+            output
+                .write_all(result.as_bytes())
+                .and_then(|()| output.write_all(b"\n"))
+                .with_context(|| "Failed to write results")?;
+            summary.records += 1;
+            summary.errors += usize::from(!ok);
+        }
+    }
+
+    output.flush().with_context(|| "Failed to write results")?;
+    Ok(summary)
+}
+
+/// Read up to `window` non-blank lines into `lines`, returning the number of
+/// the last line read
+fn read_window<R: BufRead>(
+    input: &mut R,
+    window: usize,
+    lines: &mut Vec<String>,
+    mut line_number: usize,
+) -> Result<usize> {
+    while lines.len() < window {
+        let mut line = String::new();
+        let read = Read::take(&mut *input, MAX_LINE_SIZE + 1)
+            .read_line(&mut line)
+            .with_context(|| format!("Failed to read input line {}", line_number + 1))?;
+        if read == 0 {
+            break;
+        }
+        line_number += 1;
+        if read as u64 > MAX_LINE_SIZE {
+            bail!(
+                "Input line {} too large (max {} bytes)",
+                line_number,
+                MAX_LINE_SIZE
+            );
+        }
+        if !line.trim().is_empty() {
+            lines.push(line);
+        }
+    }
+    Ok(line_number)
+}
+
+/// Evaluate a window of lines, in order, as (output line, succeeded) pairs
+fn evaluate_lines(
+    program: &CompiledProgram,
+    lines: &[String],
+    workers: usize,
+) -> Vec<(String, bool)> {
+    parallel_map_with(
+        lines,
+        workers,
+        CHUNK_SIZE,
+        || (),
+        |(), line| evaluate_line(program, line),
+    )
+}
+
+/// Evaluate one record, as its output line and whether it succeeded
+fn evaluate_line(program: &CompiledProgram, line: &str) -> (String, bool) {
+    let result = parse_json_data_projected(line, program.required_paths()).and_then(|data| {
+        evaluate(program, &data).map_err(|e| anyhow::anyhow!("Evaluation failed: {}", e))
+    });
+    match result {
+        Ok(value) => (
+            serde_json::json!({ "result": value_to_json(&value) }).to_string(),
+            true,
+        ),
+        Err(e) => (
+            serde_json::json!({ "error": format!("{:#}", e) }).to_string(),
+            false,
+        ),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use amoskeag::compile;
+    use std::io::Cursor;
+
+    fn batch(source: &str, input: &str, workers: usize) -> (Vec<String>, BatchSummary) {
+        let program = compile(source, &["high", "low"]).unwrap();
+        let mut output = Vec::new();
+        let summary = run_batch(&program, Cursor::new(input), &mut output, workers).unwrap();
+        let lines = String::from_utf8(output)
+            .unwrap()
+            .lines()
+            .map(str::to_string)
+            .collect();
+        (lines, summary)
+    }
+
+    #[test]
+    fn test_batch_results_and_errors() {
+        let input = "{\"score\": 10}\n\n{\"score\": 2}\nnot json\n{\"score\": \"x\"}\n";
+        let (lines, summary) = batch("if score > 5 :high else :low end", input, 1);
+        assert_eq!(
+            lines[..2],
+            [r#"{"result":":high"}"#, r#"{"result":":low"}"#]
+        );
+        assert!(lines[2].starts_with(r#"{"error":"Failed to parse JSON data"#));
+        assert!(lines[3].starts_with(r#"{"error":"Evaluation failed"#));
+        assert_eq!(
+            summary,
+            BatchSummary {
+                records: 4,
+                errors: 2
+            }
+        );
+    }
+
+    #[test]
+    fn test_batch_preserves_order_across_windows() {
+        let count = CHUNK_SIZE * CHUNKS_PER_WORKER * 3 * 4 + 17;
+        let input: String = (0..count).map(|i| format!("{{\"n\": {}}}\n", i)).collect();
+        let (lines, summary) = batch("n * 2", &input, 4);
+        assert_eq!(summary.records, count);
+        assert_eq!(summary.errors, 0);
+        for (i, line) in lines.iter().enumerate() {
+            assert_eq!(line, &format!("{{\"result\":{}}}", i * 2));
+        }
+    }
+
+    #[test]
+    fn test_batch_without_trailing_newline() {
+        let (lines, _) = batch("n + 1", "{\"n\": 1}\n{\"n\": 2}", 2);
+        assert_eq!(lines, [r#"{"result":2}"#, r#"{"result":3}"#]);
+    }
+}
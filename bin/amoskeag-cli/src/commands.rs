@@ -1,13 +1,20 @@
 //! CLI command implementations
 
 use crate::backend::{evaluate_with_backend, BackendType};
+use crate::batch::run_batch;
 use crate::format::format_value;
-use crate::json::parse_json_data;
-use amoskeag::compile;
+use crate::json::{parse_json_data, parse_json_data_projected};
+use amoskeag::{compile, render, ArtifactError, CompiledProgram, DataPaths, ProfiledProgram};
+#[cfg(feature = "stats")]
+use amoskeag::{metrics_snapshot, LatencyHistogram, MetricsSnapshot};
 use anyhow::{bail, Context, Result};
 use std::collections::HashMap;
-use std::fs;
-use std::path::Path;
+#[cfg(feature = "stats")]
+use std::fmt::Write as _;
+use std::fs::{self, File};
+use std::io::{self, BufReader, BufWriter, Write};
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant};
 
 /// Maximum source file size in bytes (10 MB)
 const MAX_SOURCE_SIZE: u64 = 10 * 1024 * 1024;
@@ -15,43 +22,252 @@ const MAX_SOURCE_SIZE: u64 = 10 * 1024 * 1024;
 /// Maximum data file size in bytes (100 MB)
 const MAX_DATA_SIZE: u64 = 100 * 1024 * 1024;
 
-/// Run a program from a source file
+/// Extension given to precompiled programs by default
+const PRECOMPILED_EXTENSION: &str = "amkc";
+
+/// Number of expressions listed in the profile table
+const PROFILE_TABLE_ROWS: usize = 20;
+
+/// Profiler output requested with `--profile`
+#[derive(Debug, Default, PartialEq)]
+pub struct ProfileOptions {
+    /// Where to write folded stacks (`--profile-folded <path>`)
+    pub folded: Option<String>,
+}
+
+/// Run a program from a source file or a precompiled program
+///
+/// With `stats`, the latencies, function calls and allocations recorded
+/// while loading and evaluating the program are written to stderr, even if
+/// evaluation fails. They are only recorded when the CLI is built with the
+/// `stats` feature.
 ///
 /// # Errors
-/// Returns an error if the file cannot be read, parsed, or evaluated.
+/// Returns an error if the file cannot be read, parsed, loaded, or
+/// evaluated, or if `stats` is asked for without the `stats` feature.
 pub fn run_file(
     source_file: &str,
     data_file: Option<&String>,
     symbols: &[&str],
     backend_type: BackendType,
+    stats: bool,
 ) -> Result<()> {
-    // Validate source file
-    validate_file_path(source_file)?;
-    validate_file_size(source_file, MAX_SOURCE_SIZE, "Source")?;
+    if stats && !cfg!(feature = "stats") {
+        bail!("--stats requires a build with the `stats` feature");
+    }
+    let program = load_program(source_file, symbols)?;
+    program.set_metrics_name(source_file);
 
-    // Read the source file
-    let source = fs::read_to_string(source_file)
-        .with_context(|| format!("Failed to read source file: {}", source_file))?;
+    // Read the data file (if provided), decoding only what the program reads
+    let data = load_data_file(data_file, Some(program.required_paths()))?;
 
-    if source.trim().is_empty() {
-        bail!("Source file is empty: {}", source_file);
+    // Evaluate using the selected backend
+    let result = evaluate_with_backend(&program, &data, &backend_type);
+    #[cfg(feature = "stats")]
+    if stats {
+        eprint!("{}", format_stats(&metrics_snapshot()));
     }
+    let result = result?;
 
-    // Read the data file (if provided)
-    let data = load_data_file(data_file)?;
+    // Print the result
+    println!("{}", format_value(&result));
 
-    // Compile the program
-    let program = compile(&source, symbols).with_context(|| "Failed to compile program")?;
+    Ok(())
+}
 
-    // Evaluate using the selected backend
-    let result = evaluate_with_backend(&program, &data, &backend_type)?;
+/// Render a program from a source file or a precompiled program to stdout
+///
+/// The result is streamed to stdout as it is evaluated, exactly as it would
+/// be converted to a string by `+`, without a trailing newline. Templates
+/// built with `+` are written part by part, never holding the whole page.
+///
+/// # Errors
+/// Returns an error if the file cannot be read, parsed, loaded, or
+/// evaluated, or if writing the output fails.
+pub fn render_file(source_file: &str, data_file: Option<&String>, symbols: &[&str]) -> Result<()> {
+    let program = load_program(source_file, symbols)?;
+    let data = load_data_file(data_file, Some(program.required_paths()))?;
 
-    // Print the result
+    let stdout = io::stdout().lock();
+    let mut output = BufWriter::with_capacity(1 << 16, stdout);
+    render(&program, &data, &mut output)?;
+    output.flush()?;
+
+    Ok(())
+}
+
+/// Run a program from a source file under the profiler
+///
+/// The result is printed as by `run_file`. The profile table goes to stderr,
+/// so it stays out of the result, and folded stacks to their file. The
+/// profile is written even when evaluation fails.
+///
+/// # Errors
+/// Returns an error if the file cannot be read, parsed, or evaluated, or if
+/// the folded stacks cannot be written.
+pub fn profile_file(
+    source_file: &str,
+    data_file: Option<&String>,
+    symbols: &[&str],
+    options: &ProfileOptions,
+) -> Result<()> {
+    let source = read_source_file(source_file)?;
+    let data = load_data_file(data_file, None)?;
+
+    let program =
+        ProfiledProgram::compile(&source, symbols).with_context(|| "Failed to compile program")?;
+    let result = program.evaluate(&data);
+
+    let profile = program.profile();
+    eprint!("{}", profile.table(PROFILE_TABLE_ROWS));
+    if let Some(path) = &options.folded {
+        fs::write(path, profile.folded())
+            .with_context(|| format!("Failed to write folded stacks: {}", path))?;
+    }
+
+    let result = result.map_err(|e| anyhow::anyhow!("{}", e))?;
     println!("{}", format_value(&result));
 
     Ok(())
 }
 
+/// Evaluate a program from a source file or a precompiled program against
+/// every record of an NDJSON stream
+///
+/// Records are read from `input`, or from stdin when it is `None` or `-`, and
+/// evaluated on `jobs` threads. Results are written to stdout in input order,
+/// one line per record, and a summary to stderr.
+///
+/// # Errors
+/// Returns an error if the program cannot be read, compiled, or loaded, or
+/// if reading the input or writing the results fails.
+pub fn batch_file(
+    source_file: &str,
+    input: Option<&str>,
+    symbols: &[&str],
+    jobs: usize,
+) -> Result<()> {
+    let program = load_program(source_file, symbols)?;
+
+    let stdout = io::stdout().lock();
+    let output = BufWriter::with_capacity(1 << 16, stdout);
+    let summary = match input {
+        Some(path) if path != "-" => {
+            validate_file_path(path)?;
+            let file =
+                File::open(path).with_context(|| format!("Failed to open input file: {}", path))?;
+            run_batch(
+                &program,
+                BufReader::with_capacity(1 << 16, file),
+                output,
+                jobs,
+            )?
+        }
+        _ => run_batch(&program, io::stdin().lock(), output, jobs)?,
+    };
+
+    eprintln!(
+        "Evaluated {} records ({} errors)",
+        summary.records, summary.errors
+    );
+    Ok(())
+}
+
+/// Statically analyze a rule file, or every rule file under a directory
+///
+/// Rules are analyzed on `jobs` threads. One line per rule is written to
+/// stdout, in path order, with the time its analysis took and what was
+/// found, and a summary to stderr.
+///
+/// # Errors
+/// Returns an error if `path` has no rule files, or if any rule cannot be
+/// read or parsed or has critical errors.
+pub fn sast_path(path: &str, symbols: &[&str], jobs: usize) -> Result<()> {
+    if !Path::new(path).exists() {
+        bail!("Path does not exist: {}", path);
+    }
+    let rules = amoskeag_sast::find_rules(Path::new(path))
+        .with_context(|| format!("Failed to list rule files: {}", path))?;
+    if rules.is_empty() {
+        bail!("No rule files found: {}", path);
+    }
+
+    let start = Instant::now();
+    let reports = amoskeag_sast::analyze_files(&rules, symbols, jobs);
+    let wall = start.elapsed();
+
+    let mut failed = 0;
+    let mut critical = 0;
+    let mut analysis = Duration::ZERO;
+    for report in &reports {
+        analysis += report.elapsed;
+        match &report.result {
+            Ok(result) => {
+                let stats = &result.statistics;
+                critical += stats.critical_errors;
+                println!(
+                    "{}  {:.3?}  {} critical, {} warnings, {} info, {} vulnerable inputs",
+                    report.path.display(),
+                    report.elapsed,
+                    stats.critical_errors,
+                    stats.warnings,
+                    stats.info_issues,
+                    stats.vulnerable_patterns
+                );
+            }
+            Err(e) => {
+                failed += 1;
+                println!("{}  error: {}", report.path.display(), e);
+            }
+        }
+    }
+
+    eprintln!(
+        "Analyzed {} rules in {:.3?} ({:.3?} of analysis on {} threads)",
+        reports.len(),
+        wall,
+        analysis,
+        jobs.min(reports.len())
+    );
+    if failed > 0 || critical > 0 {
+        bail!(
+            "{} rules failed to parse, {} critical errors found",
+            failed,
+            critical
+        );
+    }
+    Ok(())
+}
+
+/// Compile a source file into a precompiled program
+///
+/// The program is written to `output`, or next to the source file with the
+/// `.amkc` extension. `run` and `batch` accept it in place of the source.
+///
+/// # Errors
+/// Returns an error if the file cannot be read or compiled, or if the
+/// precompiled program cannot be written.
+pub fn compile_file(source_file: &str, output: Option<&str>, symbols: &[&str]) -> Result<()> {
+    let source = read_source_file(source_file)?;
+    let program = compile(&source, symbols).with_context(|| "Failed to compile program")?;
+
+    let output = output.map_or_else(
+        || Path::new(source_file).with_extension(PRECOMPILED_EXTENSION),
+        PathBuf::from,
+    );
+    let bytes = program.to_bytes();
+    fs::write(&output, &bytes)
+        .with_context(|| format!("Failed to write precompiled program: {}", output.display()))?;
+
+    eprintln!(
+        "Compiled {} to {} ({} bytes)",
+        source_file,
+        output.display(),
+        bytes.len()
+    );
+    Ok(())
+}
+
 /// Evaluate an expression from a string
 ///
 /// # Errors
@@ -66,12 +282,12 @@ pub fn eval_string(
         bail!("Source expression is empty");
     }
 
-    // Read the data file (if provided)
-    let data = load_data_file(data_file)?;
-
     // Compile the program
     let program = compile(source, symbols).with_context(|| "Failed to compile program")?;
 
+    // Read the data file (if provided), decoding only what the program reads
+    let data = load_data_file(data_file, Some(program.required_paths()))?;
+
     // Evaluate using the selected backend
     let result = evaluate_with_backend(&program, &data, &backend_type)?;
 
@@ -81,6 +297,98 @@ pub fn eval_string(
     Ok(())
 }
 
+/// Format metrics for `run --stats`, one line per measurement
+#[cfg(feature = "stats")]
+fn format_stats(snapshot: &MetricsSnapshot) -> String {
+    let mut out = String::new();
+    latency_line(&mut out, "compile", &snapshot.compile);
+    latency_line(&mut out, "evaluate", &snapshot.evaluate);
+    for backend in &snapshot.backends {
+        latency_line(
+            &mut out,
+            &format!("backend {}", backend.name),
+            &backend.latency,
+        );
+    }
+    for program in &snapshot.programs {
+        latency_line(
+            &mut out,
+            &format!("program {}", program.name),
+            &program.latency,
+        );
+    }
+    for function in &snapshot.functions {
+        let _ = writeln!(
+            out,
+            "function {}  {} calls  {:.3?}",
+            function.name, function.calls, function.time
+        );
+    }
+    if let Some(allocations) = snapshot.allocations {
+        let _ = writeln!(out, "allocations  {}", allocations);
+    }
+    out
+}
+
+#[cfg(feature = "stats")]
+fn latency_line(out: &mut String, label: &str, latency: &LatencyHistogram) {
+    let _ = writeln!(
+        out,
+        "{}  {} calls  p50 {:.3?}  p99 {:.3?}  max {:.3?}",
+        label,
+        latency.count(),
+        latency.quantile(0.5),
+        latency.quantile(0.99),
+        latency.max()
+    );
+}
+
+/// Load a program from a precompiled program, or else compile it from source
+///
+/// A precompiled program carries the symbols it was compiled with, so it
+/// can't be given others.
+fn load_program(source_file: &str, symbols: &[&str]) -> Result<CompiledProgram> {
+    validate_file_path(source_file)?;
+    validate_file_size(source_file, MAX_SOURCE_SIZE, "Source")?;
+
+    let bytes = fs::read(source_file)
+        .with_context(|| format!("Failed to read source file: {}", source_file))?;
+
+    match CompiledProgram::from_bytes(&bytes) {
+        Ok(_) if !symbols.is_empty() => {
+            bail!("Symbols are fixed when a program is precompiled; recompile it to change them")
+        }
+        Ok(program) => Ok(program),
+        Err(ArtifactError::NotAnArtifact) => {
+            let source = String::from_utf8(bytes)
+                .with_context(|| format!("Failed to read source file: {}", source_file))?;
+            if source.trim().is_empty() {
+                bail!("Source file is empty: {}", source_file);
+            }
+            compile(&source, symbols).with_context(|| "Failed to compile program")
+        }
+        Err(e) => {
+            Err(e).with_context(|| format!("Failed to load precompiled program: {}", source_file))
+        }
+    }
+}
+
+fn read_source_file(source_file: &str) -> Result<String> {
+    // Validate source file
+    validate_file_path(source_file)?;
+    validate_file_size(source_file, MAX_SOURCE_SIZE, "Source")?;
+
+    // Read the source file
+    let source = fs::read_to_string(source_file)
+        .with_context(|| format!("Failed to read source file: {}", source_file))?;
+
+    if source.trim().is_empty() {
+        bail!("Source file is empty: {}", source_file);
+    }
+
+    Ok(source)
+}
+
 fn validate_file_path(path: &str) -> Result<()> {
     if path.is_empty() {
         bail!("File path cannot be empty");
@@ -115,7 +423,11 @@ fn validate_file_size(path: &str, max_size: u64, file_type: &str) -> Result<()>
     Ok(())
 }
 
-fn load_data_file(data_file: Option<&String>) -> Result<HashMap<String, amoskeag::AmoskeagValue>> {
+/// Load the data file, if any, keeping only `paths` when given
+fn load_data_file(
+    data_file: Option<&String>,
+    paths: Option<&DataPaths>,
+) -> Result<HashMap<String, amoskeag::AmoskeagValue>> {
     if let Some(data_path) = data_file {
         validate_file_path(data_path)?;
         validate_file_size(data_path, MAX_DATA_SIZE, "Data")?;
@@ -123,7 +435,10 @@ fn load_data_file(data_file: Option<&String>) -> Result<HashMap<String, amoskeag
         let data_content = fs::read_to_string(data_path)
             .with_context(|| format!("Failed to read data file: {}", data_path))?;
 
-        parse_json_data(&data_content)
+        match paths {
+            Some(paths) => parse_json_data_projected(&data_content, paths),
+            None => parse_json_data(&data_content),
+        }
     } else {
         Ok(HashMap::new())
     }
@@ -136,40 +451,68 @@ pub fn print_usage() {
     println!("USAGE:");
     println!("  amoskeag run <source-file> [options] [data-file] [symbols...]");
     println!("  amoskeag eval <source-string> [options] [data-file] [symbols...]");
+    println!("  amoskeag render <source-file> [data-file] [symbols...]");
+    println!("  amoskeag batch <source-file> [--input <file>] [--jobs <n>] [symbols...]");
+    println!("  amoskeag compile <source-file> [--output <file>] [symbols...]");
+    println!("  amoskeag sast <path> [--jobs <n>] [symbols...]");
     println!("  amoskeag repl [options]");
     println!("  amoskeag --help");
     println!("  amoskeag --version");
     println!();
     println!("COMMANDS:");
-    println!("  run    Run an Amoskeag program from a file");
-    println!("  eval   Evaluate an Amoskeag expression from a string");
-    println!("  repl   Start an interactive REPL");
+    println!("  run      Run an Amoskeag program from a file");
+    println!("  eval     Evaluate an Amoskeag expression from a string");
+    println!("  render   Stream a program's result to stdout as text, for templates");
+    println!("  batch    Evaluate a program against each record of an NDJSON stream");
+    println!("  compile  Precompile a program for fast loading by run and batch");
+    println!("  sast     Statically analyze a rule file, or every rule file under a directory");
+    println!("  repl     Start an interactive REPL");
     println!();
     println!("OPTIONS:");
     println!(
         "  -b, --backend <name>   Select execution backend (available: {})",
         BackendType::available_backends()
     );
+    println!("  --profile              Profile the program (run only, interpreter backend)");
+    println!("  --profile-folded <file>  Also write folded stacks for flamegraph tools");
+    #[cfg(feature = "stats")]
+    println!("  --stats                Print latencies, function calls and allocations (run only)");
+    println!("  -i, --input <file>     NDJSON records for batch (default: stdin)");
+    println!("  -j, --jobs <n>         Worker threads for batch and sast (default: all cores)");
+    println!("  -o, --output <file>    Precompiled program to write (default: <source>.amkc)");
     println!("  -h, --help             Print help information");
     println!("  -v, --version          Print version information");
     println!();
     println!("BACKENDS:");
     println!("  interpreter  Tree-walking interpreter (default, full language support)");
+    println!("  bytecode     Bytecode VM with compile-time resolved locals and functions");
     #[cfg(feature = "jit")]
     println!("  jit          LLVM JIT compiler (enterprise feature, fast numeric expressions)");
     #[cfg(not(feature = "jit"))]
     println!("  jit          Enterprise feature (contact support for access)");
     println!();
     println!("ARGUMENTS:");
-    println!("  <source-file>    Path to the Amoskeag source file (.amos)");
+    println!("  <source-file>    Path to the Amoskeag source file (.amos), or a precompiled");
+    println!("                   program (.amkc) for run and batch");
     println!("  <source-string>  Amoskeag expression to evaluate");
+    println!("  <path>           Rule file, or directory searched for .amos files, for sast");
     println!("  [data-file]      Optional path to JSON data file");
     println!("  [symbols...]     Optional list of valid symbol names (without colons)");
     println!();
     println!("EXAMPLES:");
     println!("  amoskeag run example.amos");
     println!("  amoskeag run example.amos data.json approve deny");
+    println!("  amoskeag run example.amos data.json --profile --profile-folded out.folded");
+    #[cfg(feature = "stats")]
+    println!("  amoskeag run example.amos data.json --stats --backend bytecode");
+    println!("  amoskeag render page.amos post.json > page.html");
+    println!("  amoskeag batch rule.amos --input records.ndjson approve deny > results.ndjson");
+    println!(
+        "  amoskeag compile rule.amos approve deny && amoskeag batch rule.amkc < records.ndjson"
+    );
+    println!("  amoskeag sast rules/ approve deny");
     println!("  amoskeag eval \"2 + 3\"");
+    println!("  amoskeag eval \"2 + 3 * 4\" --backend bytecode");
     println!("  amoskeag eval \"2 + 3 * 4\" --backend jit");
     println!("  amoskeag eval \"if user.age > 18 :adult else :minor end\" user.json adult minor");
     println!("  amoskeag repl");
@@ -219,7 +562,7 @@ mod tests {
 
     #[test]
     fn test_load_data_file_none() {
-        let result = load_data_file(None).unwrap();
+        let result = load_data_file(None, None).unwrap();
         assert!(result.is_empty());
     }
 
@@ -229,7 +572,7 @@ mod tests {
         writeln!(temp, "{{\"x\": 42}}").unwrap();
         let path = temp.path().to_str().unwrap().to_string();
 
-        let result = load_data_file(Some(&path)).unwrap();
+        let result = load_data_file(Some(&path), None).unwrap();
         assert!(result.contains_key("x"));
     }
 
@@ -239,7 +582,7 @@ mod tests {
         writeln!(temp, "not json").unwrap();
         let path = temp.path().to_str().unwrap().to_string();
 
-        assert!(load_data_file(Some(&path)).is_err());
+        assert!(load_data_file(Some(&path), None).is_err());
     }
 
     #[test]
@@ -256,7 +599,7 @@ mod tests {
 
     #[test]
     fn test_run_file_empty_path() {
-        let result = run_file("", None, &[], BackendType::Interpreter);
+        let result = run_file("", None, &[], BackendType::Interpreter, false);
         assert!(result.is_err());
     }
 
@@ -267,15 +610,97 @@ mod tests {
             None,
             &[],
             BackendType::Interpreter,
+            false,
         );
         assert!(result.is_err());
     }
 
+    #[test]
+    fn test_compile_file_and_load_program() {
+        let dir = tempfile::tempdir().unwrap();
+        let source = dir.path().join("rule.amos");
+        fs::write(&source, "if score > 5 then :high else :low end").unwrap();
+        let source = source.to_str().unwrap();
+
+        compile_file(source, None, &["high", "low"]).unwrap();
+        let precompiled = dir.path().join("rule.amkc");
+        let precompiled = precompiled.to_str().unwrap();
+
+        let loaded = load_program(precompiled, &[]).unwrap();
+        let compiled = load_program(source, &["high", "low"]).unwrap();
+        assert_eq!(loaded.ast(), compiled.ast());
+        assert!(load_program(precompiled, &["other"]).is_err());
+
+        // A damaged program is rejected, not compiled as source
+        let mut bytes = fs::read(precompiled).unwrap();
+        *bytes.last_mut().unwrap() ^= 1;
+        fs::write(precompiled, bytes).unwrap();
+        let error = load_program(precompiled, &[]).unwrap_err();
+        assert!(format!("{:#}", error).contains("checksum"));
+    }
+
+    #[test]
+    fn test_sast_path() {
+        let dir = tempfile::tempdir().unwrap();
+        fs::write(dir.path().join("clean.amos"), "amount * 2").unwrap();
+        let path = dir.path().to_str().unwrap();
+        assert!(sast_path(path, &[], 2).is_ok());
+
+        fs::write(dir.path().join("divide.amos"), "amount / 0").unwrap();
+        assert!(sast_path(path, &[], 2).is_err());
+
+        let empty = tempfile::tempdir().unwrap();
+        assert!(sast_path(empty.path().to_str().unwrap(), &[], 1).is_err());
+        assert!(sast_path("/nonexistent/rules", &[], 1).is_err());
+    }
+
+    #[test]
+    fn test_render_file() {
+        let dir = tempfile::tempdir().unwrap();
+        let source = dir.path().join("page.amos");
+        fs::write(&source, "\"<h1>\" + title + \"</h1>\" + views").unwrap();
+        let data = dir.path().join("post.json");
+        fs::write(&data, r#"{"title": "Hello", "views": 3}"#).unwrap();
+        let data = data.to_str().unwrap().to_string();
+
+        assert!(render_file(source.to_str().unwrap(), Some(&data), &[]).is_ok());
+        assert!(render_file(source.to_str().unwrap(), None, &[]).is_err());
+        assert!(render_file("/nonexistent/page.amos", None, &[]).is_err());
+    }
+
     #[test]
     fn test_run_file_empty_content() {
         let temp = NamedTempFile::new().unwrap();
         let path = temp.path().to_str().unwrap();
-        let result = run_file(path, None, &[], BackendType::Interpreter);
+        let result = run_file(path, None, &[], BackendType::Interpreter, false);
         assert!(result.is_err());
     }
+
+    #[cfg(feature = "stats")]
+    #[test]
+    fn test_run_file_stats() {
+        let dir = tempfile::tempdir().unwrap();
+        let source = dir.path().join("stats.amos");
+        fs::write(&source, "round(10 / 3, 2) + 1").unwrap();
+        let source = source.to_str().unwrap();
+        for backend in [BackendType::Interpreter, BackendType::Bytecode] {
+            run_file(source, None, &[], backend, true).unwrap();
+        }
+
+        let stats = format_stats(&metrics_snapshot());
+        assert!(stats.starts_with("compile  "));
+        assert!(stats.contains("\nbackend interpreter  "));
+        assert!(stats.contains("\nbackend bytecode  "));
+        assert!(stats.contains(&format!("\nprogram {}  1 calls  ", source)));
+    }
+
+    #[cfg(not(feature = "stats"))]
+    #[test]
+    fn test_run_file_stats_requires_the_feature() {
+        let temp = NamedTempFile::new().unwrap();
+        fs::write(temp.path(), "1 + 1").unwrap();
+        let path = temp.path().to_str().unwrap();
+        let error = run_file(path, None, &[], BackendType::Interpreter, true).unwrap_err();
+        assert!(error.to_string().contains("`stats` feature"));
+    }
 }
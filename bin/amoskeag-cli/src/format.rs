@@ -112,11 +112,8 @@ mod tests {
 
     #[test]
     fn test_format_symbol() {
-        assert_eq!(
-            format_value(&Value::Symbol("approve".to_string())),
-            ":approve"
-        );
-        assert_eq!(format_value(&Value::Symbol("test".to_string())), ":test");
+        assert_eq!(format_value(&Value::Symbol("approve".into())), ":approve");
+        assert_eq!(format_value(&Value::Symbol("test".into())), ":test");
     }
 
     #[test]
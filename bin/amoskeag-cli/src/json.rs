@@ -1,100 +1,70 @@
 //! JSON data parsing utilities
 
 use amoskeag::AmoskeagValue as Value;
-use anyhow::{bail, Context, Result};
+use amoskeag::DataPaths;
+use anyhow::Result;
 use std::collections::HashMap;
 
-/// Maximum JSON depth to prevent stack overflow
-const MAX_JSON_DEPTH: usize = 100;
-
 /// Parse JSON string into a HashMap of Values
 ///
+/// The values are decoded directly, without an intermediate
+/// `serde_json::Value`. An empty string gives an empty map.
+///
 /// # Errors
-/// Returns an error if the JSON is invalid or not an object at the top level.
+/// Returns an error if the JSON is invalid, too deeply nested, or not an
+/// object at the top level.
 pub fn parse_json_data(json: &str) -> Result<HashMap<String, Value>> {
     if json.trim().is_empty() {
         return Ok(HashMap::new());
     }
 
-    let json_value: serde_json::Value =
-        serde_json::from_str(json).with_context(|| "Failed to parse JSON data")?;
-
-    json_to_value_map(&json_value)
+    Ok(amoskeag::data_from_json_str(json)?)
 }
 
-/// Convert a JSON value to a HashMap of Values
+/// Parse the parts of a JSON data string in `paths` into a HashMap of
+/// Values, skipping everything else
 ///
 /// # Errors
-/// Returns an error if the JSON is not an object at the top level.
-pub fn json_to_value_map(json: &serde_json::Value) -> Result<HashMap<String, Value>> {
-    match json {
-        serde_json::Value::Object(obj) => {
-            let mut map = HashMap::with_capacity(obj.len());
-            for (key, value) in obj {
-                map.insert(key.clone(), json_to_value_with_depth(value, 0)?);
-            }
-            Ok(map)
-        }
-        serde_json::Value::Null => Ok(HashMap::new()),
-        _ => bail!("Data must be a JSON object, got: {}", json_type_name(json)),
+/// Returns an error if the JSON is invalid or not an object at the top level.
+pub fn parse_json_data_projected(json: &str, paths: &DataPaths) -> Result<HashMap<String, Value>> {
+    if json.trim().is_empty() {
+        return Ok(HashMap::new());
     }
+
+    Ok(amoskeag::data_from_json_str_projected(json, paths)?)
 }
 
-/// Convert a JSON value to an Amoskeag Value
+/// Parse a JSON string into a single Value
 ///
 /// # Errors
-/// Returns an error if the JSON contains invalid numbers or exceeds max depth.
-pub fn json_to_value(json: &serde_json::Value) -> Result<Value> {
-    json_to_value_with_depth(json, 0)
+/// Returns an error if the JSON is invalid or too deeply nested.
+pub fn parse_json_value(json: &str) -> Result<Value> {
+    Ok(amoskeag::value_from_json_str(json)?)
 }
 
-fn json_to_value_with_depth(json: &serde_json::Value, depth: usize) -> Result<Value> {
-    if depth > MAX_JSON_DEPTH {
-        bail!("JSON nesting too deep (max {} levels)", MAX_JSON_DEPTH);
-    }
-
-    match json {
-        serde_json::Value::Null => Ok(Value::Nil),
-        serde_json::Value::Bool(b) => Ok(Value::Boolean(*b)),
-        serde_json::Value::Number(n) => {
-            if let Some(f) = n.as_f64() {
-                if f.is_nan() {
-                    bail!("JSON number converted to NaN");
-                }
-                if f.is_infinite() {
-                    bail!("JSON number converted to infinity");
-                }
-                Ok(Value::Number(f))
-            } else {
-                bail!("Invalid number in JSON: cannot convert to f64")
-            }
-        }
-        serde_json::Value::String(s) => Ok(Value::String(s.clone())),
-        serde_json::Value::Array(arr) => {
-            let values: Result<Vec<Value>> = arr
-                .iter()
-                .map(|v| json_to_value_with_depth(v, depth + 1))
-                .collect();
-            Ok(Value::Array(values?))
-        }
-        serde_json::Value::Object(obj) => {
-            let mut map = HashMap::with_capacity(obj.len());
-            for (key, value) in obj {
-                map.insert(key.clone(), json_to_value_with_depth(value, depth + 1)?);
-            }
-            Ok(Value::Dictionary(map))
+/// Convert an Amoskeag Value to JSON
+///
+/// Whole numbers are written as integers and symbols as `":name"` strings,
+/// the way `format_value` shows them. NaN and the infinities, which JSON
+/// can't represent, become null.
+#[must_use]
+pub fn value_to_json(value: &Value) -> serde_json::Value {
+    match value {
+        Value::Number(n) if n.fract() == 0.0 && n.abs() < 1e15 => {
+            serde_json::Value::from(*n as i64)
         }
-    }
-}
-
-fn json_type_name(json: &serde_json::Value) -> &'static str {
-    match json {
-        serde_json::Value::Null => "null",
-        serde_json::Value::Bool(_) => "boolean",
-        serde_json::Value::Number(_) => "number",
-        serde_json::Value::String(_) => "string",
-        serde_json::Value::Array(_) => "array",
-        serde_json::Value::Object(_) => "object",
+        Value::Number(n) => serde_json::Number::from_f64(*n)
+            .map_or(serde_json::Value::Null, serde_json::Value::Number),
+        Value::String(s) => serde_json::Value::String(s.clone()),
+        Value::Boolean(b) => serde_json::Value::Bool(*b),
+        Value::Nil => serde_json::Value::Null,
+        Value::Symbol(s) => serde_json::Value::String(format!(":{}", s)),
+        Value::Array(arr) => serde_json::Value::Array(arr.iter().map(value_to_json).collect()),
+        Value::Dictionary(map) => serde_json::Value::Object(
+            map.iter()
+                .map(|(k, v)| (k.clone(), value_to_json(v)))
+                .collect(),
+        ),
     }
 }
 
@@ -181,33 +151,24 @@ mod tests {
     }
 
     #[test]
-    fn test_json_to_value_all_types() {
+    fn test_parse_json_value_all_types() {
+        assert!(matches!(parse_json_value("null"), Ok(Value::Nil)));
+        assert!(matches!(parse_json_value("true"), Ok(Value::Boolean(true))));
         assert!(matches!(
-            json_to_value(&serde_json::Value::Null),
-            Ok(Value::Nil)
-        ));
-        assert!(matches!(
-            json_to_value(&serde_json::Value::Bool(true)),
-            Ok(Value::Boolean(true))
-        ));
-        assert!(matches!(
-            json_to_value(&serde_json::json!(42)),
+            parse_json_value("42"),
             Ok(Value::Number(n)) if n == 42.0
         ));
         assert!(matches!(
-            json_to_value(&serde_json::json!("hello")),
+            parse_json_value("\"hello\""),
             Ok(Value::String(s)) if s == "hello"
         ));
     }
 
     #[test]
-    fn test_json_type_name() {
-        assert_eq!(json_type_name(&serde_json::Value::Null), "null");
-        assert_eq!(json_type_name(&serde_json::Value::Bool(true)), "boolean");
-        assert_eq!(json_type_name(&serde_json::json!(42)), "number");
-        assert_eq!(json_type_name(&serde_json::json!("hello")), "string");
-        assert_eq!(json_type_name(&serde_json::json!([1, 2, 3])), "array");
-        assert_eq!(json_type_name(&serde_json::json!({"a": 1})), "object");
+    fn test_parse_too_deep() {
+        let json = format!("{{\"v\": {}{}}}", "[".repeat(200), "]".repeat(200));
+        let error = parse_json_data(&json).unwrap_err().to_string();
+        assert!(error.contains("too deep"), "{}", error);
     }
 
     #[test]
@@ -234,4 +195,21 @@ mod tests {
             panic!("Expected array");
         }
     }
+
+    #[test]
+    fn test_value_to_json() {
+        let value = Value::Dictionary(HashMap::from([
+            ("count".to_string(), Value::Number(3.0)),
+            ("rate".to_string(), Value::Number(0.25)),
+            ("bad".to_string(), Value::Number(f64::NAN)),
+            (
+                "tags".to_string(),
+                Value::Array(vec![Value::Symbol("approve".into()), Value::Nil]),
+            ),
+        ]));
+        assert_eq!(
+            value_to_json(&value),
+            serde_json::json!({"count": 3, "rate": 0.25, "bad": null, "tags": [":approve", null]})
+        );
+    }
 }
@@ -3,21 +3,32 @@
 //! Command-line interface for running Amoskeag programs
 
 mod backend;
+mod batch;
 mod commands;
 mod format;
 mod json;
 mod repl;
 
 use backend::BackendType;
-use commands::{eval_string, print_usage, run_file};
+use commands::{
+    batch_file, compile_file, eval_string, print_usage, profile_file, render_file, run_file,
+    sast_path, ProfileOptions,
+};
 use repl::run_repl;
 
 use anyhow::{bail, Result};
 use std::env;
+use std::thread;
 
 /// Maximum number of command line arguments to prevent abuse
 const MAX_ARGS: usize = 1000;
 
+// Counts allocations for `run --profile` and `run --stats`; without it,
+// they report timings only
+#[cfg(feature = "profile")]
+#[global_allocator]
+static ALLOCATOR: amoskeag::CountingAllocator = amoskeag::CountingAllocator;
+
 fn main() -> Result<()> {
     let args: Vec<String> = env::args().collect();
 
@@ -36,6 +47,10 @@ fn main() -> Result<()> {
     match command.as_str() {
         "run" => handle_run_command(&args)?,
         "eval" => handle_eval_command(&args)?,
+        "render" => handle_render_command(&args)?,
+        "batch" => handle_batch_command(&args)?,
+        "compile" => handle_compile_command(&args)?,
+        "sast" => handle_sast_command(&args)?,
         "repl" => handle_repl_command(&args)?,
         "--help" | "-h" | "help" => print_usage(),
         "--version" | "-v" | "version" => {
@@ -58,11 +73,66 @@ fn handle_run_command(args: &[String]) -> Result<()> {
         std::process::exit(1);
     }
 
-    let (source_file, data_file, symbols, backend) = parse_run_eval_args(args)?;
+    let (args, stats) = parse_stats_arg(args);
+    let (args, profile) = parse_profile_args(&args)?;
+    let (source_file, data_file, symbols, backend) = parse_run_eval_args(&args)?;
 
     let source_file = source_file.ok_or_else(|| anyhow::anyhow!("Missing source file"))?;
 
-    run_file(source_file, data_file, &symbols, backend)
+    match profile {
+        Some(_) if backend != BackendType::Interpreter => {
+            bail!("--profile requires the interpreter backend")
+        }
+        Some(_) if stats => bail!("--stats can't be combined with --profile"),
+        Some(options) => profile_file(source_file, data_file, &symbols, &options),
+        None => run_file(source_file, data_file, &symbols, backend, stats),
+    }
+}
+
+/// Take `--stats` out of the arguments of `run`
+///
+/// Returns the remaining arguments, and whether `--stats` was given.
+fn parse_stats_arg(args: &[String]) -> (Vec<String>, bool) {
+    let rest: Vec<String> = args
+        .iter()
+        .filter(|arg| *arg != "--stats")
+        .cloned()
+        .collect();
+    let stats = rest.len() < args.len();
+    (rest, stats)
+}
+
+/// Take the profiler options out of the arguments of `run`
+///
+/// Returns the remaining arguments, and the profiler options if `--profile`
+/// or `--profile-folded` was given.
+fn parse_profile_args(args: &[String]) -> Result<(Vec<String>, Option<ProfileOptions>)> {
+    let mut rest = Vec::with_capacity(args.len());
+    let mut profile: Option<ProfileOptions> = None;
+    let mut i = 0;
+
+    while i < args.len() {
+        match args[i].as_str() {
+            "--profile" => {
+                profile.get_or_insert_with(ProfileOptions::default);
+                i += 1;
+            }
+            "--profile-folded" => {
+                if i + 1 >= args.len() {
+                    bail!("--profile-folded requires a value");
+                }
+                profile.get_or_insert_with(ProfileOptions::default).folded =
+                    Some(args[i + 1].clone());
+                i += 2;
+            }
+            _ => {
+                rest.push(args[i].clone());
+                i += 1;
+            }
+        }
+    }
+
+    Ok((rest, profile))
 }
 
 fn handle_eval_command(args: &[String]) -> Result<()> {
@@ -79,6 +149,67 @@ fn handle_eval_command(args: &[String]) -> Result<()> {
     eval_string(source, data_file, &symbols, backend)
 }
 
+fn handle_render_command(args: &[String]) -> Result<()> {
+    if args.len() < 3 {
+        eprintln!("Error: 'render' command requires a source file");
+        print_usage();
+        std::process::exit(1);
+    }
+
+    let (source_file, data_file, symbols, backend) = parse_run_eval_args(args)?;
+    if backend != BackendType::Interpreter {
+        bail!("render requires the interpreter backend");
+    }
+
+    let source_file = source_file.ok_or_else(|| anyhow::anyhow!("Missing source file"))?;
+
+    render_file(source_file, data_file, &symbols)
+}
+
+fn handle_batch_command(args: &[String]) -> Result<()> {
+    if args.len() < 3 {
+        eprintln!("Error: 'batch' command requires a source file");
+        print_usage();
+        std::process::exit(1);
+    }
+
+    let (source_file, input, symbols, jobs) = parse_batch_args(args)?;
+
+    let source_file = source_file.ok_or_else(|| anyhow::anyhow!("Missing source file"))?;
+    let jobs = jobs.unwrap_or_else(|| thread::available_parallelism().map_or(1, |n| n.get()));
+
+    batch_file(source_file, input, &symbols, jobs)
+}
+
+fn handle_compile_command(args: &[String]) -> Result<()> {
+    if args.len() < 3 {
+        eprintln!("Error: 'compile' command requires a source file");
+        print_usage();
+        std::process::exit(1);
+    }
+
+    let (source_file, output, symbols) = parse_compile_args(args)?;
+
+    let source_file = source_file.ok_or_else(|| anyhow::anyhow!("Missing source file"))?;
+
+    compile_file(source_file, output, &symbols)
+}
+
+fn handle_sast_command(args: &[String]) -> Result<()> {
+    if args.len() < 3 {
+        eprintln!("Error: 'sast' command requires a file or directory");
+        print_usage();
+        std::process::exit(1);
+    }
+
+    let (path, symbols, jobs) = parse_sast_args(args)?;
+
+    let path = path.ok_or_else(|| anyhow::anyhow!("Missing file or directory"))?;
+    let jobs = jobs.unwrap_or_else(|| thread::available_parallelism().map_or(1, |n| n.get()));
+
+    sast_path(path, &symbols, jobs)
+}
+
 fn handle_repl_command(args: &[String]) -> Result<()> {
     let mut backend = BackendType::default();
 
@@ -135,6 +266,123 @@ fn parse_run_eval_args(args: &[String]) -> Result<ParsedArgs<'_>> {
     Ok((source, data_file, symbols, backend))
 }
 
+type BatchArgs<'a> = (
+    Option<&'a str>,
+    Option<&'a str>,
+    Vec<&'a str>,
+    Option<usize>,
+);
+
+/// Parse arguments for the batch command
+/// Returns (source, input, symbols, jobs)
+fn parse_batch_args(args: &[String]) -> Result<BatchArgs<'_>> {
+    let mut source = None;
+    let mut input = None;
+    let mut jobs = None;
+    let mut symbols = Vec::new();
+    let mut i = 2;
+
+    while i < args.len() {
+        let arg = args[i].as_str();
+
+        if arg == "--input" || arg == "-i" {
+            if i + 1 >= args.len() {
+                bail!("--input requires a value");
+            }
+            input = Some(args[i + 1].as_str());
+            i += 2;
+        } else if arg == "--jobs" || arg == "-j" {
+            if i + 1 >= args.len() {
+                bail!("--jobs requires a value");
+            }
+            match args[i + 1].parse::<usize>() {
+                Ok(n) if n > 0 => jobs = Some(n),
+                _ => bail!("--jobs must be a positive integer"),
+            }
+            i += 2;
+        } else if arg.starts_with('-') {
+            bail!("Unknown option: {}", arg);
+        } else if source.is_none() {
+            source = Some(arg);
+            i += 1;
+        } else {
+            symbols.push(arg);
+            i += 1;
+        }
+    }
+
+    Ok((source, input, symbols, jobs))
+}
+
+type SastArgs<'a> = (Option<&'a str>, Vec<&'a str>, Option<usize>);
+
+/// Parse arguments for the sast command
+/// Returns (path, symbols, jobs)
+fn parse_sast_args(args: &[String]) -> Result<SastArgs<'_>> {
+    let mut path = None;
+    let mut jobs = None;
+    let mut symbols = Vec::new();
+    let mut i = 2;
+
+    while i < args.len() {
+        let arg = args[i].as_str();
+
+        if arg == "--jobs" || arg == "-j" {
+            if i + 1 >= args.len() {
+                bail!("--jobs requires a value");
+            }
+            match args[i + 1].parse::<usize>() {
+                Ok(n) if n > 0 => jobs = Some(n),
+                _ => bail!("--jobs must be a positive integer"),
+            }
+            i += 2;
+        } else if arg.starts_with('-') {
+            bail!("Unknown option: {}", arg);
+        } else if path.is_none() {
+            path = Some(arg);
+            i += 1;
+        } else {
+            symbols.push(arg);
+            i += 1;
+        }
+    }
+
+    Ok((path, symbols, jobs))
+}
+
+type CompileArgs<'a> = (Option<&'a str>, Option<&'a str>, Vec<&'a str>);
+
+/// Parse arguments for the compile command
+/// Returns (source, output, symbols)
+fn parse_compile_args(args: &[String]) -> Result<CompileArgs<'_>> {
+    let mut source = None;
+    let mut output = None;
+    let mut symbols = Vec::new();
+    let mut i = 2;
+
+    while i < args.len() {
+        let arg = args[i].as_str();
+
+        if arg == "--output" || arg == "-o" {
+            if i + 1 >= args.len() {
+                bail!("--output requires a value");
+            }
+            output = Some(args[i + 1].as_str());
+            i += 2;
+        } else if arg.starts_with('-') {
+            bail!("Unknown option: {}", arg);
+        } else if source.is_none() {
+            source = Some(arg);
+            i += 1;
+        } else {
+            symbols.push(arg);
+            i += 1;
+        }
+    }
+
+    Ok((source, output, symbols))
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -212,4 +460,108 @@ mod tests {
         assert!(data.is_none());
         assert!(symbols.is_empty());
     }
+
+    #[test]
+    fn test_parse_stats_arg() {
+        let args = make_args(&["amoskeag", "run", "file.amos", "--stats", "data.json"]);
+        let (rest, stats) = parse_stats_arg(&args);
+        assert_eq!(
+            rest,
+            make_args(&["amoskeag", "run", "file.amos", "data.json"])
+        );
+        assert!(stats);
+        assert!(!parse_stats_arg(&rest).1);
+    }
+
+    #[test]
+    fn test_parse_profile_args() {
+        let args = make_args(&["amoskeag", "run", "file.amos", "--profile", "data.json"]);
+        let (rest, profile) = parse_profile_args(&args).unwrap();
+        assert_eq!(
+            rest,
+            make_args(&["amoskeag", "run", "file.amos", "data.json"])
+        );
+        assert_eq!(profile, Some(ProfileOptions::default()));
+
+        let args = make_args(&[
+            "amoskeag",
+            "run",
+            "--profile-folded",
+            "out.folded",
+            "f.amos",
+        ]);
+        let (rest, profile) = parse_profile_args(&args).unwrap();
+        assert_eq!(rest, make_args(&["amoskeag", "run", "f.amos"]));
+        assert_eq!(profile.unwrap().folded.as_deref(), Some("out.folded"));
+
+        let args = make_args(&["amoskeag", "run", "file.amos"]);
+        assert_eq!(parse_profile_args(&args).unwrap().1, None);
+        let args = make_args(&["amoskeag", "run", "file.amos", "--profile-folded"]);
+        assert!(parse_profile_args(&args).is_err());
+    }
+
+    #[test]
+    fn test_parse_batch_args() {
+        let args = make_args(&[
+            "amoskeag",
+            "batch",
+            "rule.amos",
+            "--input",
+            "records.ndjson",
+            "approve",
+            "-j",
+            "4",
+            "deny",
+        ]);
+        let (source, input, symbols, jobs) = parse_batch_args(&args).unwrap();
+        assert_eq!(source, Some("rule.amos"));
+        assert_eq!(input, Some("records.ndjson"));
+        assert_eq!(symbols, vec!["approve", "deny"]);
+        assert_eq!(jobs, Some(4));
+
+        let args = make_args(&["amoskeag", "batch", "rule.amos"]);
+        assert_eq!(parse_batch_args(&args).unwrap().1, None);
+        let args = make_args(&["amoskeag", "batch", "rule.amos", "--jobs", "0"]);
+        assert!(parse_batch_args(&args).is_err());
+        let args = make_args(&["amoskeag", "batch", "rule.amos", "--input"]);
+        assert!(parse_batch_args(&args).is_err());
+    }
+
+    #[test]
+    fn test_parse_sast_args() {
+        let args = make_args(&["amoskeag", "sast", "rules", "approve", "-j", "2", "deny"]);
+        let (path, symbols, jobs) = parse_sast_args(&args).unwrap();
+        assert_eq!(path, Some("rules"));
+        assert_eq!(symbols, vec!["approve", "deny"]);
+        assert_eq!(jobs, Some(2));
+
+        let args = make_args(&["amoskeag", "sast", "rules"]);
+        assert_eq!(parse_sast_args(&args).unwrap().2, None);
+        let args = make_args(&["amoskeag", "sast", "rules", "--jobs", "0"]);
+        assert!(parse_sast_args(&args).is_err());
+        let args = make_args(&["amoskeag", "sast", "rules", "--output", "x"]);
+        assert!(parse_sast_args(&args).is_err());
+    }
+
+    #[test]
+    fn test_parse_compile_args() {
+        let args = make_args(&[
+            "amoskeag",
+            "compile",
+            "rule.amos",
+            "approve",
+            "-o",
+            "rule.bin",
+            "deny",
+        ]);
+        let (source, output, symbols) = parse_compile_args(&args).unwrap();
+        assert_eq!(source, Some("rule.amos"));
+        assert_eq!(output, Some("rule.bin"));
+        assert_eq!(symbols, vec!["approve", "deny"]);
+
+        let args = make_args(&["amoskeag", "compile", "rule.amos"]);
+        assert_eq!(parse_compile_args(&args).unwrap().1, None);
+        let args = make_args(&["amoskeag", "compile", "rule.amos", "--output"]);
+        assert!(parse_compile_args(&args).is_err());
+    }
 }
@@ -120,14 +120,11 @@ fn handle_set_command(rest: &str, data: &mut HashMap<String, Value>) {
         return;
     }
 
-    match serde_json::from_str::<serde_json::Value>(value_str) {
-        Ok(json) => match crate::json::json_to_value(&json) {
-            Ok(value) => {
-                data.insert(key.to_string(), value);
-                println!("Set {} = {}", key, value_str);
-            }
-            Err(e) => eprintln!("Error converting value: {}", e),
-        },
+    match crate::json::parse_json_value(value_str) {
+        Ok(value) => {
+            data.insert(key.to_string(), value);
+            println!("Set {} = {}", key, value_str);
+        }
         Err(e) => eprintln!("Invalid JSON: {}", e),
     }
 }
@@ -6,7 +6,10 @@
 //! Run with:
 //!   cargo run --example backend-comparison
 
-use amoskeag::backend::{interpreter::DirectInterpreterBackend, Backend, BackendRegistry};
+use amoskeag::backend::{
+    bytecode::BytecodeBackend, columnar::ColumnarBackend, interpreter::DirectInterpreterBackend,
+    Backend, BackendRegistry,
+};
 use amoskeag_lexer::Lexer;
 use amoskeag_parser::Parser;
 use amoskeag_stdlib_operators::Value;
@@ -50,11 +53,58 @@ fn main() {
     println!("Execute time: {:?}", exec_time);
     println!();
 
+    // Test bytecode backend
+    println!("🔍 Testing Bytecode Backend");
+    println!("--------------------------------");
+    let bytecode = BytecodeBackend::new();
+    println!("Name: {}", bytecode.name());
+    println!("Description: {}", bytecode.description());
+    println!("Supports expression: {}", bytecode.supports(&expr));
+
+    let start = Instant::now();
+    let compiled = bytecode.compile(&expr, &[]).unwrap();
+    let compile_time = start.elapsed();
+
+    let start = Instant::now();
+    let result = bytecode.execute(&compiled, &data).unwrap();
+    let exec_time = start.elapsed();
+
+    println!("Result: {:?}", result);
+    println!("Instructions: {}", compiled.code().len());
+    println!("Compile time: {:?}", compile_time);
+    println!("Execute time: {:?}", exec_time);
+    println!();
+
+    // Test columnar backend
+    println!("🔍 Testing Columnar Backend");
+    println!("--------------------------------");
+    let columnar = ColumnarBackend::new();
+    println!("Name: {}", columnar.name());
+    println!("Description: {}", columnar.description());
+    println!("Supports expression: {}", columnar.supports(&expr));
+
+    let start = Instant::now();
+    let compiled = columnar.compile(&expr, &[]).unwrap();
+    let compile_time = start.elapsed();
+
+    let batch = vec![data.clone(); 1000];
+    let start = Instant::now();
+    let results = compiled.evaluate_records(&batch);
+    let exec_time = start.elapsed();
+
+    println!("Result: {:?}", results[0]);
+    println!("Batch size: {}", results.len());
+    println!("Compile time: {:?}", compile_time);
+    println!("Batch execute time: {:?}", exec_time);
+    println!();
+
     // Display backend capabilities
     println!("📋 Backend Registry");
     println!("-------------------");
     let mut registry = BackendRegistry::new();
     registry.register(DirectInterpreterBackend::capabilities());
+    registry.register(BytecodeBackend::capabilities());
+    registry.register(ColumnarBackend::capabilities());
 
     for caps in registry.list() {
         println!("\nBackend: {}", caps.name);
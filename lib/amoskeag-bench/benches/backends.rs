@@ -0,0 +1,165 @@
+//! Side-by-side benchmarks of the backends
+//!
+//! All backends run the same numeric-only rule, the one kind of program
+//! every backend supports. `interpreter` is the `compile()`/`evaluate()`
+//! API, which the interpreter backend wraps. `native` is the rule compiled
+//! to Rust by the build script. The other transpilers only generate code,
+//! so for them the generation itself is measured.
+
+use amoskeag::backend::{
+    bytecode::BytecodeBackend, columnar::ColumnarBackend, interpreter::DirectInterpreterBackend,
+    Backend,
+};
+use amoskeag::{compile, evaluate, evaluate_batch};
+use amoskeag_bench::{examples, large_rule, native, numeric_rule, records};
+use amoskeag_parser::{parse, Expr};
+use amoskeag_transpiler_ruby::RubyTranspiler;
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+/// Number of records in a batch
+const BATCH: usize = 10_000;
+
+fn rule() -> (String, Expr) {
+    let source = numeric_rule(20);
+    let expr = parse(&source).unwrap();
+    (source, expr)
+}
+
+fn bench_compile(c: &mut Criterion) {
+    let (source, expr) = rule();
+    let mut group = c.benchmark_group("backend_compile");
+    group.bench_function("interpreter", |b| {
+        b.iter(|| compile(black_box(&source), &[]).unwrap())
+    });
+    group.bench_function("direct-interpreter", |b| {
+        let backend = DirectInterpreterBackend::new();
+        b.iter(|| backend.compile(black_box(&expr), &[]).unwrap())
+    });
+    group.bench_function("bytecode", |b| {
+        let backend = BytecodeBackend::new();
+        b.iter(|| backend.compile(black_box(&expr), &[]).unwrap())
+    });
+    group.bench_function("columnar", |b| {
+        let backend = ColumnarBackend::new();
+        b.iter(|| backend.compile(black_box(&expr), &[]).unwrap())
+    });
+    group.finish();
+}
+
+fn bench_execute(c: &mut Criterion) {
+    let (source, expr) = rule();
+    let data = records(1).pop().unwrap();
+    let mut group = c.benchmark_group("backend_execute");
+
+    let program = compile(&source, &[]).unwrap();
+    group.bench_function("interpreter", |b| {
+        b.iter(|| evaluate(&program, black_box(&data)).unwrap())
+    });
+
+    let direct = DirectInterpreterBackend::new();
+    let compiled = direct.compile(&expr, &[]).unwrap();
+    group.bench_function("direct-interpreter", |b| {
+        b.iter(|| direct.execute(&compiled, black_box(&data)).unwrap())
+    });
+
+    let bytecode = BytecodeBackend::new();
+    let compiled = bytecode.compile(&expr, &[]).unwrap();
+    group.bench_function("bytecode", |b| {
+        b.iter(|| bytecode.execute(&compiled, black_box(&data)).unwrap())
+    });
+
+    let columnar = ColumnarBackend::new();
+    let compiled = columnar.compile(&expr, &[]).unwrap();
+    group.bench_function("columnar", |b| {
+        b.iter(|| columnar.execute(&compiled, black_box(&data)).unwrap())
+    });
+
+    group.bench_function("native", |b| {
+        b.iter(|| native::numeric_rule(black_box(&data)).unwrap())
+    });
+    group.finish();
+}
+
+fn bench_batch(c: &mut Criterion) {
+    let (source, expr) = rule();
+    let records = records(BATCH);
+    let program = compile(&source, &[]).unwrap();
+    let mut group = c.benchmark_group("backend_batch");
+    group.throughput(Throughput::Elements(BATCH as u64));
+
+    group.bench_function("interpreter", |b| {
+        b.iter(|| {
+            records
+                .iter()
+                .map(|data| evaluate(&program, data))
+                .collect::<Vec<_>>()
+        })
+    });
+    group.bench_function("interpreter-parallel", |b| {
+        b.iter(|| evaluate_batch(&program, black_box(&records)))
+    });
+
+    let bytecode = BytecodeBackend::new().compile_program(&program).unwrap();
+    group.bench_function("bytecode", |b| {
+        b.iter(|| {
+            records
+                .iter()
+                .map(|data| bytecode.run(data))
+                .collect::<Vec<_>>()
+        })
+    });
+
+    let columnar = ColumnarBackend::new().compile(&expr, &[]).unwrap();
+    group.bench_function("columnar", |b| {
+        b.iter(|| columnar.evaluate_records(black_box(&records)))
+    });
+
+    group.bench_function("native", |b| {
+        b.iter(|| records.iter().map(native::numeric_rule).collect::<Vec<_>>())
+    });
+    group.finish();
+}
+
+fn bench_transpile(c: &mut Criterion) {
+    let mut programs: Vec<(String, Expr)> = examples()
+        .into_iter()
+        .map(|e| (e.name, parse(&e.source).unwrap()))
+        .collect();
+    programs.push(("numeric_rule".to_string(), rule().1));
+    programs.push((
+        "large_rule_100".to_string(),
+        parse(&large_rule(100)).unwrap(),
+    ));
+
+    let python = amoskeag_transpiler_python::TranspileConfig::default();
+    let javascript = amoskeag_transpiler_javascript::TranspileConfig::default();
+    let mut group = c.benchmark_group("transpile");
+    for (name, expr) in &programs {
+        // Not every transpiler supports every program; skip the ones it rejects
+        if amoskeag_transpiler_python::transpile(expr, &python).is_ok() {
+            group.bench_with_input(BenchmarkId::new("python", name), expr, |b, expr| {
+                b.iter(|| amoskeag_transpiler_python::transpile(expr, &python))
+            });
+        }
+        if amoskeag_transpiler_javascript::transpile(expr, &javascript).is_ok() {
+            group.bench_with_input(BenchmarkId::new("javascript", name), expr, |b, expr| {
+                b.iter(|| amoskeag_transpiler_javascript::transpile(expr, &javascript))
+            });
+        }
+        if RubyTranspiler::new().transpile(expr).is_ok() {
+            group.bench_with_input(BenchmarkId::new("ruby", name), expr, |b, expr| {
+                b.iter(|| RubyTranspiler::new().transpile(expr))
+            });
+        }
+    }
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    bench_compile,
+    bench_execute,
+    bench_batch,
+    bench_transpile
+);
+criterion_main!(benches);
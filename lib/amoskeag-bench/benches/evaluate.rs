@@ -0,0 +1,130 @@
+//! Evaluation benchmarks over small, medium, and huge data dictionaries
+//!
+//! `numeric_rule` reads a handful of fields, so its time should not grow
+//! with the size of the data dictionary. `report` walks the whole `items`
+//! array through pipe chains, so its time grows with it.
+//!
+//! `workbook` recalculates a 20,000-formula pricing sheet after changing an
+//! input every formula reads (`full`) and one only a single product reads
+//! (`one_input`).
+//!
+//! `rule_set` evaluates 50 rules that read the same risk score against one
+//! record, as separate programs (`separate`) and as a `RuleSet` that
+//! evaluates the score once (`rule_set`).
+//!
+//! `template` builds a page of 200 sections, about 12 KB, by evaluating it
+//! to a string (`evaluate`) and by streaming it into a buffer (`render`).
+
+use amoskeag::{compile, evaluate, render, AmoskeagValue as Value, RuleSet, Workbook};
+use amoskeag_bench::{
+    data, numeric_rule, pricing_inputs, pricing_sheet, records, scoring_rules, template_page,
+    DATA_SIZES, PRICING_FORMULAS, REPORT,
+};
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+fn bench_evaluate(c: &mut Criterion) {
+    let programs = [
+        ("numeric_rule", compile(&numeric_rule(20), &[]).unwrap()),
+        ("report", compile(REPORT, &[]).unwrap()),
+    ];
+
+    let mut group = c.benchmark_group("evaluate");
+    for (label, size) in DATA_SIZES {
+        let data = data(size);
+        if size >= 100_000 {
+            group.sample_size(10);
+        }
+        for (name, program) in &programs {
+            group.throughput(Throughput::Elements(size as u64));
+            group.bench_with_input(BenchmarkId::new(*name, label), &data, |b, data| {
+                b.iter(|| evaluate(program, black_box(data)).unwrap())
+            });
+        }
+    }
+    group.finish();
+}
+
+fn bench_workbook(c: &mut Criterion) {
+    let products = 20_000 / PRICING_FORMULAS;
+    let sheet = pricing_sheet(products);
+    let formulas: Vec<(&str, &str)> = sheet
+        .iter()
+        .map(|(name, source)| (name.as_str(), source.as_str()))
+        .collect();
+    let mut book = Workbook::new(&formulas, &[]).unwrap();
+    for (name, value) in pricing_inputs(products) {
+        book.set_input(&name, value).unwrap();
+    }
+    book.recalculate();
+
+    let mut group = c.benchmark_group("workbook");
+    group.sample_size(10);
+    for (label, input) in [("full", "markup"), ("one_input", "base0")] {
+        let mut step = 0;
+        group.bench_function(label, |b| {
+            b.iter(|| {
+                step += 1;
+                book.set_input(input, Value::Number(step as f64)).unwrap();
+                black_box(book.recalculate())
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_rule_set(c: &mut Criterion) {
+    let sources = scoring_rules(50);
+    let rules: Vec<(&str, &str)> = sources
+        .iter()
+        .map(|(name, source)| (name.as_str(), source.as_str()))
+        .collect();
+    let programs: Vec<_> = rules
+        .iter()
+        .map(|(_, source)| compile(source, &[]).unwrap())
+        .collect();
+    let set = RuleSet::compile(&rules, &[]).unwrap();
+    let data = records(1).pop().unwrap();
+
+    let mut group = c.benchmark_group("rule_set");
+    group.bench_function("separate", |b| {
+        b.iter(|| {
+            for program in &programs {
+                black_box(evaluate(program, black_box(&data)).unwrap());
+            }
+        })
+    });
+    group.bench_function("rule_set", |b| {
+        b.iter(|| black_box(set.evaluate(black_box(&data)).unwrap()))
+    });
+    group.finish();
+}
+
+fn bench_template(c: &mut Criterion) {
+    let program = compile(&template_page(200), &[]).unwrap();
+    let data = records(1).pop().unwrap();
+    let mut page = Vec::new();
+    render(&program, &data, &mut page).unwrap();
+
+    let mut group = c.benchmark_group("template");
+    group.throughput(Throughput::Bytes(page.len() as u64));
+    group.bench_function("evaluate", |b| {
+        b.iter(|| black_box(evaluate(&program, black_box(&data)).unwrap()))
+    });
+    group.bench_function("render", |b| {
+        b.iter(|| {
+            page.clear();
+            render(&program, black_box(&data), &mut page).unwrap();
+            black_box(page.len())
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    bench_evaluate,
+    bench_workbook,
+    bench_rule_set,
+    bench_template
+);
+criterion_main!(benches);
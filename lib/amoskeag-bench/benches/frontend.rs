@@ -0,0 +1,77 @@
+//! Lexing, parsing, and compilation benchmarks
+//!
+//! Each group runs over the example programs and over generated rules of
+//! increasing size. Lexing and parsing report throughput in bytes of
+//! source; `compile` measures the whole `compile()` call, including
+//! validation, constant folding and name resolution.
+
+use amoskeag::compile;
+use amoskeag_bench::{examples, large_rule, SYMBOLS};
+use amoskeag_lexer::Lexer;
+use amoskeag_parser::Parser;
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+/// The example programs followed by generated rules, as (name, source)
+fn corpus() -> Vec<(String, String)> {
+    let mut corpus: Vec<(String, String)> =
+        examples().into_iter().map(|e| (e.name, e.source)).collect();
+    for clauses in [10, 100, 1_000] {
+        corpus.push((format!("large_rule_{}", clauses), large_rule(clauses)));
+    }
+    corpus
+}
+
+fn bench_lex(c: &mut Criterion) {
+    let mut group = c.benchmark_group("lex");
+    for (name, source) in corpus() {
+        group.throughput(Throughput::Bytes(source.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::from_parameter(name),
+            source.as_str(),
+            |b, s| b.iter(|| Lexer::new(black_box(s)).tokenize().unwrap()),
+        );
+    }
+    group.finish();
+}
+
+fn bench_parse(c: &mut Criterion) {
+    let mut group = c.benchmark_group("parse");
+    for (name, source) in corpus() {
+        group.throughput(Throughput::Bytes(source.len() as u64));
+        group.bench_with_input(BenchmarkId::new("expr", &name), source.as_str(), |b, s| {
+            b.iter(|| {
+                Parser::from_lexer(Lexer::new(black_box(s)))
+                    .and_then(|mut p| p.parse())
+                    .unwrap()
+            })
+        });
+        group.bench_with_input(
+            BenchmarkId::new("positions", &name),
+            source.as_str(),
+            |b, s| {
+                b.iter(|| {
+                    Parser::from_lexer(Lexer::new(black_box(s)))
+                        .and_then(|mut p| p.parse_with_positions())
+                        .unwrap()
+                })
+            },
+        );
+    }
+    group.finish();
+}
+
+fn bench_compile(c: &mut Criterion) {
+    let mut group = c.benchmark_group("compile");
+    for (name, source) in corpus() {
+        group.throughput(Throughput::Bytes(source.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::from_parameter(name),
+            source.as_str(),
+            |b, s| b.iter(|| compile(black_box(s), SYMBOLS).unwrap()),
+        );
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_lex, bench_parse, bench_compile);
+criterion_main!(benches);
@@ -0,0 +1,35 @@
+//! Compiles the benchmark programs to native code
+//!
+//! Every `examples/*/example.amos` is compiled as a rule named after its
+//! directory, along with the programs of `src/programs.rs`.
+
+#[path = "src/programs.rs"]
+mod programs;
+
+use amoskeag_transpiler::build::Rules;
+use std::fs;
+use std::path::Path;
+
+fn main() {
+    let examples = Path::new(env!("CARGO_MANIFEST_DIR")).join("../../examples");
+    println!("cargo:rerun-if-changed={}", examples.display());
+    println!("cargo:rerun-if-changed=src/programs.rs");
+
+    let mut rules = Rules::new()
+        .symbols(programs::SYMBOLS)
+        .source("numeric_rule", &programs::numeric_rule(20))
+        .source("large_rule", &programs::large_rule(50))
+        .source("report", programs::REPORT);
+    for (i, source) in programs::EDGE_CASES.iter().enumerate() {
+        rules = rules.source(&format!("edge_case_{}", i), source);
+    }
+    for entry in fs::read_dir(&examples).expect("failed to read examples") {
+        let path = entry.expect("failed to read examples").path();
+        let source = path.join("example.amos");
+        if source.is_file() {
+            let name = path.file_name().unwrap().to_string_lossy().into_owned();
+            rules = rules.file(&name, source);
+        }
+    }
+    rules.compile().expect("failed to compile rules");
+}
@@ -0,0 +1,331 @@
+//! Shared inputs for the Amoskeag benchmarks
+//!
+//! The benches in `benches/` run the example programs in `examples/` and the
+//! synthetic programs and data built here. Keeping the inputs in one place
+//! means every bench measures the same work, and the tests below check that
+//! each input still compiles and evaluates.
+
+mod programs;
+
+use amoskeag_stdlib_operators::Value;
+use std::collections::HashMap;
+use std::fs;
+use std::path::PathBuf;
+
+pub use programs::{large_rule, numeric_rule, EDGE_CASES, RECORD_FIELDS, REPORT, SYMBOLS};
+
+/// The example programs, `numeric_rule(20)`, `large_rule(50)`, `REPORT`,
+/// and `EDGE_CASES` (as `edge_case_<index>`), compiled to native code by
+/// the build script
+pub mod native {
+    amoskeag::include_rules!();
+}
+
+/// Data dictionary sizes for evaluation benches, as (label, size)
+///
+/// The size is both the number of extra top-level keys and the length of
+/// the `items` array.
+pub const DATA_SIZES: [(&str, usize); 3] = [("small", 10), ("medium", 1_000), ("huge", 100_000)];
+
+/// An example program from `examples/`
+pub struct Example {
+    /// Directory name, such as `01_hello_world`
+    pub name: String,
+    pub source: String,
+}
+
+/// Load every `examples/*/example.amos`, in name order
+pub fn examples() -> Vec<Example> {
+    let dir = PathBuf::from(env!("CARGO_MANIFEST_DIR")).join("../../examples");
+    let mut examples: Vec<Example> = fs::read_dir(&dir)
+        .unwrap_or_else(|e| panic!("Failed to read {}: {}", dir.display(), e))
+        .filter_map(|entry| {
+            let path = entry.ok()?.path();
+            let source = fs::read_to_string(path.join("example.amos")).ok()?;
+            let name = path.file_name()?.to_string_lossy().into_owned();
+            Some(Example { name, source })
+        })
+        .collect();
+    examples.sort_by(|a, b| a.name.cmp(&b.name));
+    examples
+}
+
+/// The numeric fields read by `numeric_rule` and `large_rule`
+pub fn record(seed: usize) -> Value {
+    let mut record: HashMap<String, Value> = (0..RECORD_FIELDS)
+        .map(|i| {
+            let value = ((seed * 31 + i * 17) % 97) as f64;
+            (format!("f{}", i), Value::Number(value))
+        })
+        .collect();
+    record.insert("name".to_string(), Value::String(format!("Name{}", seed)));
+    Value::Dictionary(record)
+}
+
+/// An item of the `items` array read by `REPORT`
+pub fn item(index: usize) -> Value {
+    Value::Dictionary(HashMap::from([
+        (
+            "name".to_string(),
+            Value::String(format!("item {}", (index * 7919) % 10_007)),
+        ),
+        (
+            "price".to_string(),
+            Value::Number(((index * 104_729) % 100_003) as f64 / 100.0),
+        ),
+        (
+            "category".to_string(),
+            Value::String(format!("c{}", index % 12)),
+        ),
+    ]))
+}
+
+/// A data dictionary holding a `record`, an `items` array of `size`
+/// elements, and `size` unrelated top-level keys
+pub fn data(size: usize) -> HashMap<String, Value> {
+    let mut data: HashMap<String, Value> = (0..size)
+        .map(|i| (format!("key{}", i), Value::Number(i as f64)))
+        .collect();
+    data.insert("record".to_string(), record(size));
+    data.insert(
+        "items".to_string(),
+        Value::Array((0..size).map(item).collect()),
+    );
+    data
+}
+
+/// `count` small data dictionaries, each holding a different `record`
+pub fn records(count: usize) -> Vec<HashMap<String, Value>> {
+    (0..count)
+        .map(|i| HashMap::from([("record".to_string(), record(i))]))
+        .collect()
+}
+
+/// Number of formulas per product in `pricing_sheet`
+pub const PRICING_FORMULAS: usize = 5;
+
+/// A pricing sheet with `PRICING_FORMULAS` formulas for each of `products`
+/// products, as (name, source)
+///
+/// Every product's price reads its own `base<i>` input and the shared
+/// `markup`, `discount` and `tax_rate` inputs from `pricing_inputs`, so
+/// changing a shared input recalculates the whole sheet and changing a
+/// base recalculates one product.
+pub fn pricing_sheet(products: usize) -> Vec<(String, String)> {
+    (0..products)
+        .flat_map(|i| {
+            [
+                (format!("list{}", i), format!("base{} * (1 + markup)", i)),
+                (format!("net{}", i), format!("list{} * (1 - discount)", i)),
+                (format!("tax{}", i), format!("net{} * tax_rate", i)),
+                (
+                    format!("price{}", i),
+                    format!("round(net{0} + tax{0}, 2)", i),
+                ),
+                (
+                    format!("band{}", i),
+                    format!("if price{} > 50 \"high\" else \"low\" end", i),
+                ),
+            ]
+        })
+        .collect()
+}
+
+/// The inputs read by `pricing_sheet(products)`
+pub fn pricing_inputs(products: usize) -> Vec<(String, Value)> {
+    let mut inputs: Vec<(String, Value)> = (0..products)
+        .map(|i| (format!("base{}", i), Value::Number((i % 100) as f64 * 10.0)))
+        .collect();
+    inputs.push(("markup".to_string(), Value::Number(0.3)));
+    inputs.push(("discount".to_string(), Value::Number(0.1)));
+    inputs.push(("tax_rate".to_string(), Value::Number(0.08)));
+    inputs
+}
+
+/// Decision rules over `record` that all read the same risk score, as
+/// (name, source)
+///
+/// Each of the `rules` rules compares the score, written out in full, with
+/// its own threshold, so a `RuleSet` evaluates the score once per record
+/// where separate programs evaluate it once per rule.
+pub fn scoring_rules(rules: usize) -> Vec<(String, String)> {
+    let score = (0..RECORD_FIELDS)
+        .map(|i| format!("record.f{} * {}", i, i % 5 + 1))
+        .collect::<Vec<_>>()
+        .join(" + ");
+    (0..rules)
+        .map(|i| {
+            (
+                format!("rule{}", i),
+                format!(
+                    "if ({0}) / 10 > {1} then record.f{2} else ({0}) / 20 end",
+                    score,
+                    i * 3,
+                    i % RECORD_FIELDS
+                ),
+            )
+        })
+        .collect()
+}
+
+/// A page of `sections` sections over `record`, built as templates build
+/// their output, with one chain of `+`
+///
+/// Each section adds five strings and numbers to the page, about 60 bytes.
+pub fn template_page(sections: usize) -> String {
+    let body = (0..sections)
+        .map(|i| {
+            format!(
+                "\"<section id='s{}'><h2>\" + record.name + \"</h2><p>\" + record.f{} + \"</p></section>\"",
+                i,
+                i % RECORD_FIELDS
+            )
+        })
+        .collect::<Vec<_>>()
+        .join(" + ");
+    format!("\"<html><body>\" + {} + \"</body></html>\"", body)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use amoskeag::backend::{
+        bytecode::BytecodeBackend, columnar::ColumnarBackend,
+        interpreter::DirectInterpreterBackend, Backend,
+    };
+    use amoskeag::{compile, eval_expr, evaluate, render, Context, RuleSet, Workbook};
+
+    #[test]
+    fn test_examples_compile() {
+        let examples = examples();
+        assert_eq!(examples.len(), 25);
+        for example in &examples {
+            assert!(
+                compile(&example.source, SYMBOLS).is_ok(),
+                "{}",
+                example.name
+            );
+        }
+    }
+
+    #[test]
+    fn test_generated_programs_evaluate() {
+        let data = data(10);
+        for source in [numeric_rule(50), large_rule(50), REPORT.to_string()] {
+            let program = compile(&source, SYMBOLS).unwrap();
+            assert!(evaluate(&program, &data).is_ok(), "{}", source);
+        }
+    }
+
+    #[test]
+    fn test_pricing_sheet_recalculates() {
+        let sheet = pricing_sheet(10);
+        let formulas: Vec<(&str, &str)> = sheet
+            .iter()
+            .map(|(name, source)| (name.as_str(), source.as_str()))
+            .collect();
+        let mut book = Workbook::new(&formulas, &[]).unwrap();
+        for (name, value) in pricing_inputs(10) {
+            book.set_input(&name, value).unwrap();
+        }
+        assert_eq!(book.recalculate(), 10 * PRICING_FORMULAS);
+        assert_eq!(
+            book.get("band9").unwrap().unwrap(),
+            &Value::String("high".to_string())
+        );
+
+        book.set_input("base3", Value::Number(31.0)).unwrap();
+        assert_eq!(book.recalculate(), PRICING_FORMULAS);
+    }
+
+    #[test]
+    fn test_scoring_rules_share_the_score() {
+        let sources = scoring_rules(20);
+        let rules: Vec<(&str, &str)> = sources
+            .iter()
+            .map(|(name, source)| (name.as_str(), source.as_str()))
+            .collect();
+        let set = RuleSet::compile(&rules, &[]).unwrap();
+        // The score, and its quotients by 10 and by 20
+        assert_eq!(set.shared_count(), 3);
+        for data in records(5) {
+            let Value::Dictionary(results) = set.evaluate(&data).unwrap() else {
+                panic!("expected a dictionary");
+            };
+            for (name, source) in &rules {
+                let program = compile(source, &[]).unwrap();
+                assert_eq!(results[*name], evaluate(&program, &data).unwrap());
+            }
+        }
+    }
+
+    #[test]
+    fn test_template_page_renders() {
+        let program = compile(&template_page(100), &[]).unwrap();
+        let data = records(1).pop().unwrap();
+        let Value::String(page) = evaluate(&program, &data).unwrap() else {
+            panic!("expected a string");
+        };
+        assert!(page.len() > 5_000, "{}", page.len());
+        assert!(page.ends_with("</p></section></body></html>"));
+
+        let mut rendered = Vec::new();
+        render(&program, &data, &mut rendered).unwrap();
+        assert_eq!(rendered, page.as_bytes());
+    }
+
+    #[test]
+    fn test_backends_agree_on_numeric_rule() {
+        let expr = amoskeag_parser::parse(&numeric_rule(20)).unwrap();
+        let direct = DirectInterpreterBackend::new();
+        let bytecode = BytecodeBackend::new();
+        let columnar = ColumnarBackend::new();
+        let (d, b, c) = (
+            direct.compile(&expr, &[]).unwrap(),
+            bytecode.compile(&expr, &[]).unwrap(),
+            columnar.compile(&expr, &[]).unwrap(),
+        );
+        for data in records(20) {
+            let expected = direct.execute(&d, &data).unwrap();
+            assert_eq!(bytecode.execute(&b, &data).unwrap(), expected);
+            assert_eq!(columnar.execute(&c, &data).unwrap(), expected);
+        }
+    }
+
+    #[test]
+    fn test_native_rules_agree_with_the_interpreter() {
+        let mut programs = vec![
+            ("numeric_rule".to_string(), numeric_rule(20)),
+            ("large_rule".to_string(), large_rule(50)),
+            ("report".to_string(), REPORT.to_string()),
+        ];
+        programs.extend(examples().into_iter().map(|e| (e.name, e.source)));
+        programs.extend(
+            EDGE_CASES
+                .iter()
+                .enumerate()
+                .map(|(i, source)| (format!("edge_case_{}", i), source.to_string())),
+        );
+        assert_eq!(native::RULES.len(), programs.len());
+
+        let mut inputs = records(20);
+        inputs.push(data(10));
+        inputs.push(HashMap::new());
+        for (name, source) in &programs {
+            // Native rules run the program as written, as `eval_expr` does.
+            // The optimizer may reorder reads, so with several variables
+            // missing, `evaluate` can report a different one.
+            let expr = amoskeag_parser::parse(source).unwrap();
+            let program = compile(source, SYMBOLS).unwrap();
+            for data in &inputs {
+                let actual = native::evaluate(name, data)
+                    .unwrap_or_else(|| panic!("no native rule {}", name))
+                    .map_err(|e| e.to_string());
+                let expected = eval_expr(&expr, &Context::new(data)).map_err(|e| e.to_string());
+                assert_eq!(actual, expected, "{}", name);
+                assert_eq!(actual.ok(), evaluate(&program, data).ok(), "{}", name);
+            }
+        }
+        assert!(native::evaluate("missing", &HashMap::new()).is_none());
+    }
+}
@@ -0,0 +1,120 @@
+//! Source of the programs the benchmarks run
+//!
+//! Kept free of dependencies so the build script, which compiles the same
+//! programs to native code, can include it too.
+
+/// Symbols used by the example programs and `large_rule`
+pub const SYMBOLS: &[&str] = &[
+    "approve",
+    "approved",
+    "deny",
+    "denied",
+    "instant_approve",
+    "manual_review",
+    "waiting",
+    "valid",
+    "invalid_age",
+    "invalid_email",
+    "invalid_password",
+    "invalid_unknown",
+    "terms_not_accepted",
+    "unsupported_country",
+    "tag",
+];
+
+/// Number of numeric fields in a generated `record`
+pub const RECORD_FIELDS: usize = 16;
+
+/// A scoring rule with `clauses` branches that only uses numbers
+///
+/// Every branch reads fields of `record` and does some arithmetic, so the
+/// rule stresses variable access and operators. Being numeric-only, it runs
+/// on every backend, including the columnar one.
+pub fn numeric_rule(clauses: usize) -> String {
+    // Fields are read by full path: the columnar backend can bind numbers
+    // but not dictionaries
+    let mut source = String::from("let base = record.f0 * 1.5 + record.f1 in\n");
+    for i in 0..clauses {
+        let keyword = if i == 0 { "if" } else { "else if" };
+        source.push_str(&format!(
+            "  {} (record.f{} - record.f{}) * {} > base and record.f{} <= {}\n    base / {} + {}\n",
+            keyword,
+            i % RECORD_FIELDS,
+            (i + 3) % RECORD_FIELDS,
+            i % 7 + 1,
+            (i + 5) % RECORD_FIELDS,
+            i * 10 + 50,
+            i + 2,
+            i,
+        ));
+    }
+    source.push_str("  else\n    base\n  end\n");
+    source
+}
+
+/// A large rule mixing strings, pipes, dictionaries and arithmetic
+///
+/// Meant for front-end throughput: it exercises every token kind the lexer
+/// has and most of the grammar.
+pub fn large_rule(clauses: usize) -> String {
+    let mut source = String::from("# Generated rule\nlet r = record in\nlet tags = {\n");
+    for i in 0..clauses {
+        source.push_str(&format!("  \"tag{}\": [{}, 'label {}', :tag],\n", i, i, i));
+    }
+    source.push_str("  \"end\": nil\n} in\n");
+    for i in 0..clauses {
+        let keyword = if i == 0 { "if" } else { "else if" };
+        source.push_str(&format!(
+            "  {} r.f{} * {} + r.f{} >= {}.5 or not (r.name | downcase | contains(\"n{}\"))\n    \
+             tags.tag{} | at(1) | upcase | truncate({})\n",
+            keyword,
+            i % RECORD_FIELDS,
+            i + 1,
+            (i + 1) % RECORD_FIELDS,
+            i * 3,
+            i,
+            i,
+            i % 20 + 5,
+        ));
+    }
+    source.push_str("  else\n    \"none\"\n  end\n");
+    source
+}
+
+/// A reporting template over `items`, built from pipe chains
+pub const REPORT: &str = r#"
+let prices = items | map('price') in
+{
+  "count": items | size,
+  "total": prices | sum | round(2),
+  "highest": prices | sort | last,
+  "lowest": prices | sort | first,
+  "first_name": items | map('name') | sort | first | upcase,
+  "categories": items | map('category') | uniq | size,
+  "score": record.f0 * 2 + record.f1
+}
+"#;
+
+/// Small programs covering the corners of evaluation: type errors, division
+/// by zero, safe navigation, shadowing, and mixed-type branches
+///
+/// They aren't benchmarked; the tests check that the native build of each
+/// agrees with the interpreter.
+pub const EDGE_CASES: &[&str] = &[
+    "record.name * 2",
+    "2 * record.name",
+    "record.f0 / (record.f1 - record.f1)",
+    "record.f0 % 0",
+    "-record.name",
+    "record.name + 1",
+    "1 + record.name",
+    "record.name < 1",
+    "record.name < 'z' and record.f0 >= 0",
+    "record.missing.deeper == nil",
+    "missing",
+    "if record.f0 > 50 then record.f0 else record.name end",
+    "let r = record in let r = r.f0 in r.x == nil and r > -1",
+    "not record.f0 or record.nothing",
+    "[record.f0 ^ 2, {\"k\": record.f1 / 2}, :tag, -(2 ^ 0.5)]",
+    "record | keys | size",
+];
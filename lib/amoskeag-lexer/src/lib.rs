@@ -9,13 +9,20 @@
 //! - Handles whitespace and comments
 //! - Provides detailed error reporting with line and column information
 //! - Supports string literals with escape sequences
+//!
+//! The lexer scans the source bytes in place. Tokens borrow their lexeme and
+//! identifier text from the source, and string literals are only copied when
+//! they contain escape sequences, so tokenizing allocates almost nothing.
+//! Tokens can be pulled one at a time with [`Lexer::next_token`] or collected
+//! with [`Lexer::tokenize`].
 
+use std::borrow::Cow;
 use std::fmt;
 use thiserror::Error;
 
 /// Token types in the Amoskeag language
 #[derive(Debug, Clone, PartialEq)]
-pub enum TokenType {
+pub enum TokenType<'a> {
     // Keywords
     If,
     Then,
@@ -32,9 +39,9 @@ pub enum TokenType {
 
     // Literals
     Number(f64),
-    String(String),
-    Identifier(String),
-    Symbol(String), // The value after the colon, e.g., :approve -> "approve"
+    String(Cow<'a, str>),
+    Identifier(&'a str),
+    Symbol(Cow<'a, str>), // The value after the colon, e.g., :approve -> "approve"
 
     // Operators
     Plus,
@@ -76,7 +83,7 @@ pub enum TokenType {
     Eof,
 }
 
-impl fmt::Display for TokenType {
+impl fmt::Display for TokenType<'_> {
     fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
         match self {
             TokenType::If => write!(f, "if"),
@@ -127,16 +134,18 @@ impl fmt::Display for TokenType {
 }
 
 /// A token with location information
+///
+/// `lexeme` is the exact source text of the token, borrowed from the input.
 #[derive(Debug, Clone, PartialEq)]
-pub struct Token {
-    pub token_type: TokenType,
-    pub lexeme: String,
+pub struct Token<'a> {
+    pub token_type: TokenType<'a>,
+    pub lexeme: &'a str,
     pub line: usize,
     pub column: usize,
 }
 
-impl Token {
-    pub fn new(token_type: TokenType, lexeme: String, line: usize, column: usize) -> Self {
+impl<'a> Token<'a> {
+    pub fn new(token_type: TokenType<'a>, lexeme: &'a str, line: usize, column: usize) -> Self {
         Self {
             token_type,
             lexeme,
@@ -174,18 +183,19 @@ pub enum LexError {
 }
 
 /// The Amoskeag lexer
-pub struct Lexer {
-    input: Vec<char>,
+pub struct Lexer<'a> {
+    input: &'a str,
+    /// Byte offset of the next unread character
     position: usize,
     line: usize,
     column: usize,
 }
 
-impl Lexer {
+impl<'a> Lexer<'a> {
     /// Create a new lexer from source code
-    pub fn new(input: &str) -> Self {
+    pub fn new(input: &'a str) -> Self {
         Self {
-            input: input.chars().collect(),
+            input,
             position: 0,
             line: 1,
             column: 1,
@@ -193,7 +203,7 @@ impl Lexer {
     }
 
     /// Tokenize the entire input
-    pub fn tokenize(&mut self) -> Result<Vec<Token>, LexError> {
+    pub fn tokenize(&mut self) -> Result<Vec<Token<'a>>, LexError> {
         let mut tokens = Vec::new();
 
         loop {
@@ -209,239 +219,240 @@ impl Lexer {
     }
 
     /// Get the next token
-    pub fn next_token(&mut self) -> Result<Token, LexError> {
+    ///
+    /// Once the input is exhausted, every call returns an `Eof` token.
+    pub fn next_token(&mut self) -> Result<Token<'a>, LexError> {
         self.skip_whitespace_and_comments();
 
-        if self.is_at_end() {
-            return Ok(Token::new(
-                TokenType::Eof,
-                String::new(),
-                self.line,
-                self.column,
-            ));
-        }
-
+        let start = self.position;
         let start_line = self.line;
         let start_column = self.column;
-        let ch = self.advance();
 
-        match ch {
+        let Some(byte) = self.peek() else {
+            return Ok(Token::new(TokenType::Eof, "", start_line, start_column));
+        };
+        self.advance();
+
+        let token_type = match byte {
             // Single-character tokens
-            '(' => Ok(self.make_token(TokenType::LeftParen, "(", start_line, start_column)),
-            ')' => Ok(self.make_token(TokenType::RightParen, ")", start_line, start_column)),
-            '[' => Ok(self.make_token(TokenType::LeftBracket, "[", start_line, start_column)),
-            ']' => Ok(self.make_token(TokenType::RightBracket, "]", start_line, start_column)),
-            '{' => {
+            b'(' => TokenType::LeftParen,
+            b')' => TokenType::RightParen,
+            b'[' => TokenType::LeftBracket,
+            b']' => TokenType::RightBracket,
+            b'{' => {
                 // Check if this is a brace-enclosed identifier
                 // We need to look ahead to determine if this is {identifier} or {key: value}
                 if self.is_brace_identifier() {
-                    return self.scan_brace_identifier(start_line, start_column);
+                    return self.scan_brace_identifier(start, start_line, start_column);
                 }
-                Ok(self.make_token(TokenType::LeftBrace, "{", start_line, start_column))
+                TokenType::LeftBrace
             }
-            '}' => Ok(self.make_token(TokenType::RightBrace, "}", start_line, start_column)),
-            ',' => Ok(self.make_token(TokenType::Comma, ",", start_line, start_column)),
-            '.' => Ok(self.make_token(TokenType::Dot, ".", start_line, start_column)),
-            '+' => Ok(self.make_token(TokenType::Plus, "+", start_line, start_column)),
-            '-' => Ok(self.make_token(TokenType::Minus, "-", start_line, start_column)),
-            '*' => Ok(self.make_token(TokenType::Star, "*", start_line, start_column)),
-            '/' => Ok(self.make_token(TokenType::Slash, "/", start_line, start_column)),
-            '%' => Ok(self.make_token(TokenType::Percent, "%", start_line, start_column)),
-            '^' => Ok(self.make_token(TokenType::Caret, "^", start_line, start_column)),
+            b'}' => TokenType::RightBrace,
+            b',' => TokenType::Comma,
+            b'.' => TokenType::Dot,
+            b'+' => TokenType::Plus,
+            b'-' => TokenType::Minus,
+            b'*' => TokenType::Star,
+            b'/' => TokenType::Slash,
+            b'%' => TokenType::Percent,
+            b'^' => TokenType::Caret,
 
             // Pipe or logical OR
-            '|' => {
-                if self.match_char('|') {
-                    Ok(self.make_token(TokenType::LogicalOr, "||", start_line, start_column))
+            b'|' => {
+                if self.match_byte(b'|') {
+                    TokenType::LogicalOr
                 } else {
-                    Ok(self.make_token(TokenType::Pipe, "|", start_line, start_column))
+                    TokenType::Pipe
                 }
             }
 
             // Logical AND
-            '&' => {
-                if self.match_char('&') {
-                    Ok(self.make_token(TokenType::LogicalAnd, "&&", start_line, start_column))
+            b'&' => {
+                if self.match_byte(b'&') {
+                    TokenType::LogicalAnd
                 } else {
-                    Err(LexError::UnexpectedCharacter {
+                    return Err(LexError::UnexpectedCharacter {
                         character: '&',
                         line: start_line,
                         column: start_column,
-                    })
+                    });
                 }
             }
 
             // Two-character tokens or single character
-            '=' => {
-                if self.match_char('=') {
-                    Ok(self.make_token(TokenType::Equal, "==", start_line, start_column))
+            b'=' => {
+                if self.match_byte(b'=') {
+                    TokenType::Equal
                 } else {
-                    Ok(self.make_token(TokenType::Assign, "=", start_line, start_column))
+                    TokenType::Assign
                 }
             }
-            '!' => {
-                if self.match_char('=') {
-                    Ok(self.make_token(TokenType::NotEqual, "!=", start_line, start_column))
+            b'!' => {
+                if self.match_byte(b'=') {
+                    TokenType::NotEqual
                 } else {
-                    Ok(self.make_token(TokenType::Bang, "!", start_line, start_column))
+                    TokenType::Bang
                 }
             }
-            '<' => {
-                if self.match_char('=') {
-                    Ok(self.make_token(TokenType::LessEqual, "<=", start_line, start_column))
+            b'<' => {
+                if self.match_byte(b'=') {
+                    TokenType::LessEqual
                 } else {
-                    Ok(self.make_token(TokenType::Less, "<", start_line, start_column))
+                    TokenType::Less
                 }
             }
-            '>' => {
-                if self.match_char('=') {
-                    Ok(self.make_token(TokenType::GreaterEqual, ">=", start_line, start_column))
+            b'>' => {
+                if self.match_byte(b'=') {
+                    TokenType::GreaterEqual
                 } else {
-                    Ok(self.make_token(TokenType::Greater, ">", start_line, start_column))
+                    TokenType::Greater
                 }
             }
 
             // Symbol literals
-            ':' => self.scan_symbol(start_line, start_column),
+            b':' => self.scan_symbol(start_line, start_column)?,
 
             // String literals
-            '"' | '\'' => self.scan_string(ch, start_line, start_column),
+            b'"' | b'\'' => TokenType::String(self.scan_quoted(byte, start_line, start_column)?),
 
             // Numbers
-            '0'..='9' => self.scan_number(ch, start_line, start_column),
+            b'0'..=b'9' => self.scan_number(start, start_line, start_column)?,
 
             // Identifiers and keywords
-            'a'..='z' | 'A'..='Z' | '_' => self.scan_identifier(ch, start_line, start_column),
+            b'a'..=b'z' | b'A'..=b'Z' | b'_' => self.scan_identifier(start),
 
-            _ => Err(LexError::UnexpectedCharacter {
-                character: ch,
-                line: start_line,
-                column: start_column,
-            }),
-        }
+            _ => {
+                return Err(LexError::UnexpectedCharacter {
+                    character: self.input[start..].chars().next().unwrap_or_default(),
+                    line: start_line,
+                    column: start_column,
+                })
+            }
+        };
+
+        Ok(Token::new(
+            token_type,
+            &self.input[start..self.position],
+            start_line,
+            start_column,
+        ))
     }
 
     // Helper methods
 
-    fn make_token(&self, token_type: TokenType, lexeme: &str, line: usize, column: usize) -> Token {
-        Token::new(token_type, lexeme.to_string(), line, column)
+    fn peek(&self) -> Option<u8> {
+        self.input.as_bytes().get(self.position).copied()
     }
 
-    fn is_at_end(&self) -> bool {
-        self.position >= self.input.len()
+    fn peek_next(&self) -> Option<u8> {
+        self.input.as_bytes().get(self.position + 1).copied()
     }
 
-    fn advance(&mut self) -> char {
+    /// Consume one byte, tracking the line and (character) column
+    fn advance(&mut self) {
         debug_assert!(
             self.position < self.input.len(),
             "advance() called at end of input"
         );
-        let ch = self.input[self.position];
+        let byte = self.input.as_bytes()[self.position];
         self.position += 1;
-        if ch == '\n' {
+        if byte == b'\n' {
             self.line += 1;
             self.column = 1;
-        } else {
+        } else if byte & 0xC0 != 0x80 {
+            // Continuation bytes of a multi-byte character don't start a column
             self.column += 1;
         }
-        ch
     }
 
-    fn peek(&self) -> Option<char> {
-        if self.is_at_end() {
-            None
-        } else {
-            Some(self.input[self.position])
+    /// Consume a whole character
+    fn advance_char(&mut self) -> Option<char> {
+        let ch = self.input[self.position..].chars().next()?;
+        for _ in 0..ch.len_utf8() {
+            self.advance();
         }
+        Some(ch)
     }
 
-    fn peek_next(&self) -> Option<char> {
-        if self.position + 1 >= self.input.len() {
-            None
+    fn match_byte(&mut self, expected: u8) -> bool {
+        if self.peek() == Some(expected) {
+            self.advance();
+            true
         } else {
-            Some(self.input[self.position + 1])
+            false
         }
     }
 
-    fn match_char(&mut self, expected: char) -> bool {
-        if self.is_at_end() {
-            return false;
-        }
-        if self.input[self.position] != expected {
-            return false;
+    fn advance_while(&mut self, predicate: impl Fn(u8) -> bool) {
+        while self.peek().is_some_and(&predicate) {
+            self.advance();
         }
-        self.advance();
-        true
     }
 
     fn skip_whitespace_and_comments(&mut self) {
         loop {
             match self.peek() {
-                Some(' ') | Some('\t') | Some('\r') | Some('\n') => {
-                    self.advance();
-                }
-                Some('#') => {
-                    // Skip comment until end of line
-                    while let Some(ch) = self.peek() {
-                        if ch == '\n' {
-                            break;
-                        }
-                        self.advance();
-                    }
-                }
+                Some(b' ' | b'\t' | b'\r' | b'\n') => self.advance(),
+                // Skip comment until end of line
+                Some(b'#') => self.advance_while(|b| b != b'\n'),
                 _ => break,
             }
         }
     }
 
-    fn scan_string(
+    /// Scan the rest of a quoted string or symbol, after its opening quote
+    ///
+    /// The value borrows from the input unless it contains escape sequences.
+    fn scan_quoted(
         &mut self,
-        quote: char,
+        quote: u8,
         start_line: usize,
         start_column: usize,
-    ) -> Result<Token, LexError> {
-        let mut value = String::new();
+    ) -> Result<Cow<'a, str>, LexError> {
+        let mut chunk_start = self.position;
+        let mut unescaped: Option<String> = None;
 
-        while let Some(ch) = self.peek() {
-            if ch == quote {
+        while let Some(byte) = self.peek() {
+            if byte == quote {
+                let rest = &self.input[chunk_start..self.position];
                 self.advance(); // Consume closing quote
-                let lexeme = format!("{}{}{}", quote, value, quote);
-                return Ok(Token::new(
-                    TokenType::String(value),
-                    lexeme,
-                    start_line,
-                    start_column,
-                ));
+                return Ok(match unescaped {
+                    Some(mut value) => {
+                        value.push_str(rest);
+                        Cow::Owned(value)
+                    }
+                    None => Cow::Borrowed(rest),
+                });
             }
 
-            if ch == '\\' {
+            if byte == b'\\' {
+                let value = unescaped.get_or_insert_with(String::new);
+                value.push_str(&self.input[chunk_start..self.position]);
                 self.advance(); // Consume backslash
-                if let Some(escaped) = self.peek() {
-                    self.advance();
-                    let unescaped = match escaped {
-                        'n' => '\n',
-                        't' => '\t',
-                        'r' => '\r',
-                        '\\' => '\\',
-                        '\'' => '\'',
-                        '"' => '"',
-                        _ => {
-                            return Err(LexError::InvalidEscape {
-                                sequence: escaped,
-                                line: self.line,
-                                column: self.column - 1,
-                            });
-                        }
-                    };
-                    value.push(unescaped);
-                } else {
+
+                let Some(escaped) = self.advance_char() else {
                     return Err(LexError::UnterminatedString {
                         line: start_line,
                         column: start_column,
                     });
-                }
+                };
+                value.push(match escaped {
+                    'n' => '\n',
+                    't' => '\t',
+                    'r' => '\r',
+                    '\\' => '\\',
+                    '\'' => '\'',
+                    '"' => '"',
+                    _ => {
+                        return Err(LexError::InvalidEscape {
+                            sequence: escaped,
+                            line: self.line,
+                            column: self.column - 1,
+                        });
+                    }
+                });
+                chunk_start = self.position;
             } else {
-                value.push(ch);
                 self.advance();
             }
         }
@@ -454,83 +465,32 @@ impl Lexer {
 
     fn scan_number(
         &mut self,
-        first: char,
+        start: usize,
         start_line: usize,
         start_column: usize,
-    ) -> Result<Token, LexError> {
-        debug_assert!(
-            first.is_ascii_digit(),
-            "scan_number() called with non-digit"
-        );
-        let mut lexeme = String::new();
-        lexeme.push(first);
-
+    ) -> Result<TokenType<'a>, LexError> {
         // Scan integer part
-        while let Some(ch) = self.peek() {
-            if ch.is_ascii_digit() {
-                lexeme.push(ch);
-                self.advance();
-            } else {
-                break;
-            }
-        }
+        self.advance_while(|b| b.is_ascii_digit());
 
         // Check for decimal part
-        if let Some('.') = self.peek() {
-            if let Some(next) = self.peek_next() {
-                if next.is_ascii_digit() {
-                    lexeme.push('.');
-                    self.advance();
-
-                    while let Some(ch) = self.peek() {
-                        if ch.is_ascii_digit() {
-                            lexeme.push(ch);
-                            self.advance();
-                        } else {
-                            break;
-                        }
-                    }
-                }
-            }
+        if self.peek() == Some(b'.') && self.peek_next().is_some_and(|b| b.is_ascii_digit()) {
+            self.advance();
+            self.advance_while(|b| b.is_ascii_digit());
         }
 
-        match lexeme.parse::<f64>() {
-            Ok(num) if num.is_finite() => Ok(Token::new(
-                TokenType::Number(num),
-                lexeme,
-                start_line,
-                start_column,
-            )),
-            Ok(_) => Err(LexError::InvalidNumber {
-                line: start_line,
-                column: start_column,
-            }),
-            Err(_) => Err(LexError::InvalidNumber {
+        match self.input[start..self.position].parse::<f64>() {
+            Ok(num) if num.is_finite() => Ok(TokenType::Number(num)),
+            _ => Err(LexError::InvalidNumber {
                 line: start_line,
                 column: start_column,
             }),
         }
     }
 
-    fn scan_identifier(
-        &mut self,
-        first: char,
-        start_line: usize,
-        start_column: usize,
-    ) -> Result<Token, LexError> {
-        let mut lexeme = String::new();
-        lexeme.push(first);
+    fn scan_identifier(&mut self, start: usize) -> TokenType<'a> {
+        self.advance_while(|b| b.is_ascii_alphanumeric() || b == b'_');
 
-        while let Some(ch) = self.peek() {
-            if ch.is_ascii_alphanumeric() || ch == '_' {
-                lexeme.push(ch);
-                self.advance();
-            } else {
-                break;
-            }
-        }
-
-        let token_type = match lexeme.as_str() {
+        match &self.input[start..self.position] {
             "if" => TokenType::If,
             "then" => TokenType::Then,
             "else" => TokenType::Else,
@@ -543,119 +503,48 @@ impl Lexer {
             "and" => TokenType::And,
             "or" => TokenType::Or,
             "not" => TokenType::Not,
-            _ => TokenType::Identifier(lexeme.clone()),
-        };
-
-        Ok(Token::new(token_type, lexeme, start_line, start_column))
+            name => TokenType::Identifier(name),
+        }
     }
 
-    fn scan_symbol(&mut self, start_line: usize, start_column: usize) -> Result<Token, LexError> {
+    fn scan_symbol(
+        &mut self,
+        start_line: usize,
+        start_column: usize,
+    ) -> Result<TokenType<'a>, LexError> {
         // Symbol is : followed by either an identifier or a string
         match self.peek() {
-            Some('"') | Some('\'') => {
-                let quote = self.advance();
-                let mut value = String::new();
-
-                while let Some(ch) = self.peek() {
-                    if ch == quote {
-                        self.advance();
-                        let lexeme = format!(":{}{}{}", quote, value, quote);
-                        return Ok(Token::new(
-                            TokenType::Symbol(value),
-                            lexeme,
-                            start_line,
-                            start_column,
-                        ));
-                    }
-
-                    if ch == '\\' {
-                        self.advance();
-                        if let Some(escaped) = self.peek() {
-                            self.advance();
-                            let unescaped = match escaped {
-                                'n' => '\n',
-                                't' => '\t',
-                                'r' => '\r',
-                                '\\' => '\\',
-                                '\'' => '\'',
-                                '"' => '"',
-                                _ => {
-                                    return Err(LexError::InvalidEscape {
-                                        sequence: escaped,
-                                        line: self.line,
-                                        column: self.column - 1,
-                                    });
-                                }
-                            };
-                            value.push(unescaped);
-                        } else {
-                            return Err(LexError::UnterminatedString {
-                                line: start_line,
-                                column: start_column,
-                            });
-                        }
-                    } else {
-                        value.push(ch);
-                        self.advance();
-                    }
-                }
-
-                Err(LexError::UnterminatedString {
-                    line: start_line,
-                    column: start_column,
-                })
-            }
-            Some(ch) if ch.is_ascii_alphabetic() || ch == '_' => {
-                let mut value = String::new();
-                value.push(self.advance());
-
-                while let Some(ch) = self.peek() {
-                    if ch.is_ascii_alphanumeric() || ch == '_' {
-                        value.push(ch);
-                        self.advance();
-                    } else {
-                        break;
-                    }
-                }
-
-                let lexeme = format!(":{}", value);
-                Ok(Token::new(
-                    TokenType::Symbol(value),
-                    lexeme,
+            Some(quote @ (b'"' | b'\'')) => {
+                self.advance();
+                Ok(TokenType::Symbol(self.scan_quoted(
+                    quote,
                     start_line,
                     start_column,
-                ))
+                )?))
             }
-            _ => {
-                // Just a colon (for dictionary literals)
-                Ok(Token::new(
-                    TokenType::Colon,
-                    ":".to_string(),
-                    start_line,
-                    start_column,
-                ))
+            Some(b) if b.is_ascii_alphabetic() || b == b'_' => {
+                let start = self.position;
+                self.advance_while(|b| b.is_ascii_alphanumeric() || b == b'_');
+                Ok(TokenType::Symbol(Cow::Borrowed(
+                    &self.input[start..self.position],
+                )))
             }
+            // Just a colon (for dictionary literals)
+            _ => Ok(TokenType::Colon),
         }
     }
 
     fn is_brace_identifier(&self) -> bool {
         // Look ahead to see if this looks like {identifier} vs {key: value}
         // A brace identifier should NOT contain a colon before the closing brace
-        let mut i = self.position;
         let mut has_content = false;
 
-        while i < self.input.len() {
-            let ch = self.input[i];
+        for ch in self.input[self.position..].chars() {
             match ch {
                 '}' => return has_content,  // Found closing brace, it's an identifier
                 ':' => return false,        // Found colon, it's a dictionary
                 '"' | '\'' => return false, // String literal, likely a dictionary
-                _ => {
-                    if !ch.is_whitespace() {
-                        has_content = true;
-                    }
-                    i += 1;
-                }
+                _ => has_content |= !ch.is_whitespace(),
             }
         }
 
@@ -664,40 +553,37 @@ impl Lexer {
 
     fn scan_brace_identifier(
         &mut self,
+        start: usize,
         start_line: usize,
         start_column: usize,
-    ) -> Result<Token, LexError> {
+    ) -> Result<Token<'a>, LexError> {
         // Brace identifier: { followed by identifier with possible spaces, then }
-        let mut value = String::new();
+        let content_start = self.position;
+        self.advance_while(|b| b != b'}');
 
-        while let Some(ch) = self.peek() {
-            if ch == '}' {
-                self.advance();
-                let trimmed_value = value.trim();
-                if trimmed_value.is_empty() {
-                    return Err(LexError::UnexpectedCharacter {
-                        character: '}',
-                        line: self.line,
-                        column: self.column - 1,
-                    });
-                }
-                let lexeme = format!("{{{}}}", value);
-                return Ok(Token::new(
-                    TokenType::Identifier(trimmed_value.to_string()),
-                    lexeme,
-                    start_line,
-                    start_column,
-                ));
-            }
+        if self.peek().is_none() {
+            return Err(LexError::UnterminatedBraceIdentifier {
+                line: start_line,
+                column: start_column,
+            });
+        }
 
-            value.push(ch);
-            self.advance();
+        let value = self.input[content_start..self.position].trim();
+        self.advance(); // Consume closing brace
+        if value.is_empty() {
+            return Err(LexError::UnexpectedCharacter {
+                character: '}',
+                line: self.line,
+                column: self.column - 1,
+            });
         }
 
-        Err(LexError::UnterminatedBraceIdentifier {
-            line: start_line,
-            column: start_column,
-        })
+        Ok(Token::new(
+            TokenType::Identifier(value),
+            &self.input[start..self.position],
+            start_line,
+            start_column,
+        ))
     }
 }
 
@@ -742,11 +628,11 @@ mod tests {
         let mut lexer = Lexer::new(input);
         let tokens = lexer.tokenize().unwrap();
 
-        assert_eq!(tokens[0].token_type, TokenType::String("hello".to_string()));
-        assert_eq!(tokens[1].token_type, TokenType::String("world".to_string()));
+        assert_eq!(tokens[0].token_type, TokenType::String("hello".into()));
+        assert_eq!(tokens[1].token_type, TokenType::String("world".into()));
         assert_eq!(
             tokens[2].token_type,
-            TokenType::String("hello\nworld".to_string())
+            TokenType::String("hello\nworld".into())
         );
     }
 
@@ -756,14 +642,11 @@ mod tests {
         let mut lexer = Lexer::new(input);
         let tokens = lexer.tokenize().unwrap();
 
-        assert_eq!(
-            tokens[0].token_type,
-            TokenType::Symbol("approve".to_string())
-        );
-        assert_eq!(tokens[1].token_type, TokenType::Symbol("deny".to_string()));
+        assert_eq!(tokens[0].token_type, TokenType::Symbol("approve".into()));
+        assert_eq!(tokens[1].token_type, TokenType::Symbol("deny".into()));
         assert_eq!(
             tokens[2].token_type,
-            TokenType::Symbol("test.something".to_string())
+            TokenType::Symbol("test.something".into())
         );
     }
 
@@ -795,11 +678,11 @@ mod tests {
         let tokens = lexer.tokenize().unwrap();
 
         assert_eq!(tokens[0].token_type, TokenType::Let);
-        assert_eq!(tokens[1].token_type, TokenType::Identifier("x".to_string()));
+        assert_eq!(tokens[1].token_type, TokenType::Identifier("x"));
         assert_eq!(tokens[2].token_type, TokenType::Assign);
         assert_eq!(tokens[3].token_type, TokenType::Number(5.0));
         assert_eq!(tokens[4].token_type, TokenType::Let);
-        assert_eq!(tokens[5].token_type, TokenType::Identifier("y".to_string()));
+        assert_eq!(tokens[5].token_type, TokenType::Identifier("y"));
     }
 
     #[test]
@@ -815,23 +698,14 @@ mod tests {
         let tokens = lexer.tokenize().unwrap();
 
         assert_eq!(tokens[0].token_type, TokenType::If);
-        assert_eq!(
-            tokens[1].token_type,
-            TokenType::Identifier("driver".to_string())
-        );
+        assert_eq!(tokens[1].token_type, TokenType::Identifier("driver"));
         assert_eq!(tokens[2].token_type, TokenType::Dot);
-        assert_eq!(
-            tokens[3].token_type,
-            TokenType::Identifier("age".to_string())
-        );
+        assert_eq!(tokens[3].token_type, TokenType::Identifier("age"));
         assert_eq!(tokens[4].token_type, TokenType::Greater);
         assert_eq!(tokens[5].token_type, TokenType::Number(16.0));
-        assert_eq!(
-            tokens[6].token_type,
-            TokenType::Symbol("continue".to_string())
-        );
+        assert_eq!(tokens[6].token_type, TokenType::Symbol("continue".into()));
         assert_eq!(tokens[7].token_type, TokenType::Else);
-        assert_eq!(tokens[8].token_type, TokenType::Symbol("deny".to_string()));
+        assert_eq!(tokens[8].token_type, TokenType::Symbol("deny".into()));
         assert_eq!(tokens[9].token_type, TokenType::End);
     }
 
@@ -841,20 +715,11 @@ mod tests {
         let mut lexer = Lexer::new(input);
         let tokens = lexer.tokenize().unwrap();
 
-        assert_eq!(
-            tokens[0].token_type,
-            TokenType::Identifier("salesperson".to_string())
-        );
+        assert_eq!(tokens[0].token_type, TokenType::Identifier("salesperson"));
         assert_eq!(tokens[1].token_type, TokenType::Dot);
-        assert_eq!(
-            tokens[2].token_type,
-            TokenType::Identifier("name".to_string())
-        );
+        assert_eq!(tokens[2].token_type, TokenType::Identifier("name"));
         assert_eq!(tokens[3].token_type, TokenType::Pipe);
-        assert_eq!(
-            tokens[4].token_type,
-            TokenType::Identifier("downcase".to_string())
-        );
+        assert_eq!(tokens[4].token_type, TokenType::Identifier("downcase"));
     }
 
     #[test]
@@ -938,7 +803,7 @@ mod tests {
 
         assert_eq!(
             tokens[0].token_type,
-            TokenType::String("hello\nworld\t\r\\\"'".to_string())
+            TokenType::String("hello\nworld\t\r\\\"'".into())
         );
     }
 
@@ -974,14 +839,8 @@ mod tests {
         let mut lexer = Lexer::new(input);
         let tokens = lexer.tokenize().unwrap();
 
-        assert_eq!(
-            tokens[0].token_type,
-            TokenType::String("double".to_string())
-        );
-        assert_eq!(
-            tokens[1].token_type,
-            TokenType::String("single".to_string())
-        );
+        assert_eq!(tokens[0].token_type, TokenType::String("double".into()));
+        assert_eq!(tokens[1].token_type, TokenType::String("single".into()));
     }
 
     #[test]
@@ -990,17 +849,14 @@ mod tests {
         let mut lexer = Lexer::new(input);
         let tokens = lexer.tokenize().unwrap();
 
-        assert_eq!(
-            tokens[0].token_type,
-            TokenType::Symbol("simple".to_string())
-        );
+        assert_eq!(tokens[0].token_type, TokenType::Symbol("simple".into()));
         assert_eq!(
             tokens[1].token_type,
-            TokenType::Symbol("with spaces".to_string())
+            TokenType::Symbol("with spaces".into())
         );
         assert_eq!(
             tokens[2].token_type,
-            TokenType::Symbol("single quoted".to_string())
+            TokenType::Symbol("single quoted".into())
         );
     }
 
@@ -1011,9 +867,9 @@ mod tests {
         let tokens = lexer.tokenize().unwrap();
 
         assert_eq!(tokens[0].token_type, TokenType::LeftBrace);
-        assert_eq!(tokens[1].token_type, TokenType::String("key".to_string()));
+        assert_eq!(tokens[1].token_type, TokenType::String("key".into()));
         assert_eq!(tokens[2].token_type, TokenType::Colon);
-        assert_eq!(tokens[3].token_type, TokenType::String("value".to_string()));
+        assert_eq!(tokens[3].token_type, TokenType::String("value".into()));
         assert_eq!(tokens[4].token_type, TokenType::RightBrace);
     }
 
@@ -1070,18 +926,9 @@ mod tests {
         let mut lexer = Lexer::new(input);
         let tokens = lexer.tokenize().unwrap();
 
-        assert_eq!(
-            tokens[0].token_type,
-            TokenType::Identifier("_start".to_string())
-        );
-        assert_eq!(
-            tokens[1].token_type,
-            TokenType::Identifier("middle_".to_string())
-        );
-        assert_eq!(
-            tokens[2].token_type,
-            TokenType::Identifier("_under_score_".to_string())
-        );
+        assert_eq!(tokens[0].token_type, TokenType::Identifier("_start"));
+        assert_eq!(tokens[1].token_type, TokenType::Identifier("middle_"));
+        assert_eq!(tokens[2].token_type, TokenType::Identifier("_under_score_"));
     }
 
     #[test]
@@ -1147,7 +994,7 @@ mod tests {
         let tokens = lexer.tokenize().unwrap();
         assert_eq!(
             tokens[0].token_type,
-            TokenType::Identifier("Customer Ratio".to_string())
+            TokenType::Identifier("Customer Ratio")
         );
     }
 
@@ -1158,7 +1005,7 @@ mod tests {
         let tokens = lexer.tokenize().unwrap();
         assert_eq!(
             tokens[0].token_type,
-            TokenType::Identifier("Customer Ratio".to_string())
+            TokenType::Identifier("Customer Ratio")
         );
     }
 
@@ -1169,7 +1016,7 @@ mod tests {
         let tokens = lexer.tokenize().unwrap();
         assert_eq!(
             tokens[0].token_type,
-            TokenType::Identifier("Customer Ratio".to_string())
+            TokenType::Identifier("Customer Ratio")
         );
         assert_eq!(tokens[1].token_type, TokenType::Greater);
         assert_eq!(tokens[2].token_type, TokenType::Number(0.5));
@@ -1182,7 +1029,7 @@ mod tests {
         let tokens = lexer.tokenize().unwrap();
         assert_eq!(
             tokens[0].token_type,
-            TokenType::Identifier("Total Revenue (USD)".to_string())
+            TokenType::Identifier("Total Revenue (USD)")
         );
     }
 
@@ -1192,10 +1039,7 @@ mod tests {
         let mut lexer = Lexer::new(input);
         let tokens = lexer.tokenize().unwrap();
         assert_eq!(tokens[0].token_type, TokenType::LeftBrace);
-        assert_eq!(
-            tokens[1].token_type,
-            TokenType::Identifier("name".to_string())
-        );
+        assert_eq!(tokens[1].token_type, TokenType::Identifier("name"));
         assert_eq!(tokens[2].token_type, TokenType::Colon);
     }
 
@@ -1207,14 +1051,8 @@ mod tests {
         let mut lexer = Lexer::new(input);
         let tokens = lexer.tokenize().unwrap();
         assert_eq!(tokens[0].token_type, TokenType::LeftBrace);
-        assert_eq!(
-            tokens[1].token_type,
-            TokenType::Identifier("Customer".to_string())
-        );
-        assert_eq!(
-            tokens[2].token_type,
-            TokenType::Identifier("Ratio".to_string())
-        );
+        assert_eq!(tokens[1].token_type, TokenType::Identifier("Customer"));
+        assert_eq!(tokens[2].token_type, TokenType::Identifier("Ratio"));
     }
 
     #[test]
@@ -1245,13 +1083,67 @@ mod tests {
 
         // Only lowercase "if" is a keyword
         assert_eq!(tokens[0].token_type, TokenType::If);
+        assert_eq!(tokens[1].token_type, TokenType::Identifier("IF"));
+        assert_eq!(tokens[2].token_type, TokenType::Identifier("If"));
+    }
+
+    #[test]
+    fn test_tokens_borrow_from_source() {
+        let input = "upcase(name) | \"plain\" | 'esc\\n' | :sym | { Total Revenue }";
+        let tokens = Lexer::new(input).tokenize().unwrap();
+
+        assert_eq!(tokens[0].lexeme, "upcase");
+        assert_eq!(tokens[5].lexeme, "\"plain\"");
+        assert!(matches!(
+            &tokens[5].token_type,
+            TokenType::String(Cow::Borrowed("plain"))
+        ));
+        // Only literals with escapes are copied
+        assert!(matches!(
+            &tokens[7].token_type,
+            TokenType::String(Cow::Owned(s)) if s == "esc\n"
+        ));
+        assert_eq!(tokens[7].lexeme, "'esc\\n'");
+        assert!(matches!(
+            &tokens[9].token_type,
+            TokenType::Symbol(Cow::Borrowed("sym"))
+        ));
         assert_eq!(
-            tokens[1].token_type,
-            TokenType::Identifier("IF".to_string())
+            tokens[11].token_type,
+            TokenType::Identifier("Total Revenue")
         );
+        assert_eq!(tokens[11].lexeme, "{ Total Revenue }");
+    }
+
+    #[test]
+    fn test_columns_count_characters() {
+        let input = "\"héllo\" + x\n  é";
+        let mut lexer = Lexer::new(input);
+
+        let string = lexer.next_token().unwrap();
+        assert_eq!(string.token_type, TokenType::String("héllo".into()));
+        let plus = lexer.next_token().unwrap();
+        assert_eq!((plus.line, plus.column), (1, 9));
+        lexer.next_token().unwrap();
+
+        match lexer.next_token() {
+            Err(LexError::UnexpectedCharacter {
+                character,
+                line,
+                column,
+            }) => assert_eq!((character, line, column), ('é', 2, 3)),
+            other => panic!("Expected unexpected character error, got {:?}", other),
+        }
+    }
+
+    #[test]
+    fn test_next_token_after_eof() {
+        let mut lexer = Lexer::new("x");
         assert_eq!(
-            tokens[2].token_type,
-            TokenType::Identifier("If".to_string())
+            lexer.next_token().unwrap().token_type,
+            TokenType::Identifier("x")
         );
+        assert_eq!(lexer.next_token().unwrap().token_type, TokenType::Eof);
+        assert_eq!(lexer.next_token().unwrap().token_type, TokenType::Eof);
     }
 }
@@ -0,0 +1,146 @@
+//! Tree construction
+//!
+//! The grammar in `Parser` doesn't build nodes itself. It hands each node's
+//! parts to a `Build` implementation, so the same parser produces the boxed
+//! [`Expr`] tree with or without the positions of its nodes.
+
+use crate::{BinaryOp, Expr, UnaryOp};
+use std::borrow::Cow;
+
+/// A sink for the nodes recognized by the parser
+///
+/// `'a` is the lifetime of the source text, which token text borrows from.
+pub(crate) trait Build<'a> {
+    type Node;
+
+    fn number(&mut self, n: f64) -> Self::Node;
+    fn string(&mut self, s: Cow<'a, str>) -> Self::Node;
+    fn boolean(&mut self, b: bool) -> Self::Node;
+    fn nil(&mut self) -> Self::Node;
+    fn symbol(&mut self, s: Cow<'a, str>) -> Self::Node;
+    fn array(&mut self, items: Vec<Self::Node>) -> Self::Node;
+    fn dictionary(&mut self, pairs: Vec<(Cow<'a, str>, Self::Node)>) -> Self::Node;
+    fn variable(&mut self, path: Vec<&'a str>) -> Self::Node;
+    fn call(&mut self, name: &'a str, args: Vec<Self::Node>) -> Self::Node;
+    fn let_in(&mut self, name: &'a str, value: Self::Node, body: Self::Node) -> Self::Node;
+    fn if_else(
+        &mut self,
+        condition: Self::Node,
+        then_branch: Self::Node,
+        else_branch: Self::Node,
+    ) -> Self::Node;
+    fn binary(&mut self, op: BinaryOp, left: Self::Node, right: Self::Node) -> Self::Node;
+    fn unary(&mut self, op: UnaryOp, operand: Self::Node) -> Self::Node;
+
+    /// Record that `node` starts at `line` and `column` of the source
+    ///
+    /// The parser calls this right after building each node. Builders that
+    /// don't keep positions ignore it.
+    fn locate(&mut self, node: Self::Node, _line: usize, _column: usize) -> Self::Node {
+        node
+    }
+
+    /// Desugar `left | right` into a call with `left` as the first argument
+    ///
+    /// `right` must be a bare identifier or a function call; anything else
+    /// returns `None`.
+    fn pipe(&mut self, left: Self::Node, right: Self::Node) -> Option<Self::Node>;
+}
+
+/// Builds the boxed `Expr` tree
+pub(crate) struct ExprBuilder;
+
+impl<'a> Build<'a> for ExprBuilder {
+    type Node = Expr;
+
+    fn number(&mut self, n: f64) -> Expr {
+        Expr::Number(n)
+    }
+
+    fn string(&mut self, s: Cow<'a, str>) -> Expr {
+        Expr::String(s.into_owned())
+    }
+
+    fn boolean(&mut self, b: bool) -> Expr {
+        Expr::Boolean(b)
+    }
+
+    fn nil(&mut self) -> Expr {
+        Expr::Nil
+    }
+
+    fn symbol(&mut self, s: Cow<'a, str>) -> Expr {
+        Expr::Symbol(s.into_owned())
+    }
+
+    fn array(&mut self, items: Vec<Expr>) -> Expr {
+        Expr::Array(items)
+    }
+
+    fn dictionary(&mut self, pairs: Vec<(Cow<'a, str>, Expr)>) -> Expr {
+        Expr::Dictionary(
+            pairs
+                .into_iter()
+                .map(|(k, v)| (k.into_owned(), v))
+                .collect(),
+        )
+    }
+
+    fn variable(&mut self, path: Vec<&'a str>) -> Expr {
+        Expr::Variable(path.into_iter().map(str::to_string).collect())
+    }
+
+    fn call(&mut self, name: &'a str, args: Vec<Expr>) -> Expr {
+        Expr::FunctionCall {
+            name: name.to_string(),
+            args,
+        }
+    }
+
+    fn let_in(&mut self, name: &'a str, value: Expr, body: Expr) -> Expr {
+        Expr::Let {
+            name: name.to_string(),
+            value: Box::new(value),
+            body: Box::new(body),
+        }
+    }
+
+    fn if_else(&mut self, condition: Expr, then_branch: Expr, else_branch: Expr) -> Expr {
+        Expr::If {
+            condition: Box::new(condition),
+            then_branch: Box::new(then_branch),
+            else_branch: Box::new(else_branch),
+        }
+    }
+
+    fn binary(&mut self, op: BinaryOp, left: Expr, right: Expr) -> Expr {
+        Expr::Binary {
+            op,
+            left: Box::new(left),
+            right: Box::new(right),
+        }
+    }
+
+    fn unary(&mut self, op: UnaryOp, operand: Expr) -> Expr {
+        Expr::Unary {
+            op,
+            operand: Box::new(operand),
+        }
+    }
+
+    fn pipe(&mut self, left: Expr, right: Expr) -> Option<Expr> {
+        match right {
+            // Simple identifier: x | func => func(x)
+            Expr::Variable(mut parts) if parts.len() == 1 => Some(Expr::FunctionCall {
+                name: parts.pop().expect("one part"),
+                args: vec![left],
+            }),
+            // Function call: x | func(a, b) => func(x, a, b)
+            Expr::FunctionCall { name, mut args } => {
+                args.insert(0, left);
+                Some(Expr::FunctionCall { name, args })
+            }
+            _ => None,
+        }
+    }
+}
@@ -4,7 +4,15 @@
 //! This module is responsible for consuming tokens from the lexer and
 //! producing an Abstract Syntax Tree (AST) using a recursive descent parser.
 
-use amoskeag_lexer::{Token, TokenType};
+mod builder;
+mod positions;
+
+pub use positions::Position;
+
+use amoskeag_lexer::{LexError, Lexer, Token, TokenType};
+use builder::{Build, ExprBuilder};
+use positions::PositionBuilder;
+use std::borrow::Cow;
 use std::fmt;
 use thiserror::Error;
 
@@ -64,7 +72,7 @@ pub enum Expr {
 }
 
 /// Binary operators
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub enum BinaryOp {
     // Arithmetic
     Add,
@@ -109,7 +117,7 @@ impl fmt::Display for BinaryOp {
 }
 
 /// Unary operators
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub enum UnaryOp {
     Not,
     Negate,
@@ -124,6 +132,14 @@ impl fmt::Display for UnaryOp {
     }
 }
 
+/// How deeply expressions may nest inside one another
+///
+/// Parentheses, unary operands and the right-hand sides of operators each
+/// recurse in the parser, and the passes that walk the tree afterwards
+/// recurse the same way. The limit keeps all of them well inside a small
+/// worker thread's stack.
+pub const MAX_NESTING_DEPTH: usize = 128;
+
 /// Parser errors
 #[derive(Error, Debug)]
 pub enum ParseError {
@@ -142,95 +158,212 @@ pub enum ParseError {
 
     #[error("Invalid expression at line {line}, column {column}")]
     InvalidExpression { line: usize, column: usize },
+
+    #[error("Expression nested more than {limit} levels deep at line {line}, column {column}")]
+    NestingTooDeep {
+        limit: usize,
+        line: usize,
+        column: usize,
+    },
+
+    /// A lexer error hit while parsing from a [`Lexer`]
+    #[error("Lexer error: {0}")]
+    LexError(#[from] LexError),
 }
 
 /// Parser state
-pub struct Parser {
-    tokens: Vec<Token>,
-    current: usize,
+///
+/// The parser only ever looks at the current token, so it can pull tokens
+/// from a [`Lexer`] one at a time instead of needing the whole token stream.
+pub struct Parser<'a> {
+    tokens: TokenSource<'a>,
+    current: Token<'a>,
+    depth: usize,
+}
+
+/// Where the parser gets its tokens from
+enum TokenSource<'a> {
+    Buffered(std::vec::IntoIter<Token<'a>>),
+    Lexer(Lexer<'a>),
+}
+
+impl<'a> TokenSource<'a> {
+    fn next_token(&mut self) -> Result<Token<'a>, ParseError> {
+        match self {
+            TokenSource::Buffered(tokens) => Ok(tokens
+                .next()
+                .unwrap_or_else(|| Token::new(TokenType::Eof, "", 0, 0))),
+            TokenSource::Lexer(lexer) => Ok(lexer.next_token()?),
+        }
+    }
+
+    /// Lex whatever input the parser didn't reach, so a lexer error anywhere
+    /// in the source is reported just as it is when tokenizing up front
+    fn finish(&mut self) -> Result<(), ParseError> {
+        if let TokenSource::Lexer(lexer) = self {
+            while lexer.next_token()?.token_type != TokenType::Eof {}
+        }
+        Ok(())
+    }
 }
 
-impl Parser {
+impl<'a> Parser<'a> {
     /// Create a new parser from a token stream
-    pub fn new(tokens: Vec<Token>) -> Self {
-        Self { tokens, current: 0 }
+    pub fn new(tokens: Vec<Token<'a>>) -> Self {
+        let mut tokens = tokens.into_iter();
+        let current = tokens
+            .next()
+            .unwrap_or_else(|| Token::new(TokenType::Eof, "", 1, 1));
+        Self {
+            tokens: TokenSource::Buffered(tokens),
+            current,
+            depth: 0,
+        }
+    }
+
+    /// Create a parser that pulls tokens from a lexer as it goes
+    ///
+    /// Lexer errors are reported as [`ParseError::LexError`] when the parser
+    /// reaches them.
+    pub fn from_lexer(lexer: Lexer<'a>) -> Result<Self, ParseError> {
+        let mut tokens = TokenSource::Lexer(lexer);
+        let current = tokens.next_token()?;
+        Ok(Self {
+            tokens,
+            current,
+            depth: 0,
+        })
     }
 
     /// Parse the token stream into an AST
     pub fn parse(&mut self) -> Result<Expr, ParseError> {
-        self.expression()
+        let expr = self.expression(&mut ExprBuilder)?;
+        self.tokens.finish()?;
+        Ok(expr)
+    }
+
+    /// Parse the token stream into an AST, along with the source position
+    /// of each of its nodes
+    ///
+    /// Accepts exactly the same programs as [`Parser::parse`] and returns
+    /// the same tree. The positions are listed in pre-order: each node
+    /// before its children, and the children left to right.
+    pub fn parse_with_positions(&mut self) -> Result<(Expr, Vec<Position>), ParseError> {
+        let mut builder = PositionBuilder::default();
+        let (expr, root) = self.expression(&mut builder)?;
+        self.tokens.finish()?;
+        Ok((expr, builder.finish(root)))
     }
 
     // Recursive descent parser implementation
+    //
+    // Each production hands the parts it recognizes to a `Build`
+    // implementation, which decides what kind of tree to make.
 
-    fn expression(&mut self) -> Result<Expr, ParseError> {
+    fn expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // Expression ::= LetExpression | IfExpression | LogicalExpression
-        if self.check(&TokenType::Let) {
-            self.let_expression()
-        } else if self.check(&TokenType::If) {
-            self.if_expression()
-        } else {
-            self.logical_expression()
+        self.nested(|parser| {
+            if parser.check(&TokenType::Let) {
+                parser.let_expression(b)
+            } else if parser.check(&TokenType::If) {
+                parser.if_expression(b)
+            } else {
+                parser.logical_expression(b)
+            }
+        })
+    }
+
+    /// Parse one level further in, failing past [`MAX_NESTING_DEPTH`]
+    fn nested<T>(
+        &mut self,
+        parse: impl FnOnce(&mut Self) -> Result<T, ParseError>,
+    ) -> Result<T, ParseError> {
+        self.check_depth()?;
+        self.depth += 1;
+        let result = parse(self);
+        self.depth -= 1;
+        result
+    }
+
+    /// Fail if the parser can't go another level further in
+    fn check_depth(&self) -> Result<(), ParseError> {
+        if self.depth < MAX_NESTING_DEPTH {
+            return Ok(());
         }
+        let (line, column) = self.position();
+        Err(ParseError::NestingTooDeep {
+            limit: MAX_NESTING_DEPTH,
+            line,
+            column,
+        })
     }
 
-    fn let_expression(&mut self) -> Result<Expr, ParseError> {
+    fn let_expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // LetExpression ::= "let" IDENTIFIER "=" Expression ["in"] Expression
-        self.consume_token(&TokenType::Let, "let")?;
+        //
+        // A chain of lets, where each body is the next let, is parsed in a
+        // loop and built from the inside out, so long chains don't take
+        // native stack in proportion.
+        let mut bindings = vec![];
 
-        let name = self.consume_identifier()?;
+        while self.check(&TokenType::Let) {
+            let (line, column) = self.position();
+            self.consume_token(&TokenType::Let, "let")?;
 
-        self.consume_token(&TokenType::Assign, "=")?;
+            let name = self.consume_identifier()?;
 
-        let value = Box::new(self.expression()?);
+            self.consume_token(&TokenType::Assign, "=")?;
 
-        // "in" is optional; when absent the body is the rest of the expression
-        if self.check(&TokenType::In) {
-            self.advance();
-        }
+            let value = self.expression(b)?;
 
-        let body = Box::new(self.expression()?);
+            // "in" is optional; when absent the body is the rest of the expression
+            if self.check(&TokenType::In) {
+                self.advance()?;
+            }
 
-        Ok(Expr::Let { name, value, body })
+            bindings.push((name, value, line, column));
+        }
+
+        let mut expr = self.expression(b)?;
+        for (name, value, line, column) in bindings.into_iter().rev() {
+            let node = b.let_in(name, value, expr);
+            expr = b.locate(node, line, column);
+        }
+        Ok(expr)
     }
 
-    fn if_expression(&mut self) -> Result<Expr, ParseError> {
+    fn if_expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
+        let (line, column) = self.position();
         self.consume_token(&TokenType::If, "if")?;
 
-        let mut conditions = vec![];
-        let mut thens = vec![];
+        let mut branches = vec![];
 
-        let condition = Box::new(self.expression()?);
+        let condition = self.expression(b)?;
         if self.check(&TokenType::Then) {
-            self.advance();
+            self.advance()?;
         }
-        let then_branch = Box::new(self.expression()?);
+        let then_branch = self.expression(b)?;
+        branches.push((condition, then_branch, line, column));
 
-        conditions.push(condition);
-        thens.push(then_branch);
-
-        while self.match_token(&TokenType::Else) {
+        while self.match_token(&TokenType::Else)? {
             if self.check(&TokenType::If) {
-                self.advance();
-                let cond = Box::new(self.expression()?);
+                let (line, column) = self.position();
+                self.advance()?;
+                let cond = self.expression(b)?;
                 if self.check(&TokenType::Then) {
-                    self.advance();
+                    self.advance()?;
                 }
-                let then = Box::new(self.expression()?);
-                conditions.push(cond);
-                thens.push(then);
+                let then = self.expression(b)?;
+                branches.push((cond, then, line, column));
             } else {
-                let else_branch = Box::new(self.expression()?);
+                let else_branch = self.expression(b)?;
                 self.consume_token(&TokenType::End, "end")?;
 
                 // Build the nested if from the inside out
-                let mut expr = *else_branch;
-                for i in (0..conditions.len()).rev() {
-                    expr = Expr::If {
-                        condition: conditions[i].clone(),
-                        then_branch: thens[i].clone(),
-                        else_branch: Box::new(expr),
-                    };
+                let mut expr = else_branch;
+                for (condition, then_branch, line, column) in branches.into_iter().rev() {
+                    let node = b.if_else(condition, then_branch, expr);
+                    expr = b.locate(node, line, column);
                 }
                 return Ok(expr);
             }
@@ -245,9 +378,10 @@ impl Parser {
         })
     }
 
-    fn logical_expression(&mut self) -> Result<Expr, ParseError> {
+    fn logical_expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // LogicalExpression ::= ComparisonExpression ( ("or" | "||" | "and" | "&&") ComparisonExpression )*
         self.binary_op(
+            b,
             Self::comparison_expression,
             &[
                 (TokenType::Or, BinaryOp::Or),
@@ -258,9 +392,10 @@ impl Parser {
         )
     }
 
-    fn comparison_expression(&mut self) -> Result<Expr, ParseError> {
+    fn comparison_expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // ComparisonExpression ::= PipeExpression ( ( "==" | "!=" | "<" | ">" | "<=" | ">=" ) PipeExpression )*
         self.binary_op(
+            b,
             Self::pipe_expression,
             &[
                 (TokenType::Equal, BinaryOp::Equal),
@@ -273,32 +408,36 @@ impl Parser {
         )
     }
 
-    fn pipe_expression(&mut self) -> Result<Expr, ParseError> {
+    fn pipe_expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // PipeExpression ::= AdditiveExpression ( "|" FunctionCall )*
-        let mut expr = self.additive_expression()?;
+        //
+        // Each step nests the expression so far in a call, so it counts
+        // towards the nesting depth until the chain ends
+        let expr = self.additive_expression(b)?;
+        let depth = self.depth;
+        let result = self.pipe_steps(b, expr);
+        self.depth = depth;
+        result
+    }
 
-        while self.match_token(&TokenType::Pipe) {
+    fn pipe_steps<B: Build<'a>>(
+        &mut self,
+        b: &mut B,
+        mut expr: B::Node,
+    ) -> Result<B::Node, ParseError> {
+        while self.match_token(&TokenType::Pipe)? {
+            self.check_depth()?;
+            self.depth += 1;
             // After pipe, we expect either:
             // 1. An identifier (becomes a function call with expr as first arg)
             // 2. A function call (expr becomes first argument)
-
-            let right = self.additive_expression()?;
+            let (line, column) = self.position();
+            let right = self.additive_expression(b)?;
 
             // Transform pipe into function call
-            expr = match right {
-                Expr::Variable(ref parts) if parts.len() == 1 => {
-                    // Simple identifier: x | func => func(x)
-                    Expr::FunctionCall {
-                        name: parts[0].clone(),
-                        args: vec![expr],
-                    }
-                }
-                Expr::FunctionCall { name, mut args } => {
-                    // Function call: x | func(a, b) => func(x, a, b)
-                    args.insert(0, expr);
-                    Expr::FunctionCall { name, args }
-                }
-                _ => {
+            expr = match b.pipe(expr, right) {
+                Some(call) => b.locate(call, line, column),
+                None => {
                     return Err(ParseError::InvalidExpression {
                         line: self.current_token().line,
                         column: self.current_token().column,
@@ -310,9 +449,10 @@ impl Parser {
         Ok(expr)
     }
 
-    fn additive_expression(&mut self) -> Result<Expr, ParseError> {
+    fn additive_expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // AdditiveExpression ::= MultiplicativeExpression ( ( "+" | "-" ) MultiplicativeExpression )*
         self.binary_op(
+            b,
             Self::multiplicative_expression,
             &[
                 (TokenType::Plus, BinaryOp::Add),
@@ -321,9 +461,13 @@ impl Parser {
         )
     }
 
-    fn multiplicative_expression(&mut self) -> Result<Expr, ParseError> {
+    fn multiplicative_expression<B: Build<'a>>(
+        &mut self,
+        b: &mut B,
+    ) -> Result<B::Node, ParseError> {
         // MultiplicativeExpression ::= ExponentialExpression ( ( "*" | "/" | "%" ) ExponentialExpression )*
         self.binary_op(
+            b,
             Self::exponential_expression,
             &[
                 (TokenType::Star, BinaryOp::Multiply),
@@ -333,105 +477,104 @@ impl Parser {
         )
     }
 
-    fn exponential_expression(&mut self) -> Result<Expr, ParseError> {
+    fn exponential_expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // ExponentialExpression ::= PrimaryExpression ( "^" PrimaryExpression )*
         self.binary_op(
+            b,
             Self::primary_expression,
             &[(TokenType::Caret, BinaryOp::Power)],
         )
     }
 
-    fn primary_expression(&mut self) -> Result<Expr, ParseError> {
+    fn primary_expression<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // PrimaryExpression ::= Literal | SymbolLiteral | FunctionCall | VariableAccess | "(" Expression ")"
 
+        let (line, column) = self.position();
         let token = self.peek();
 
-        match &token.token_type {
+        let node = match &token.token_type {
             // Literals
             TokenType::Number(n) => {
                 let n = *n;
-                self.advance();
-                Ok(Expr::Number(n))
+                self.advance()?;
+                b.number(n)
             }
             TokenType::String(s) => {
                 let s = s.clone();
-                self.advance();
-                Ok(Expr::String(s))
+                self.advance()?;
+                b.string(s)
             }
             TokenType::True => {
-                self.advance();
-                Ok(Expr::Boolean(true))
+                self.advance()?;
+                b.boolean(true)
             }
             TokenType::False => {
-                self.advance();
-                Ok(Expr::Boolean(false))
+                self.advance()?;
+                b.boolean(false)
             }
             TokenType::Nil => {
-                self.advance();
-                Ok(Expr::Nil)
+                self.advance()?;
+                b.nil()
             }
             TokenType::Symbol(s) => {
                 let s = s.clone();
-                self.advance();
-                Ok(Expr::Symbol(s))
+                self.advance()?;
+                b.symbol(s)
             }
 
             // Array literal
-            TokenType::LeftBracket => self.array_literal(),
+            TokenType::LeftBracket => self.array_literal(b)?,
 
             // Dictionary literal
-            TokenType::LeftBrace => self.dictionary_literal(),
+            TokenType::LeftBrace => self.dictionary_literal(b)?,
 
-            // Grouped expression
+            // Grouped expression, which keeps the position of its contents
             TokenType::LeftParen => {
-                self.advance();
-                let expr = self.expression()?;
+                self.advance()?;
+                let expr = self.expression(b)?;
                 self.consume_token(&TokenType::RightParen, ")")?;
-                Ok(expr)
+                return Ok(expr);
             }
 
             // Unary operators
             TokenType::Not | TokenType::Bang => {
-                self.advance();
-                let operand = Box::new(self.primary_expression()?);
-                Ok(Expr::Unary {
-                    op: UnaryOp::Not,
-                    operand,
-                })
+                self.advance()?;
+                let operand = self.nested(|parser| parser.primary_expression(b))?;
+                b.unary(UnaryOp::Not, operand)
             }
             TokenType::Minus => {
-                self.advance();
-                let operand = Box::new(self.primary_expression()?);
-                Ok(Expr::Unary {
-                    op: UnaryOp::Negate,
-                    operand,
-                })
+                self.advance()?;
+                let operand = self.nested(|parser| parser.primary_expression(b))?;
+                b.unary(UnaryOp::Negate, operand)
             }
 
             // Identifier (variable access or function call)
             TokenType::Identifier(name) => {
-                let name = name.clone();
-                self.advance();
+                let name = *name;
+                self.advance()?;
 
                 // Check if it's a function call
                 if self.check(&TokenType::LeftParen) {
-                    self.function_call(name)
+                    self.function_call(b, name)?
                 } else {
                     // Variable access with potential dot notation
-                    self.variable_access(name)
+                    self.variable_access(b, name)?
                 }
             }
 
-            _ => Err(ParseError::UnexpectedToken {
-                expected: "expression".to_string(),
-                found: format!("{}", token.token_type),
-                line: token.line,
-                column: token.column,
-            }),
-        }
+            _ => {
+                return Err(ParseError::UnexpectedToken {
+                    expected: "expression".to_string(),
+                    found: format!("{}", token.token_type),
+                    line: token.line,
+                    column: token.column,
+                })
+            }
+        };
+        Ok(b.locate(node, line, column))
     }
 
-    fn array_literal(&mut self) -> Result<Expr, ParseError> {
+    fn array_literal<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // ArrayLiteral ::= "[" ( Expression ( "," Expression )* )? "]"
         self.consume_token(&TokenType::LeftBracket, "[")?;
 
@@ -439,9 +582,9 @@ impl Parser {
 
         if !self.check(&TokenType::RightBracket) {
             loop {
-                elements.push(self.expression()?);
+                elements.push(self.expression(b)?);
 
-                if !self.match_token(&TokenType::Comma) {
+                if !self.match_token(&TokenType::Comma)? {
                     break;
                 }
             }
@@ -449,10 +592,10 @@ impl Parser {
 
         self.consume_token(&TokenType::RightBracket, "]")?;
 
-        Ok(Expr::Array(elements))
+        Ok(b.array(elements))
     }
 
-    fn dictionary_literal(&mut self) -> Result<Expr, ParseError> {
+    fn dictionary_literal<B: Build<'a>>(&mut self, b: &mut B) -> Result<B::Node, ParseError> {
         // DictionaryLiteral ::= "{" ( ( STRING | IDENTIFIER ) ":" Expression ( "," ... )* )? "}"
         self.consume_token(&TokenType::LeftBrace, "{")?;
 
@@ -464,12 +607,12 @@ impl Parser {
                 let key = match &self.peek().token_type {
                     TokenType::String(s) => {
                         let s = s.clone();
-                        self.advance();
+                        self.advance()?;
                         s
                     }
                     TokenType::Identifier(s) => {
-                        let s = s.clone();
-                        self.advance();
+                        let s = Cow::Borrowed(*s);
+                        self.advance()?;
                         s
                     }
                     _ => {
@@ -484,11 +627,11 @@ impl Parser {
 
                 self.consume_token(&TokenType::Colon, ":")?;
 
-                let value = self.expression()?;
+                let value = self.expression(b)?;
 
                 pairs.push((key, value));
 
-                if !self.match_token(&TokenType::Comma) {
+                if !self.match_token(&TokenType::Comma)? {
                     break;
                 }
             }
@@ -496,10 +639,14 @@ impl Parser {
 
         self.consume_token(&TokenType::RightBrace, "}")?;
 
-        Ok(Expr::Dictionary(pairs))
+        Ok(b.dictionary(pairs))
     }
 
-    fn function_call(&mut self, name: String) -> Result<Expr, ParseError> {
+    fn function_call<B: Build<'a>>(
+        &mut self,
+        b: &mut B,
+        name: &'a str,
+    ) -> Result<B::Node, ParseError> {
         // Already consumed the identifier, now parse arguments
         self.consume_token(&TokenType::LeftParen, "(")?;
 
@@ -507,9 +654,9 @@ impl Parser {
 
         if !self.check(&TokenType::RightParen) {
             loop {
-                args.push(self.expression()?);
+                args.push(self.expression(b)?);
 
-                if !self.match_token(&TokenType::Comma) {
+                if !self.match_token(&TokenType::Comma)? {
                     break;
                 }
             }
@@ -517,40 +664,43 @@ impl Parser {
 
         self.consume_token(&TokenType::RightParen, ")")?;
 
-        Ok(Expr::FunctionCall { name, args })
+        Ok(b.call(name, args))
     }
 
-    fn variable_access(&mut self, first: String) -> Result<Expr, ParseError> {
+    fn variable_access<B: Build<'a>>(
+        &mut self,
+        b: &mut B,
+        first: &'a str,
+    ) -> Result<B::Node, ParseError> {
         // VariableAccess ::= IDENTIFIER ( "." IDENTIFIER )*
         let mut parts = vec![first];
 
-        while self.match_token(&TokenType::Dot) {
+        while self.match_token(&TokenType::Dot)? {
             let ident = self.consume_identifier()?;
             parts.push(ident);
         }
 
-        Ok(Expr::Variable(parts))
+        Ok(b.variable(parts))
     }
 
     // Generic binary operator parser
-    fn binary_op(
+    fn binary_op<B: Build<'a>>(
         &mut self,
-        sub_expr: fn(&mut Self) -> Result<Expr, ParseError>,
-        operators: &[(TokenType, BinaryOp)],
-    ) -> Result<Expr, ParseError> {
-        let mut left = sub_expr(self)?;
+        b: &mut B,
+        sub_expr: fn(&mut Self, &mut B) -> Result<B::Node, ParseError>,
+        operators: &[(TokenType<'static>, BinaryOp)],
+    ) -> Result<B::Node, ParseError> {
+        let mut left = sub_expr(self, b)?;
 
         loop {
             let mut matched = false;
+            let (line, column) = self.position();
 
             for (token_type, op) in operators {
-                if self.match_token_ref(token_type) {
-                    let right = sub_expr(self)?;
-                    left = Expr::Binary {
-                        op: *op,
-                        left: Box::new(left),
-                        right: Box::new(right),
-                    };
+                if self.match_token(token_type)? {
+                    let right = sub_expr(self, b)?;
+                    let node = b.binary(*op, left, right);
+                    left = b.locate(node, line, column);
                     matched = true;
                     break;
                 }
@@ -566,54 +716,53 @@ impl Parser {
 
     // Token stream helpers
 
-    fn peek(&self) -> &Token {
-        &self.tokens[self.current]
+    fn peek(&self) -> &Token<'a> {
+        &self.current
+    }
+
+    /// Line and column of the current token
+    fn position(&self) -> (usize, usize) {
+        (self.current.line, self.current.column)
     }
 
-    fn current_token(&self) -> &Token {
-        &self.tokens[self.current]
+    fn current_token(&self) -> &Token<'a> {
+        &self.current
     }
 
-    fn advance(&mut self) -> &Token {
+    fn advance(&mut self) -> Result<(), ParseError> {
         if !self.is_at_end() {
-            self.current += 1;
+            self.current = self.tokens.next_token()?;
         }
-        &self.tokens[self.current - 1]
+        Ok(())
     }
 
     fn is_at_end(&self) -> bool {
         matches!(self.peek().token_type, TokenType::Eof)
     }
 
-    fn check(&self, token_type: &TokenType) -> bool {
+    fn check(&self, token_type: &TokenType<'_>) -> bool {
         if self.is_at_end() {
             return false;
         }
         std::mem::discriminant(&self.peek().token_type) == std::mem::discriminant(token_type)
     }
 
-    fn match_token(&mut self, token_type: &TokenType) -> bool {
-        if self.check(token_type) {
-            self.advance();
-            true
-        } else {
-            false
-        }
-    }
-
-    fn match_token_ref(&mut self, token_type: &TokenType) -> bool {
+    fn match_token(&mut self, token_type: &TokenType<'_>) -> Result<bool, ParseError> {
         if self.check(token_type) {
-            self.advance();
-            true
+            self.advance()?;
+            Ok(true)
         } else {
-            false
+            Ok(false)
         }
     }
 
-    fn consume_token(&mut self, token_type: &TokenType, expected: &str) -> Result<(), ParseError> {
+    fn consume_token(
+        &mut self,
+        token_type: &TokenType<'_>,
+        expected: &str,
+    ) -> Result<(), ParseError> {
         if self.check(token_type) {
-            self.advance();
-            Ok(())
+            self.advance()
         } else {
             let token = self.peek();
             Err(ParseError::UnexpectedToken {
@@ -625,11 +774,11 @@ impl Parser {
         }
     }
 
-    fn consume_identifier(&mut self) -> Result<String, ParseError> {
+    fn consume_identifier(&mut self) -> Result<&'a str, ParseError> {
         match &self.peek().token_type {
             TokenType::Identifier(name) => {
-                let name = name.clone();
-                self.advance();
+                let name = *name;
+                self.advance()?;
                 Ok(name)
             }
             _ => {
@@ -647,9 +796,7 @@ impl Parser {
 
 /// Convenience function to parse source code
 pub fn parse(source: &str) -> Result<Expr, Box<dyn std::error::Error>> {
-    let mut lexer = amoskeag_lexer::Lexer::new(source);
-    let tokens = lexer.tokenize()?;
-    let mut parser = Parser::new(tokens);
+    let mut parser = Parser::from_lexer(Lexer::new(source))?;
     Ok(parser.parse()?)
 }
 
@@ -1437,4 +1584,84 @@ mod tests {
             panic!("Expected if expression");
         }
     }
+
+    #[test]
+    fn test_parse_from_lexer_matches_token_vector() {
+        let source =
+            "let x = {'a': [1, 2]} in if x.a | contains(2) then :yes else upcase(\"no\") end";
+        let streamed = Parser::from_lexer(Lexer::new(source))
+            .unwrap()
+            .parse()
+            .unwrap();
+        let tokens = Lexer::new(source).tokenize().unwrap();
+        assert_eq!(streamed, Parser::new(tokens).parse().unwrap());
+    }
+
+    #[test]
+    fn test_parse_from_lexer_reports_lex_errors() {
+        for source in ["1 + @", "@", "x + 1 # ok\n 'unterminated"] {
+            let result = Parser::from_lexer(Lexer::new(source)).and_then(|mut p| p.parse());
+            assert!(
+                matches!(result, Err(ParseError::LexError(_))),
+                "{}: {:?}",
+                source,
+                result
+            );
+        }
+    }
+
+    fn parse_nested(source: &str) -> Result<Expr, ParseError> {
+        Parser::from_lexer(Lexer::new(source)).and_then(|mut p| p.parse())
+    }
+
+    #[test]
+    fn test_parse_nesting_limit() {
+        // The top-level expression is the first level
+        let inner = MAX_NESTING_DEPTH - 1;
+        let nested = [
+            |n: usize| format!("{}1{}", "(".repeat(n), ")".repeat(n)),
+            |n: usize| format!("{}1{}", "1 + (".repeat(n), ")".repeat(n)),
+            |n: usize| format!("{}1", "- ".repeat(n)),
+            |n: usize| format!("{}1", "not ".repeat(n)),
+            |n: usize| format!("x{}", " | upcase".repeat(n)),
+            |n: usize| format!("{}1{}", "if true then ".repeat(n), " else 2 end".repeat(n)),
+        ];
+        for make in nested {
+            let source = make(inner);
+            assert!(parse_nested(&source).is_ok(), "{}", source);
+            let source = make(inner + 1);
+            assert!(
+                matches!(
+                    parse_nested(&source),
+                    Err(ParseError::NestingTooDeep {
+                        limit: MAX_NESTING_DEPTH,
+                        ..
+                    })
+                ),
+                "{}",
+                source
+            );
+        }
+    }
+
+    #[test]
+    fn test_parse_very_deep_nesting_fails_without_overflowing() {
+        for source in [
+            "(".repeat(100_000),
+            format!("{}1", "1 + (".repeat(100_000)),
+            format!("{}1", "-".repeat(100_000)),
+            format!("[{}1", "[".repeat(100_000)),
+            format!("x{}", " | upcase".repeat(100_000)),
+        ] {
+            assert!(matches!(
+                parse_nested(&source),
+                Err(ParseError::NestingTooDeep { .. })
+            ));
+            let tokens = Lexer::new(&source).tokenize().unwrap();
+            assert!(matches!(
+                Parser::new(tokens).parse_with_positions(),
+                Err(ParseError::NestingTooDeep { .. })
+            ));
+        }
+    }
 }
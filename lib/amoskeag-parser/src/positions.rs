@@ -0,0 +1,212 @@
+//! Source positions
+//!
+//! [`Parser::parse_with_positions`](crate::Parser::parse_with_positions)
+//! returns where each node of the tree starts, for tools that report on
+//! single expressions, such as the profiler. `parse` doesn't keep them.
+
+use crate::builder::{Build, ExprBuilder};
+use crate::{BinaryOp, Expr, UnaryOp};
+use std::borrow::Cow;
+use std::fmt;
+
+/// A 1-based line and column in the source
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq, Hash)]
+pub struct Position {
+    pub line: u32,
+    pub column: u32,
+}
+
+impl fmt::Display for Position {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(f, "{}:{}", self.line, self.column)
+    }
+}
+
+/// The position of a node and the indices of its children, in the order
+/// `Expr` holds them
+#[derive(Debug, Default)]
+struct Located {
+    at: Position,
+    children: Vec<u32>,
+}
+
+/// Builds the `Expr` tree along with the positions of its nodes
+///
+/// Each node is paired with the index of its entry in `located`, which
+/// keeps the nodes the grammar passes around small.
+#[derive(Default)]
+pub(crate) struct PositionBuilder {
+    located: Vec<Located>,
+}
+
+type Node = (Expr, u32);
+
+impl PositionBuilder {
+    fn push(&mut self, expr: Expr, children: Vec<u32>) -> Node {
+        let id = u32::try_from(self.located.len()).expect("AST exceeds u32::MAX nodes");
+        self.located.push(Located {
+            at: Position::default(),
+            children,
+        });
+        (expr, id)
+    }
+
+    fn leaf(&mut self, expr: Expr) -> Node {
+        self.push(expr, Vec::new())
+    }
+
+    /// List the positions of the tree under `root` in pre-order: each node
+    /// before its children, and the children left to right
+    pub(crate) fn finish(mut self, root: u32) -> Vec<Position> {
+        let mut positions = Vec::with_capacity(self.located.len());
+        let mut pending = vec![root];
+        while let Some(id) = pending.pop() {
+            let node = &mut self.located[id as usize];
+            positions.push(node.at);
+            pending.extend(node.children.drain(..).rev());
+        }
+        positions
+    }
+}
+
+fn split(nodes: Vec<Node>) -> (Vec<Expr>, Vec<u32>) {
+    nodes.into_iter().unzip()
+}
+
+impl<'a> Build<'a> for PositionBuilder {
+    type Node = Node;
+
+    fn number(&mut self, n: f64) -> Node {
+        self.leaf(ExprBuilder.number(n))
+    }
+
+    fn string(&mut self, s: Cow<'a, str>) -> Node {
+        self.leaf(ExprBuilder.string(s))
+    }
+
+    fn boolean(&mut self, b: bool) -> Node {
+        self.leaf(ExprBuilder.boolean(b))
+    }
+
+    fn nil(&mut self) -> Node {
+        self.leaf(ExprBuilder.nil())
+    }
+
+    fn symbol(&mut self, s: Cow<'a, str>) -> Node {
+        self.leaf(ExprBuilder.symbol(s))
+    }
+
+    fn array(&mut self, items: Vec<Node>) -> Node {
+        let (items, children) = split(items);
+        self.push(ExprBuilder.array(items), children)
+    }
+
+    fn dictionary(&mut self, pairs: Vec<(Cow<'a, str>, Node)>) -> Node {
+        let (pairs, children) = pairs
+            .into_iter()
+            .map(|(key, (value, id))| ((key, value), id))
+            .unzip();
+        self.push(ExprBuilder.dictionary(pairs), children)
+    }
+
+    fn variable(&mut self, path: Vec<&'a str>) -> Node {
+        self.leaf(ExprBuilder.variable(path))
+    }
+
+    fn call(&mut self, name: &'a str, args: Vec<Node>) -> Node {
+        let (args, children) = split(args);
+        self.push(ExprBuilder.call(name, args), children)
+    }
+
+    fn let_in(&mut self, name: &'a str, value: Node, body: Node) -> Node {
+        let expr = ExprBuilder.let_in(name, value.0, body.0);
+        self.push(expr, vec![value.1, body.1])
+    }
+
+    fn if_else(&mut self, condition: Node, then_branch: Node, else_branch: Node) -> Node {
+        let expr = ExprBuilder.if_else(condition.0, then_branch.0, else_branch.0);
+        self.push(expr, vec![condition.1, then_branch.1, else_branch.1])
+    }
+
+    fn binary(&mut self, op: BinaryOp, left: Node, right: Node) -> Node {
+        let expr = ExprBuilder.binary(op, left.0, right.0);
+        self.push(expr, vec![left.1, right.1])
+    }
+
+    fn unary(&mut self, op: UnaryOp, operand: Node) -> Node {
+        let expr = ExprBuilder.unary(op, operand.0);
+        self.push(expr, vec![operand.1])
+    }
+
+    fn locate(&mut self, node: Node, line: usize, column: usize) -> Node {
+        self.located[node.1 as usize].at = Position {
+            line: line.try_into().unwrap_or(u32::MAX),
+            column: column.try_into().unwrap_or(u32::MAX),
+        };
+        node
+    }
+
+    fn pipe(&mut self, left: Node, right: Node) -> Option<Node> {
+        // The piped value becomes the first argument of the call `right`
+        // is rewritten into
+        let expr = ExprBuilder.pipe(left.0, right.0)?;
+        self.located[right.1 as usize].children.insert(0, left.1);
+        Some((expr, right.1))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::Parser;
+    use amoskeag_lexer::Lexer;
+
+    fn parse(source: &str) -> (Expr, Vec<String>) {
+        let (expr, positions) = Parser::from_lexer(Lexer::new(source))
+            .unwrap()
+            .parse_with_positions()
+            .unwrap();
+        (expr, positions.iter().map(Position::to_string).collect())
+    }
+
+    #[test]
+    fn test_positions_match_parse() {
+        for source in [
+            "let rate = 0.05 / 12 in loan.amount * rate",
+            "if x > 1 then :high else if x > 0 :mid else :low end",
+            "{'a': [1, 'two', nil, true], b: -x} | keys | sort | join(', ')",
+            "not applicant.flags.fraud and (score >= 700 || vip)",
+            "{ Total Revenue } | round(2)",
+            "[] | first",
+        ] {
+            let expected = Parser::from_lexer(Lexer::new(source))
+                .unwrap()
+                .parse()
+                .unwrap();
+            assert_eq!(parse(source).0, expected, "{}", source);
+        }
+    }
+
+    #[test]
+    fn test_positions_are_in_pre_order() {
+        let (_, positions) = parse("let x = a.b in\n  if x > 1 then x | round(2) else -[x] end");
+        assert_eq!(
+            positions,
+            [
+                "1:1",  // let
+                "1:9",  // a.b
+                "2:3",  // if
+                "2:8",  // x > 1
+                "2:6",  // x
+                "2:10", // 1
+                // A pipe is located at the function it calls
+                "2:21", // round(x, 2)
+                "2:17", // x
+                "2:27", // 2
+                "2:35", // -[x]
+                "2:36", // [x]
+                "2:37", // x
+            ]
+        );
+    }
+}
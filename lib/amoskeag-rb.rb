@@ -30,6 +30,11 @@ module Amoskeag
   #   program = Amoskeag.compile("user.age >= 18", [])
   #   Amoskeag.evaluate(program, { "user" => { "age" => 25 } })  # => true
   #   Amoskeag.evaluate(program, { "user" => { "age" => 15 } })  # => false
+  #
+  # @example Evaluate a batch of records
+  #   program = Amoskeag.compile("score * weight", [])
+  #   program.evaluate_many([{ "score" => 1, "weight" => 2 }, { "score" => 3, "weight" => 4 }])
+  #   # => [2.0, 12.0]
 
   class << self
     # Compile an Amoskeag program for later evaluation
@@ -75,6 +80,24 @@ module Amoskeag
       super(program, data)
     end
 
+    # Evaluate a compiled program with each of a list of data hashes
+    #
+    # The records are evaluated one by one with {evaluate}, on the calling
+    # thread, and the first failure stops the batch.
+    #
+    # @param program [Amoskeag::Program] A program compiled with {compile}
+    # @param records [Array<Hash>] The data contexts, as for {evaluate}
+    # @return [Array<Object>] The result for each record, in order
+    # @raise [Amoskeag::EvalError] If evaluation fails for any record
+    #
+    # @example
+    #   program = Amoskeag.compile("total * tax_rate", [])
+    #   Amoskeag.evaluate_many(program, [{ "total" => 100, "tax_rate" => 0.08 }])
+    #   # => [8.0]
+    def evaluate_many(program, records)
+      records.map { |data| evaluate(program, data) }
+    end
+
     # Compile and evaluate in one step (convenience method)
     #
     # This is convenient for one-off evaluations, but if you need to evaluate
@@ -106,6 +129,38 @@ module Amoskeag
       super(source, data, symbols)
     end
 
+    # Snapshot of the library's built-in metrics
+    #
+    # Latencies of compilation and evaluation, overall, by backend and by
+    # program, calls of each standard library function, and allocation
+    # counts, all in nanoseconds. Counters only grow, so the difference of
+    # two snapshots is what happened between them.
+    #
+    # @return [Hash] The metrics, as decoded from the library's JSON
+    # @raise [NotImplementedError] If the native extension was built
+    #   without the metrics feature
+    #
+    # @example
+    #   Amoskeag.metrics["evaluate"]["p99_ns"]
+    #   # => 1250
+    def metrics
+      raise NotImplementedError, "Amoskeag was built without metrics" unless defined?(super)
+
+      JSON.parse(super)
+    end
+
+    # Snapshot of the library's built-in metrics for Prometheus
+    #
+    # @return [String] The metrics in the Prometheus text exposition format,
+    #   ready to serve from a /metrics endpoint
+    # @raise [NotImplementedError] If the native extension was built
+    #   without the metrics feature
+    def metrics_prometheus
+      raise NotImplementedError, "Amoskeag was built without metrics" unless defined?(super)
+
+      super
+    end
+
     private
 
     # Convert Ruby symbols to strings for FFI
@@ -135,6 +190,20 @@ module Amoskeag
   class Program
     # Programs cannot be instantiated from Ruby
     # Use Amoskeag.compile instead
+
+    # Evaluate this program with data
+    #
+    # @see Amoskeag.evaluate
+    def evaluate(data)
+      Amoskeag.evaluate(self, data)
+    end
+
+    # Evaluate this program with each of a list of data hashes
+    #
+    # @see Amoskeag.evaluate_many
+    def evaluate_many(records)
+      Amoskeag.evaluate_many(self, records)
+    end
   end
 
   # Raised when compilation fails
@@ -3,9 +3,9 @@
 //! Uses constraint solving and symbolic execution to find input parameters
 //! that could cause errors.
 
-use crate::constraint_solver::{Constraint, ConstraintSolver};
+use crate::constraint_solver::{Constraint, Domains};
 use crate::range_analysis::ValueRange;
-use amoskeag_parser::{BinaryOp, Expr};
+use amoskeag_parser::{BinaryOp, Expr, UnaryOp};
 use serde::{Deserialize, Serialize};
 use std::collections::HashMap;
 
@@ -36,6 +36,11 @@ pub struct VulnerableInput {
 }
 
 /// Algebraic analyzer using symbolic execution
+///
+/// Each path through the expression carries the intervals its conditions
+/// allow for each variable, narrowed once where the path enters a branch
+/// and shared by every check beneath it. A branch its path can't take is
+/// not analyzed, since nothing in it can fail.
 pub struct AlgebraicAnalyzer {
     vulnerable_inputs: Vec<VulnerableInput>,
 }
@@ -56,25 +61,25 @@ impl AlgebraicAnalyzer {
         _ranges: &HashMap<String, ValueRange>,
     ) -> Vec<VulnerableInput> {
         self.vulnerable_inputs.clear();
-        self.analyze_expr(expr, &mut Vec::new());
+        self.analyze_expr(expr, &Domains::default());
         self.vulnerable_inputs.clone()
     }
 
-    fn analyze_expr(&mut self, expr: &Expr, path_conditions: &mut Vec<Constraint>) {
+    fn analyze_expr(&mut self, expr: &Expr, path: &Domains) {
         match expr {
             Expr::Binary { op, left, right } => {
                 // Recursively analyze subexpressions
-                self.analyze_expr(left, path_conditions);
-                self.analyze_expr(right, path_conditions);
+                self.analyze_expr(left, path);
+                self.analyze_expr(right, path);
 
                 // Check for division by zero
                 if matches!(op, BinaryOp::Divide | BinaryOp::Modulo) {
-                    self.check_division_by_zero(right, path_conditions);
+                    self.check_division_by_zero(right, path);
                 }
 
                 // Check for overflow
                 if matches!(op, BinaryOp::Multiply | BinaryOp::Add) {
-                    self.check_overflow(left, right, *op, path_conditions);
+                    self.check_overflow(left, right, *op, path);
                 }
             }
 
@@ -84,61 +89,59 @@ impl AlgebraicAnalyzer {
                 else_branch,
             } => {
                 // Analyze condition
-                self.analyze_expr(condition, path_conditions);
-
-                // Analyze then branch with condition = true
-                if let Some(true_constraint) = self.extract_constraint(condition, true) {
-                    path_conditions.push(true_constraint);
-                    self.analyze_expr(then_branch, path_conditions);
-                    path_conditions.pop();
-                } else {
-                    self.analyze_expr(then_branch, path_conditions);
-                }
-
-                // Analyze else branch with condition = false
-                if let Some(false_constraint) = self.extract_constraint(condition, false) {
-                    path_conditions.push(false_constraint);
-                    self.analyze_expr(else_branch, path_conditions);
-                    path_conditions.pop();
-                } else {
-                    self.analyze_expr(else_branch, path_conditions);
+                self.analyze_expr(condition, path);
+
+                // Analyze each branch with the condition it is taken on
+                for (branch, taken) in [(then_branch, true), (else_branch, false)] {
+                    match self.extract_constraint(condition, taken) {
+                        Some(constraint) => {
+                            let mut narrowed = path.clone();
+                            if narrowed.narrow(&constraint) {
+                                self.analyze_expr(branch, &narrowed);
+                            }
+                        }
+                        None => self.analyze_expr(branch, path),
+                    }
                 }
             }
 
-            Expr::Let { value, body, .. } => {
-                self.analyze_expr(value, path_conditions);
-                self.analyze_expr(body, path_conditions);
+            Expr::Let { name, value, body } => {
+                self.analyze_expr(value, path);
+                // The body's `name` is the binding, not the input
+                let mut body_path = path.clone();
+                body_path.forget(name);
+                self.analyze_expr(body, &body_path);
             }
 
             Expr::Unary { operand, .. } => {
-                self.analyze_expr(operand, path_conditions);
+                self.analyze_expr(operand, path);
             }
 
             Expr::FunctionCall { name, args } => {
                 // Analyze arguments
                 for arg in args {
-                    self.analyze_expr(arg, path_conditions);
+                    self.analyze_expr(arg, path);
                 }
 
                 // Check for specific function vulnerabilities
-                self.check_function_vulnerabilities(name, args, path_conditions);
+                self.check_function_vulnerabilities(name, args, path);
             }
 
             Expr::Array(elements) => {
                 for elem in elements {
-                    self.analyze_expr(elem, path_conditions);
+                    self.analyze_expr(elem, path);
                 }
             }
 
             Expr::Dictionary(pairs) => {
                 for (_, value) in pairs {
-                    self.analyze_expr(value, path_conditions);
+                    self.analyze_expr(value, path);
                 }
             }
 
             Expr::Pipe { left, right } => {
-                self.analyze_expr(left, path_conditions);
-                self.analyze_expr(right, path_conditions);
+                self.analyze_expr(left, path);
+                self.analyze_expr(right, path);
             }
 
             _ => {
@@ -147,34 +150,22 @@ impl AlgebraicAnalyzer {
         }
     }
 
-    fn check_division_by_zero(&mut self, divisor: &Expr, path_conditions: &[Constraint]) {
+    fn check_division_by_zero(&mut self, divisor: &Expr, path: &Domains) {
         // Check if divisor could be zero
         if let Some(var_name) = self.extract_variable_name(divisor) {
-            // Create a constraint: divisor == 0
-            let mut solver = ConstraintSolver::new();
-
-            // Add path conditions
-            for condition in path_conditions {
-                solver.add_constraint(condition.clone());
-            }
-
-            // Add the constraint that divisor == 0
-            solver.add_constraint(Constraint::Equal {
+            // Try to solve the path with divisor == 0
+            let zero = Constraint::Equal {
                 variable: var_name.clone(),
                 value: 0.0,
-            });
-
-            // Try to solve
-            if let Some(solution) = solver.solve() {
-                if solution.satisfies {
-                    self.vulnerable_inputs.push(VulnerableInput {
-                        error_type: "DivisionByZero".to_string(),
-                        description: format!("Division by zero when {} = 0", var_name),
-                        example_input: solution.values.clone(),
-                        location: format!("division by {}", var_name),
-                        severity: "Critical".to_string(),
-                    });
-                }
+            };
+            if let Some(solution) = path.solve_with(&zero) {
+                self.vulnerable_inputs.push(VulnerableInput {
+                    error_type: "DivisionByZero".to_string(),
+                    description: format!("Division by zero when {} = 0", var_name),
+                    example_input: solution.values,
+                    location: format!("division by {}", var_name),
+                    severity: "Critical".to_string(),
+                });
             }
         } else if let Expr::Number(n) = divisor {
             if *n == 0.0 {
@@ -189,98 +180,126 @@ impl AlgebraicAnalyzer {
         }
     }
 
-    fn check_overflow(
-        &mut self,
-        left: &Expr,
-        right: &Expr,
-        op: BinaryOp,
-        path_conditions: &[Constraint],
-    ) {
-        // Try to find inputs that cause overflow
-        let left_var = self.extract_variable_name(left);
-        let right_var = self.extract_variable_name(right);
-
-        if left_var.is_none() && right_var.is_none() {
-            return; // Both are constants, already checked during evaluation
-        }
-
-        let mut solver = ConstraintSolver::new();
-
-        // Add path conditions
-        for condition in path_conditions {
-            solver.add_constraint(condition.clone());
-        }
-
-        // Add constraints that could cause overflow
-        if let Some(var) = left_var.as_ref().or(right_var.as_ref()) {
-            // Try very large values
-            solver.add_constraint(Constraint::GreaterThan {
-                variable: var.clone(),
-                value: 1e100,
-            });
-
-            if let Some(solution) = solver.solve() {
-                if solution.satisfies {
-                    self.vulnerable_inputs.push(VulnerableInput {
-                        error_type: "Overflow".to_string(),
-                        description: format!("Potential overflow in {} operation", op),
-                        example_input: solution.values.clone(),
-                        location: format!("{} operation", op),
-                        severity: "Warning".to_string(),
-                    });
-                }
+    /// Check whether a variable combined with a constant can overflow to
+    /// infinity on this path
+    fn check_overflow(&mut self, left: &Expr, right: &Expr, op: BinaryOp, path: &Domains) {
+        let (var, constant) = match (
+            self.extract_variable_name(left),
+            self.extract_number_value(left),
+            self.extract_variable_name(right),
+            self.extract_number_value(right),
+        ) {
+            (Some(var), _, _, Some(constant)) | (_, Some(constant), Some(var), _) => {
+                (var, constant)
+            }
+            // Constants are already checked during evaluation, and nothing
+            // is known of other operands
+            _ => return,
+        };
+
+        // The smallest input that overflows, on the side it overflows
+        let threshold = match op {
+            BinaryOp::Add => f64::MAX - constant.abs(),
+            BinaryOp::Multiply if constant.abs() > 1.0 => f64::MAX / constant.abs(),
+            _ => return,
+        };
+        let large = if op == BinaryOp::Add && constant < 0.0 {
+            Constraint::LessThan {
+                variable: var,
+                value: -threshold,
             }
+        } else {
+            Constraint::GreaterThan {
+                variable: var,
+                value: threshold,
+            }
+        };
+
+        if let Some(solution) = path.solve_with(&large) {
+            self.vulnerable_inputs.push(VulnerableInput {
+                error_type: "Overflow".to_string(),
+                description: format!("Potential overflow in {} operation", op),
+                example_input: solution.values,
+                location: format!("{} operation", op),
+                severity: "Warning".to_string(),
+            });
         }
     }
 
-    fn check_function_vulnerabilities(
-        &mut self,
-        name: &str,
-        args: &[Expr],
-        path_conditions: &[Constraint],
-    ) {
+    fn check_function_vulnerabilities(&mut self, name: &str, args: &[Expr], path: &Domains) {
         match name {
             "at" => {
                 // Array access - check for out of bounds
                 if args.len() >= 2 {
                     if let Some(index_var) = self.extract_variable_name(&args[1]) {
                         // Try negative index
-                        let mut solver = ConstraintSolver::new();
-                        for condition in path_conditions {
-                            solver.add_constraint(condition.clone());
-                        }
-                        solver.add_constraint(Constraint::LessThan {
+                        let negative = Constraint::LessThan {
                             variable: index_var.clone(),
                             value: 0.0,
-                        });
-
-                        if let Some(solution) = solver.solve() {
-                            if solution.satisfies {
-                                self.vulnerable_inputs.push(VulnerableInput {
-                                    error_type: "ArrayOutOfBounds".to_string(),
-                                    description: format!(
-                                        "Negative array index when {} < 0",
-                                        index_var
-                                    ),
-                                    example_input: solution.values.clone(),
-                                    location: format!("at() with index {}", index_var),
-                                    severity: "Warning".to_string(),
-                                });
-                            }
+                        };
+                        if let Some(solution) = path.solve_with(&negative) {
+                            self.vulnerable_inputs.push(VulnerableInput {
+                                error_type: "ArrayOutOfBounds".to_string(),
+                                description: format!("Negative array index when {} < 0", index_var),
+                                example_input: solution.values,
+                                location: format!("at() with index {}", index_var),
+                                severity: "Warning".to_string(),
+                            });
                         }
                     }
                 }
             }
             // Check for division by zero in function form
             "divided_by" if args.len() >= 2 => {
-                self.check_division_by_zero(&args[1], path_conditions);
+                self.check_division_by_zero(&args[1], path);
             }
             _ => {}
         }
     }
 
+    /// The constraint under which `expr` is `value`, if it is a comparison
+    /// of a variable with a number or a combination of those
     fn extract_constraint(&self, expr: &Expr, value: bool) -> Option<Constraint> {
         match expr {
+            Expr::Unary {
+                op: UnaryOp::Not,
+                operand,
+            } => self.extract_constraint(operand, !value),
+
+            // `a and b` holds when both do, and fails when either fails
+            Expr::Binary {
+                op: op @ (BinaryOp::And | BinaryOp::Or),
+                left,
+                right,
+            } => {
+                let left = self.extract_constraint(left, value)?;
+                let right = self.extract_constraint(right, value)?;
+                if (*op == BinaryOp::And) == value {
+                    Some(Constraint::And(vec![left, right]))
+                } else {
+                    Some(Constraint::Or(vec![left, right]))
+                }
+            }
+
+            // `5 < x` is `x > 5`
+            Expr::Binary { op, left, right } if matches!(**left, Expr::Number(_)) => {
+                let flipped = match op {
+                    BinaryOp::Less => BinaryOp::Greater,
+                    BinaryOp::Greater => BinaryOp::Less,
+                    BinaryOp::LessEqual => BinaryOp::GreaterEqual,
+                    BinaryOp::GreaterEqual => BinaryOp::LessEqual,
+                    op => *op,
+                };
+                self.extract_constraint(
+                    &Expr::Binary {
+                        op: flipped,
+                        left: right.clone(),
+                        right: left.clone(),
+                    },
+                    value,
+                )
+            }
+
             Expr::Binary { op, left, right } => {
                 let left_var = self.extract_variable_name(left)?;
                 let right_val = self.extract_number_value(right)?;
@@ -384,12 +403,74 @@ mod tests {
     #[test]
     fn test_conditional_division_by_zero() {
         let mut analyzer = AlgebraicAnalyzer::new();
-        let expr = parse("if x > 0 10 / x else 0 end").unwrap();
-        let _vulnerabilities = analyzer.analyze(&expr, &[], &HashMap::new());
+        // The condition rules out x = 0 where x divides
+        for source in [
+            "if x > 0 10 / x else 0 end",
+            "if x == 0 0 else 10 / x end",
+            "if 0 < x and x < 10 10 / x else 0 end",
+            "if not (x >= 0) 10 / x else 1 end",
+        ] {
+            let expr = parse(source).unwrap();
+            let vulnerabilities = analyzer.analyze(&expr, &[], &HashMap::new());
+            assert!(
+                !vulnerabilities
+                    .iter()
+                    .any(|v| v.error_type == "DivisionByZero"),
+                "{}",
+                source
+            );
+        }
+
+        // But not out of the other branch
+        let expr = parse("if x > 0 1 else 10 / x end").unwrap();
+        let vulnerabilities = analyzer.analyze(&expr, &[], &HashMap::new());
+        let found = vulnerabilities
+            .iter()
+            .find(|v| v.error_type == "DivisionByZero")
+            .unwrap();
+        assert_eq!(found.example_input["x"], 0.0);
+    }
+
+    #[test]
+    fn test_overflow_needs_a_large_enough_constant() {
+        let mut analyzer = AlgebraicAnalyzer::new();
+        // The language has no exponent notation
+        let huge = format!("1{}", "0".repeat(300));
+        for source in [
+            "x + 10".to_string(),
+            "x * 0.5".to_string(),
+            format!("if x < 100 x * {} else 0 end", huge),
+        ] {
+            let expr = parse(&source).unwrap();
+            assert!(
+                analyzer.analyze(&expr, &[], &HashMap::new()).is_empty(),
+                "{}",
+                source
+            );
+        }
+
+        let expr = parse(&format!("x * {}", huge)).unwrap();
+        let vulnerabilities = analyzer.analyze(&expr, &[], &HashMap::new());
+        assert_eq!(vulnerabilities.len(), 1);
+        let x = vulnerabilities[0].example_input["x"];
+        assert!((x * 1e300).is_infinite(), "{}", x);
+    }
+
+    #[test]
+    fn test_branches_the_path_cannot_take() {
+        let mut analyzer = AlgebraicAnalyzer::new();
+        let expr = parse("if x > 5 (if x < 3 10 / y else 0 end) else 0 end").unwrap();
+        assert!(analyzer.analyze(&expr, &[], &HashMap::new()).is_empty());
+    }
 
-        // Should still find the vulnerability in the then branch
-        // (even though there's a condition, the condition doesn't prevent x from being 0 in practice)
-        // May or may not find depending on path sensitivity
+    #[test]
+    fn test_let_rebinding_forgets_the_path() {
+        let mut analyzer = AlgebraicAnalyzer::new();
+        let expr = parse("if x > 0 (let x = y in 10 / x) else 0 end").unwrap();
+        let vulnerabilities = analyzer.analyze(&expr, &[], &HashMap::new());
+        assert!(vulnerabilities
+            .iter()
+            .any(|v| v.error_type == "DivisionByZero"));
     }
 
     #[test]
@@ -153,7 +153,212 @@ impl Default for Solution {
     }
 }
 
-/// Constraint solver using simple heuristics
+/// Most alternatives of `Or` constraints `solve` tries before giving up
+const MAX_BRANCHES: usize = 4096;
+
+/// The values a variable can take: an interval, less a set of points
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) struct Interval {
+    min: f64,
+    min_inclusive: bool,
+    max: f64,
+    max_inclusive: bool,
+    /// Points excluded by `NotEqual` constraints
+    excluded: Vec<f64>,
+}
+
+impl Interval {
+    /// Every number
+    fn full() -> Self {
+        Self {
+            min: f64::NEG_INFINITY,
+            min_inclusive: false,
+            max: f64::INFINITY,
+            max_inclusive: false,
+            excluded: Vec::new(),
+        }
+    }
+
+    fn contains(&self, value: f64) -> bool {
+        let above = value > self.min || (self.min_inclusive && value == self.min);
+        let below = value < self.max || (self.max_inclusive && value == self.max);
+        above && below && !self.excluded.contains(&value)
+    }
+
+    fn is_empty(&self) -> bool {
+        self.min > self.max
+            || (self.min == self.max
+                && !(self.min_inclusive && self.max_inclusive && self.contains(self.min)))
+    }
+
+    /// Keep the values above `value`, and `value` itself if `inclusive`
+    fn raise(&mut self, value: f64, inclusive: bool) {
+        if value > self.min || (value == self.min && !inclusive) {
+            self.min = value;
+            self.min_inclusive = inclusive;
+        }
+    }
+
+    /// Keep the values below `value`, and `value` itself if `inclusive`
+    fn lower(&mut self, value: f64, inclusive: bool) {
+        if value < self.max || (value == self.max && !inclusive) {
+            self.max = value;
+            self.max_inclusive = inclusive;
+        }
+    }
+
+    /// Narrow to the values satisfying a constraint on this variable alone,
+    /// returning false if none are left
+    fn narrow(&mut self, constraint: &Constraint) -> bool {
+        match constraint {
+            Constraint::Equal { value, .. } => {
+                self.raise(*value, true);
+                self.lower(*value, true);
+            }
+            Constraint::NotEqual { value, .. } => self.excluded.push(*value),
+            Constraint::LessThan { value, .. } => self.lower(*value, false),
+            Constraint::LessEqual { value, .. } => self.lower(*value, true),
+            Constraint::GreaterThan { value, .. } => self.raise(*value, false),
+            Constraint::GreaterEqual { value, .. } => self.raise(*value, true),
+            Constraint::InRange { min, max, .. } => {
+                self.raise(*min, true);
+                self.lower(*max, true);
+            }
+            _ => {}
+        }
+        !self.is_empty()
+    }
+
+    /// A value of the interval, preferring zero, then its bounds, then
+    /// round values just inside them
+    fn witness(&self) -> Option<f64> {
+        if self.is_empty() {
+            return None;
+        }
+        let (min, max) = (self.min, self.max);
+        let mut candidates = vec![0.0, min, max];
+        let n = self.excluded.len() + 1;
+        match (min.is_finite(), max.is_finite()) {
+            (true, true) => {
+                let step = (max - min) / (n + 1) as f64;
+                candidates.extend((1..=n).map(|k| min + step * k as f64));
+            }
+            (true, false) => {
+                let step = min.abs().max(1.0);
+                candidates.extend((1..=n).map(|k| min + step * k as f64));
+            }
+            (false, true) => {
+                let step = max.abs().max(1.0);
+                candidates.extend((1..=n).map(|k| max - step * k as f64));
+            }
+            (false, false) => candidates.extend((1..=n).map(|k| k as f64)),
+        }
+        candidates
+            .into_iter()
+            .find(|&v| v.is_finite() && self.contains(v))
+    }
+}
+
+/// The interval of every constrained variable
+///
+/// The algebraic analyzer keeps one per path, narrowed by each condition
+/// the path takes, so a check along it only adds its own constraint
+/// instead of solving every path condition again.
+#[derive(Debug, Clone, Default)]
+pub(crate) struct Domains {
+    intervals: HashMap<String, Interval>,
+}
+
+impl Domains {
+    /// Narrow the domains by a constraint, returning false if it can't hold
+    ///
+    /// A disjunction narrows to its one satisfiable alternative, if only one
+    /// is; otherwise the domains are left as they are, which may admit
+    /// values the disjunction doesn't.
+    pub(crate) fn narrow(&mut self, constraint: &Constraint) -> bool {
+        match constraint {
+            Constraint::And(constraints) => constraints.iter().all(|c| self.narrow(c)),
+            Constraint::Or(constraints) => {
+                let mut feasible = constraints.iter().filter_map(|c| {
+                    let mut domains = self.clone();
+                    domains.narrow(c).then_some(domains)
+                });
+                match (feasible.next(), feasible.next()) {
+                    (None, _) => false,
+                    (Some(domains), None) => {
+                        *self = domains;
+                        true
+                    }
+                    _ => true,
+                }
+            }
+            Constraint::IsString { .. }
+            | Constraint::IsNumber { .. }
+            | Constraint::IsBoolean { .. }
+            | Constraint::IsNil { .. } => true,
+            atom => self
+                .intervals
+                .entry(atom_variable(atom).to_string())
+                .or_insert_with(Interval::full)
+                .narrow(atom),
+        }
+    }
+
+    /// Stop constraining `variable`, as when a `let` rebinds its name
+    pub(crate) fn forget(&mut self, variable: &str) {
+        self.intervals.remove(variable);
+    }
+
+    /// A solution of the domains and a further constraint on one variable,
+    /// if they are satisfiable together
+    pub(crate) fn solve_with(&self, constraint: &Constraint) -> Option<Solution> {
+        let variable = atom_variable(constraint);
+        let mut interval = self
+            .intervals
+            .get(variable)
+            .cloned()
+            .unwrap_or_else(Interval::full);
+        if !interval.narrow(constraint) {
+            return None;
+        }
+
+        let mut solution = Solution::new();
+        for (name, other) in &self.intervals {
+            if name != variable {
+                solution.assign(name.clone(), other.witness()?);
+            }
+        }
+        solution.assign(variable.to_string(), interval.witness()?);
+        constraint.is_satisfied(&solution).then_some(solution)
+    }
+}
+
+/// The variable of a constraint that isn't a conjunction or disjunction
+fn atom_variable(constraint: &Constraint) -> &str {
+    match constraint {
+        Constraint::Equal { variable, .. }
+        | Constraint::NotEqual { variable, .. }
+        | Constraint::LessThan { variable, .. }
+        | Constraint::GreaterThan { variable, .. }
+        | Constraint::LessEqual { variable, .. }
+        | Constraint::GreaterEqual { variable, .. }
+        | Constraint::InRange { variable, .. }
+        | Constraint::IsString { variable }
+        | Constraint::IsNumber { variable }
+        | Constraint::IsBoolean { variable }
+        | Constraint::IsNil { variable } => variable,
+        Constraint::And(_) | Constraint::Or(_) => {
+            unreachable!("conjunctions and disjunctions have no single variable")
+        }
+    }
+}
+
+/// Constraint solver over intervals
+///
+/// Every numeric constraint narrows the interval of its variable, so a
+/// conjunction is solved by intersecting intervals, and contradictions are
+/// found without trying values. Disjunctions are solved by trying each
+/// alternative in turn.
 pub struct ConstraintSolver {
     constraints: Vec<Constraint>,
 }
@@ -172,37 +377,60 @@ impl ConstraintSolver {
     }
 
     /// Solve the constraints and find a satisfying solution
+    ///
+    /// Every variable the constraints mention is assigned, preferring zero
+    /// for those only constrained by type. Returns `None` if the constraints
+    /// contradict each other, or if they have more disjunctions than can be
+    /// tried.
     pub fn solve(&self) -> Option<Solution> {
-        if self.constraints.is_empty() {
-            return Some(Solution::new());
-        }
+        let pending: Vec<&Constraint> = self.constraints.iter().collect();
+        let mut branches = MAX_BRANCHES;
+        let domains = Self::search(Domains::default(), pending, &mut branches)?;
 
-        // Extract all variables
-        let variables = self.extract_variables();
-
-        // Try to find a solution using simple heuristics
         let mut solution = Solution::new();
-
-        for variable in &variables {
-            // Try to find a value that satisfies all constraints for this variable
-            if let Some(value) = self.find_value_for_variable(variable, &solution) {
-                solution.assign(variable.clone(), value);
-            } else {
-                // If we can't find a value, try 0
-                solution.assign(variable.clone(), 0.0);
-            }
+        for variable in self.extract_variables() {
+            let value = match domains.intervals.get(&variable) {
+                Some(interval) => interval.witness()?,
+                None => 0.0,
+            };
+            solution.assign(variable, value);
         }
+        solution.satisfies = self.constraints.iter().all(|c| c.is_satisfied(&solution));
+        solution.satisfies.then_some(solution)
+    }
 
-        // Check if the solution satisfies all constraints
-        let satisfies = self.constraints.iter().all(|c| c.is_satisfied(&solution));
-        solution.satisfies = satisfies;
-
-        if satisfies {
-            Some(solution)
-        } else {
-            // Try backtracking with different values
-            self.solve_with_backtracking(&variables)
+    /// Narrow `domains` by the `pending` constraints, trying each
+    /// alternative of a disjunction until one leads to satisfiable domains
+    fn search(
+        mut domains: Domains,
+        mut pending: Vec<&Constraint>,
+        branches: &mut usize,
+    ) -> Option<Domains> {
+        while let Some(constraint) = pending.pop() {
+            match constraint {
+                Constraint::And(constraints) => pending.extend(constraints),
+                Constraint::Or(constraints) => {
+                    for alternative in constraints {
+                        if *branches == 0 {
+                            return None;
+                        }
+                        *branches -= 1;
+                        let mut rest = pending.clone();
+                        rest.push(alternative);
+                        if let Some(domains) = Self::search(domains.clone(), rest, branches) {
+                            return Some(domains);
+                        }
+                    }
+                    return None;
+                }
+                atom => {
+                    if !domains.narrow(atom) {
+                        return None;
+                    }
+                }
+            }
         }
+        Some(domains)
     }
 
     fn extract_variables(&self) -> Vec<String> {
@@ -241,58 +469,6 @@ impl ConstraintSolver {
         }
     }
 
-    fn find_value_for_variable(&self, variable: &str, _solution: &Solution) -> Option<f64> {
-        // Look for direct constraints on this variable
-        for constraint in &self.constraints {
-            match constraint {
-                Constraint::Equal { variable: v, value } if v == variable => {
-                    return Some(*value);
-                }
-                Constraint::LessThan { variable: v, value } if v == variable => {
-                    return Some(value - 1.0);
-                }
-                Constraint::GreaterThan { variable: v, value } if v == variable => {
-                    return Some(value + 1.0);
-                }
-                Constraint::LessEqual { variable: v, value } if v == variable => {
-                    return Some(*value);
-                }
-                Constraint::GreaterEqual { variable: v, value } if v == variable => {
-                    return Some(*value);
-                }
-                Constraint::InRange {
-                    variable: v,
-                    min,
-                    max,
-                } if v == variable => {
-                    return Some((min + max) / 2.0);
-                }
-                _ => {}
-            }
-        }
-        None
-    }
-
-    fn solve_with_backtracking(&self, variables: &[String]) -> Option<Solution> {
-        // Try a few common values for each variable
-        let test_values = [-1000.0, -100.0, -10.0, -1.0, 0.0, 1.0, 10.0, 100.0, 1000.0];
-
-        // Try different combinations (limited search space)
-        for &test_value in test_values.iter().take(3) {
-            let mut solution = Solution::new();
-            for variable in variables {
-                solution.assign(variable.clone(), test_value);
-            }
-
-            if self.constraints.iter().all(|c| c.is_satisfied(&solution)) {
-                solution.satisfies = true;
-                return Some(solution);
-            }
-        }
-
-        None
-    }
-
     /// Clear all constraints
     pub fn clear(&mut self) {
         self.constraints.clear();
@@ -360,4 +536,108 @@ mod tests {
 
         assert!(matches!(negated, Constraint::NotEqual { .. }));
     }
+
+    fn var(constraint: fn(String, f64) -> Constraint, value: f64) -> Constraint {
+        constraint("x".to_string(), value)
+    }
+
+    fn less(variable: String, value: f64) -> Constraint {
+        Constraint::LessThan { variable, value }
+    }
+
+    fn greater(variable: String, value: f64) -> Constraint {
+        Constraint::GreaterThan { variable, value }
+    }
+
+    fn equal(variable: String, value: f64) -> Constraint {
+        Constraint::Equal { variable, value }
+    }
+
+    fn not_equal(variable: String, value: f64) -> Constraint {
+        Constraint::NotEqual { variable, value }
+    }
+
+    fn solve(constraints: Vec<Constraint>) -> Option<f64> {
+        let mut solver = ConstraintSolver::new();
+        for constraint in constraints {
+            solver.add_constraint(constraint);
+        }
+        solver.solve().map(|solution| solution.values["x"])
+    }
+
+    #[test]
+    fn test_solve_contradiction() {
+        assert_eq!(solve(vec![var(greater, 5.0), var(less, 3.0)]), None);
+        assert_eq!(solve(vec![var(greater, 5.0), var(less, 5.0)]), None);
+        assert_eq!(
+            solve(vec![
+                Constraint::InRange {
+                    variable: "x".to_string(),
+                    min: 2.0,
+                    max: 2.0
+                },
+                var(not_equal, 2.0),
+            ]),
+            None
+        );
+    }
+
+    #[test]
+    fn test_solve_avoids_excluded_points() {
+        let x = solve(vec![
+            var(greater, 0.0),
+            var(less, 4.0),
+            var(not_equal, 1.0),
+            var(not_equal, 2.0),
+            var(not_equal, 3.0),
+        ])
+        .unwrap();
+        assert!(
+            x > 0.0 && x < 4.0 && x != 1.0 && x != 2.0 && x != 3.0,
+            "{}",
+            x
+        );
+    }
+
+    #[test]
+    fn test_solve_large_bounds() {
+        assert!(solve(vec![var(greater, 1e100)]).unwrap() > 1e100);
+        assert!(solve(vec![var(less, -1e100)]).unwrap() < -1e100);
+    }
+
+    #[test]
+    fn test_solve_disjunction() {
+        // Only the second alternative fits x > 5
+        let x = solve(vec![
+            Constraint::Or(vec![var(less, 0.0), var(greater, 10.0)]),
+            var(greater, 5.0),
+        ])
+        .unwrap();
+        assert!(x > 10.0, "{}", x);
+
+        assert_eq!(
+            solve(vec![
+                Constraint::Or(vec![var(less, 0.0), var(greater, 10.0)]),
+                var(greater, 5.0),
+                var(less, 8.0),
+            ]),
+            None
+        );
+    }
+
+    #[test]
+    fn test_domains_solve_with() {
+        let mut domains = Domains::default();
+        assert!(domains.narrow(&var(greater, 0.0)));
+        assert!(domains.solve_with(&var(equal, 0.0)).is_none());
+
+        let mut domains = Domains::default();
+        assert!(domains.narrow(&var(less, 10.0)));
+        let solution = domains.solve_with(&var(equal, 0.0)).unwrap();
+        assert_eq!(solution.values["x"], 0.0);
+
+        // A rebinding forgets what the path knew about the variable
+        domains.forget("x");
+        assert!(domains.solve_with(&var(greater, 1e100)).is_some());
+    }
 }
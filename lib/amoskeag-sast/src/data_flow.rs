@@ -2,7 +2,7 @@
 //!
 //! Analyzes how data flows through an expression.
 
-use amoskeag_parser::Expr;
+use amoskeag_parser::{BinaryOp, Expr};
 use serde::{Deserialize, Serialize};
 use std::collections::{HashMap, HashSet};
 
@@ -98,8 +98,23 @@ impl DataFlowGraph {
         self.uses.entry(variable).or_default().push(node_id);
     }
 
+    /// The successors of every node, by node id
+    fn successors(&self) -> Vec<Vec<usize>> {
+        let mut successors = vec![Vec::new(); self.nodes.len()];
+        for &(from, to) in &self.edges {
+            successors[from].push(to);
+        }
+        successors
+    }
+
     /// Compute liveness analysis
+    ///
+    /// Nodes are visited backwards against lists of their successors, so a
+    /// pass takes time in proportion to the size of the graph rather than
+    /// its nodes times its edges.
     pub fn compute_liveness(&mut self) {
+        let successors = self.successors();
+
         // Backward dataflow analysis
         let mut changed = true;
         while changed {
@@ -109,17 +124,14 @@ impl DataFlowGraph {
                 let mut new_live_out = HashSet::new();
 
                 // live_out[n] = union of live_in[s] for all successors s
-                for &(from, to) in &self.edges {
-                    if from == i {
-                        // live_in[s] = use[s] union (live_out[s] - def[s])
-                        let successor = &self.nodes[to];
-                        let mut live_in = successor.uses.clone();
-                        for var in &successor.live_out {
-                            if !successor.defines.contains(var) {
-                                live_in.insert(var.clone());
-                            }
+                for &to in &successors[i] {
+                    // live_in[s] = use[s] union (live_out[s] - def[s])
+                    let successor = &self.nodes[to];
+                    new_live_out.extend(successor.uses.iter().cloned());
+                    for var in &successor.live_out {
+                        if !successor.defines.contains(var) {
+                            new_live_out.insert(var.clone());
                         }
-                        new_live_out.extend(live_in);
                     }
                 }
 
@@ -153,7 +165,8 @@ impl DataFlowGraph {
             return true;
         }
 
-        let mut visited = HashSet::new();
+        let successors = self.successors();
+        let mut visited = vec![false; self.nodes.len()];
         let mut stack = vec![from];
 
         while let Some(current) = stack.pop() {
@@ -161,16 +174,11 @@ impl DataFlowGraph {
                 return true;
             }
 
-            if visited.contains(&current) {
+            if visited[current] {
                 continue;
             }
-            visited.insert(current);
-
-            for &(edge_from, edge_to) in &self.edges {
-                if edge_from == current {
-                    stack.push(edge_to);
-                }
-            }
+            visited[current] = true;
+            stack.extend(&successors[current]);
         }
 
         false
@@ -300,6 +308,41 @@ impl DataFlowAnalyzer {
                 vec![branch_node, join_node]
             }
 
+            // `and`/`or` short-circuit, so the right operand only runs on one
+            // outcome of the left one: model it as a branch that can skip it
+            Expr::Binary {
+                op: BinaryOp::And | BinaryOp::Or,
+                left,
+                right,
+            } => {
+                let left_nodes = self.analyze_expr(left);
+                let branch_node = self.graph.add_node(DataFlowNodeType::Branch);
+
+                // Connect left to branch
+                if let Some(&last_left) = left_nodes.last() {
+                    self.graph.add_edge(last_left, branch_node);
+                }
+
+                let right_nodes = self.analyze_expr(right);
+                let join_node = self.graph.add_node(DataFlowNodeType::Expression);
+
+                // Connect branch through the right operand to join
+                if let (Some(&first_right), Some(&last_right)) =
+                    (right_nodes.first(), right_nodes.last())
+                {
+                    self.graph.add_edge(branch_node, first_right);
+                    self.graph.add_edge(last_right, join_node);
+                }
+
+                // The short-circuit path skips the right operand
+                self.graph.add_edge(branch_node, join_node);
+
+                let mut nodes = left_nodes;
+                nodes.push(branch_node);
+                nodes.push(join_node);
+                nodes
+            }
+
             Expr::Binary { left, right, .. } => {
                 let left_nodes = self.analyze_expr(left);
                 let right_nodes = self.analyze_expr(right);
@@ -432,4 +475,30 @@ mod tests {
             .iter()
             .any(|n| matches!(n.node_type, DataFlowNodeType::Branch)));
     }
+
+    #[test]
+    fn test_logical_operator_flow_can_skip_right_operand() {
+        let mut analyzer = DataFlowAnalyzer::new();
+        let expr = parse("a and b").unwrap();
+        let graph = analyzer.analyze(&expr);
+
+        let branch = graph
+            .nodes
+            .iter()
+            .find(|n| n.node_type == DataFlowNodeType::Branch)
+            .expect("short-circuit branch")
+            .id;
+        let b_use = graph.uses["b"][0];
+        let join = graph
+            .edges
+            .iter()
+            .find(|&&(from, _)| from == b_use)
+            .map(|&(_, to)| to)
+            .unwrap();
+
+        // Both the path through `b` and the path around it reach the join
+        assert!(graph.edges.contains(&(branch, b_use)));
+        assert!(graph.edges.contains(&(branch, join)));
+        assert!(graph.can_reach(graph.uses["a"][0], branch));
+    }
 }
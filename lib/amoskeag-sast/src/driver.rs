@@ -0,0 +1,115 @@
+//! Multi-file driver
+//!
+//! Analyzes a tree of rule files in parallel. Each file is read, parsed and
+//! analyzed independently, so idle workers claim the next file as they
+//! finish and one slow rule never holds up the rest. Reports come back in
+//! the order the paths were given, each with the time its analysis took.
+
+use crate::{AnalysisResult, SastAnalyzer};
+use amoskeag::parallel_map_with;
+use amoskeag_parser::parse;
+use std::fs;
+use std::io;
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant};
+use thiserror::Error;
+
+/// Extension of Amoskeag rule files
+const RULE_EXTENSION: &str = "amos";
+
+/// Why a rule file could not be analyzed
+#[derive(Error, Debug)]
+pub enum RuleFileError {
+    #[error("failed to read file: {0}")]
+    Read(#[from] io::Error),
+
+    #[error("failed to parse: {0}")]
+    Parse(String),
+}
+
+/// The analysis of one rule file
+#[derive(Debug)]
+pub struct RuleReport {
+    /// The file analyzed
+    pub path: PathBuf,
+    /// The analysis, or why the file could not be analyzed
+    pub result: Result<AnalysisResult, RuleFileError>,
+    /// Time spent analyzing the parsed rule, excluding reading and parsing
+    pub elapsed: Duration,
+}
+
+/// Find every rule file under `root`, sorted by path
+///
+/// `root` itself is returned if it is a file, whatever its extension.
+pub fn find_rules(root: &Path) -> io::Result<Vec<PathBuf>> {
+    let mut rules = Vec::new();
+    if root.is_file() {
+        rules.push(root.to_path_buf());
+    } else {
+        collect_rules(root, &mut rules)?;
+        rules.sort();
+    }
+    Ok(rules)
+}
+
+fn collect_rules(dir: &Path, rules: &mut Vec<PathBuf>) -> io::Result<()> {
+    for entry in fs::read_dir(dir)? {
+        let path = entry?.path();
+        if path.is_dir() {
+            collect_rules(&path, rules)?;
+        } else if path.extension().is_some_and(|ext| ext == RULE_EXTENSION) {
+            rules.push(path);
+        }
+    }
+    Ok(())
+}
+
+/// Analyze every file in `paths` on up to `workers` threads
+///
+/// The report for `paths[i]` is at index `i` of the returned vector.
+pub fn analyze_files(paths: &[PathBuf], symbols: &[&str], workers: usize) -> Vec<RuleReport> {
+    // Rules take very different times to analyze, so workers claim one
+    // file at a time
+    parallel_map_with(paths, workers, 1, SastAnalyzer::new, |analyzer, path| {
+        analyze_file(analyzer, path, symbols)
+    })
+}
+
+fn analyze_file(analyzer: &mut SastAnalyzer, path: &Path, symbols: &[&str]) -> RuleReport {
+    let parsed = fs::read_to_string(path)
+        .map_err(RuleFileError::from)
+        .and_then(|source| parse(&source).map_err(|e| RuleFileError::Parse(e.to_string())));
+
+    let start = Instant::now();
+    let result = parsed.map(|expr| analyzer.analyze(&expr, symbols));
+    RuleReport {
+        path: path.to_path_buf(),
+        result,
+        elapsed: start.elapsed(),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_analyze_files_keeps_input_order() {
+        let paths: Vec<PathBuf> = (0..10)
+            .map(|i| PathBuf::from(format!("/nonexistent/rule_{}.amos", i)))
+            .collect();
+        for workers in [1, 3, 16] {
+            let reports = analyze_files(&paths, &[], workers);
+            let reported: Vec<_> = reports.iter().map(|r| r.path.clone()).collect();
+            assert_eq!(reported, paths);
+            assert!(reports
+                .iter()
+                .all(|r| matches!(r.result, Err(RuleFileError::Read(_)))));
+        }
+    }
+
+    #[test]
+    fn test_analyze_files_empty() {
+        assert!(analyze_files(&[], &[], 4).is_empty());
+    }
+}
@@ -11,16 +11,20 @@
 //!   input parameters that could trigger errors.
 //! - **Range Analysis**: Tracks possible value ranges for expressions.
 //! - **Data Flow Analysis**: Analyzes how data flows through the program.
+//! - **Multi-file Driver**: Analyzes a tree of rule files in parallel, timing
+//!   each rule.
 
 mod algebraic_analysis;
 mod constraint_solver;
 mod data_flow;
+mod driver;
 mod error_detection;
 mod range_analysis;
 
 pub use algebraic_analysis::{AlgebraicAnalyzer, InputConstraint, VulnerableInput};
 pub use constraint_solver::{Constraint, ConstraintSolver, Solution};
 pub use data_flow::{DataFlowAnalyzer, DataFlowNode};
+pub use driver::{analyze_files, find_rules, RuleFileError, RuleReport};
 pub use error_detection::{ErrorDetector, ErrorSeverity, ProgrammingError};
 pub use range_analysis::{RangeAnalyzer, ValueRange};
 
@@ -29,11 +33,14 @@ use serde::{Deserialize, Serialize};
 use std::collections::HashMap;
 
 /// Main SAST analyzer that combines all analysis techniques
+///
+/// Ranges are computed once and shared by error detection and algebraic
+/// analysis. Data flow graphs aren't needed by either, so they're left to
+/// [`DataFlowAnalyzer`] for callers that want them.
 pub struct SastAnalyzer {
     error_detector: ErrorDetector,
     algebraic_analyzer: AlgebraicAnalyzer,
     range_analyzer: RangeAnalyzer,
-    data_flow_analyzer: DataFlowAnalyzer,
 }
 
 /// Complete SAST analysis result
@@ -69,15 +76,11 @@ impl SastAnalyzer {
             error_detector: ErrorDetector::new(),
             algebraic_analyzer: AlgebraicAnalyzer::new(),
             range_analyzer: RangeAnalyzer::new(),
-            data_flow_analyzer: DataFlowAnalyzer::new(),
         }
     }
 
     /// Analyze an expression for potential errors and vulnerabilities
     pub fn analyze(&mut self, expr: &Expr, symbols: &[&str]) -> AnalysisResult {
-        // Perform data flow analysis
-        let _data_flow = self.data_flow_analyzer.analyze(expr);
-
         // Perform range analysis
         let ranges = self.range_analyzer.analyze(expr, &HashMap::new());
 
@@ -1,7 +1,8 @@
 //! Integration tests for amoskeag-sast
 
 use amoskeag_parser::parse;
-use amoskeag_sast::{analyze, SastAnalyzer};
+use amoskeag_sast::{analyze, analyze_files, find_rules, RuleFileError, SastAnalyzer};
+use std::fs;
 
 #[test]
 fn test_end_to_end_division_by_zero() {
@@ -200,3 +201,28 @@ fn test_statistics_accuracy() {
     assert_eq!(result.statistics.critical_errors, 1);
     // total_expressions is always >= 0 by definition (it's unsigned)
 }
+
+#[test]
+fn test_analyze_rule_directory() {
+    let dir = tempfile::tempdir().unwrap();
+    fs::create_dir(dir.path().join("nested")).unwrap();
+    fs::write(dir.path().join("b.amos"), "10 / 0").unwrap();
+    fs::write(dir.path().join("nested/a.amos"), "amount * 2").unwrap();
+    fs::write(dir.path().join("broken.amos"), "if true").unwrap();
+    fs::write(dir.path().join("notes.txt"), "not a rule").unwrap();
+
+    let paths = find_rules(dir.path()).unwrap();
+    let names: Vec<_> = paths
+        .iter()
+        .map(|p| p.strip_prefix(dir.path()).unwrap().to_str().unwrap())
+        .collect();
+    assert_eq!(names, ["b.amos", "broken.amos", "nested/a.amos"]);
+
+    let reports = analyze_files(&paths, &[], 2);
+    assert_eq!(reports.len(), 3);
+    let division = reports[0].result.as_ref().unwrap();
+    assert_eq!(division.statistics.critical_errors, 1);
+    assert!(matches!(reports[1].result, Err(RuleFileError::Parse(_))));
+    let clean = reports[2].result.as_ref().unwrap();
+    assert_eq!(clean.statistics.critical_errors, 0);
+}
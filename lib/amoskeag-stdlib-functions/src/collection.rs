@@ -1,6 +1,8 @@
 //! Collection manipulation functions for Amoskeag
 
-use crate::{FunctionError, Value};
+use crate::{FunctionError, Value, ValueSet};
+use std::cmp::Ordering;
+use std::collections::HashMap;
 
 /// Get the size/length of a collection
 /// size(val: String | Array | Dictionary) -> Number
@@ -115,35 +117,9 @@ pub fn avg(value: &Value) -> Result<Value, FunctionError> {
 pub fn sort(value: &Value) -> Result<Value, FunctionError> {
     match value {
         Value::Array(arr) => {
-            let mut sorted = arr.clone();
-
-            // Check if all elements are numbers or all are strings
-            let all_numbers = arr.iter().all(|v| matches!(v, Value::Number(_)));
-            let all_strings = arr.iter().all(|v| matches!(v, Value::String(_)));
-
-            if all_numbers {
-                sorted.sort_by(|a, b| {
-                    if let (Value::Number(x), Value::Number(y)) = (a, b) {
-                        x.partial_cmp(y).unwrap_or(std::cmp::Ordering::Equal)
-                    } else {
-                        std::cmp::Ordering::Equal
-                    }
-                });
-                Ok(Value::Array(sorted))
-            } else if all_strings {
-                sorted.sort_by(|a, b| {
-                    if let (Value::String(x), Value::String(y)) = (a, b) {
-                        x.cmp(y)
-                    } else {
-                        std::cmp::Ordering::Equal
-                    }
-                });
-                Ok(Value::Array(sorted))
-            } else {
-                Err(FunctionError::InvalidOperation {
-                    message: "Array must contain all Numbers or all Strings to sort".to_string(),
-                })
-            }
+            let mut sorted: Vec<&Value> = arr.iter().collect();
+            sort_refs(&mut sorted)?;
+            Ok(Value::Array(sorted.into_iter().cloned().collect()))
         }
         _ => Err(FunctionError::TypeError {
             expected: "Array".to_string(),
@@ -152,6 +128,66 @@ pub fn sort(value: &Value) -> Result<Value, FunctionError> {
     }
 }
 
+/// Sort borrowed array elements in place, as `sort` does
+///
+/// The elements must be all Numbers or all Strings. The sort is stable.
+pub fn sort_refs(items: &mut [&Value]) -> Result<(), FunctionError> {
+    let order = sort_order(items)?;
+    items.sort_by(|a, b| order(a, b));
+    Ok(())
+}
+
+/// The element `sort` would put first (or, with `last`, last), found
+/// without sorting
+///
+/// Returns `None` for an empty slice and the same error as `sort` for
+/// elements that can't be sorted.
+pub fn sorted_end<'v>(items: &[&'v Value], last: bool) -> Result<Option<&'v Value>, FunctionError> {
+    let order = sort_order(items)?;
+    if items
+        .iter()
+        .any(|v| matches!(v, Value::Number(n) if n.is_nan()))
+    {
+        // NaN compares equal to everything, so only a real sort says where
+        // the ends are
+        let mut sorted = items.to_vec();
+        sorted.sort_by(|a, b| order(a, b));
+        return Ok(if last { sorted.last() } else { sorted.first() }.copied());
+    }
+
+    // A stable sort keeps equal elements in order, so the first minimum
+    // comes first and the last maximum comes last
+    let mut best: Option<&'v Value> = None;
+    for &item in items {
+        best = match best {
+            Some(b) if last && order(item, b) == Ordering::Less => Some(b),
+            Some(b) if !last && order(item, b) != Ordering::Less => Some(b),
+            _ => Some(item),
+        };
+    }
+    Ok(best)
+}
+
+/// Comparison used by `sort`, after checking the elements are all Numbers
+/// or all Strings
+fn sort_order(items: &[&Value]) -> Result<fn(&Value, &Value) -> Ordering, FunctionError> {
+    if items.iter().all(|v| matches!(v, Value::Number(_))) {
+        Ok(|a, b| match (a, b) {
+            (Value::Number(x), Value::Number(y)) => x.partial_cmp(y).unwrap_or(Ordering::Equal),
+            _ => Ordering::Equal,
+        })
+    } else if items.iter().all(|v| matches!(v, Value::String(_))) {
+        Ok(|a, b| match (a, b) {
+            (Value::String(x), Value::String(y)) => x.cmp(y),
+            _ => Ordering::Equal,
+        })
+    } else {
+        Err(FunctionError::InvalidOperation {
+            message: "Array must contain all Numbers or all Strings to sort".to_string(),
+        })
+    }
+}
+
 /// Get the keys of a dictionary
 /// keys(dict: Dictionary) -> Array
 pub fn keys(value: &Value) -> Result<Value, FunctionError> {
@@ -231,17 +267,8 @@ pub fn at(array: &Value, index: &Value) -> Result<Value, FunctionError> {
 pub fn uniq(value: &Value) -> Result<Value, FunctionError> {
     match value {
         Value::Array(arr) => {
-            let mut seen = Vec::new();
-            let mut unique = Vec::new();
-
-            for item in arr {
-                if !seen.contains(item) {
-                    seen.push(item.clone());
-                    unique.push(item.clone());
-                }
-            }
-
-            Ok(Value::Array(unique))
+            let unique: ValueSet = arr.iter().collect();
+            Ok(Value::Array(unique.into_values()))
         }
         _ => Err(FunctionError::TypeError {
             expected: "Array".to_string(),
@@ -255,26 +282,30 @@ pub fn uniq(value: &Value) -> Result<Value, FunctionError> {
 pub fn group_by(array: &Value, key: &Value) -> Result<Value, FunctionError> {
     match (array, key) {
         (Value::Array(arr), Value::String(key_str)) => {
-            let mut groups = std::collections::HashMap::new();
+            // Each distinct key value is converted to its group name once;
+            // keys that print the same (such as 1 and "1") share a group
+            let mut group_of: HashMap<GroupKey<'_>, usize> = HashMap::new();
+            let mut group_names: HashMap<String, usize> = HashMap::new();
+            let mut groups: Vec<(String, Vec<Value>)> = Vec::new();
 
             for item in arr {
                 match item {
                     Value::Dictionary(dict) => {
-                        if let Some(key_value) = dict.get(key_str) {
-                            // Convert the key value to a string for grouping
-                            let group_key = match key_value {
-                                Value::String(s) => s.clone(),
-                                Value::Number(n) => n.to_string(),
-                                Value::Boolean(b) => b.to_string(),
-                                Value::Nil => "nil".to_string(),
-                                _ => continue, // Skip complex types
-                            };
-
-                            groups
-                                .entry(group_key)
-                                .or_insert_with(Vec::new)
-                                .push(item.clone());
-                        }
+                        let Some(key_value) = dict.get(key_str) else {
+                            continue;
+                        };
+                        let Some(group_key) = GroupKey::new(key_value) else {
+                            continue; // Skip complex types
+                        };
+
+                        let group = *group_of.entry(group_key).or_insert_with(|| {
+                            let name = group_key.name();
+                            *group_names.entry(name.clone()).or_insert_with(|| {
+                                groups.push((name, Vec::new()));
+                                groups.len() - 1
+                            })
+                        });
+                        groups[group].1.push(item.clone());
                     }
                     _ => {
                         return Err(FunctionError::TypeError {
@@ -285,8 +316,7 @@ pub fn group_by(array: &Value, key: &Value) -> Result<Value, FunctionError> {
                 }
             }
 
-            // Convert HashMap<String, Vec<Value>> to HashMap<String, Value>
-            let result: std::collections::HashMap<String, Value> = groups
+            let result: HashMap<String, Value> = groups
                 .into_iter()
                 .map(|(k, v)| (k, Value::Array(v)))
                 .collect();
@@ -304,6 +334,38 @@ pub fn group_by(array: &Value, key: &Value) -> Result<Value, FunctionError> {
     }
 }
 
+/// A `group_by` key value, borrowed from the array being grouped
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+enum GroupKey<'a> {
+    String(&'a str),
+    /// The bits of the number, which `to_string` renders distinctly
+    Number(u64),
+    Boolean(bool),
+    Nil,
+}
+
+impl<'a> GroupKey<'a> {
+    fn new(value: &'a Value) -> Option<Self> {
+        Some(match value {
+            Value::String(s) => GroupKey::String(s),
+            Value::Number(n) => GroupKey::Number(n.to_bits()),
+            Value::Boolean(b) => GroupKey::Boolean(*b),
+            Value::Nil => GroupKey::Nil,
+            _ => return None,
+        })
+    }
+
+    /// The group's name in the result dictionary
+    fn name(&self) -> String {
+        match *self {
+            GroupKey::String(s) => s.to_string(),
+            GroupKey::Number(bits) => f64::from_bits(bits).to_string(),
+            GroupKey::Boolean(b) => b.to_string(),
+            GroupKey::Nil => "nil".to_string(),
+        }
+    }
+}
+
 /// Map a key from an array of dictionaries to an array of values
 /// map(arr: Array, key: String) -> Array
 pub fn map(array: &Value, key: &Value) -> Result<Value, FunctionError> {
@@ -611,6 +673,50 @@ mod tests {
         }
     }
 
+    #[test]
+    fn test_group_by_merges_keys_that_print_the_same() {
+        let item = |key: Value, n: f64| {
+            let mut dict = HashMap::new();
+            dict.insert("k".to_string(), key);
+            dict.insert("n".to_string(), Value::Number(n));
+            Value::Dictionary(dict)
+        };
+        let items = vec![
+            item(Value::Number(1.0), 0.0),
+            item(Value::String("1".to_string()), 1.0),
+            item(Value::Number(1.0), 2.0),
+            item(Value::Boolean(true), 3.0),
+            item(Value::String("true".to_string()), 4.0),
+        ];
+        let arr = Value::Array(items.clone());
+
+        let Value::Dictionary(groups) = group_by(&arr, &Value::String("k".to_string())).unwrap()
+        else {
+            panic!("Expected Dictionary result");
+        };
+        assert_eq!(groups.len(), 2);
+        let Value::Array(ones) = &groups["1"] else {
+            panic!("Expected Array group");
+        };
+        // Items stay in array order within a group
+        assert_eq!(ones[..], items[..3]);
+        assert!(matches!(&groups["true"], Value::Array(items) if items.len() == 2));
+    }
+
+    #[test]
+    fn test_uniq_large_array() {
+        let arr = Value::Array(
+            (0..50_000)
+                .map(|i| Value::Number((i % 1000) as f64))
+                .collect(),
+        );
+        let Value::Array(unique) = uniq(&arr).unwrap() else {
+            panic!("Expected Array result");
+        };
+        assert_eq!(unique.len(), 1000);
+        assert_eq!(unique[999], Value::Number(999.0));
+    }
+
     #[test]
     fn test_group_by_with_numbers() {
         let mut dict1 = HashMap::new();
@@ -13,8 +13,11 @@ pub mod collection;
 pub mod date;
 pub mod logic;
 pub mod numeric;
+mod set;
 pub mod string;
 
+pub use set::ValueSet;
+
 /// Error types for function operations
 #[derive(Debug, Clone, PartialEq)]
 pub enum FunctionError {
@@ -0,0 +1,165 @@
+//! Amortization engine shared by the payment functions
+//!
+//! `pmt`, `ipmt`, `ppmt`, `cumipmt`, `cumprinc` and `amortization_schedule`
+//! validate their arguments and then work on a `Loan` of plain `f64`s, so a
+//! payment is computed once per call rather than once per period.
+
+/// A loan with constant payments at a constant interest rate
+pub(crate) struct Loan {
+    rate: f64,
+    /// 1 + rate when payments are due at the start of each period, else 1
+    due: f64,
+    pv: f64,
+    payment: f64,
+}
+
+impl Loan {
+    /// A loan of `pv` over `nper` periods, with payments at the end of each
+    /// period for `type_` 0 or at the start for `type_` 1
+    pub(crate) fn new(rate: f64, nper: f64, pv: f64, type_: f64) -> Self {
+        let due = if type_ == 1.0 { 1.0 + rate } else { 1.0 };
+        let payment = if rate == 0.0 {
+            -pv / nper
+        } else {
+            // PMT = PV * (r * (1 + r)^n) / ((1 + r)^n - 1)
+            let factor = (1.0 + rate).powf(nper);
+            -pv * (rate * factor) / (factor - 1.0)
+        };
+        Self {
+            rate,
+            due,
+            pv,
+            payment: payment / due,
+        }
+    }
+
+    /// The payment due every period
+    pub(crate) fn payment(&self) -> f64 {
+        self.payment
+    }
+
+    /// The interest paid in `period`, counting from 1
+    pub(crate) fn interest(&self, period: f64) -> f64 {
+        if self.rate == 0.0 {
+            return 0.0;
+        }
+        // Balance at the start of the period:
+        // PV * (1+r)^(p-1) + PMT * ((1+r)^(p-1) - 1) / r
+        let factor = (1.0 + self.rate).powf(period - 1.0);
+        let balance = self.pv * factor + self.payment * ((factor - 1.0) / self.rate);
+        self.interest_on(balance)
+    }
+
+    /// The principal paid in `period`, counting from 1
+    pub(crate) fn principal(&self, period: f64) -> f64 {
+        self.payment - self.interest(period)
+    }
+
+    /// The interest paid from period `start` to period `end`, inclusive
+    ///
+    /// The balances at the start of each period form a geometric series, so
+    /// the total takes the same two powers whatever the number of periods.
+    pub(crate) fn cumulative_interest(&self, start: f64, end: f64) -> f64 {
+        if self.rate == 0.0 {
+            return 0.0;
+        }
+        let r = self.rate;
+        let periods = end - start + 1.0;
+        // Sum of (1+r)^(p-1) for p in start..=end
+        let growth = if r > -1.0 {
+            (periods * r.ln_1p()).exp_m1()
+        } else {
+            (1.0 + r).powf(periods) - 1.0
+        };
+        let factors = (1.0 + r).powf(start - 1.0) * growth / r;
+        // Sum of the balances times r, from PV * r * f + PMT * (f - 1)
+        let charged = (self.pv * r + self.payment) * factors - self.payment * periods;
+        -charged / self.due
+    }
+
+    /// The principal paid from period `start` to period `end`, inclusive
+    pub(crate) fn cumulative_principal(&self, start: f64, end: f64) -> f64 {
+        self.payment * (end - start + 1.0) - self.cumulative_interest(start, end)
+    }
+
+    /// Every period of the loan from 1 to `periods`, as (interest, principal)
+    ///
+    /// Carries the balance from one period to the next instead of raising
+    /// 1 + r to each period.
+    pub(crate) fn schedule(&self, periods: usize) -> impl Iterator<Item = (f64, f64)> + '_ {
+        let mut balance = self.pv;
+        (0..periods).map(move |_| {
+            let interest = self.interest_on(balance);
+            balance = balance * (1.0 + self.rate) + self.payment;
+            (interest, self.payment - interest)
+        })
+    }
+
+    fn interest_on(&self, balance: f64) -> f64 {
+        if self.rate == 0.0 {
+            return 0.0;
+        }
+        -(balance * self.rate) / self.due
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn close(a: f64, b: f64) -> bool {
+        (a - b).abs() <= 1e-9 * b.abs().max(1.0)
+    }
+
+    #[test]
+    fn test_cumulative_matches_sum_of_periods() {
+        for &(rate, nper, pv) in &[
+            (0.045 / 12.0, 360.0, 250000.0),
+            (0.09 / 12.0, 30.0 * 12.0, 125000.0),
+            (0.1, 10.0, -5000.0),
+            (1e-9, 48.0, 8000.0),
+            (0.5, 12.0, 1000.0),
+        ] {
+            for &type_ in &[0.0, 1.0] {
+                let loan = Loan::new(rate, nper, pv, type_);
+                for &(start, end) in &[(1.0, 1.0), (1.0, nper), (3.0, 7.0), (nper, nper)] {
+                    let mut interest = 0.0;
+                    let mut principal = 0.0;
+                    let mut period = start;
+                    while period <= end {
+                        interest += loan.interest(period);
+                        principal += loan.principal(period);
+                        period += 1.0;
+                    }
+                    assert!(close(loan.cumulative_interest(start, end), interest));
+                    assert!(close(loan.cumulative_principal(start, end), principal));
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_schedule_matches_periods() {
+        for &type_ in &[0.0, 1.0] {
+            let loan = Loan::new(0.045 / 12.0, 360.0, 250000.0, type_);
+            let mut count = 0;
+            for (i, (interest, principal)) in loan.schedule(360).enumerate() {
+                let period = (i + 1) as f64;
+                assert!(close(interest, loan.interest(period)));
+                assert!(close(principal, loan.principal(period)));
+                count += 1;
+            }
+            assert_eq!(count, 360);
+        }
+    }
+
+    #[test]
+    fn test_zero_rate() {
+        let loan = Loan::new(0.0, 10.0, 1000.0, 1.0);
+        assert_eq!(loan.payment(), -100.0);
+        assert_eq!(loan.interest(4.0), 0.0);
+        assert_eq!(loan.cumulative_interest(1.0, 10.0), 0.0);
+        assert_eq!(loan.cumulative_principal(1.0, 10.0), -1000.0);
+        assert!(loan.schedule(10).all(|(i, p)| i == 0.0 && p == -100.0));
+    }
+}
@@ -0,0 +1,89 @@
+//! amortization_schedule function
+
+use super::amortization::Loan;
+use crate::{FunctionError, Value};
+use std::collections::HashMap;
+
+/// Longest schedule that can be built, in periods
+///
+/// Larger than any real loan (a century of weekly payments), but small
+/// enough that a mistyped nper can't allocate without bound.
+const MAX_SCHEDULE_PERIODS: f64 = 10_000.0;
+
+/// Build the payment schedule of a loan, one entry per period
+/// amortization_schedule(rate: Number, nper: Number, pv: Number, type_: Number) -> Array
+///
+/// type_: 0 = payment at end of period, 1 = payment at beginning of period
+///
+/// Each entry is a Dictionary with the keys `period`, `payment`, `interest`
+/// and `principal`, as `pmt`, `ipmt` and `ppmt` give them for that period,
+/// and `balance`, the principal still owed after the payment. The whole
+/// schedule is computed in one pass.
+///
+/// Example: amortization_schedule(0.1/12, 36, 8000, 0) = 36 monthly entries for a 3-year loan
+pub fn amortization_schedule(
+    rate: &Value,
+    nper: &Value,
+    pv: &Value,
+    type_: &Value,
+) -> Result<Value, FunctionError> {
+    match (rate, nper, pv, type_) {
+        (Value::Number(r), Value::Number(n), Value::Number(v), Value::Number(t)) => {
+            if *n < 1.0 || n.fract() != 0.0 {
+                return Err(FunctionError::ArgumentError {
+                    message: "nper must be a whole number greater than 0".to_string(),
+                });
+            }
+
+            if *n > MAX_SCHEDULE_PERIODS {
+                return Err(FunctionError::ArgumentError {
+                    message: format!("nper must be at most {}", MAX_SCHEDULE_PERIODS),
+                });
+            }
+
+            if *t != 0.0 && *t != 1.0 {
+                return Err(FunctionError::ArgumentError {
+                    message: "type must be 0 or 1".to_string(),
+                });
+            }
+
+            let loan = Loan::new(*r, *n, *v, *t);
+            let payment = loan.payment();
+            let mut balance = *v;
+            let schedule = loan
+                .schedule(*n as usize)
+                .enumerate()
+                .map(|(i, (interest, principal))| {
+                    balance += principal;
+                    let mut entry = HashMap::with_capacity(5);
+                    entry.insert("period".to_string(), Value::Number((i + 1) as f64));
+                    entry.insert("payment".to_string(), Value::Number(payment));
+                    entry.insert("interest".to_string(), Value::Number(interest));
+                    entry.insert("principal".to_string(), Value::Number(principal));
+                    entry.insert("balance".to_string(), Value::Number(balance));
+                    Value::Dictionary(entry)
+                })
+                .collect();
+
+            Ok(Value::Array(schedule))
+        }
+        (Value::Number(_), Value::Number(_), Value::Number(_), _) => {
+            Err(FunctionError::TypeError {
+                expected: "Number".to_string(),
+                got: type_.type_name().to_string(),
+            })
+        }
+        (Value::Number(_), Value::Number(_), _, _) => Err(FunctionError::TypeError {
+            expected: "Number".to_string(),
+            got: pv.type_name().to_string(),
+        }),
+        (Value::Number(_), _, _, _) => Err(FunctionError::TypeError {
+            expected: "Number".to_string(),
+            got: nper.type_name().to_string(),
+        }),
+        _ => Err(FunctionError::TypeError {
+            expected: "Number".to_string(),
+            got: rate.type_name().to_string(),
+        }),
+    }
+}
@@ -1,6 +1,6 @@
 //! cumipmt function
 
-use super::ipmt::ipmt;
+use super::amortization::Loan;
 use crate::{FunctionError, Value};
 
 /// Calculate cumulative interest paid between two periods
@@ -44,24 +44,11 @@ pub fn cumipmt(
                 });
             }
 
-            let mut total_interest = 0.0;
-
-            for period in (*sp as i32)..=(*ep as i32) {
-                let interest = match ipmt(
-                    &Value::Number(*r),
-                    &Value::Number(period as f64),
-                    &Value::Number(*n),
-                    &Value::Number(*v),
-                    &Value::Number(*t),
-                )? {
-                    Value::Number(i) => i,
-                    _ => unreachable!(),
-                };
-
-                total_interest += interest;
-            }
-
-            Ok(Value::Number(total_interest))
+            // Only whole periods are counted
+            let loan = Loan::new(*r, *n, *v, *t);
+            Ok(Value::Number(
+                loan.cumulative_interest(sp.trunc(), ep.trunc()),
+            ))
         }
         _ => Err(FunctionError::TypeError {
             expected: "all arguments must be Numbers".to_string(),
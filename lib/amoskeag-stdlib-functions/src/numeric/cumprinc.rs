@@ -1,6 +1,6 @@
 //! cumprinc function
 
-use super::ppmt::ppmt;
+use super::amortization::Loan;
 use crate::{FunctionError, Value};
 
 /// Calculate cumulative principal paid between two periods
@@ -44,24 +44,11 @@ pub fn cumprinc(
                 });
             }
 
-            let mut total_principal = 0.0;
-
-            for period in (*sp as i32)..=(*ep as i32) {
-                let principal = match ppmt(
-                    &Value::Number(*r),
-                    &Value::Number(period as f64),
-                    &Value::Number(*n),
-                    &Value::Number(*v),
-                    &Value::Number(*t),
-                )? {
-                    Value::Number(p) => p,
-                    _ => unreachable!(),
-                };
-
-                total_principal += principal;
-            }
-
-            Ok(Value::Number(total_principal))
+            // Only whole periods are counted
+            let loan = Loan::new(*r, *n, *v, *t);
+            Ok(Value::Number(
+                loan.cumulative_principal(sp.trunc(), ep.trunc()),
+            ))
         }
         _ => Err(FunctionError::TypeError {
             expected: "all arguments must be Numbers".to_string(),
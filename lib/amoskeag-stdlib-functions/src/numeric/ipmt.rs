@@ -1,6 +1,6 @@
 //! ipmt function
 
-use super::pmt::pmt;
+use super::amortization::Loan;
 use crate::{FunctionError, Value};
 
 /// Calculate the interest payment for a given period
@@ -44,50 +44,7 @@ pub fn ipmt(
                 });
             }
 
-            // Handle zero interest rate case
-            if *r == 0.0 {
-                return Ok(Value::Number(0.0));
-            }
-
-            // Calculate total payment using pmt function
-            let payment = match pmt(
-                &Value::Number(*r),
-                &Value::Number(*n),
-                &Value::Number(*v),
-                &Value::Number(*t),
-            )? {
-                Value::Number(pmt) => pmt,
-                _ => unreachable!(),
-            };
-
-            // For period 1, interest is calculated on the full principal
-            if *p == 1.0 {
-                let interest = -(*v * *r);
-                let adjusted_interest = if *t == 1.0 {
-                    interest / (1.0 + *r)
-                } else {
-                    interest
-                };
-                return Ok(Value::Number(adjusted_interest));
-            }
-
-            // Calculate remaining balance at start of period
-            // Balance = PV * (1+r)^(p-1) - PMT * (((1+r)^(p-1) - 1) / r)
-            // Since PMT is negative in this codebase, adjust the formula
-            let factor = (1.0 + *r).powf(*p - 1.0);
-            let balance = *v * factor + payment * ((factor - 1.0) / *r);
-
-            // Interest for this period
-            let interest = -(balance * *r);
-
-            // For type 1, adjust interest
-            let adjusted_interest = if *t == 1.0 {
-                interest / (1.0 + *r)
-            } else {
-                interest
-            };
-
-            Ok(Value::Number(adjusted_interest))
+            Ok(Value::Number(Loan::new(*r, *n, *v, *t).interest(*p)))
         }
         (Value::Number(_), Value::Number(_), Value::Number(_), Value::Number(_), _) => {
             Err(FunctionError::TypeError {
@@ -1,11 +1,24 @@
 //! irr function
 
+use super::solve;
 use crate::{FunctionError, Value};
 
+/// Lowest and highest rates considered
+const MIN_RATE: f64 = -0.99;
+const MAX_RATE: f64 = 100.0;
+
+/// Newton steps tried before falling back to a bracketing search
+const NEWTON_ITERATIONS: usize = 50;
+
+/// Intervals the range of rates is divided into when searching for a change
+/// of sign, spaced evenly in log(1 + rate)
+const SCAN_POINTS: usize = 200;
+
 /// Calculate internal rate of return for a series of cash flows
 /// irr(values: Array) -> Number
 ///
-/// Uses Newton-Raphson method to find the rate where NPV = 0
+/// Uses Newton's method to find the rate where NPV = 0, falling back to
+/// bisection within a change of sign in NPV when Newton's method fails
 /// The first value is typically a negative investment, followed by positive returns
 ///
 /// Example: irr([-10000, 3000, 4200, 6800]) = internal rate of return
@@ -42,48 +55,52 @@ pub fn irr(values: &Value) -> Result<Value, FunctionError> {
                 });
             }
 
-            // Newton-Raphson method to find rate where NPV = 0
-            let mut rate = 0.1; // Initial guess: 10%
-            let tolerance = 1e-6;
-            let max_iterations = 100;
-
-            for _ in 0..max_iterations {
-                let mut npv = 0.0;
-                let mut dnpv = 0.0;
+            let npv = |rate: f64| npv_and_slope(&cash_flows, rate);
 
-                for (i, &cf) in cash_flows.iter().enumerate() {
-                    let period = i as f64;
-                    let factor = (1.0_f64 + rate).powf(period);
-                    npv += cf / factor;
-                    dnpv -= period * cf / ((1.0 + rate) * factor);
-                }
-
-                if dnpv.abs() < tolerance {
-                    return Err(FunctionError::ArgumentError {
-                        message: "IRR calculation did not converge".to_string(),
-                    });
+            // Newton's method from the guess, for as long as it stays in range
+            let guess = initial_guess(&cash_flows);
+            let mut rate = guess;
+            for _ in 0..NEWTON_ITERATIONS {
+                let (value, slope) = npv(rate);
+                let new_rate = rate - value / slope;
+                if !(MIN_RATE..=MAX_RATE).contains(&new_rate) {
+                    break;
                 }
-
-                let new_rate = rate - npv / dnpv;
-
-                if (new_rate - rate).abs() < tolerance {
+                if (new_rate - rate).abs() <= solve::TOLERANCE * rate.abs().max(1.0) {
                     return Ok(Value::Number(new_rate));
                 }
-
                 rate = new_rate;
-
-                // Ensure rate stays in reasonable bounds
-                if !(-0.99..=100.0).contains(&rate) {
-                    return Err(FunctionError::ArgumentError {
-                        message: "IRR calculation did not converge to a reasonable value"
-                            .to_string(),
-                    });
-                }
             }
 
-            Err(FunctionError::ArgumentError {
-                message: "IRR calculation exceeded maximum iterations".to_string(),
-            })
+            // Otherwise look for a change of sign in NPV, nearest the guess,
+            // and narrow it down
+            let rates = (0..=SCAN_POINTS).map(|i| {
+                let t = i as f64 / SCAN_POINTS as f64;
+                (1.0 + MIN_RATE) * ((1.0 + MAX_RATE) / (1.0 + MIN_RATE)).powf(t) - 1.0
+            });
+            let samples: Vec<(f64, f64)> = rates.map(|r| (r, npv(r).0)).collect();
+            let bracket = samples
+                .windows(2)
+                .filter(|w| w[0].1 == 0.0 || w[0].1 * w[1].1 < 0.0)
+                .map(|w| (w[0], w[1]))
+                .min_by(|a, b| {
+                    let distance = |(lo, hi): ((f64, f64), (f64, f64))| {
+                        (lo.0 - guess).max(0.0) + (guess - hi.0).max(0.0)
+                    };
+                    distance(*a).total_cmp(&distance(*b))
+                });
+            match bracket {
+                Some(((lo, 0.0), _)) => Ok(Value::Number(lo)),
+                Some(((lo, _), (hi, _))) => match solve::bracketed(npv, lo, hi, guess) {
+                    Some(rate) => Ok(Value::Number(rate)),
+                    None => Err(FunctionError::ArgumentError {
+                        message: "IRR calculation did not converge".to_string(),
+                    }),
+                },
+                None => Err(FunctionError::ArgumentError {
+                    message: "IRR calculation did not converge to a reasonable value".to_string(),
+                }),
+            }
         }
         _ => Err(FunctionError::TypeError {
             expected: "Array".to_string(),
@@ -91,3 +108,58 @@ pub fn irr(values: &Value) -> Result<Value, FunctionError> {
         }),
     }
 }
+
+/// NPV at `rate` and its derivative with respect to the rate
+///
+/// Evaluates NPV as a polynomial in 1 / (1 + rate) by Horner's rule, so a
+/// call takes one pass over the cash flows and no powers.
+fn npv_and_slope(cash_flows: &[f64], rate: f64) -> (f64, f64) {
+    let x = 1.0 / (1.0 + rate);
+    let mut value = 0.0;
+    let mut slope = 0.0;
+    for &cf in cash_flows.iter().rev() {
+        slope = slope * x + value;
+        value = value * x + cf;
+    }
+    // d/d(rate) of 1 / (1 + rate) is -x^2
+    (value, -slope * x * x)
+}
+
+/// Where Newton's method starts for `cash_flows`
+///
+/// When the flows change sign only once, NPV has a single root, and the
+/// rate that turns the total of one side into the other over the distance
+/// between their weighted mean periods is close to it. Otherwise there may
+/// be several roots, and the conventional 10% finds the usual one.
+fn initial_guess(cash_flows: &[f64]) -> f64 {
+    let signs = cash_flows
+        .iter()
+        .filter(|cf| **cf != 0.0)
+        .map(|cf| *cf > 0.0);
+    let changes = signs
+        .clone()
+        .zip(signs.skip(1))
+        .filter(|(a, b)| a != b)
+        .count();
+    if changes != 1 {
+        return 0.1;
+    }
+
+    let (mut inflow, mut inflow_time, mut outflow, mut outflow_time) = (0.0, 0.0, 0.0, 0.0);
+    for (i, &cf) in cash_flows.iter().enumerate() {
+        if cf > 0.0 {
+            inflow += cf;
+            inflow_time += cf * i as f64;
+        } else {
+            outflow -= cf;
+            outflow_time -= cf * i as f64;
+        }
+    }
+    let span = inflow_time / inflow - outflow_time / outflow;
+    let guess = (inflow / outflow).powf(1.0 / span) - 1.0;
+    if guess.is_finite() {
+        guess.clamp(MIN_RATE, MAX_RATE)
+    } else {
+        0.1
+    }
+}
@@ -37,21 +37,25 @@ pub fn mirr(
 
             let n = cash_flows.len() as f64;
 
-            // Calculate present value of negative cash flows (financed at finance_rate)
+            // Present value of negative cash flows (financed at finance_rate)
+            // and future value of positive ones (reinvested at
+            // reinvest_rate), in one pass: each period divides the discount
+            // by 1 + finance_rate and compounds what's reinvested so far by
+            // 1 + reinvest_rate
             let mut pv_negative = 0.0;
-            for (i, &cf) in cash_flows.iter().enumerate() {
-                if cf < 0.0 {
-                    let period = i as f64;
-                    pv_negative += cf / (1.0 + fr).powf(period);
-                }
-            }
-
-            // Calculate future value of positive cash flows (reinvested at reinvest_rate)
             let mut fv_positive = 0.0;
+            let mut discount = 1.0;
             for (i, &cf) in cash_flows.iter().enumerate() {
-                if cf > 0.0 {
-                    let period = n - 1.0 - i as f64;
-                    fv_positive += cf * (1.0 + rr).powf(period);
+                if i > 0 {
+                    discount /= 1.0 + fr;
+                    if fv_positive != 0.0 {
+                        fv_positive *= 1.0 + rr;
+                    }
+                }
+                if cf < 0.0 {
+                    pv_negative += cf * discount;
+                } else if cf > 0.0 {
+                    fv_positive += cf;
                 }
             }
 
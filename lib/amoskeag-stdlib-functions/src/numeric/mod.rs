@@ -18,6 +18,8 @@ pub mod sqrt;
 pub mod times;
 
 // Financial functions
+mod amortization;
+pub mod amortization_schedule;
 pub mod cumipmt;
 pub mod cumprinc;
 pub mod db;
@@ -35,9 +37,11 @@ pub mod ppmt;
 pub mod pv;
 pub mod rate;
 pub mod sln;
+mod solve;
 
 // Re-export all functions
 pub use abs::abs;
+pub use amortization_schedule::amortization_schedule;
 pub use array_max::array_max;
 pub use array_min::array_min;
 pub use ceil::ceil;
@@ -222,6 +226,10 @@ inventory::submit! {
     NumericFunction { name: "cumprinc", description: "Calculate cumulative principal paid", arity: Arity::Senary }
 }
 
+inventory::submit! {
+    NumericFunction { name: "amortization_schedule", description: "Build a loan's payment schedule", arity: Arity::Quaternary }
+}
+
 inventory::submit! {
     NumericFunction { name: "effect", description: "Calculate effective annual interest rate", arity: Arity::Binary }
 }
@@ -301,7 +309,7 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            abs(&Value::Symbol("sym".to_string())),
+            abs(&Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -376,7 +384,7 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            ceil(&Value::Symbol("sym".to_string())),
+            ceil(&Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -454,7 +462,7 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            floor(&Value::Symbol("sym".to_string())),
+            floor(&Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -835,11 +843,11 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            plus(&Value::Symbol("sym".to_string()), &Value::Number(1.0)),
+            plus(&Value::Symbol("sym".into()), &Value::Number(1.0)),
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            plus(&Value::Number(1.0), &Value::Symbol("sym".to_string())),
+            plus(&Value::Number(1.0), &Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -1014,11 +1022,11 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            minus(&Value::Symbol("sym".to_string()), &Value::Number(1.0)),
+            minus(&Value::Symbol("sym".into()), &Value::Number(1.0)),
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            minus(&Value::Number(1.0), &Value::Symbol("sym".to_string())),
+            minus(&Value::Number(1.0), &Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -1218,11 +1226,11 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            times(&Value::Symbol("sym".to_string()), &Value::Number(1.0)),
+            times(&Value::Symbol("sym".into()), &Value::Number(1.0)),
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            times(&Value::Number(1.0), &Value::Symbol("sym".to_string())),
+            times(&Value::Number(1.0), &Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -1438,7 +1446,7 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            divided_by(&Value::Symbol("sym".to_string()), &Value::Number(2.0)),
+            divided_by(&Value::Symbol("sym".into()), &Value::Number(2.0)),
             Err(FunctionError::TypeError { .. })
         ));
 
@@ -1467,7 +1475,7 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            divided_by(&Value::Number(10.0), &Value::Symbol("sym".to_string())),
+            divided_by(&Value::Number(10.0), &Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -1874,11 +1882,11 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            max(&Value::Symbol("sym".to_string()), &Value::Number(1.0)),
+            max(&Value::Symbol("sym".into()), &Value::Number(1.0)),
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            max(&Value::Number(1.0), &Value::Symbol("sym".to_string())),
+            max(&Value::Number(1.0), &Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -2058,11 +2066,11 @@ mod tests {
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            min(&Value::Symbol("sym".to_string()), &Value::Number(1.0)),
+            min(&Value::Symbol("sym".into()), &Value::Number(1.0)),
             Err(FunctionError::TypeError { .. })
         ));
         assert!(matches!(
-            min(&Value::Number(1.0), &Value::Symbol("sym".to_string())),
+            min(&Value::Number(1.0), &Value::Symbol("sym".into())),
             Err(FunctionError::TypeError { .. })
         ));
     }
@@ -2815,6 +2823,57 @@ mod tests {
             assert!(r > 0.0, "Rate should be positive: {}", r);
         }
     }
+    #[test]
+    fn test_rate_recovers_pmt_rate() {
+        for &(r, n) in &[
+            (0.0001, 2.0),
+            (0.00375, 360.0),
+            (0.01, 48.0),
+            (0.5, 12.0),
+            (20.0, 3.0),
+        ] {
+            let Value::Number(payment) = pmt(
+                &Value::Number(r),
+                &Value::Number(n),
+                &Value::Number(10000.0),
+                &Value::Number(0.0),
+            )
+            .unwrap() else {
+                panic!("Expected Number");
+            };
+            let Value::Number(found) = rate(
+                &Value::Number(n),
+                &Value::Number(payment),
+                &Value::Number(10000.0),
+            )
+            .unwrap() else {
+                panic!("Expected Number");
+            };
+            assert!((found - r).abs() < 1e-9 * r.max(1.0), "{} vs {}", found, r);
+        }
+    }
+
+    #[test]
+    fn test_rate_zero_root_and_no_root() {
+        // Payments that exactly repay the principal have a root at 0,
+        // reported as the lowest rate
+        let result = rate(
+            &Value::Number(2.0),
+            &Value::Number(-5000.0),
+            &Value::Number(10000.0),
+        );
+        assert!(matches!(result, Ok(Value::Number(r)) if r == 0.0001));
+
+        // Payments in the same direction as the principal never repay it
+        let result = rate(
+            &Value::Number(12.0),
+            &Value::Number(100.0),
+            &Value::Number(1000.0),
+        );
+        assert!(
+            matches!(result, Err(FunctionError::ArgumentError { message }) if message.contains("converge"))
+        );
+    }
 
     #[test]
     fn test_npv_basic() {
@@ -3107,6 +3166,51 @@ mod tests {
         // May or may not converge, but should not panic
         let _ = result;
     }
+    #[test]
+    fn test_irr_long_and_negative() {
+        // A 30-year monthly loan and a loss, where Newton's method from 10%
+        // leaves the range of rates
+        let mut flows = vec![Value::Number(-200000.0)];
+        flows.extend((0..360).map(|_| Value::Number(1100.0)));
+        let Value::Number(monthly) = irr(&Value::Array(flows)).unwrap() else {
+            panic!("Expected Number");
+        };
+        let Value::Number(check) = rate(
+            &Value::Number(360.0),
+            &Value::Number(-1100.0),
+            &Value::Number(200000.0),
+        )
+        .unwrap() else {
+            panic!("Expected Number");
+        };
+        assert!((monthly - check).abs() < 1e-9, "{} vs {}", monthly, check);
+
+        let flows = Value::Array(
+            [-100.0, 10.0, 10.0, 10.0]
+                .iter()
+                .map(|&cf| Value::Number(cf))
+                .collect(),
+        );
+        let Value::Number(loss) = irr(&flows).unwrap() else {
+            panic!("Expected Number");
+        };
+        let x = 1.0 / (1.0 + loss);
+        assert!((-100.0 + 10.0 * (x + x * x + x * x * x)).abs() < 1e-6);
+    }
+
+    #[test]
+    fn test_irr_multiple_roots_finds_nearest() {
+        // NPV is zero at both 10% and 20%
+        let flows = Value::Array(vec![
+            Value::Number(-100.0),
+            Value::Number(230.0),
+            Value::Number(-132.0),
+        ]);
+        let Value::Number(r) = irr(&flows).unwrap() else {
+            panic!("Expected Number");
+        };
+        assert!((r - 0.1).abs() < 1e-9, "{}", r);
+    }
 
     #[test]
     fn test_mirr_basic() {
@@ -3600,7 +3704,7 @@ mod tests {
         let nil_val = Value::Nil;
         let array_val = Value::Array(vec![]);
         let dict_val = Value::Dictionary(HashMap::new());
-        let symbol_val = Value::Symbol("test".to_string());
+        let symbol_val = Value::Symbol("test".into());
         let num_val = Value::Number(30000.0);
         let salvage_val = Value::Number(7500.0);
         let life_val = Value::Number(10.0);
@@ -4699,7 +4803,130 @@ mod tests {
             &Value::Number(1000.0),
             &Value::Number(1.0),
             &Value::Number(5.0),
-            &Value::Symbol("type".to_string()),
+            &Value::Symbol("type".into()),
+        );
+        assert!(matches!(result, Err(FunctionError::TypeError { .. })));
+    }
+
+    #[test]
+    fn test_cumipmt_cumprinc_match_sum_of_periods() {
+        for &type_ in &[0.0, 1.0] {
+            let args = |x: f64| Value::Number(x);
+            let mut interest = 0.0;
+            let mut principal = 0.0;
+            for period in 13..=24 {
+                let per = args(period as f64);
+                if let Value::Number(i) = ipmt(
+                    &args(0.005),
+                    &per,
+                    &args(360.0),
+                    &args(250000.0),
+                    &args(type_),
+                )
+                .unwrap()
+                {
+                    interest += i;
+                }
+                if let Value::Number(p) = ppmt(
+                    &args(0.005),
+                    &per,
+                    &args(360.0),
+                    &args(250000.0),
+                    &args(type_),
+                )
+                .unwrap()
+                {
+                    principal += p;
+                }
+            }
+
+            let range = [
+                args(0.005),
+                args(360.0),
+                args(250000.0),
+                args(13.0),
+                args(24.0),
+                args(type_),
+            ];
+            let [r, n, v, start, end, t] = &range;
+            let Value::Number(total_interest) = cumipmt(r, n, v, start, end, t).unwrap() else {
+                panic!("Expected Number");
+            };
+            let Value::Number(total_principal) = cumprinc(r, n, v, start, end, t).unwrap() else {
+                panic!("Expected Number");
+            };
+            assert!((total_interest - interest).abs() < 1e-6);
+            assert!((total_principal - principal).abs() < 1e-6);
+        }
+    }
+
+    #[test]
+    fn test_amortization_schedule_basic() {
+        let result = amortization_schedule(
+            &Value::Number(0.1 / 12.0),
+            &Value::Number(36.0),
+            &Value::Number(8000.0),
+            &Value::Number(0.0),
+        )
+        .unwrap();
+        let Value::Array(entries) = result else {
+            panic!("Expected Array");
+        };
+        assert_eq!(entries.len(), 36);
+
+        let field = |entry: &Value, key: &str| match entry {
+            Value::Dictionary(map) => match map.get(key) {
+                Some(Value::Number(n)) => *n,
+                other => panic!("Expected Number for {}, got {:?}", key, other),
+            },
+            _ => panic!("Expected Dictionary"),
+        };
+        for (i, entry) in entries.iter().enumerate() {
+            let per = Value::Number((i + 1) as f64);
+            let expected = |f: fn(&Value, &Value, &Value, &Value, &Value) -> _| match f(
+                &Value::Number(0.1 / 12.0),
+                &per,
+                &Value::Number(36.0),
+                &Value::Number(8000.0),
+                &Value::Number(0.0),
+            ) {
+                Ok(Value::Number(n)) => n,
+                _ => panic!("Expected Number"),
+            };
+            assert_eq!(field(entry, "period"), (i + 1) as f64);
+            assert!((field(entry, "payment") + 258.14).abs() < 0.01);
+            assert!((field(entry, "interest") - expected(ipmt)).abs() < 1e-9);
+            assert!((field(entry, "principal") - expected(ppmt)).abs() < 1e-9);
+        }
+        assert!((field(&entries[0], "balance") - (8000.0 - 191.47)).abs() < 0.01);
+        assert!(field(&entries[35], "balance").abs() < 1e-6);
+    }
+
+    #[test]
+    fn test_amortization_schedule_invalid_args() {
+        for nper in [0.0, -3.0, 12.5, 1e9] {
+            let result = amortization_schedule(
+                &Value::Number(0.01),
+                &Value::Number(nper),
+                &Value::Number(1000.0),
+                &Value::Number(0.0),
+            );
+            assert!(matches!(result, Err(FunctionError::ArgumentError { .. })));
+        }
+
+        let result = amortization_schedule(
+            &Value::Number(0.01),
+            &Value::Number(12.0),
+            &Value::Number(1000.0),
+            &Value::Number(2.0),
+        );
+        assert!(matches!(result, Err(FunctionError::ArgumentError { .. })));
+
+        let result = amortization_schedule(
+            &Value::Number(0.01),
+            &Value::Number(12.0),
+            &Value::String("1000".to_string()),
+            &Value::Number(0.0),
         );
         assert!(matches!(result, Err(FunctionError::TypeError { .. })));
     }
@@ -4881,7 +5108,7 @@ mod tests {
         let nil_val = Value::Nil;
         let array_val = Value::Array(vec![]);
         let dict_val = Value::Dictionary(std::collections::HashMap::new());
-        let symbol_val = Value::Symbol("test".to_string());
+        let symbol_val = Value::Symbol("test".into());
         let num_val = Value::Number(0.05);
         let npery_val = Value::Number(4.0);
 
@@ -5114,7 +5341,7 @@ mod tests {
         let nil_val = Value::Nil;
         let array_val = Value::Array(vec![]);
         let dict_val = Value::Dictionary(std::collections::HashMap::new());
-        let symbol_val = Value::Symbol("test".to_string());
+        let symbol_val = Value::Symbol("test".into());
         let num_val = Value::Number(0.05);
         let npery_val = Value::Number(4.0);
 
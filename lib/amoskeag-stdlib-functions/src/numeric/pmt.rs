@@ -1,5 +1,6 @@
 //! pmt function
 
+use super::amortization::Loan;
 use crate::{FunctionError, Value};
 
 /// Calculate the payment for a loan based on constant payments and a constant interest rate
@@ -27,28 +28,7 @@ pub fn pmt(rate: &Value, nper: &Value, pv: &Value, type_: &Value) -> Result<Valu
                 });
             }
 
-            // Handle zero interest rate case
-            if *r == 0.0 {
-                let payment = -*p / *n;
-                return Ok(Value::Number(if *t == 1.0 {
-                    payment / (1.0 + *r)
-                } else {
-                    payment
-                }));
-            }
-
-            // Standard formula: PMT = PV * (r * (1 + r)^n) / ((1 + r)^n - 1)
-            let factor = (1.0 + *r).powf(*n);
-            let payment = -*p * (*r * factor) / (factor - 1.0);
-
-            // For type 1, adjust payment
-            let adjusted_payment = if *t == 1.0 {
-                payment / (1.0 + *r)
-            } else {
-                payment
-            };
-
-            Ok(Value::Number(adjusted_payment))
+            Ok(Value::Number(Loan::new(*r, *n, *p, *t).payment()))
         }
         (Value::Number(_), Value::Number(_), Value::Number(_), _) => {
             Err(FunctionError::TypeError {
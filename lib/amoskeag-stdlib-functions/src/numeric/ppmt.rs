@@ -1,7 +1,6 @@
 //! ppmt function
 
-use super::ipmt::ipmt;
-use super::pmt::pmt;
+use super::amortization::Loan;
 use crate::{FunctionError, Value};
 
 /// Calculate the principal payment for a given period
@@ -21,10 +20,10 @@ pub fn ppmt(
 ) -> Result<Value, FunctionError> {
     match (rate, per, nper, pv, type_) {
         (
-            Value::Number(_),
+            Value::Number(r),
             Value::Number(p),
             Value::Number(n),
-            Value::Number(_),
+            Value::Number(v),
             Value::Number(t),
         ) => {
             if *p < 1.0 || *p > *n {
@@ -39,22 +38,8 @@ pub fn ppmt(
                 });
             }
 
-            // Calculate total payment
-            let payment = match pmt(rate, nper, pv, type_)? {
-                Value::Number(pmt) => pmt,
-                _ => unreachable!(),
-            };
-
-            // Calculate interest payment
-            let interest = match ipmt(rate, per, nper, pv, type_)? {
-                Value::Number(ipmt) => ipmt,
-                _ => unreachable!(),
-            };
-
             // Principal = Total Payment - Interest
-            let principal = payment - interest;
-
-            Ok(Value::Number(principal))
+            Ok(Value::Number(Loan::new(*r, *n, *v, *t).principal(*p)))
         }
         (Value::Number(_), Value::Number(_), Value::Number(_), Value::Number(_), _) => {
             Err(FunctionError::TypeError {
@@ -1,12 +1,20 @@
 //! rate function
 
+use super::solve;
 use crate::{FunctionError, Value};
 
+/// Lowest rate returned; a lower root is reported as this
+const MIN_RATE: f64 = 0.0001;
+
+/// Highest rate returned; a higher root is an error
+const MAX_RATE: f64 = 50.0;
+
 /// Calculate the interest rate per period
 /// rate(nper: Number, pmt: Number, pv: Number) -> Number
 ///
-/// Uses Newton-Raphson method to solve for rate
-/// This is an iterative numerical method as there's no closed-form solution
+/// Uses Newton's method, starting from an estimate of the rate and falling
+/// back to bisection whenever a step would leave the bracket around the
+/// root, as there's no closed-form solution
 ///
 /// Example: rate(48, -200, 8000) = monthly interest rate for a 48-month $8000 loan with $200 payments
 pub fn rate(nper: &Value, pmt: &Value, pv: &Value) -> Result<Value, FunctionError> {
@@ -29,54 +37,54 @@ pub fn rate(nper: &Value, pmt: &Value, pv: &Value) -> Result<Value, FunctionErro
                 return Ok(Value::Number(r));
             }
 
-            // Newton-Raphson method to solve for rate
-            // We're solving: PV + PMT * ((1 - (1+r)^-n) / r) = 0
-
-            let mut rate = if *v < 0.0 { 0.2 } else { 0.05 }; // Higher initial guess for investments
-            let tolerance = 1e-7;
-            let max_iterations = 2000;
-
-            for _ in 0..max_iterations {
-                let r = rate;
-                let one_plus_r: f64 = 1.0 + r;
-                let factor = one_plus_r.powf(*n);
-                let p_inv = 1.0 / factor;
-
-                // f(r) = PV + PMT * ((1 - (1+r)^-n) / r)
-                let f = v + p * ((1.0 - p_inv) / r);
-
-                // f'(r) = PMT * [(-r*n/(1+r)^(n+1) - 1 + (1+r)^-n) / r^2]
-                let df = p * ((-r * n * p_inv / one_plus_r - 1.0 + p_inv) / (r * r));
-
-                if df.abs() < tolerance {
-                    return Err(FunctionError::ArgumentError {
-                        message: "rate calculation did not converge".to_string(),
-                    });
-                }
-
-                let new_rate = rate - f / df;
+            // Solve PV + PMT * ((1 - (1+r)^-n) / r) = 0. The annuity factor
+            // falls as r rises, so there's exactly one root when PMT and PV
+            // have opposite signs, and none otherwise.
+            let sign = *p * *v;
+            if sign >= 0.0 || sign.is_nan() {
+                return Err(FunctionError::ArgumentError {
+                    message: "rate calculation did not converge to a reasonable value".to_string(),
+                });
+            }
 
-                // Constrain rate to non-negative for financial calculations
-                let new_rate = new_rate.max(0.0001);
+            let f = |r: f64| {
+                let log_discount = -*n * r.ln_1p();
+                let annuity = -log_discount.exp_m1() / r;
+                let slope = (*n * log_discount.exp() / (1.0 + r) - annuity) / r;
+                (*v + *p * annuity, *p * slope)
+            };
 
-                if (new_rate - rate).abs() < tolerance {
-                    return Ok(Value::Number(new_rate));
-                }
+            // Below the root f has the sign of PMT, above it the sign of PV.
+            // A root below the lowest rate is reported as the lowest rate.
+            let (f_min, _) = f(MIN_RATE);
+            if f_min == 0.0 || f_min.signum() == v.signum() {
+                return Ok(Value::Number(MIN_RATE));
+            }
+            let (f_max, _) = f(MAX_RATE);
+            if f_max.signum() != v.signum() && f_max != 0.0 {
+                return Err(FunctionError::ArgumentError {
+                    message: "rate calculation did not converge to a reasonable value".to_string(),
+                });
+            }
 
-                rate = new_rate;
+            // Start from whichever is closer of the root of the annuity
+            // factor's second-order expansion, n * (1 - (n+1) * r / 2), good
+            // for small rates, and the perpetuity rate -PMT / PV, good for
+            // large ones
+            let small = 2.0 * (-*p * *n / *v - 1.0) / (*n + 1.0);
+            let large = -*p / *v;
+            let guess = [small, large]
+                .into_iter()
+                .filter(|r| (MIN_RATE..=MAX_RATE).contains(r))
+                .min_by(|a, b| f(*a).0.abs().total_cmp(&f(*b).0.abs()))
+                .unwrap_or(MIN_RATE);
 
-                // Ensure rate stays in reasonable bounds
-                if !(0.0001..=50.0).contains(&rate) {
-                    return Err(FunctionError::ArgumentError {
-                        message: "rate calculation did not converge to a reasonable value"
-                            .to_string(),
-                    });
-                }
+            match solve::bracketed(f, MIN_RATE, MAX_RATE, guess) {
+                Some(r) => Ok(Value::Number(r)),
+                None => Err(FunctionError::ArgumentError {
+                    message: "rate calculation did not converge".to_string(),
+                }),
             }
-
-            Err(FunctionError::ArgumentError {
-                message: "rate calculation exceeded maximum iterations".to_string(),
-            })
         }
         (Value::Number(_), Value::Number(_), _) => Err(FunctionError::TypeError {
             expected: "Number".to_string(),
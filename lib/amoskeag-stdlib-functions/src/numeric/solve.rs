@@ -0,0 +1,77 @@
+//! Root finding shared by the rate solvers
+
+/// How close two successive estimates must be to stop
+pub(crate) const TOLERANCE: f64 = 1e-12;
+
+/// Upper bound on iterations, which bisection alone reaches long before
+const MAX_ITERATIONS: usize = 200;
+
+/// Find a root of `f` between `lo` and `hi`, starting from `guess`
+///
+/// `f` returns its value and derivative at a point, and must have opposite
+/// signs at `lo` and `hi`. Each step is a Newton step when that lands
+/// inside the bracket still known to hold the root, and bisects it
+/// otherwise, so it converges as fast as Newton's method near the root
+/// and can't diverge away from it. Returns `None` only if `f` isn't
+/// finite.
+pub(crate) fn bracketed(
+    f: impl Fn(f64) -> (f64, f64),
+    mut lo: f64,
+    mut hi: f64,
+    guess: f64,
+) -> Option<f64> {
+    let (f_lo, _) = f(lo);
+    let lo_sign = f_lo.signum();
+    let mut x = if guess > lo && guess < hi {
+        guess
+    } else {
+        lo + (hi - lo) / 2.0
+    };
+
+    for _ in 0..MAX_ITERATIONS {
+        let (value, slope) = f(x);
+        if value == 0.0 {
+            return Some(x);
+        }
+        if !value.is_finite() {
+            return None;
+        }
+        if value.signum() == lo_sign {
+            lo = x;
+        } else {
+            hi = x;
+        }
+
+        let newton = x - value / slope;
+        let next = if newton > lo && newton < hi {
+            newton
+        } else {
+            lo + (hi - lo) / 2.0
+        };
+        if (next - x).abs() <= TOLERANCE * x.abs().max(1.0) || hi - lo <= TOLERANCE {
+            return Some(next);
+        }
+        x = next;
+    }
+    Some(x)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bracketed_finds_root_from_any_guess() {
+        // x^3 - 2x - 5, root near 2.0945515
+        let f = |x: f64| (x * x * x - 2.0 * x - 5.0, 3.0 * x * x - 2.0);
+        for &guess in &[-10.0, 0.0, 0.5, 2.0, 3.0, 100.0] {
+            let root = bracketed(f, 0.0, 4.0, guess).unwrap();
+            assert!((root - 2.0945514815423265).abs() < 1e-10, "{}", root);
+        }
+    }
+
+    #[test]
+    fn test_bracketed_not_finite() {
+        assert_eq!(bracketed(|_| (f64::NAN, 1.0), 0.0, 1.0, 0.5), None);
+    }
+}
@@ -0,0 +1,170 @@
+//! Hash set of values
+//!
+//! `ValueSet` gives expected constant-time membership tests with exactly the
+//! semantics of `==` on `Value`, which is what `contains` and `uniq` use.
+//! `Value` can't implement `Eq` (NaN is not equal to itself), so rather than
+//! wrapping it for `HashSet`, the set keeps its values in insertion order and
+//! indexes them with an open-addressing table of positions.
+
+use crate::Value;
+use std::hash::{BuildHasher, RandomState};
+
+/// A set of values, in insertion order
+#[derive(Debug, Clone)]
+pub struct ValueSet {
+    values: Vec<Value>,
+    hashes: Vec<u64>,
+    /// Open-addressing table; each slot holds a position in `values` plus
+    /// one, or 0 if empty. Its length is a power of two.
+    slots: Vec<u32>,
+    state: RandomState,
+}
+
+impl ValueSet {
+    /// Create an empty set
+    pub fn new() -> Self {
+        Self::with_capacity(0)
+    }
+
+    /// Create an empty set with room for `capacity` values
+    pub fn with_capacity(capacity: usize) -> Self {
+        ValueSet {
+            values: Vec::with_capacity(capacity),
+            hashes: Vec::with_capacity(capacity),
+            slots: vec![0; slot_count(capacity)],
+            state: RandomState::new(),
+        }
+    }
+
+    /// Whether the set contains a value equal to `value`
+    pub fn contains(&self, value: &Value) -> bool {
+        let hash = self.state.hash_one(value);
+        self.find(hash, value).is_ok()
+    }
+
+    /// Add a copy of `value` unless the set already contains an equal value
+    ///
+    /// Returns whether the value was added.
+    pub fn insert(&mut self, value: &Value) -> bool {
+        let hash = self.state.hash_one(value);
+        let Err(slot) = self.find(hash, value) else {
+            return false;
+        };
+
+        self.values.push(value.clone());
+        self.hashes.push(hash);
+        self.slots[slot] = u32::try_from(self.values.len()).expect("set too large");
+
+        // Keep the table at most half full
+        if self.values.len() * 2 > self.slots.len() {
+            self.grow();
+        }
+        true
+    }
+
+    /// Number of values in the set
+    pub fn len(&self) -> usize {
+        self.values.len()
+    }
+
+    /// Whether the set is empty
+    pub fn is_empty(&self) -> bool {
+        self.values.is_empty()
+    }
+
+    /// The values, in the order they were first inserted
+    pub fn values(&self) -> &[Value] {
+        &self.values
+    }
+
+    /// Consume the set, returning its values in insertion order
+    pub fn into_values(self) -> Vec<Value> {
+        self.values
+    }
+
+    /// Find the slot holding `value`, or the empty slot where it would go
+    fn find(&self, hash: u64, value: &Value) -> Result<usize, usize> {
+        let mask = self.slots.len() - 1;
+        let mut slot = hash as usize & mask;
+        loop {
+            match self.slots[slot] {
+                0 => return Err(slot),
+                entry => {
+                    let index = entry as usize - 1;
+                    if self.hashes[index] == hash && self.values[index] == *value {
+                        return Ok(slot);
+                    }
+                }
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    fn grow(&mut self) {
+        let mut slots = vec![0; self.slots.len() * 2];
+        let mask = slots.len() - 1;
+        for (index, &hash) in self.hashes.iter().enumerate() {
+            let mut slot = hash as usize & mask;
+            while slots[slot] != 0 {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = index as u32 + 1;
+        }
+        self.slots = slots;
+    }
+}
+
+impl Default for ValueSet {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Two sets are equal if they hold the same values in the same order
+impl PartialEq for ValueSet {
+    fn eq(&self, other: &Self) -> bool {
+        self.values == other.values
+    }
+}
+
+impl<'v> FromIterator<&'v Value> for ValueSet {
+    fn from_iter<I: IntoIterator<Item = &'v Value>>(iter: I) -> Self {
+        let iter = iter.into_iter();
+        let mut set = ValueSet::with_capacity(iter.size_hint().0);
+        for value in iter {
+            set.insert(value);
+        }
+        set
+    }
+}
+
+/// Smallest power-of-two table that keeps `capacity` values at most half full
+fn slot_count(capacity: usize) -> usize {
+    (capacity * 2).next_power_of_two().max(8)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_value_set_membership() {
+        let mut set = ValueSet::new();
+        for i in 0..1000 {
+            assert!(set.insert(&Value::Number((i % 100) as f64)) == (i < 100));
+        }
+        assert_eq!(set.len(), 100);
+        assert!(set.contains(&Value::Number(42.0)));
+        assert!(set.contains(&Value::Number(-0.0)));
+        assert!(!set.contains(&Value::String("42".to_string())));
+        assert_eq!(set.values()[..3], [0.0, 1.0, 2.0].map(Value::Number));
+    }
+
+    #[test]
+    fn test_value_set_nan_is_never_a_member() {
+        let mut set = ValueSet::new();
+        assert!(set.insert(&Value::Number(f64::NAN)));
+        assert!(set.insert(&Value::Number(f64::NAN)));
+        assert!(!set.contains(&Value::Number(f64::NAN)));
+    }
+}
@@ -3,7 +3,14 @@
 //! This crate implements the core operators for the Amoskeag language,
 //! including arithmetic, comparison, and logical operators.
 
+use std::collections::hash_map::DefaultHasher;
 use std::collections::HashMap;
+use std::fmt::Write as _;
+use std::hash::{Hash, Hasher};
+
+mod symbol;
+
+pub use symbol::Symbol;
 
 /// The core Value type for Amoskeag
 /// Represents all possible values in the language
@@ -15,7 +22,7 @@ pub enum Value {
     Nil,
     Array(Vec<Value>),
     Dictionary(HashMap<String, Value>),
-    Symbol(String),
+    Symbol(Symbol),
 }
 
 impl std::fmt::Display for Value {
@@ -98,6 +105,46 @@ impl Value {
     }
 }
 
+/// Hashing consistent with `==`: values that compare equal hash equally
+///
+/// Numbers hash by value, so `0.0` and `-0.0` hash the same. Every NaN hashes
+/// the same, though NaN never compares equal to anything. Dictionaries hash
+/// independently of iteration order.
+impl Hash for Value {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        std::mem::discriminant(self).hash(state);
+        match self {
+            Value::Number(n) => {
+                let bits = if *n == 0.0 {
+                    0
+                } else if n.is_nan() {
+                    f64::NAN.to_bits()
+                } else {
+                    n.to_bits()
+                };
+                state.write_u64(bits);
+            }
+            Value::String(s) => s.hash(state),
+            Value::Boolean(b) => b.hash(state),
+            Value::Nil => {}
+            Value::Array(items) => items.hash(state),
+            Value::Dictionary(dict) => {
+                // Combine entry hashes commutatively so order doesn't matter
+                let mut combined: u64 = 0;
+                for (key, value) in dict {
+                    let mut entry = DefaultHasher::new();
+                    key.hash(&mut entry);
+                    value.hash(&mut entry);
+                    combined = combined.wrapping_add(entry.finish());
+                }
+                state.write_usize(dict.len());
+                state.write_u64(combined);
+            }
+            Value::Symbol(s) => s.hash(state),
+        }
+    }
+}
+
 // Arithmetic Operators
 
 /// Addition operator (+)
@@ -114,6 +161,25 @@ pub fn add(left: &Value, right: &Value) -> Result<Value, OperatorError> {
     }
 }
 
+/// Addition operator (+) on an owned left operand
+///
+/// Gives the same result as `add`, but extends a string on the left in
+/// place instead of copying it, so a chain of `+` that builds a string
+/// copies each part once rather than the whole string at every step.
+pub fn add_owned(left: Value, right: &Value) -> Result<Value, OperatorError> {
+    match (left, right) {
+        (Value::String(mut l), Value::String(r)) => {
+            l.push_str(r);
+            Ok(Value::String(l))
+        }
+        (Value::String(mut l), _) => {
+            write!(l, "{}", right).expect("writing to a String cannot fail");
+            Ok(Value::String(l))
+        }
+        (left, _) => add(&left, right),
+    }
+}
+
 /// Subtraction operator (-)
 pub fn subtract(left: &Value, right: &Value) -> Result<Value, OperatorError> {
     match (left, right) {
@@ -590,7 +656,27 @@ mod tests {
         assert_eq!(Value::Nil.type_name(), "Nil");
         assert_eq!(Value::Array(vec![]).type_name(), "Array");
         assert_eq!(Value::Dictionary(HashMap::new()).type_name(), "Dictionary");
-        assert_eq!(Value::Symbol("test".to_string()).type_name(), "Symbol");
+        assert_eq!(Value::Symbol("test".into()).type_name(), "Symbol");
+    }
+
+    #[test]
+    fn test_add_owned_matches_add() {
+        let values = [
+            Value::Number(2.5),
+            Value::String("total: ".to_string()),
+            Value::Boolean(true),
+            Value::Nil,
+            Value::Array(vec![Value::Number(1.0)]),
+        ];
+        for left in &values {
+            for right in &values {
+                match (add(left, right), add_owned(left.clone(), right)) {
+                    (Ok(a), Ok(b)) => assert_eq!(a, b),
+                    (Err(a), Err(b)) => assert_eq!(a.to_string(), b.to_string()),
+                    (a, b) => panic!("{:?} + {:?}: {:?} != {:?}", left, right, a, b),
+                }
+            }
+        }
     }
 
     #[test]
@@ -640,4 +726,31 @@ mod tests {
         };
         assert_eq!(format!("{}", err), "Invalid operation: Number + String");
     }
+
+    #[test]
+    fn test_hash_matches_equality() {
+        fn hash_of(value: &Value) -> u64 {
+            let mut hasher = DefaultHasher::new();
+            value.hash(&mut hasher);
+            hasher.finish()
+        }
+
+        assert_eq!(hash_of(&Value::Number(0.0)), hash_of(&Value::Number(-0.0)));
+        assert_ne!(
+            hash_of(&Value::Number(1.0)),
+            hash_of(&Value::String("1".to_string()))
+        );
+
+        let mut a = HashMap::new();
+        let mut b = HashMap::new();
+        for i in 0..10 {
+            a.insert(format!("k{}", i), Value::Number(i as f64));
+        }
+        for i in (0..10).rev() {
+            b.insert(format!("k{}", i), Value::Number(i as f64));
+        }
+        let (a, b) = (Value::Dictionary(a), Value::Dictionary(b));
+        assert_eq!(a, b);
+        assert_eq!(hash_of(&a), hash_of(&b));
+    }
 }
@@ -0,0 +1,168 @@
+//! Interned symbols
+//!
+//! Every symbol name is stored once per process. A `Symbol` is a shared
+//! handle to that copy, so cloning one never allocates and two symbols are
+//! equal exactly when they have the same name. Programs only intern
+//! symbols from their validated symbol tables and literals, so the set of
+//! names stays small; symbols decoded from data use [`Symbol::lookup`],
+//! which never adds a name.
+
+use std::borrow::Borrow;
+use std::collections::HashSet;
+use std::fmt;
+use std::hash::{Hash, Hasher};
+use std::ops::Deref;
+use std::sync::{Arc, OnceLock, RwLock};
+
+/// An interned symbol name, such as `approve` for `:approve`
+#[derive(Clone)]
+pub struct Symbol(Arc<str>);
+
+fn names() -> &'static RwLock<HashSet<Arc<str>>> {
+    static NAMES: OnceLock<RwLock<HashSet<Arc<str>>>> = OnceLock::new();
+    NAMES.get_or_init(Default::default)
+}
+
+impl Symbol {
+    /// Intern `name`, returning the shared symbol for it
+    pub fn new(name: &str) -> Symbol {
+        if let Some(interned) = Symbol::interned(name) {
+            return interned;
+        }
+        let mut names = names().write().unwrap_or_else(|e| e.into_inner());
+        if let Some(interned) = names.get(name) {
+            return Symbol(Arc::clone(interned));
+        }
+        let interned: Arc<str> = Arc::from(name);
+        names.insert(Arc::clone(&interned));
+        Symbol(interned)
+    }
+
+    /// The shared symbol for `name` if it is interned, or else a symbol of
+    /// its own
+    ///
+    /// Unlike [`Symbol::new`] this never grows the table, so it suits names
+    /// that come from data rather than from a program. A name no program has
+    /// interned can't be one of its symbols, and only compares equal by name.
+    pub fn lookup(name: &str) -> Symbol {
+        Symbol::interned(name).unwrap_or_else(|| Symbol(Arc::from(name)))
+    }
+
+    fn interned(name: &str) -> Option<Symbol> {
+        let names = names().read().unwrap_or_else(|e| e.into_inner());
+        names.get(name).map(|interned| Symbol(Arc::clone(interned)))
+    }
+
+    /// The symbol's name, without the leading colon
+    pub fn as_str(&self) -> &str {
+        &self.0
+    }
+}
+
+impl PartialEq for Symbol {
+    fn eq(&self, other: &Symbol) -> bool {
+        // Interned symbols with the same name share it, so comparing names
+        // is only needed when one of them came from `lookup`
+        Arc::ptr_eq(&self.0, &other.0) || self.0 == other.0
+    }
+}
+
+impl Eq for Symbol {}
+
+impl Hash for Symbol {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.0.hash(state)
+    }
+}
+
+impl PartialEq<str> for Symbol {
+    fn eq(&self, other: &str) -> bool {
+        &*self.0 == other
+    }
+}
+
+impl PartialEq<&str> for Symbol {
+    fn eq(&self, other: &&str) -> bool {
+        &*self.0 == *other
+    }
+}
+
+impl Deref for Symbol {
+    type Target = str;
+
+    fn deref(&self) -> &str {
+        &self.0
+    }
+}
+
+impl AsRef<str> for Symbol {
+    fn as_ref(&self) -> &str {
+        &self.0
+    }
+}
+
+impl Borrow<str> for Symbol {
+    fn borrow(&self) -> &str {
+        &self.0
+    }
+}
+
+impl From<&str> for Symbol {
+    fn from(name: &str) -> Symbol {
+        Symbol::new(name)
+    }
+}
+
+impl From<String> for Symbol {
+    fn from(name: String) -> Symbol {
+        Symbol::new(&name)
+    }
+}
+
+impl From<&String> for Symbol {
+    fn from(name: &String) -> Symbol {
+        Symbol::new(name)
+    }
+}
+
+impl fmt::Debug for Symbol {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        fmt::Debug::fmt(&*self.0, f)
+    }
+}
+
+impl fmt::Display for Symbol {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str(&self.0)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_symbols_are_interned() {
+        let a = Symbol::new("approve");
+        let b = Symbol::from("approve".to_string());
+        assert_eq!(a, b);
+        assert!(Arc::ptr_eq(&a.0, &b.0));
+        assert_ne!(a, Symbol::new("deny"));
+        assert_eq!(a, "approve");
+        assert_eq!(format!("{} {:?}", a, a), "approve \"approve\"");
+    }
+
+    #[test]
+    fn test_lookup_does_not_intern() {
+        let name = "symbol-lookup-test-name";
+        let looked_up = Symbol::lookup(name);
+        assert!(!names().read().unwrap().contains(name));
+        assert_eq!(looked_up, Symbol::lookup(name));
+        assert_eq!(looked_up, name);
+
+        let interned = Symbol::new(name);
+        assert_eq!(looked_up, interned);
+        assert!(Arc::ptr_eq(&Symbol::lookup(name).0, &interned.0));
+        assert_ne!(Symbol::lookup("symbol-lookup-other"), interned);
+    }
+}
@@ -0,0 +1,321 @@
+//! Compiling rules from a build script
+//!
+//! `Rules` collects a set of named rules, parses them, checks their symbols,
+//! and transpiles them into one Rust source file in `OUT_DIR`. The crate
+//! being built includes that file with `amoskeag::include_rules!` and calls
+//! the rules as native functions.
+//!
+//! ```no_run
+//! // in build.rs
+//! amoskeag_transpiler::build::Rules::new()
+//!     .dir("rules")
+//!     .symbols(&["approve", "deny"])
+//!     .compile()
+//!     .expect("failed to compile rules");
+//! ```
+//!
+//! A rule that doesn't parse or uses a symbol it wasn't given fails the
+//! build script, naming the rule. Calls to undefined functions, or with the
+//! wrong number of arguments, fail the build when the generated code is
+//! compiled.
+
+use crate::{TranspileError, Transpiler};
+use amoskeag_parser::{parse, Expr};
+use std::collections::{BTreeMap, HashSet};
+use std::fs;
+use std::io;
+use std::path::{Path, PathBuf};
+use thiserror::Error;
+
+/// Extension of Amoskeag source files
+const SOURCE_EXTENSION: &str = "amos";
+
+/// Name of the output file, without its extension, by default
+const DEFAULT_OUTPUT: &str = "amoskeag_rules";
+
+/// Errors that can occur compiling rules
+#[derive(Error, Debug)]
+pub enum BuildError {
+    #[error("Failed to read {}: {source}", path.display())]
+    Io {
+        path: PathBuf,
+        #[source]
+        source: io::Error,
+    },
+
+    #[error("Failed to write {}: {source}", path.display())]
+    Write {
+        path: PathBuf,
+        #[source]
+        source: io::Error,
+    },
+
+    #[error("Rule '{rule}' failed to parse: {message}")]
+    Parse { rule: String, message: String },
+
+    #[error(
+        "Rule '{rule}' uses the symbol '{symbol}', which is not defined in the execution contract"
+    )]
+    UndefinedSymbol { rule: String, symbol: String },
+
+    #[error("Failed to transpile rules: {0}")]
+    Transpile(#[from] TranspileError),
+
+    #[error("Rule '{0}' is defined more than once")]
+    DuplicateRule(String),
+
+    #[error("OUT_DIR is not set; rules can only be compiled from a build script")]
+    NoOutDir,
+}
+
+/// Where a rule's source comes from
+enum Source {
+    File(PathBuf),
+    Text(String),
+}
+
+/// A set of rules to compile to native code
+pub struct Rules {
+    rules: Vec<(String, Source)>,
+    dirs: Vec<PathBuf>,
+    symbols: Vec<String>,
+    output: String,
+}
+
+impl Rules {
+    /// Create an empty set of rules
+    pub fn new() -> Self {
+        Self {
+            rules: Vec::new(),
+            dirs: Vec::new(),
+            symbols: Vec::new(),
+            output: DEFAULT_OUTPUT.to_string(),
+        }
+    }
+
+    /// Add every `.amos` file in `dir`, each named after its file stem
+    pub fn dir(mut self, dir: impl AsRef<Path>) -> Self {
+        self.dirs.push(dir.as_ref().to_path_buf());
+        self
+    }
+
+    /// Add the rule `name` from the file at `path`
+    pub fn file(mut self, name: &str, path: impl AsRef<Path>) -> Self {
+        self.rules
+            .push((name.to_string(), Source::File(path.as_ref().to_path_buf())));
+        self
+    }
+
+    /// Add the rule `name` from its source
+    pub fn source(mut self, name: &str, source: &str) -> Self {
+        self.rules
+            .push((name.to_string(), Source::Text(source.to_string())));
+        self
+    }
+
+    /// Set the symbols the rules may use
+    pub fn symbols(mut self, symbols: &[&str]) -> Self {
+        self.symbols = symbols.iter().map(|s| s.to_string()).collect();
+        self
+    }
+
+    /// Set the name of the output, for including it with
+    /// `amoskeag::include_rules!(name)`
+    ///
+    /// The default is `amoskeag_rules`, which `include_rules!()` includes.
+    pub fn output(mut self, name: &str) -> Self {
+        self.output = name.to_string();
+        self
+    }
+
+    /// Compile the rules and write them to `OUT_DIR`
+    ///
+    /// Also tells Cargo to rerun the build script when a rule file or
+    /// directory changes. Returns the path written.
+    ///
+    /// # Errors
+    /// Returns an error when a rule can't be read or doesn't compile, when
+    /// two rules have the same name, or when run outside a build script.
+    pub fn compile(&self) -> Result<PathBuf, BuildError> {
+        let out_dir = std::env::var_os("OUT_DIR").ok_or(BuildError::NoOutDir)?;
+        for dir in &self.dirs {
+            println!("cargo:rerun-if-changed={}", dir.display());
+        }
+        for (_, source) in &self.rules {
+            if let Source::File(path) = source {
+                println!("cargo:rerun-if-changed={}", path.display());
+            }
+        }
+
+        let code = self.generate()?;
+        let path = Path::new(&out_dir).join(format!("{}.rs", self.output));
+        fs::write(&path, code).map_err(|source| BuildError::Write {
+            path: path.clone(),
+            source,
+        })?;
+        Ok(path)
+    }
+
+    /// Compile the rules to Rust source, without writing anything
+    pub fn generate(&self) -> Result<String, BuildError> {
+        // Rules are ordered by name so the output doesn't depend on the
+        // order of directory entries
+        let mut sources = BTreeMap::new();
+        for dir in &self.dirs {
+            for (name, path) in read_dir(dir)? {
+                if sources.insert(name.clone(), read(&path)?).is_some() {
+                    return Err(BuildError::DuplicateRule(name));
+                }
+            }
+        }
+        for (name, source) in &self.rules {
+            let source = match source {
+                Source::File(path) => read(path)?,
+                Source::Text(text) => text.clone(),
+            };
+            if sources.insert(name.clone(), source).is_some() {
+                return Err(BuildError::DuplicateRule(name.clone()));
+            }
+        }
+
+        let symbols: HashSet<&str> = self.symbols.iter().map(String::as_str).collect();
+        let mut programs = Vec::with_capacity(sources.len());
+        for (name, source) in &sources {
+            let expr = parse(source).map_err(|e| BuildError::Parse {
+                rule: name.clone(),
+                message: e.to_string(),
+            })?;
+            if let Some(symbol) = undefined_symbol(&expr, &symbols) {
+                return Err(BuildError::UndefinedSymbol {
+                    rule: name.clone(),
+                    symbol: symbol.to_string(),
+                });
+            }
+            programs.push((name.as_str(), expr));
+        }
+
+        let rules: Vec<(&str, &Expr)> = programs.iter().map(|(name, expr)| (*name, expr)).collect();
+        Ok(Transpiler::new().transpile_rules(&rules)?)
+    }
+}
+
+impl Default for Rules {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// The `.amos` files in `dir`, as (rule name, path)
+fn read_dir(dir: &Path) -> Result<Vec<(String, PathBuf)>, BuildError> {
+    let entries = fs::read_dir(dir).map_err(|source| BuildError::Io {
+        path: dir.to_path_buf(),
+        source,
+    })?;
+    let mut rules = Vec::new();
+    for entry in entries {
+        let path = entry
+            .map_err(|source| BuildError::Io {
+                path: dir.to_path_buf(),
+                source,
+            })?
+            .path();
+        if path.extension().is_some_and(|ext| ext == SOURCE_EXTENSION) {
+            if let Some(stem) = path.file_stem() {
+                rules.push((stem.to_string_lossy().into_owned(), path));
+            }
+        }
+    }
+    Ok(rules)
+}
+
+/// The first symbol `expr` uses that isn't in `symbols`
+fn undefined_symbol<'e>(expr: &'e Expr, symbols: &HashSet<&str>) -> Option<&'e str> {
+    let mut pending = vec![expr];
+    while let Some(expr) = pending.pop() {
+        match expr {
+            Expr::Symbol(symbol) if !symbols.contains(symbol.as_str()) => return Some(symbol),
+            Expr::Number(_)
+            | Expr::String(_)
+            | Expr::Boolean(_)
+            | Expr::Nil
+            | Expr::Symbol(_)
+            | Expr::Variable(_) => {}
+            Expr::Array(items) => pending.extend(items),
+            Expr::Dictionary(pairs) => pending.extend(pairs.iter().map(|(_, value)| value)),
+            Expr::FunctionCall { args, .. } => pending.extend(args),
+            Expr::Let { value, body, .. } => pending.extend([&**value, &**body]),
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => pending.extend([&**condition, &**then_branch, &**else_branch]),
+            Expr::Binary { left, right, .. } | Expr::Pipe { left, right } => {
+                pending.extend([&**left, &**right])
+            }
+            Expr::Unary { operand, .. } => pending.push(operand),
+        }
+    }
+    None
+}
+
+fn read(path: &Path) -> Result<String, BuildError> {
+    fs::read_to_string(path).map_err(|source| BuildError::Io {
+        path: path.to_path_buf(),
+        source,
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn temp_dir(name: &str) -> PathBuf {
+        let dir = std::env::temp_dir().join(format!(
+            "amoskeag-transpiler-{}-{}",
+            name,
+            std::process::id()
+        ));
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    #[test]
+    fn test_generate_from_dir_and_sources() {
+        let dir = temp_dir("generate");
+        fs::write(dir.join("premium.amos"), "base * 1.2").unwrap();
+        fs::write(dir.join("notes.txt"), "not a rule").unwrap();
+
+        let code = Rules::new()
+            .dir(&dir)
+            .source("decision", "if score > 5 then :approve else :deny end")
+            .symbols(&["approve", "deny"])
+            .generate()
+            .unwrap();
+        assert!(code.contains("pub const RULES: &[&str] = &[\"decision\", \"premium\", ];"));
+        assert!(code.contains("pub fn premium(data: &Data)"));
+        assert!(!code.contains("notes"));
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn test_generate_errors() {
+        let result = Rules::new()
+            .source("bad", "[1, {\"k\": :unknown}]")
+            .symbols(&["known"])
+            .generate();
+        assert!(matches!(
+            result,
+            Err(BuildError::UndefinedSymbol { rule, symbol }) if rule == "bad" && symbol == "unknown"
+        ));
+
+        let result = Rules::new().source("bad", "1 +").generate();
+        assert!(matches!(result, Err(BuildError::Parse { rule, .. }) if rule == "bad"));
+
+        let result = Rules::new().source("a", "1").source("a", "2").generate();
+        assert!(matches!(result, Err(BuildError::DuplicateRule(rule)) if rule == "a"));
+
+        let result = Rules::new().dir("/nonexistent/rules").generate();
+        assert!(matches!(result, Err(BuildError::Io { .. })));
+    }
+}
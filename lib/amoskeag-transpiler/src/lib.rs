@@ -1,10 +1,33 @@
 //! Amoskeag to Rust Transpiler
 //!
-//! This crate provides functionality to transpile Amoskeag AST into Rust source code.
-//! The generated Rust code uses the amoskeag-stdlib-operators and amoskeag-stdlib-functions
-//! to maintain semantic equivalence with the interpreted version.
+//! This crate transpiles Amoskeag programs into Rust source code, to be
+//! compiled into a host as native code. The generated code calls into
+//! `amoskeag::native` for variable lookup, stdlib functions, and operators
+//! on values of unknown type, so it returns exactly what the interpreter
+//! returns for the same program and data, errors included.
+//!
+//! Each expression is generated as one of three Rust types. Number literals
+//! and arithmetic are plain `f64`, comparisons and logical operators plain
+//! `bool`, and everything else a `Cow<Value>`. Arithmetic always produces a
+//! number when it succeeds, so `(record.f0 - record.f1) * 2 > base` only
+//! touches a `Value` to read the two fields, and `let` bindings of numbers
+//! become `f64` locals. Each data path a rule reads is looked up once, at
+//! the start of its function, however many times the rule reads it.
+//!
+//! Calls name the stdlib function they call, and the generated code turns
+//! each name into a function id with `amoskeag::native::function_id` in a
+//! constant. An undefined function or a wrong number of arguments therefore
+//! fails when the generated code is compiled. This crate doesn't depend on
+//! `amoskeag` itself, so that a build script using it doesn't build a
+//! second copy of that crate for the host.
+//!
+//! `build` compiles a set of rules from a build script, and
+//! `amoskeag::include_rules!` includes the result in the crate being built.
+
+pub mod build;
 
 use amoskeag_parser::{BinaryOp, Expr, UnaryOp};
+use std::collections::{HashMap, HashSet};
 use std::fmt::Write;
 use thiserror::Error;
 
@@ -16,6 +39,9 @@ pub enum TranspileError {
 
     #[error("Unsupported expression: {0}")]
     UnsupportedExpression(String),
+
+    #[error("Rule '{0}' has the same Rust name as another rule")]
+    DuplicateName(String),
 }
 
 /// Configuration for the transpiler
@@ -39,19 +65,117 @@ impl Default for TranspilerConfig {
     }
 }
 
+/// Lints that the generated code, written for simplicity, would trigger
+const ALLOW: &str = "#[allow(unused_parens, unused_braces, unused_variables, clippy::all)]";
+
+/// Names a generated rule function can't take
+const RESERVED: &[&str] = &[
+    "abstract", "as", "async", "await", "become", "box", "break", "const", "continue", "crate",
+    "do", "dyn", "else", "enum", "evaluate", "extern", "false", "final", "fn", "for", "gen", "if",
+    "impl", "in", "let", "loop", "macro", "match", "mod", "move", "mut", "native", "override",
+    "priv", "pub", "ref", "return", "self", "static", "struct", "super", "trait", "true", "try",
+    "type", "typeof", "union", "unsafe", "unsized", "use", "virtual", "where", "while", "yield",
+];
+
+/// The Rust type an expression is generated as
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Kind {
+    /// An unboxed `f64`
+    Number,
+    /// An unboxed `bool`
+    Boolean,
+    /// A `Cow<Value>`
+    Value,
+}
+
+/// A Rust expression generated for an Amoskeag expression
+struct Code {
+    kind: Kind,
+    code: String,
+}
+
+impl Code {
+    fn number(code: String) -> Self {
+        Self {
+            kind: Kind::Number,
+            code,
+        }
+    }
+
+    fn boolean(code: String) -> Self {
+        Self {
+            kind: Kind::Boolean,
+            code,
+        }
+    }
+
+    fn value(code: String) -> Self {
+        Self {
+            kind: Kind::Value,
+            code,
+        }
+    }
+
+    /// The expression as a `Cow<Value>`
+    fn into_value(self) -> String {
+        match self.kind {
+            Kind::Number => format!("native::owned(Value::Number({}))", self.code),
+            Kind::Boolean => format!("native::owned(Value::Boolean({}))", self.code),
+            Kind::Value => self.code,
+        }
+    }
+
+    /// The expression as an owned `Value`
+    fn into_owned(self) -> String {
+        match self.kind {
+            Kind::Number => format!("Value::Number({})", self.code),
+            Kind::Boolean => format!("Value::Boolean({})", self.code),
+            Kind::Value => format!("({}).into_owned()", self.code),
+        }
+    }
+
+    /// The expression as a `&Value`
+    fn into_ref(self) -> String {
+        match self.kind {
+            Kind::Number => format!("&Value::Number({})", self.code),
+            Kind::Boolean => format!("&Value::Boolean({})", self.code),
+            Kind::Value => format!("&*({})", self.code),
+        }
+    }
+
+    /// The expression's truthiness as a `bool`
+    fn into_condition(self) -> String {
+        match self.kind {
+            Kind::Boolean => self.code,
+            Kind::Number => format!("native::truthy(&Value::Number({}))", self.code),
+            Kind::Value => format!("native::truthy(&*({}))", self.code),
+        }
+    }
+}
+
 /// The Amoskeag to Rust transpiler
 pub struct Transpiler {
     config: TranspilerConfig,
     indent_level: usize,
+    /// Values of the literals hoisted into statics, by index
+    literals: Vec<String>,
+    /// Constants holding the ids of the functions called, by name and
+    /// number of arguments
+    functions: HashMap<(String, usize), String>,
+    /// Names bound by enclosing lets, innermost last, as (Amoskeag name,
+    /// Rust local, kind)
+    scope: Vec<(String, String, Kind)>,
+    /// Number of locals generated so far in the current function
+    locals: usize,
+    /// Data paths the current function reads, each looked up once at its
+    /// start, by index
+    reads: Vec<Vec<String>>,
 }
 
 impl Transpiler {
     /// Create a new transpiler with the default configuration
     pub fn new() -> Self {
-        Self {
-            config: TranspilerConfig::default(),
-            indent_level: 0,
-        }
+        Self::with_config(TranspilerConfig::default())
     }
 
     /// Create a new transpiler with a custom configuration
@@ -59,6 +183,11 @@ impl Transpiler {
         Self {
             config,
             indent_level: 0,
+            literals: Vec::new(),
+            functions: HashMap::new(),
+            scope: Vec::new(),
+            locals: 0,
+            reads: Vec::new(),
         }
     }
 
@@ -70,28 +199,149 @@ impl Transpiler {
     ///
     /// # Returns
     ///
-    /// A string containing the generated Rust code
+    /// A string containing the generated Rust code: the imports it needs, and
+    /// `pub fn evaluate(data: &Data) -> Result<Value, EvalError>`
     pub fn transpile(&mut self, expr: &Expr) -> Result<String, TranspileError> {
+        self.literals.clear();
+        self.functions.clear();
         let mut output = String::new();
+        self.write_header(&mut output)?;
+        self.write_function(&mut output, "evaluate", None, expr)?;
+        self.write_literals(&mut output)?;
+        Ok(output)
+    }
+
+    /// Transpile a set of named rules into one Rust source file
+    ///
+    /// The file has a function per rule, named after the rule, plus `RULES`,
+    /// the names of the rules, and `evaluate(name, data)`, which dispatches
+    /// by name and returns `None` for a name that isn't a rule.
+    pub fn transpile_rules(&mut self, rules: &[(&str, &Expr)]) -> Result<String, TranspileError> {
+        self.literals.clear();
+        self.functions.clear();
+        let mut output = String::new();
+        self.write_header(&mut output)?;
+
+        let mut names = HashSet::new();
+        let mut functions = Vec::with_capacity(rules.len());
+        for (name, expr) in rules {
+            let function = rust_name(name);
+            if !names.insert(function.clone()) {
+                return Err(TranspileError::DuplicateName(name.to_string()));
+            }
+            self.write_function(&mut output, &function, Some(name), expr)?;
+            functions.push((*name, function));
+        }
 
-        // Add necessary imports
-        writeln!(output, "use amoskeag_stdlib_operators::{{Value, *}};")?;
-        writeln!(output, "use amoskeag_stdlib_functions::*;")?;
-        writeln!(output, "use std::collections::HashMap;")?;
+        let indent = &self.config.indent;
+        writeln!(output, "/// Names of the compiled rules")?;
+        write!(output, "pub const RULES: &[&str] = &[")?;
+        for (name, _) in &functions {
+            write!(output, "{:?}, ", name)?;
+        }
+        writeln!(output, "];")?;
+        writeln!(output)?;
+        writeln!(
+            output,
+            "/// Evaluate the rule `name`, or return `None` if there is no such rule"
+        )?;
+        writeln!(
+            output,
+            "pub fn evaluate(name: &str, data: &Data) -> Option<Result<Value, EvalError>> {{"
+        )?;
+        writeln!(output, "{}match name {{", indent)?;
+        for (name, function) in &functions {
+            writeln!(
+                output,
+                "{}{}{:?} => Some({}(data)),",
+                indent, indent, name, function
+            )?;
+        }
+        writeln!(output, "{}{}_ => None,", indent, indent)?;
+        writeln!(output, "{}}}", indent)?;
+        writeln!(output, "}}")?;
         writeln!(output)?;
 
-        // Generate the main evaluation function
-        writeln!(output, "pub fn evaluate(context: &HashMap<String, Value>) -> Result<Value, Box<dyn std::error::Error>> {{")?;
-        self.indent_level += 1;
+        self.write_literals(&mut output)?;
+        Ok(output)
+    }
 
-        // Generate the expression
-        let expr_code = self.transpile_expr(expr)?;
-        writeln!(output, "{}Ok({})", self.indent(), expr_code)?;
+    fn write_header(&self, output: &mut String) -> Result<(), TranspileError> {
+        if self.config.add_comments {
+            writeln!(output, "// Generated by amoskeag-transpiler. Do not edit.")?;
+            writeln!(output)?;
+        }
+        writeln!(output, "#[allow(unused_imports)]")?;
+        writeln!(
+            output,
+            "use ::amoskeag::native::{{self, BinaryOp, Cow, Data, EvalError, Symbol, Value}};"
+        )?;
+        writeln!(output, "#[allow(unused_imports)]")?;
+        writeln!(output, "use ::std::sync::LazyLock;")?;
+        writeln!(output)?;
+        Ok(())
+    }
 
+    /// Write a function evaluating `expr`, and hoist its literals
+    fn write_function(
+        &mut self,
+        output: &mut String,
+        function: &str,
+        rule: Option<&str>,
+        expr: &Expr,
+    ) -> Result<(), TranspileError> {
+        self.locals = 0;
+        self.reads.clear();
+        let body = self.transpile_expr(expr)?.into_owned();
+
+        if self.config.add_comments {
+            match rule {
+                Some(rule) => writeln!(output, "/// Evaluate the rule `{}`", rule)?,
+                None => writeln!(output, "/// Evaluate the program")?,
+            }
+        }
+        writeln!(output, "{}", ALLOW)?;
+        writeln!(
+            output,
+            "pub fn {}(data: &Data) -> Result<Value, EvalError> {{",
+            function
+        )?;
+        self.indent_level += 1;
+        // Lookups can't fail, so doing them all up front changes no result;
+        // each path prefix is looked up from its parent
+        for (index, path) in self.reads.iter().enumerate() {
+            let (key, parent) = path.split_last().expect("data paths aren't empty");
+            let lookup = match parent {
+                [] => format!("data.get({:?})", key),
+                parent => format!("native::child(d{}, {:?})", self.read(parent), key),
+            };
+            writeln!(output, "{}let d{} = {};", self.indent(), index, lookup)?;
+        }
+        writeln!(output, "{}Ok({})", self.indent(), body)?;
         self.indent_level -= 1;
         writeln!(output, "}}")?;
+        writeln!(output)?;
+        Ok(())
+    }
 
-        Ok(output)
+    fn write_literals(&self, output: &mut String) -> Result<(), TranspileError> {
+        let mut functions: Vec<_> = self.functions.iter().collect();
+        functions.sort_by(|a, b| a.1.cmp(b.1));
+        for ((name, arg_count), constant) in functions {
+            writeln!(
+                output,
+                "const {}: usize = native::function_id({:?}, {});",
+                constant, name, arg_count
+            )?;
+        }
+        for (index, value) in self.literals.iter().enumerate() {
+            writeln!(
+                output,
+                "static LITERAL_{}: LazyLock<Value> = LazyLock::new(|| {});",
+                index, value
+            )?;
+        }
+        Ok(())
     }
 
     /// Get the current indentation string
@@ -100,19 +350,27 @@ impl Transpiler {
     }
 
     /// Transpile a single expression
-    fn transpile_expr(&mut self, expr: &Expr) -> Result<String, TranspileError> {
+    fn transpile_expr(&mut self, expr: &Expr) -> Result<Code, TranspileError> {
         match expr {
-            Expr::Number(n) => Ok(format!("Value::Number({})", n)),
-            Expr::String(s) => Ok(format!("Value::String({:?}.to_string())", s)),
-            Expr::Boolean(b) => Ok(format!("Value::Boolean({})", b)),
-            Expr::Nil => Ok("Value::Nil".to_string()),
-            Expr::Symbol(s) => Ok(format!("Value::Symbol({:?}.to_string())", s)),
+            Expr::Number(n) if n.is_sign_negative() => {
+                Ok(Code::number(format!("({})", number_literal(*n))))
+            }
+            Expr::Number(n) => Ok(Code::number(number_literal(*n))),
+            Expr::Boolean(b) => Ok(Code::boolean(b.to_string())),
+            Expr::Nil => Ok(Code::value("native::owned(Value::Nil)".to_string())),
+
+            // Strings, symbols, and collections of literals are built once
+            Expr::String(_) | Expr::Symbol(_) => Ok(self.literal(expr)),
+            Expr::Array(_) | Expr::Dictionary(_) if is_literal(expr) => Ok(self.literal(expr)),
 
             Expr::Array(exprs) => self.transpile_array(exprs),
             Expr::Dictionary(pairs) => self.transpile_dictionary(pairs),
-            Expr::Variable(path) => self.transpile_variable(path),
-            Expr::FunctionCall { name, args } => self.transpile_function_call(name, args),
-            Expr::Let { name, value, body } => self.transpile_let(name, value, body),
+            Expr::Variable(path) => Ok(self.transpile_variable(path)),
+            Expr::FunctionCall { name, args } => {
+                let args: Vec<&Expr> = args.iter().collect();
+                self.transpile_function_call(name, &args)
+            }
+            Expr::Let { .. } => self.transpile_let(expr),
             Expr::If {
                 condition,
                 then_branch,
@@ -124,160 +382,189 @@ impl Transpiler {
         }
     }
 
+    /// Hoist a literal into a static, returning a borrow of it
+    fn literal(&mut self, expr: &Expr) -> Code {
+        let index = self.literals.len();
+        self.literals.push(literal_value(expr));
+        Code::value(format!("native::borrowed(&LITERAL_{})", index))
+    }
+
     /// Transpile an array literal
-    fn transpile_array(&mut self, exprs: &[Expr]) -> Result<String, TranspileError> {
-        let mut items = Vec::new();
+    fn transpile_array(&mut self, exprs: &[Expr]) -> Result<Code, TranspileError> {
+        let mut items = Vec::with_capacity(exprs.len());
         for expr in exprs {
-            items.push(self.transpile_expr(expr)?);
+            items.push(self.transpile_expr(expr)?.into_owned());
         }
-        Ok(format!("Value::Array(vec![{}])", items.join(", ")))
+        Ok(Code::value(format!(
+            "native::owned(Value::Array(vec![{}]))",
+            items.join(", ")
+        )))
     }
 
     /// Transpile a dictionary literal
-    fn transpile_dictionary(&mut self, pairs: &[(String, Expr)]) -> Result<String, TranspileError> {
-        let mut output = String::new();
-        write!(output, "{{")?;
-        write!(output, "let mut map = HashMap::new();")?;
-
+    fn transpile_dictionary(&mut self, pairs: &[(String, Expr)]) -> Result<Code, TranspileError> {
+        let mut entries = Vec::with_capacity(pairs.len());
         for (key, value) in pairs {
-            let value_code = self.transpile_expr(value)?;
-            write!(
-                output,
-                " map.insert({:?}.to_string(), {});",
-                key, value_code
-            )?;
+            let value = self.transpile_expr(value)?.into_owned();
+            entries.push(format!("({:?}.to_string(), {})", key, value));
         }
-
-        write!(output, " Value::Dictionary(map)")?;
-        write!(output, "}}")?;
-
-        Ok(output)
+        Ok(Code::value(format!(
+            "native::owned(Value::Dictionary(Data::from([{}])))",
+            entries.join(", ")
+        )))
     }
 
     /// Transpile a variable access (with dot navigation)
-    fn transpile_variable(&mut self, path: &[String]) -> Result<String, TranspileError> {
-        if path.is_empty() {
-            return Ok("Value::Nil".to_string());
-        }
-
-        let mut output = String::new();
-        write!(output, "{{")?;
-
-        // Look up the root variable
-        write!(
-            output,
-            "let mut current = context.get({:?}).cloned().unwrap_or(Value::Nil);",
-            path[0]
-        )?;
+    ///
+    /// A name bound by `let` is a Rust local; anything else is read from the
+    /// data, by reference.
+    fn transpile_variable(&mut self, path: &[String]) -> Code {
+        let Some((root, rest)) = path.split_first() else {
+            return Code::value("native::owned(Value::Nil)".to_string());
+        };
+        let keys = |keys: &[String]| {
+            keys.iter()
+                .map(|key| format!("{:?}", key))
+                .collect::<Vec<_>>()
+                .join(", ")
+        };
 
-        // Navigate the path
-        for key in &path[1..] {
-            write!(
-                output,
-                " current = match current {{ Value::Dictionary(ref map) => map.get({:?}).cloned().unwrap_or(Value::Nil), _ => Value::Nil }};",
-                key
-            )?;
+        match self.scope.iter().rev().find(|(name, _, _)| name == root) {
+            Some((_, local, kind)) => match (kind, rest.is_empty()) {
+                (Kind::Value, true) => Code::value(format!("native::borrowed(&{})", local)),
+                (Kind::Value, false) => {
+                    Code::value(format!("native::field(&{}, &[{}])", local, keys(rest)))
+                }
+                (kind, true) => Code {
+                    kind: *kind,
+                    code: local.clone(),
+                },
+                // Safe navigation: a number or boolean has no fields
+                (_, false) => Code::value("native::owned(Value::Nil)".to_string()),
+            },
+            // Only a missing top-level variable read on its own is an error
+            None if rest.is_empty() => {
+                let read = self.read_data(path);
+                Code::value(format!("native::found(d{}, {:?})?", read, root))
+            }
+            None => Code::value(format!("native::or_nil(d{})", self.read_data(path))),
         }
+    }
 
-        write!(output, " current")?;
-        write!(output, "}}")?;
+    /// The index of the local holding the data at `path`, adding it and its
+    /// prefixes to the reads of the current function if needed
+    fn read_data(&mut self, path: &[String]) -> usize {
+        if let Some(index) = self.reads.iter().position(|read| read == path) {
+            return index;
+        }
+        if path.len() > 1 {
+            self.read_data(&path[..path.len() - 1]);
+        }
+        self.reads.push(path.to_vec());
+        self.reads.len() - 1
+    }
 
-        Ok(output)
+    /// The index of a path already read by the current function
+    fn read(&self, path: &[String]) -> usize {
+        self.reads
+            .iter()
+            .position(|read| read == path)
+            .expect("prefixes are read before their paths")
     }
 
-    /// Transpile a function call
+    /// Transpile a function call, dispatched by the id of the function
     fn transpile_function_call(
         &mut self,
         name: &str,
-        args: &[Expr],
-    ) -> Result<String, TranspileError> {
-        let mut arg_codes = Vec::new();
-        for arg in args {
-            arg_codes.push(self.transpile_expr(arg)?);
+        args: &[&Expr],
+    ) -> Result<Code, TranspileError> {
+        if !name.chars().all(|c| c.is_ascii_alphanumeric() || c == '_') {
+            return Err(TranspileError::UnsupportedExpression(format!(
+                "Unknown function: {}",
+                name
+            )));
         }
+        let constant = self
+            .functions
+            .entry((name.to_string(), args.len()))
+            .or_insert_with(|| format!("FN_{}_{}", name.to_ascii_uppercase(), args.len()))
+            .clone();
 
-        let args_str = arg_codes.join(", ");
-
-        // Map to the corresponding stdlib function
-        let result = match name {
-            // Most functions match directly
-            "upcase" | "downcase" | "capitalize" | "strip" | "split" | "join" | "truncate"
-            | "replace" | "abs" | "ceil" | "floor" | "round" | "plus" | "minus" | "times"
-            | "divided_by" | "max" | "min" | "size" | "first" | "last" | "contains" | "sum"
-            | "avg" | "sort" | "keys" | "values" | "reverse" | "at" | "choose" | "if_then_else"
-            | "is_number" | "is_string" | "is_boolean" | "is_nil" | "is_array"
-            | "is_dictionary" | "coalesce" | "default" => {
-                format!("{}(&{})?", name, args_str)
-            }
-
-            // Special case for modulo (function name vs operator)
-            "modulo" => {
-                format!("modulo_fn(&{})?", args_str)
-            }
-
-            _ => {
-                return Err(TranspileError::UnsupportedExpression(format!(
-                    "Unknown function: {}",
-                    name
-                )));
-            }
-        };
+        let mut arg_codes = Vec::with_capacity(args.len());
+        for arg in args {
+            arg_codes.push(self.transpile_expr(arg)?.into_value());
+        }
 
-        Ok(result)
+        Ok(Code::value(format!(
+            "native::owned(native::call({}, &[{}])?)",
+            constant,
+            arg_codes.join(", ")
+        )))
     }
 
-    /// Transpile a let binding
-    fn transpile_let(
-        &mut self,
-        name: &str,
-        value: &Expr,
-        body: &Expr,
-    ) -> Result<String, TranspileError> {
-        let value_code = self.transpile_expr(value)?;
-
+    /// Transpile a chain of let bindings into one block of locals
+    fn transpile_let(&mut self, mut expr: &Expr) -> Result<Code, TranspileError> {
+        let scope = self.scope.len();
         let mut output = String::new();
         write!(output, "{{")?;
-        write!(output, " let mut new_context = context.clone();")?;
-        write!(
-            output,
-            " new_context.insert({:?}.to_string(), {});",
-            name, value_code
-        )?;
 
-        // Temporarily use new_context for the body
-        let old_body = self.transpile_expr(body)?;
-        // Replace context references in body with new_context
-        let body_code = old_body.replace("context", "&new_context");
+        while let Expr::Let { name, value, body } = expr {
+            let value = self.transpile_expr(value)?;
+            let local = format!("v{}", self.locals);
+            self.locals += 1;
+            let annotation = match value.kind {
+                Kind::Number => ": f64",
+                Kind::Boolean => ": bool",
+                Kind::Value => "",
+            };
+            write!(output, " let {}{} = {};", local, annotation, value.code)?;
+            self.scope.push((name.clone(), local, value.kind));
+            expr = body;
+        }
 
-        write!(output, " {}", body_code)?;
-        write!(output, " }}")?;
+        let body = self.transpile_expr(expr);
+        self.scope.truncate(scope);
+        let body = body?;
 
-        Ok(output)
+        // A value may borrow from the locals, which end here
+        let kind = body.kind;
+        let body = match kind {
+            Kind::Value => format!("native::owned({})", body.into_owned()),
+            _ => body.code,
+        };
+        write!(output, " {} }}", body)?;
+        Ok(Code { kind, code: output })
     }
 
     /// Transpile an if expression
+    ///
+    /// When both branches are numbers or both booleans, so is the result.
     fn transpile_if(
         &mut self,
         condition: &Expr,
         then_branch: &Expr,
         else_branch: &Expr,
-    ) -> Result<String, TranspileError> {
-        let cond_code = self.transpile_expr(condition)?;
+    ) -> Result<Code, TranspileError> {
+        let condition = self.transpile_expr(condition)?.into_condition();
         let then_code = self.transpile_expr(then_branch)?;
         let else_code = self.transpile_expr(else_branch)?;
 
-        let mut output = String::new();
-        write!(output, "{{")?;
-        write!(output, " let cond_value = {};", cond_code)?;
-        write!(output, " let is_truthy = match cond_value {{ Value::Boolean(b) => b, Value::Nil => false, _ => true }};")?;
-        write!(
-            output,
-            " if is_truthy {{ {} }} else {{ {} }}",
-            then_code, else_code
-        )?;
-        write!(output, " }}")?;
-
-        Ok(output)
+        let kind = if then_code.kind == else_code.kind {
+            then_code.kind
+        } else {
+            Kind::Value
+        };
+        let (then_code, else_code) = match kind {
+            Kind::Value => (then_code.into_value(), else_code.into_value()),
+            _ => (then_code.code, else_code.code),
+        };
+        Ok(Code {
+            kind,
+            code: format!(
+                "(if {} {{ {} }} else {{ {} }})",
+                condition, then_code, else_code
+            ),
+        })
     }
 
     /// Transpile a binary operation
@@ -286,110 +573,117 @@ impl Transpiler {
         op: BinaryOp,
         left: &Expr,
         right: &Expr,
-    ) -> Result<String, TranspileError> {
-        let left_code = self.transpile_expr(left)?;
-        let right_code = self.transpile_expr(right)?;
-
-        let op_fn = match op {
-            BinaryOp::Add => "add",
-            BinaryOp::Subtract => "subtract",
-            BinaryOp::Multiply => "multiply",
-            BinaryOp::Divide => "divide",
-            BinaryOp::Modulo => "modulo",
-            BinaryOp::Power => "power",
-            BinaryOp::Equal => "equal",
-            BinaryOp::NotEqual => "not_equal",
-            BinaryOp::Less => "less_than",
-            BinaryOp::Greater => "greater_than",
-            BinaryOp::LessEqual => "less_than_or_equal",
-            BinaryOp::GreaterEqual => "greater_than_or_equal",
-            BinaryOp::And => "logical_and",
-            BinaryOp::Or => "logical_or",
-        };
+    ) -> Result<Code, TranspileError> {
+        let left = self.transpile_expr(left)?;
+        let right = self.transpile_expr(right)?;
+        let both = |kind| left.kind == kind && right.kind == kind;
+
+        Ok(match op {
+            // `and`/`or` short-circuit: the right operand is only evaluated
+            // when the left one does not decide the result
+            BinaryOp::And | BinaryOp::Or => {
+                let op_str = if op == BinaryOp::And { "&&" } else { "||" };
+                Code::boolean(format!(
+                    "({} {} {})",
+                    left.into_condition(),
+                    op_str,
+                    right.into_condition()
+                ))
+            }
 
-        // Equal and not_equal don't return Result
-        if matches!(op, BinaryOp::Equal | BinaryOp::NotEqual) {
-            Ok(format!("{}(&{}, &{})", op_fn, left_code, right_code))
-        } else {
-            Ok(format!("{}(&{}, &{})?", op_fn, left_code, right_code))
-        }
+            // `+` also concatenates strings, so it is only numeric when the
+            // left operand is a number
+            BinaryOp::Add if left.kind != Kind::Number => Code::value(format!(
+                "native::owned(native::binary(BinaryOp::Add, {}, {})?)",
+                left.into_ref(),
+                right.into_ref()
+            )),
+
+            // Arithmetic that succeeds always produces a number
+            BinaryOp::Add
+            | BinaryOp::Subtract
+            | BinaryOp::Multiply
+            | BinaryOp::Divide
+            | BinaryOp::Modulo
+            | BinaryOp::Power => {
+                if both(Kind::Number) {
+                    Code::number(arithmetic(op, &left.code, &right.code))
+                } else {
+                    Code::number(format!(
+                        "{{ let (a, b) = native::numbers(BinaryOp::{:?}, {}, {})?; {} }}",
+                        op,
+                        left.into_ref(),
+                        right.into_ref(),
+                        arithmetic(op, "a", "b")
+                    ))
+                }
+            }
+
+            BinaryOp::Less | BinaryOp::Greater | BinaryOp::LessEqual | BinaryOp::GreaterEqual => {
+                if both(Kind::Number) {
+                    let op_str = match op {
+                        BinaryOp::Less => "<",
+                        BinaryOp::Greater => ">",
+                        BinaryOp::LessEqual => "<=",
+                        _ => ">=",
+                    };
+                    Code::boolean(format!("({} {} {})", left.code, op_str, right.code))
+                } else {
+                    Code::boolean(format!(
+                        "native::compare(BinaryOp::{:?}, {}, {})?",
+                        op,
+                        left.into_ref(),
+                        right.into_ref()
+                    ))
+                }
+            }
+
+            BinaryOp::Equal | BinaryOp::NotEqual => {
+                let op_str = if op == BinaryOp::Equal { "==" } else { "!=" };
+                if left.kind == right.kind && left.kind != Kind::Value {
+                    Code::boolean(format!("({} {} {})", left.code, op_str, right.code))
+                } else {
+                    let not = if op == BinaryOp::Equal { "" } else { "!" };
+                    Code::boolean(format!(
+                        "{}native::equal({}, {})",
+                        not,
+                        left.into_ref(),
+                        right.into_ref()
+                    ))
+                }
+            }
+        })
     }
 
     /// Transpile a unary operation
-    fn transpile_unary(&mut self, op: UnaryOp, operand: &Expr) -> Result<String, TranspileError> {
-        let operand_code = self.transpile_expr(operand)?;
-
-        match op {
-            UnaryOp::Not => Ok(format!("logical_not(&{})", operand_code)),
-            UnaryOp::Negate => {
-                let mut output = String::new();
-                write!(output, "{{")?;
-                write!(output, " let val = {};", operand_code)?;
-                write!(output, " match val {{ Value::Number(n) => Value::Number(-n), _ => return Err(\"Type error: expected Number\".into()) }}")?;
-                write!(output, " }}")?;
-                Ok(output)
-            }
-        }
+    fn transpile_unary(&mut self, op: UnaryOp, operand: &Expr) -> Result<Code, TranspileError> {
+        let operand = self.transpile_expr(operand)?;
+
+        Ok(match op {
+            UnaryOp::Not => Code::boolean(format!("(!{})", operand.into_condition())),
+            UnaryOp::Negate => match operand.kind {
+                Kind::Number => Code::number(format!("(-{})", operand.code)),
+                _ => Code::number(format!("native::negate({})?", operand.into_ref())),
+            },
+        })
     }
 
     /// Transpile a pipe expression
-    fn transpile_pipe(&mut self, left: &Expr, right: &Expr) -> Result<String, TranspileError> {
-        let left_code = self.transpile_expr(left)?;
-
+    ///
+    /// The left value becomes the first argument of the function on the
+    /// right.
+    fn transpile_pipe(&mut self, left: &Expr, right: &Expr) -> Result<Code, TranspileError> {
         match right {
             Expr::FunctionCall { name, args } => {
-                // Prepend the left value as the first argument
-                let mut all_args = vec![left_code];
-                for arg in args {
-                    all_args.push(self.transpile_expr(arg)?);
-                }
-
-                let args_str = all_args.join(", ");
-
-                // Map to the corresponding stdlib function
-                let result = match name.as_str() {
-                    "upcase" | "downcase" | "capitalize" | "strip" | "split" | "join"
-                    | "truncate" | "replace" | "abs" | "ceil" | "floor" | "round" | "plus"
-                    | "minus" | "times" | "divided_by" | "max" | "min" | "size" | "first"
-                    | "last" | "contains" | "sum" | "avg" | "sort" | "keys" | "values"
-                    | "reverse" | "at" | "choose" | "if_then_else" | "is_number" | "is_string"
-                    | "is_boolean" | "is_nil" | "is_array" | "is_dictionary" | "coalesce"
-                    | "default" => {
-                        format!("{}(&{})?", name, args_str)
-                    }
-                    "modulo" => {
-                        format!("modulo_fn(&{})?", args_str)
-                    }
-                    _ => {
-                        return Err(TranspileError::UnsupportedExpression(format!(
-                            "Unknown function in pipe: {}",
-                            name
-                        )));
-                    }
-                };
-
-                Ok(result)
+                let args: Vec<&Expr> = std::iter::once(left).chain(args).collect();
+                self.transpile_function_call(name, &args)
             }
             Expr::Variable(path) if path.len() == 1 => {
-                // Simple function name without args
-                let name = &path[0];
-                let result = match name.as_str() {
-                    "upcase" | "downcase" | "capitalize" | "strip" | "size" | "first" | "last"
-                    | "sum" | "avg" | "sort" | "keys" | "values" | "reverse" | "is_number"
-                    | "is_string" | "is_boolean" | "is_nil" | "is_array" | "is_dictionary" => {
-                        format!("{}(&{})?", name, left_code)
-                    }
-                    _ => {
-                        return Err(TranspileError::UnsupportedExpression(format!(
-                            "Unknown function in pipe: {}",
-                            name
-                        )));
-                    }
-                };
-                Ok(result)
+                self.transpile_function_call(&path[0], &[left])
             }
-            _ => Err(TranspileError::UnsupportedExpression(
-                "Pipe target must be a function call or function name".to_string(),
+            // As in the interpreter, this fails when evaluated
+            _ => Ok(Code::value(
+                "native::invalid(\"function call\", \"expression\")?".to_string(),
             )),
         }
     }
@@ -401,6 +695,84 @@ impl Default for Transpiler {
     }
 }
 
+/// A Rust identifier for the rule `name`
+fn rust_name(name: &str) -> String {
+    let mut ident: String = name
+        .chars()
+        .map(|c| {
+            if c.is_ascii_alphanumeric() {
+                c.to_ascii_lowercase()
+            } else {
+                '_'
+            }
+        })
+        .collect();
+    if ident.is_empty()
+        || ident.starts_with(|c: char| c.is_ascii_digit())
+        || RESERVED.contains(&ident.as_str())
+    {
+        ident.insert_str(0, "rule_");
+    }
+    ident
+}
+
+/// A Rust `f64` expression for the number `n`
+fn number_literal(n: f64) -> String {
+    if n.is_nan() {
+        "f64::NAN".to_string()
+    } else if n == f64::INFINITY {
+        "f64::INFINITY".to_string()
+    } else if n == f64::NEG_INFINITY {
+        "f64::NEG_INFINITY".to_string()
+    } else {
+        format!("{:?}_f64", n)
+    }
+}
+
+/// A Rust `f64` expression applying the arithmetic operator `op`
+fn arithmetic(op: BinaryOp, left: &str, right: &str) -> String {
+    match op {
+        BinaryOp::Add => format!("({} + {})", left, right),
+        BinaryOp::Subtract => format!("({} - {})", left, right),
+        BinaryOp::Multiply => format!("({} * {})", left, right),
+        BinaryOp::Divide => format!("native::divide({}, {})?", left, right),
+        BinaryOp::Modulo => format!("native::modulo({}, {})?", left, right),
+        _ => format!("f64::powf({}, {})", left, right),
+    }
+}
+
+/// Whether `expr` is made only of literals
+fn is_literal(expr: &Expr) -> bool {
+    match expr {
+        Expr::Number(_) | Expr::String(_) | Expr::Boolean(_) | Expr::Nil | Expr::Symbol(_) => true,
+        Expr::Array(items) => items.iter().all(is_literal),
+        Expr::Dictionary(pairs) => pairs.iter().all(|(_, value)| is_literal(value)),
+        _ => false,
+    }
+}
+
+/// A Rust `Value` expression for a literal
+fn literal_value(expr: &Expr) -> String {
+    match expr {
+        Expr::Number(n) => format!("Value::Number({})", number_literal(*n)),
+        Expr::String(s) => format!("Value::String({:?}.to_string())", s),
+        Expr::Boolean(b) => format!("Value::Boolean({})", b),
+        Expr::Symbol(s) => format!("Value::Symbol(Symbol::new({:?}))", s),
+        Expr::Array(items) => {
+            let items: Vec<String> = items.iter().map(literal_value).collect();
+            format!("Value::Array(vec![{}])", items.join(", "))
+        }
+        Expr::Dictionary(pairs) => {
+            let entries: Vec<String> = pairs
+                .iter()
+                .map(|(key, value)| format!("({:?}.to_string(), {})", key, literal_value(value)))
+                .collect();
+            format!("Value::Dictionary(Data::from([{}]))", entries.join(", "))
+        }
+        _ => "Value::Nil".to_string(),
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -410,7 +782,7 @@ mod tests {
         let mut transpiler = Transpiler::new();
         let expr = Expr::Number(42.0);
         let result = transpiler.transpile(&expr).unwrap();
-        assert!(result.contains("Value::Number(42)"));
+        assert!(result.contains("Value::Number(42.0_f64)"));
     }
 
     #[test]
@@ -485,22 +857,104 @@ mod tests {
         let mut transpiler = Transpiler::new();
         let expr = Expr::Binary {
             op: BinaryOp::Add,
-            left: Box::new(Expr::Number(2.0)),
+            left: Box::new(Expr::Variable(vec!["a".to_string()])),
             right: Box::new(Expr::Number(3.0)),
         };
         let result = transpiler.transpile(&expr).unwrap();
-        assert!(result.contains("add"));
+        assert!(result.contains("BinaryOp::Add"));
+    }
+
+    #[test]
+    fn test_transpile_logical_ops_short_circuit() {
+        let mut transpiler = Transpiler::new();
+        let expr = Expr::Binary {
+            op: BinaryOp::And,
+            left: Box::new(Expr::Boolean(false)),
+            right: Box::new(Expr::Boolean(true)),
+        };
+        let result = transpiler.transpile(&expr).unwrap();
+        assert!(result.contains("&&"));
+        assert!(!result.contains("logical_and"));
     }
 
     #[test]
     fn test_transpile_if() {
         let mut transpiler = Transpiler::new();
         let expr = Expr::If {
-            condition: Box::new(Expr::Boolean(true)),
+            condition: Box::new(Expr::Variable(vec!["ok".to_string()])),
             then_branch: Box::new(Expr::Number(1.0)),
             else_branch: Box::new(Expr::Number(2.0)),
         };
         let result = transpiler.transpile(&expr).unwrap();
-        assert!(result.contains("is_truthy"));
+        assert!(result.contains("native::truthy"));
+    }
+
+    fn transpile(source: &str) -> String {
+        Transpiler::new()
+            .transpile(&amoskeag_parser::parse(source).unwrap())
+            .unwrap()
+    }
+
+    #[test]
+    fn test_numeric_code_is_unboxed() {
+        let result = transpile(
+            "let base = record.f0 * 1.5 + record.f1 in if base > 10 then base / 2 else -base end",
+        );
+        assert!(result.contains("let v0: f64 = "));
+        assert!(result.contains("native::numbers(BinaryOp::Multiply"));
+        assert!(result.contains("(v0 > 10.0_f64)"));
+        assert!(result.contains("native::divide(v0, 2.0_f64)?"));
+        assert!(result.contains("(-v0)"));
+        assert!(result.contains("Ok(Value::Number("));
+
+        // `+` on a value of unknown type may concatenate strings
+        let result = transpile("name + 1");
+        assert!(result.contains("native::binary(BinaryOp::Add"));
+        assert!(!result.contains("native::numbers"));
+    }
+
+    #[test]
+    fn test_locals_shadow_data() {
+        let result = transpile("let x = 1 in let x = x + 1 in let d = data.d in [x, d.y, x.y]");
+        assert!(result.contains("let v0: f64 = 1.0_f64; let v1: f64 = (v0 + 1.0_f64);"));
+        assert!(result.contains("let d0 = data.get(\"data\");"));
+        assert!(result.contains("let d1 = native::child(d0, \"d\");"));
+        assert!(result.contains("let v2 = native::or_nil(d1);"));
+        assert!(result.contains("native::field(&v2, &[\"y\"])"));
+        // A number has no fields
+        assert!(result.contains("Value::Number(v1), (native::field(&v2, &[\"y\"])).into_owned(), (native::owned(Value::Nil)).into_owned()"));
+    }
+
+    #[test]
+    fn test_literals_are_hoisted() {
+        let result = transpile("[\"a\", {\"k\": [1, :s]}, x]");
+        assert!(result.contains("static LITERAL_0: LazyLock<Value> = LazyLock::new(|| Value::String(\"a\".to_string()));"));
+        assert!(result.contains("Value::Dictionary(Data::from([(\"k\".to_string(), Value::Array(vec![Value::Number(1.0_f64), Value::Symbol(Symbol::new(\"s\"))]))]))"));
+        assert!(result.contains("native::borrowed(&LITERAL_1)"));
+    }
+
+    #[test]
+    fn test_functions_are_resolved_by_constants() {
+        let result = transpile("round(x, 2) + round(y, 2) + round(z) | size");
+        assert!(result.contains("const FN_ROUND_2: usize = native::function_id(\"round\", 2);"));
+        assert!(result.contains("const FN_ROUND_1: usize = native::function_id(\"round\", 1);"));
+        assert_eq!(result.matches("const FN_ROUND_2").count(), 1);
+        assert!(result.contains("native::call(FN_SIZE_1, &["));
+    }
+
+    #[test]
+    fn test_transpile_rules() {
+        let a = amoskeag_parser::parse("1").unwrap();
+        let b = amoskeag_parser::parse("2").unwrap();
+        let result = Transpiler::new()
+            .transpile_rules(&[("01-first", &a), ("match", &b)])
+            .unwrap();
+        assert!(result.contains("pub fn rule_01_first(data: &Data)"));
+        assert!(result.contains("pub fn rule_match(data: &Data)"));
+        assert!(result.contains("pub const RULES: &[&str] = &[\"01-first\", \"match\", ];"));
+        assert!(result.contains("\"match\" => Some(rule_match(data)),"));
+
+        let result = Transpiler::new().transpile_rules(&[("a-b", &a), ("a_b", &b)]);
+        assert!(matches!(result, Err(TranspileError::DuplicateName(name)) if name == "a_b"));
     }
 }
@@ -0,0 +1,146 @@
+/*
+ * Amoskeag C API
+ *
+ * Declarations for the functions exported by libamoskeag.a and the
+ * libamoskeag shared library.
+ *
+ * Compile or load a program once, then create an evaluator from it on
+ * each thread that evaluates it. An evaluator reuses its buffers from one
+ * call to the next, so a long-lived evaluator avoids per-call allocation
+ * beyond the values themselves. Programs may be shared between threads;
+ * an evaluator is used by one thread at a time.
+ *
+ * Data and results are binary records. Every value is a tag byte followed
+ * by its contents:
+ *
+ *   0  nil
+ *   1  false
+ *   2  true
+ *   3  number      8 bytes, little-endian IEEE 754 double
+ *   4  string      length, then that many bytes of UTF-8
+ *   5  symbol      length, then that many bytes of UTF-8
+ *   6  array       count, then that many values
+ *   7  dictionary  count, then that many (key, value) pairs
+ *
+ * Lengths and counts are unsigned LEB128 varints, and a key is a length
+ * followed by its UTF-8 bytes, with no tag. The data of one evaluation is
+ * a dictionary, or nil for an empty one.
+ *
+ *   AmoskeagProgram *program = amoskeag_program_compile(
+ *       source, strlen(source), NULL, 0, &error);
+ *   AmoskeagEvaluator *evaluator = amoskeag_evaluator_new(program);
+ *   int status = amoskeag_evaluate(
+ *       evaluator, record, record_len, out, sizeof out, &out_len);
+ */
+
+#ifndef AMOSKEAG_H
+#define AMOSKEAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status codes */
+#define AMOSKEAG_OK 0
+#define AMOSKEAG_EVAL_ERROR 1
+#define AMOSKEAG_INVALID_RECORD 2
+#define AMOSKEAG_BUFFER_TOO_SMALL 3
+#define AMOSKEAG_INVALID_ARGUMENT 4
+#define AMOSKEAG_PANIC 5
+
+typedef struct AmoskeagProgram AmoskeagProgram;
+typedef struct AmoskeagEvaluator AmoskeagEvaluator;
+
+/*
+ * Compile `source_len` bytes of UTF-8 source, allowing the `symbol_count`
+ * NUL-terminated names in `symbols`. Returns NULL on failure and, unless
+ * `error_out` is NULL, stores a message there to be freed with
+ * amoskeag_string_free.
+ */
+AmoskeagProgram *amoskeag_program_compile(const uint8_t *source, size_t source_len,
+                                          const char *const *symbols, size_t symbol_count,
+                                          char **error_out);
+
+/*
+ * Load a program precompiled with `amoskeag compile`. Fails as
+ * amoskeag_program_compile does.
+ */
+AmoskeagProgram *amoskeag_program_load(const uint8_t *artifact, size_t len, char **error_out);
+
+/* Free a program. Evaluators created from it keep working. */
+void amoskeag_program_free(AmoskeagProgram *program);
+
+/*
+ * Report the metrics of the program's evaluations under the NUL-terminated
+ * `name`. A program keeps the first name it is given, and evaluators
+ * created before the call count under it too. Returns AMOSKEAG_OK, even
+ * without the `metrics` feature, AMOSKEAG_INVALID_ARGUMENT for a NULL
+ * pointer or a name that isn't UTF-8, or AMOSKEAG_PANIC.
+ */
+int amoskeag_program_set_metrics_name(const AmoskeagProgram *program, const char *name);
+
+/* Free a string returned by this library */
+void amoskeag_string_free(char *string);
+
+/* Create an evaluator of `program`, or return NULL if it is NULL */
+AmoskeagEvaluator *amoskeag_evaluator_new(const AmoskeagProgram *program);
+
+void amoskeag_evaluator_free(AmoskeagEvaluator *evaluator);
+
+/*
+ * The message of the evaluator's last error, valid until its next call.
+ * Empty before any error.
+ */
+const char *amoskeag_evaluator_error(const AmoskeagEvaluator *evaluator);
+
+/*
+ * Evaluate the program with the data in `record`, writing the result
+ * value to `out` and its length to `*out_len`.
+ *
+ * Returns AMOSKEAG_BUFFER_TOO_SMALL, with the length needed in `*out_len`,
+ * if the result is longer than `capacity`; amoskeag_evaluator_output then
+ * copies it without evaluating again. Returns AMOSKEAG_EVAL_ERROR or
+ * AMOSKEAG_INVALID_RECORD on failure, and AMOSKEAG_PANIC if the library
+ * panicked, with the message in amoskeag_evaluator_error.
+ */
+int amoskeag_evaluate(AmoskeagEvaluator *evaluator, const uint8_t *record, size_t record_len,
+                      uint8_t *out, size_t capacity, size_t *out_len);
+
+/*
+ * Evaluate the program with each of `count` records, stored one after
+ * another in `records`. For each record, in order, `out` receives a status
+ * byte followed by the result value after AMOSKEAG_OK, or the error
+ * message, as a varint length and UTF-8 bytes, after AMOSKEAG_EVAL_ERROR.
+ *
+ * Returns AMOSKEAG_OK once every record is evaluated, whatever their
+ * results, and fails as amoskeag_evaluate does, writing no results, if
+ * the output doesn't fit or a record doesn't decode.
+ */
+int amoskeag_evaluate_batch(AmoskeagEvaluator *evaluator, const uint8_t *records,
+                            size_t records_len, size_t count, uint8_t *out, size_t capacity,
+                            size_t *out_len);
+
+/*
+ * Copy the result of the evaluator's last call to `out`, as that call
+ * would have, to fill a larger buffer after AMOSKEAG_BUFFER_TOO_SMALL. The
+ * length is 0 after a call that failed.
+ */
+int amoskeag_evaluator_output(const AmoskeagEvaluator *evaluator, uint8_t *out, size_t capacity,
+                              size_t *out_len);
+
+/*
+ * A snapshot of the built-in metrics, as JSON or in the Prometheus text
+ * format, to be freed with amoskeag_string_free, or NULL on failure.
+ * Exported only when the library is built with the `metrics` feature.
+ */
+char *amoskeag_metrics_json(void);
+char *amoskeag_metrics_prometheus(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AMOSKEAG_H */
@@ -0,0 +1,706 @@
+//! Precompiled programs
+//!
+//! `CompiledProgram::to_bytes` encodes a validated, optimized program and
+//! its symbol table as a compact binary artifact, and
+//! `CompiledProgram::from_bytes` loads one without lexing, parsing, or
+//! optimizing anything. Hosts that load thousands of rules at startup can
+//! compile them once, ahead of time (`amoskeag compile`), and load the
+//! artifacts instead.
+//!
+//! An artifact is a 24-byte header followed by the payload:
+//!
+//! | Bytes  | Contents                                        |
+//! |--------|-------------------------------------------------|
+//! | 0..4   | Magic, `AMKC`                                   |
+//! | 4..8   | Format version, little-endian `u32`             |
+//! | 8..16  | Payload length in bytes, little-endian `u64`    |
+//! | 16..24 | FNV-1a hash of the payload, little-endian `u64` |
+//!
+//! The payload holds the symbol table, then the AST in post-order: each
+//! expression is a tag byte and its own fields, after the expressions it is
+//! built from. Both directions run in a loop over an explicit stack, so
+//! however deeply a program nests, it takes no native stack to encode or
+//! decode. Integers are LEB128 varints, numbers little-endian `f64`, and
+//! strings a varint length followed by UTF-8 bytes.
+//!
+//! Loading checks the magic, version, length, and checksum before decoding,
+//! and resolves the program against the current standard library, so a
+//! corrupted, truncated, or stale artifact is rejected rather than trusted.
+
+use crate::{metrics, paths, resolve, CompileError, CompiledProgram};
+use amoskeag_parser::{BinaryOp, Expr, UnaryOp, MAX_NESTING_DEPTH};
+use std::collections::HashSet;
+use thiserror::Error;
+
+/// The first four bytes of every artifact
+const MAGIC: &[u8; 4] = b"AMKC";
+
+/// Version of the encoding, bumped whenever it changes
+const FORMAT_VERSION: u32 = 1;
+
+const HEADER_LEN: usize = 24;
+
+// Expression tags
+const NUMBER: u8 = 0;
+const STRING: u8 = 1;
+const FALSE: u8 = 2;
+const TRUE: u8 = 3;
+const NIL: u8 = 4;
+const SYMBOL: u8 = 5;
+const ARRAY: u8 = 6;
+const DICTIONARY: u8 = 7;
+const VARIABLE: u8 = 8;
+const CALL: u8 = 9;
+const LET: u8 = 10;
+const IF: u8 = 11;
+const BINARY: u8 = 12;
+const UNARY: u8 = 13;
+const PIPE: u8 = 14;
+
+/// Errors that can occur while loading a precompiled program
+#[derive(Error, Debug)]
+pub enum ArtifactError {
+    #[error("Not a precompiled Amoskeag program")]
+    NotAnArtifact,
+
+    #[error("Unsupported precompiled format version {found} (expected {expected})")]
+    UnsupportedVersion { found: u32, expected: u32 },
+
+    #[error("Precompiled program is truncated")]
+    Truncated,
+
+    #[error("Precompiled program is corrupted: checksum mismatch")]
+    ChecksumMismatch,
+
+    #[error("Precompiled program is malformed: {0}")]
+    Malformed(&'static str),
+
+    #[error("Precompiled program is no longer valid: {0}")]
+    Invalid(#[from] CompileError),
+}
+
+impl CompiledProgram {
+    /// Encode the program as a precompiled artifact
+    ///
+    /// The encoding is deterministic: the same program always produces the
+    /// same bytes.
+    pub fn to_bytes(&self) -> Vec<u8> {
+        let mut payload = Vec::new();
+
+        let mut symbols: Vec<&str> = self.symbols.iter().map(String::as_str).collect();
+        symbols.sort_unstable();
+        write_varint(&mut payload, symbols.len() as u64);
+        for symbol in symbols {
+            write_str(&mut payload, symbol);
+        }
+        write_expr(&mut payload, &self.ast);
+
+        let mut bytes = Vec::with_capacity(HEADER_LEN + payload.len());
+        bytes.extend_from_slice(MAGIC);
+        bytes.extend_from_slice(&FORMAT_VERSION.to_le_bytes());
+        bytes.extend_from_slice(&(payload.len() as u64).to_le_bytes());
+        bytes.extend_from_slice(&checksum(&payload).to_le_bytes());
+        bytes.extend_from_slice(&payload);
+        bytes
+    }
+
+    /// Load a program encoded by [`CompiledProgram::to_bytes`]
+    ///
+    /// `bytes` can be borrowed from anywhere, such as a memory-mapped file:
+    /// nothing is kept from it, and it needs no alignment. Loading is a
+    /// linear pass over the bytes followed by name resolution.
+    ///
+    /// # Errors
+    /// Returns `ArtifactError::NotAnArtifact` if `bytes` doesn't start with
+    /// the artifact magic, so callers can fall back to compiling source,
+    /// and another `ArtifactError` if the artifact is from another format
+    /// version, damaged, or uses functions the standard library no longer
+    /// has.
+    pub fn from_bytes(bytes: &[u8]) -> Result<CompiledProgram, ArtifactError> {
+        if bytes.len() < MAGIC.len() || &bytes[..MAGIC.len()] != MAGIC {
+            return Err(ArtifactError::NotAnArtifact);
+        }
+        if bytes.len() < HEADER_LEN {
+            return Err(ArtifactError::Truncated);
+        }
+        let word = |at: usize| u64::from_le_bytes(bytes[at..at + 8].try_into().unwrap());
+        let version = u32::from_le_bytes(bytes[4..8].try_into().unwrap());
+        if version != FORMAT_VERSION {
+            return Err(ArtifactError::UnsupportedVersion {
+                found: version,
+                expected: FORMAT_VERSION,
+            });
+        }
+        let payload = &bytes[HEADER_LEN..];
+        if (payload.len() as u64) < word(8) {
+            return Err(ArtifactError::Truncated);
+        }
+        if payload.len() as u64 != word(8) {
+            return Err(ArtifactError::Malformed("trailing bytes"));
+        }
+        if checksum(payload) != word(16) {
+            return Err(ArtifactError::ChecksumMismatch);
+        }
+
+        let mut reader = Reader { bytes: payload };
+        let count = reader.varint()?;
+        let mut symbols = HashSet::with_capacity(count.min(payload.len()));
+        for _ in 0..count {
+            symbols.insert(reader.string()?);
+        }
+        let ast = read_expr(&mut reader)?;
+
+        // Resolution also checks the program against this build's
+        // standard library and the stored symbol table
+        let resolved = resolve::resolve(&ast, &symbols)?;
+        let paths = paths::required_paths(&ast);
+        Ok(CompiledProgram {
+            ast,
+            resolved,
+            paths,
+            symbols,
+            metrics: metrics::program_unnamed(),
+        })
+    }
+}
+
+/// 64-bit FNV-1a, enough to catch corruption; artifacts aren't signed
+fn checksum(bytes: &[u8]) -> u64 {
+    bytes.iter().fold(0xcbf2_9ce4_8422_2325, |hash, &byte| {
+        (hash ^ u64::from(byte)).wrapping_mul(0x0100_0000_01b3)
+    })
+}
+
+fn write_varint(out: &mut Vec<u8>, mut n: u64) {
+    while n >= 0x80 {
+        out.push(n as u8 | 0x80);
+        n >>= 7;
+    }
+    out.push(n as u8);
+}
+
+fn write_str(out: &mut Vec<u8>, s: &str) {
+    write_varint(out, s.len() as u64);
+    out.extend_from_slice(s.as_bytes());
+}
+
+/// Encode `expr` in post-order
+fn write_expr(out: &mut Vec<u8>, expr: &Expr) {
+    // An expression is entered to queue its subexpressions, and written
+    // when it is left, after all of them
+    enum Visit<'e> {
+        Enter(&'e Expr),
+        Leave(&'e Expr),
+    }
+
+    let mut stack = vec![Visit::Enter(expr)];
+    while let Some(visit) = stack.pop() {
+        let expr = match visit {
+            Visit::Enter(expr) => {
+                let first = stack.len();
+                match expr {
+                    Expr::Array(items) => stack.extend(items.iter().map(Visit::Enter)),
+                    Expr::Dictionary(pairs) => {
+                        stack.extend(pairs.iter().map(|(_, e)| Visit::Enter(e)))
+                    }
+                    Expr::FunctionCall { args, .. } => stack.extend(args.iter().map(Visit::Enter)),
+                    Expr::Let { value, body, .. } => {
+                        stack.extend([Visit::Enter(value), Visit::Enter(body)])
+                    }
+                    Expr::If {
+                        condition,
+                        then_branch,
+                        else_branch,
+                    } => stack.extend([
+                        Visit::Enter(condition),
+                        Visit::Enter(then_branch),
+                        Visit::Enter(else_branch),
+                    ]),
+                    Expr::Binary { left, right, .. } | Expr::Pipe { left, right } => {
+                        stack.extend([Visit::Enter(left), Visit::Enter(right)])
+                    }
+                    Expr::Unary { operand, .. } => stack.push(Visit::Enter(operand)),
+                    Expr::Number(_)
+                    | Expr::String(_)
+                    | Expr::Boolean(_)
+                    | Expr::Nil
+                    | Expr::Symbol(_)
+                    | Expr::Variable(_) => {}
+                }
+                if stack.len() > first {
+                    // Subexpressions are popped first to last, then `expr`
+                    stack[first..].reverse();
+                    stack.insert(first, Visit::Leave(expr));
+                    continue;
+                }
+                expr
+            }
+            Visit::Leave(expr) => expr,
+        };
+
+        match expr {
+            Expr::Number(n) => {
+                out.push(NUMBER);
+                out.extend_from_slice(&n.to_le_bytes());
+            }
+            Expr::String(s) => {
+                out.push(STRING);
+                write_str(out, s);
+            }
+            Expr::Boolean(b) => out.push(if *b { TRUE } else { FALSE }),
+            Expr::Nil => out.push(NIL),
+            Expr::Symbol(s) => {
+                out.push(SYMBOL);
+                write_str(out, s);
+            }
+            Expr::Array(items) => {
+                out.push(ARRAY);
+                write_varint(out, items.len() as u64);
+            }
+            Expr::Dictionary(pairs) => {
+                out.push(DICTIONARY);
+                write_varint(out, pairs.len() as u64);
+                for (key, _) in pairs {
+                    write_str(out, key);
+                }
+            }
+            Expr::Variable(path) => {
+                out.push(VARIABLE);
+                write_varint(out, path.len() as u64);
+                for part in path {
+                    write_str(out, part);
+                }
+            }
+            Expr::FunctionCall { name, args } => {
+                out.push(CALL);
+                write_str(out, name);
+                write_varint(out, args.len() as u64);
+            }
+            Expr::Let { name, .. } => {
+                out.push(LET);
+                write_str(out, name);
+            }
+            Expr::If { .. } => out.push(IF),
+            Expr::Binary { op, .. } => {
+                out.push(BINARY);
+                out.push(binary_code(*op));
+            }
+            Expr::Unary { op, .. } => {
+                out.push(UNARY);
+                out.push(match op {
+                    UnaryOp::Not => 0,
+                    UnaryOp::Negate => 1,
+                });
+            }
+            Expr::Pipe { .. } => out.push(PIPE),
+        }
+    }
+}
+
+/// Decode a post-order AST, which must fill the rest of the payload
+///
+/// Artifacts don't pass through the parser, so the decoder enforces its
+/// nesting limit: each expression's depth is counted as the parser counts
+/// it, and an artifact nested deeper than [`MAX_NESTING_DEPTH`] is
+/// rejected before any recursive pass, or dropping the tree, can overflow.
+fn read_expr(reader: &mut Reader<'_>) -> Result<Expr, ArtifactError> {
+    // Decoded expressions, each with its nesting depth
+    let mut stack: Vec<(Expr, usize)> = Vec::new();
+    // The last `n` decoded expressions, in order, and the depth of an
+    // expression holding them one level in
+    let take = |stack: &mut Vec<(Expr, usize)>, n: usize| {
+        if n > stack.len() {
+            return Err(ArtifactError::Malformed("missing subexpression"));
+        }
+        let items = stack.split_off(stack.len() - n);
+        let depth = items.iter().map(|(_, depth)| depth + 1).max().unwrap_or(1);
+        Ok((items.into_iter().map(|(expr, _)| expr).collect(), depth))
+    };
+    let boxed = |stack: &mut Vec<(Expr, usize)>| {
+        stack
+            .pop()
+            .map(|(expr, depth)| (Box::new(expr), depth))
+            .ok_or(ArtifactError::Malformed("missing subexpression"))
+    };
+
+    while !reader.bytes.is_empty() {
+        let (expr, depth) = match reader.byte()? {
+            NUMBER => (Expr::Number(f64::from_le_bytes(reader.array()?)), 1),
+            STRING => (Expr::String(reader.string()?), 1),
+            FALSE => (Expr::Boolean(false), 1),
+            TRUE => (Expr::Boolean(true), 1),
+            NIL => (Expr::Nil, 1),
+            SYMBOL => (Expr::Symbol(reader.string()?), 1),
+            ARRAY => {
+                let len = reader.varint()?;
+                let (items, depth) = take(&mut stack, len)?;
+                (Expr::Array(items), depth)
+            }
+            DICTIONARY => {
+                let (values, depth) = take(&mut stack, reader.varint()?)?;
+                let pairs = values
+                    .into_iter()
+                    .map(|value| Ok((reader.string()?, value)))
+                    .collect::<Result<_, ArtifactError>>()?;
+                (Expr::Dictionary(pairs), depth)
+            }
+            VARIABLE => {
+                let len = reader.varint()?;
+                if len == 0 {
+                    return Err(ArtifactError::Malformed("empty variable path"));
+                }
+                let path = (0..len)
+                    .map(|_| reader.string())
+                    .collect::<Result<_, _>>()?;
+                (Expr::Variable(path), 1)
+            }
+            CALL => {
+                let name = reader.string()?;
+                let argc = reader.varint()?;
+                let (args, depth) = take(&mut stack, argc)?;
+                (Expr::FunctionCall { name, args }, depth)
+            }
+            // The parser reads chains of let bodies, else branches and left
+            // operands in a loop, so they stay at their parent's depth
+            LET => {
+                let name = reader.string()?;
+                let (body, body_depth) = boxed(&mut stack)?;
+                let (value, value_depth) = boxed(&mut stack)?;
+                (
+                    Expr::Let { name, value, body },
+                    body_depth.max(value_depth + 1),
+                )
+            }
+            IF => {
+                let (else_branch, else_depth) = boxed(&mut stack)?;
+                let (then_branch, then_depth) = boxed(&mut stack)?;
+                let (condition, condition_depth) = boxed(&mut stack)?;
+                (
+                    Expr::If {
+                        condition,
+                        then_branch,
+                        else_branch,
+                    },
+                    else_depth.max(condition_depth.max(then_depth) + 1),
+                )
+            }
+            BINARY => {
+                let op = binary_op(reader.byte()?)?;
+                let (right, right_depth) = boxed(&mut stack)?;
+                let (left, left_depth) = boxed(&mut stack)?;
+                // A right operand only goes a level in where the source
+                // needs parentheses around it
+                let nested = usize::from(needs_parentheses(op, &right));
+                (
+                    Expr::Binary { op, left, right },
+                    left_depth.max(right_depth + nested),
+                )
+            }
+            UNARY => {
+                let op = match reader.byte()? {
+                    0 => UnaryOp::Not,
+                    1 => UnaryOp::Negate,
+                    _ => return Err(ArtifactError::Malformed("unknown unary operator")),
+                };
+                let (operand, depth) = boxed(&mut stack)?;
+                (Expr::Unary { op, operand }, depth + 1)
+            }
+            PIPE => {
+                let (right, right_depth) = boxed(&mut stack)?;
+                let (left, left_depth) = boxed(&mut stack)?;
+                (Expr::Pipe { left, right }, left_depth.max(right_depth) + 1)
+            }
+            _ => return Err(ArtifactError::Malformed("unknown expression tag")),
+        };
+        if depth > MAX_NESTING_DEPTH {
+            return Err(ArtifactError::Malformed("nesting too deep"));
+        }
+        stack.push((expr, depth));
+    }
+
+    match (stack.pop(), stack.is_empty()) {
+        (Some((expr, _)), true) => Ok(expr),
+        (None, _) => Err(ArtifactError::Malformed("no expression")),
+        (Some(_), false) => Err(ArtifactError::Malformed("unused expressions")),
+    }
+}
+
+/// Whether `right` must be parenthesized as the right operand of `op`
+fn needs_parentheses(op: BinaryOp, right: &Expr) -> bool {
+    match right {
+        Expr::Binary { op: inner, .. } => precedence(*inner) <= precedence(op),
+        Expr::Let { .. } | Expr::If { .. } | Expr::Pipe { .. } => true,
+        _ => false,
+    }
+}
+
+/// How tightly `op` binds, as the parser's grammar orders them
+fn precedence(op: BinaryOp) -> u8 {
+    match op {
+        BinaryOp::And | BinaryOp::Or => 0,
+        BinaryOp::Equal
+        | BinaryOp::NotEqual
+        | BinaryOp::Less
+        | BinaryOp::Greater
+        | BinaryOp::LessEqual
+        | BinaryOp::GreaterEqual => 1,
+        BinaryOp::Add | BinaryOp::Subtract => 2,
+        BinaryOp::Multiply | BinaryOp::Divide | BinaryOp::Modulo => 3,
+        BinaryOp::Power => 4,
+    }
+}
+
+const BINARY_OPS: [BinaryOp; 14] = [
+    BinaryOp::Add,
+    BinaryOp::Subtract,
+    BinaryOp::Multiply,
+    BinaryOp::Divide,
+    BinaryOp::Modulo,
+    BinaryOp::Power,
+    BinaryOp::Equal,
+    BinaryOp::NotEqual,
+    BinaryOp::Less,
+    BinaryOp::Greater,
+    BinaryOp::LessEqual,
+    BinaryOp::GreaterEqual,
+    BinaryOp::And,
+    BinaryOp::Or,
+];
+
+fn binary_code(op: BinaryOp) -> u8 {
+    BINARY_OPS
+        .iter()
+        .position(|&known| known == op)
+        .expect("every operator has a code") as u8
+}
+
+fn binary_op(code: u8) -> Result<BinaryOp, ArtifactError> {
+    BINARY_OPS
+        .get(usize::from(code))
+        .copied()
+        .ok_or(ArtifactError::Malformed("unknown binary operator"))
+}
+
+/// Reads the payload front to back
+struct Reader<'b> {
+    bytes: &'b [u8],
+}
+
+impl<'b> Reader<'b> {
+    fn bytes(&mut self, len: usize) -> Result<&'b [u8], ArtifactError> {
+        if len > self.bytes.len() {
+            return Err(ArtifactError::Malformed("length past the end"));
+        }
+        let (head, rest) = self.bytes.split_at(len);
+        self.bytes = rest;
+        Ok(head)
+    }
+
+    fn byte(&mut self) -> Result<u8, ArtifactError> {
+        Ok(self.bytes(1)?[0])
+    }
+
+    fn array<const N: usize>(&mut self) -> Result<[u8; N], ArtifactError> {
+        Ok(self.bytes(N)?.try_into().expect("N bytes"))
+    }
+
+    /// A count or length; callers check it against what is there before
+    /// allocating for it
+    fn varint(&mut self) -> Result<usize, ArtifactError> {
+        let mut n: u64 = 0;
+        for shift in (0..64).step_by(7) {
+            let byte = self.byte()?;
+            n |= u64::from(byte & 0x7f) << shift;
+            if byte & 0x80 == 0 {
+                return usize::try_from(n).map_err(|_| ArtifactError::Malformed("count too large"));
+            }
+        }
+        Err(ArtifactError::Malformed("varint too long"))
+    }
+
+    fn string(&mut self) -> Result<String, ArtifactError> {
+        let len = self.varint()?;
+        std::str::from_utf8(self.bytes(len)?)
+            .map(str::to_string)
+            .map_err(|_| ArtifactError::Malformed("invalid UTF-8"))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, evaluate};
+    use amoskeag_stdlib_operators::Value;
+    use std::collections::HashMap;
+
+    const SOURCES: &[&str] = &[
+        "42",
+        "-x + 2.5 * x ^ 2 % 7",
+        r#"if x > 1 and not (x == 3) or x <= 0 then :high else :low end"#,
+        r#"let total = items | map('price') | sum in {"total": total, "big": total >= 10}"#,
+        r#"[x, "två", true, false, nil, applicant.vehicle.value, upcase("a")]"#,
+        "date_now() != nil",
+    ];
+
+    fn data() -> HashMap<String, Value> {
+        let item = |price: f64| {
+            Value::Dictionary(HashMap::from([("price".to_string(), Value::Number(price))]))
+        };
+        HashMap::from([
+            ("x".to_string(), Value::Number(3.0)),
+            (
+                "items".to_string(),
+                Value::Array(vec![item(4.0), item(8.0)]),
+            ),
+            ("applicant".to_string(), Value::Nil),
+        ])
+    }
+
+    #[test]
+    fn test_round_trip() {
+        for source in SOURCES {
+            let program = compile(source, &["high", "low"]).unwrap();
+            let bytes = program.to_bytes();
+            let loaded = CompiledProgram::from_bytes(&bytes).unwrap();
+            assert_eq!(loaded.ast(), program.ast(), "{}", source);
+            assert_eq!(loaded.resolved, program.resolved, "{}", source);
+            assert_eq!(loaded.symbols, program.symbols);
+            assert_eq!(loaded.required_paths(), program.required_paths());
+            assert_eq!(
+                evaluate(&loaded, &data()).unwrap(),
+                evaluate(&program, &data()).unwrap()
+            );
+            // Deterministic
+            assert_eq!(loaded.to_bytes(), bytes);
+        }
+    }
+
+    #[test]
+    fn test_deep_programs_round_trip_on_a_small_stack() {
+        let source = format!("x{}", " + x".repeat(2000));
+        let program = compile(&source, &[]).unwrap();
+        let loaded = std::thread::scope(|scope| {
+            std::thread::Builder::new()
+                .stack_size(512 * 1024)
+                .spawn_scoped(scope, || {
+                    let bytes = program.to_bytes();
+                    let loaded = CompiledProgram::from_bytes(&bytes).unwrap();
+                    evaluate(&loaded, &data()).unwrap()
+                })
+                .unwrap()
+                .join()
+                .unwrap()
+        });
+        assert_eq!(loaded, Value::Number(3.0 * 2001.0));
+    }
+
+    #[test]
+    fn test_nesting_limit() {
+        // Programs at the parser's limit still load
+        let depth = MAX_NESTING_DEPTH - 1;
+        for source in [
+            format!("{}x", "not ".repeat(depth)),
+            format!("{}x{}", "1 + (".repeat(depth), ")".repeat(depth)),
+            format!(
+                "{}x{}",
+                "if true then ".repeat(depth),
+                " else 0 end".repeat(depth)
+            ),
+            format!("x{}", " | abs".repeat(depth)),
+        ] {
+            let bytes = compile(&source, &[]).unwrap().to_bytes();
+            assert!(CompiledProgram::from_bytes(&bytes).is_ok(), "{}", source);
+        }
+
+        // Far deeper artifacts are rejected while decoding
+        let n = 10_000;
+        let unary = [&[0, NIL][..], &[UNARY, 0].repeat(n)].concat();
+        let right_nested = [&[0][..], &[NIL].repeat(n + 1), &[BINARY, 0].repeat(n)].concat();
+        for payload in [unary, right_nested] {
+            assert!(matches!(
+                CompiledProgram::from_bytes(&artifact(&payload)),
+                Err(ArtifactError::Malformed("nesting too deep"))
+            ));
+        }
+    }
+
+    #[test]
+    fn test_damaged_artifacts_are_rejected() {
+        let bytes = compile(SOURCES[3], &[]).unwrap().to_bytes();
+
+        assert!(matches!(
+            CompiledProgram::from_bytes(b"items | sum"),
+            Err(ArtifactError::NotAnArtifact)
+        ));
+        assert!(matches!(
+            CompiledProgram::from_bytes(&bytes[..bytes.len() - 1]),
+            Err(ArtifactError::Truncated)
+        ));
+        assert!(matches!(
+            CompiledProgram::from_bytes(&bytes[..10]),
+            Err(ArtifactError::Truncated)
+        ));
+
+        let mut flipped = bytes.clone();
+        *flipped.last_mut().unwrap() ^= 1;
+        assert!(matches!(
+            CompiledProgram::from_bytes(&flipped),
+            Err(ArtifactError::ChecksumMismatch)
+        ));
+
+        let mut newer = bytes.clone();
+        newer[4] += 1;
+        assert!(matches!(
+            CompiledProgram::from_bytes(&newer),
+            Err(ArtifactError::UnsupportedVersion { found: 2, .. })
+        ));
+    }
+
+    /// An artifact holding `payload`, with a valid header
+    fn artifact(payload: &[u8]) -> Vec<u8> {
+        let mut bytes = MAGIC.to_vec();
+        bytes.extend_from_slice(&FORMAT_VERSION.to_le_bytes());
+        bytes.extend_from_slice(&(payload.len() as u64).to_le_bytes());
+        bytes.extend_from_slice(&checksum(payload).to_le_bytes());
+        bytes.extend_from_slice(payload);
+        bytes
+    }
+
+    #[test]
+    fn test_malformed_payloads_are_rejected() {
+        for payload in [
+            &[0][..],                      // no expression
+            &[0, NIL, NIL],                // two roots
+            &[0, IF],                      // missing operands
+            &[0, NIL, NIL, BINARY, 99],    // unknown operator
+            &[0, 99],                      // unknown tag
+            &[0, STRING, 5, b'a'],         // string past the end
+            &[0, STRING, 1, 0xff],         // invalid UTF-8
+            &[0, ARRAY, 0xff, 0xff, 0x7f], // huge count
+        ] {
+            assert!(
+                matches!(
+                    CompiledProgram::from_bytes(&artifact(payload)),
+                    Err(ArtifactError::Malformed(_))
+                ),
+                "{:?}",
+                payload
+            );
+        }
+
+        // A symbol missing from the stored table, or an unknown function,
+        // fails resolution
+        let call = [&[0, CALL, 4][..], b"nope", &[0]].concat();
+        assert!(matches!(
+            CompiledProgram::from_bytes(&artifact(&call)),
+            Err(ArtifactError::Invalid(
+                CompileError::UndefinedFunction { .. }
+            ))
+        ));
+        let symbol = [&[0, SYMBOL, 2][..], b"ok"].concat();
+        assert!(matches!(
+            CompiledProgram::from_bytes(&artifact(&symbol)),
+            Err(ArtifactError::Invalid(CompileError::UndefinedSymbol { .. }))
+        ));
+    }
+}
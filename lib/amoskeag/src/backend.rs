@@ -5,7 +5,11 @@
 //! - Transpilation to Python
 //! - Transpilation to Ruby
 //! - Interpretation (tree-walking evaluator)
+//! - Interpretation (bytecode VM)
+//! - Columnar batch evaluation of numeric-only programs
 
+pub mod bytecode;
+pub mod columnar;
 pub mod interpreter;
 
 use crate::{CompileError, EvalError};
@@ -145,7 +149,7 @@ impl PerformanceTier {
     pub fn description(&self) -> &str {
         match self {
             Self::Native => "Near-native performance via LLVM JIT compilation",
-            Self::Fast => "Fast tree-walking interpreter with optimizations",
+            Self::Fast => "Fast bytecode interpreter with compile-time resolution",
             Self::Standard => "Standard tree-walking interpreter",
             Self::Transpiled => "Code generation for external runtime",
         }
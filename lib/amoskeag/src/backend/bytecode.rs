@@ -0,0 +1,771 @@
+//! Bytecode virtual machine backend
+//!
+//! This module lowers an Amoskeag AST into flat bytecode and executes it on a
+//! small stack machine. Compared to the tree-walking interpreter:
+//!
+//! - `let` bindings are resolved to numbered local slots at compile time,
+//!   so locals are read by index instead of by name
+//! - data-path keys and dictionary keys are interned into a per-program table
+//! - every stdlib call is resolved to a numeric function id
+//! - constants live in the program and are pushed by reference, and values
+//!   read from the data dictionary stay borrowed until they must be owned
+//! - a value computed for a `let` is stored once per run and every read of
+//!   the local borrows it, as do reads of its fields
+
+use super::{Backend, BackendCapabilities, BackendError, BackendResult, PerformanceTier};
+use crate::functions;
+use crate::metrics::{self, BackendSlot};
+use crate::{eval_binary_op, eval_unary_op, is_truthy, validate_ast, CompiledProgram, EvalError};
+use amoskeag_parser::{BinaryOp, Expr, UnaryOp};
+use amoskeag_stdlib_operators::Value;
+use std::borrow::Cow;
+use std::cell::OnceCell;
+use std::collections::{HashMap, HashSet};
+
+/// Shared nil used for safe-navigation misses, so they never allocate
+static NIL: Value = Value::Nil;
+
+/// A single VM instruction
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Op {
+    /// Push a constant from the program's constant pool
+    Const(u32),
+    /// Push a local slot
+    LoadLocal(u32),
+    /// Push one of a local's dictionary fields (or nil)
+    LoadLocalField { slot: u32, key: u32 },
+    /// Pop the top of the stack into a local slot, keeping an owned value in
+    /// the run's `cell`
+    StoreLocal { slot: u32, cell: u32 },
+    /// Push a top-level data value; a missing key is an error
+    LoadData(u32),
+    /// Push a top-level data value; a missing key yields nil
+    LoadDataOrNil(u32),
+    /// Replace the top of the stack with one of its dictionary fields (or nil)
+    GetField(u32),
+    /// Pop two operands and push the result of a binary operator
+    Binary(BinaryOp),
+    /// Pop one operand and push the result of a unary operator
+    Unary(UnaryOp),
+    /// Pop `argc` arguments and push the result of a stdlib function
+    Call { func: u16, argc: u8 },
+    /// Pop `len` values and push them as an array
+    MakeArray(u32),
+    /// Pop `len` values and push a dictionary keyed by `keys[start..start + len]`
+    MakeDict { start: u32, len: u32 },
+    /// Replace the top of the stack with its truthiness, as a boolean
+    Truthy,
+    /// Pop the condition and jump to the target if it is falsy
+    JumpIfFalse(u32),
+    /// Jump unconditionally to the target
+    Jump(u32),
+}
+
+/// A program lowered to bytecode
+#[derive(Debug, Clone)]
+pub struct BytecodeProgram {
+    code: Vec<Op>,
+    constants: Vec<Value>,
+    keys: Vec<String>,
+    locals: usize,
+    /// How many `StoreLocal` instructions there are
+    cells: usize,
+}
+
+impl BytecodeProgram {
+    /// Lower an (already validated) expression to bytecode
+    pub fn lower(expr: &Expr) -> BackendResult<Self> {
+        let mut compiler = Compiler::default();
+        compiler.expr(expr)?;
+        Ok(Self {
+            code: compiler.code,
+            constants: compiler.constants,
+            keys: compiler.keys,
+            locals: compiler.max_locals,
+            cells: compiler.cells,
+        })
+    }
+
+    /// Get the instruction stream
+    pub fn code(&self) -> &[Op] {
+        &self.code
+    }
+
+    /// Get the number of local slots this program needs
+    pub fn local_slots(&self) -> usize {
+        self.locals
+    }
+
+    /// Execute the program against a data dictionary
+    pub fn run(&self, data: &HashMap<String, Value>) -> Result<Value, EvalError> {
+        let cells: Vec<OnceCell<Value>> = (0..self.cells).map(|_| OnceCell::new()).collect();
+        let mut vm = Vm {
+            program: self,
+            data,
+            cells: &cells,
+            stack: Vec::with_capacity(16),
+            locals: vec![&NIL; self.locals],
+        };
+        metrics::evaluation(None, BackendSlot::Bytecode, || vm.run())
+    }
+}
+
+/// Lowers an AST into a `BytecodeProgram`
+#[derive(Default)]
+struct Compiler<'e> {
+    code: Vec<Op>,
+    constants: Vec<Value>,
+    keys: Vec<String>,
+    key_ids: HashMap<&'e str, u32>,
+    /// Names of the let bindings currently in scope; a name's position is its slot
+    scope: Vec<&'e str>,
+    max_locals: usize,
+    cells: usize,
+}
+
+impl<'e> Compiler<'e> {
+    fn expr(&mut self, expr: &'e Expr) -> BackendResult<()> {
+        match expr {
+            Expr::Number(n) => self.constant(Value::Number(*n)),
+            Expr::String(s) => self.constant(Value::String(s.clone())),
+            Expr::Boolean(b) => self.constant(Value::Boolean(*b)),
+            Expr::Nil => self.constant(Value::Nil),
+            Expr::Symbol(s) => self.constant(Value::Symbol(s.into())),
+
+            Expr::Array(exprs) => {
+                for e in exprs {
+                    self.expr(e)?;
+                }
+                self.emit(Op::MakeArray(exprs.len() as u32));
+            }
+
+            Expr::Dictionary(pairs) => {
+                // Dictionary keys are stored contiguously so one op can name them all
+                let start = self.keys.len() as u32;
+                for (key, _) in pairs {
+                    self.keys.push(key.clone());
+                }
+                for (_, e) in pairs {
+                    self.expr(e)?;
+                }
+                self.emit(Op::MakeDict {
+                    start,
+                    len: pairs.len() as u32,
+                });
+            }
+
+            Expr::Variable(path) => self.variable(path),
+
+            Expr::FunctionCall { name, args } => {
+                for arg in args {
+                    self.expr(arg)?;
+                }
+                self.call(name, args.len())?;
+            }
+
+            Expr::Let { name, value, body } => {
+                self.expr(value)?;
+                let slot = self.scope.len();
+                self.emit(Op::StoreLocal {
+                    slot: slot as u32,
+                    cell: self.cells as u32,
+                });
+                self.cells += 1;
+                self.scope.push(name);
+                self.max_locals = self.max_locals.max(self.scope.len());
+                self.expr(body)?;
+                self.scope.pop();
+            }
+
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                self.expr(condition)?;
+                let to_else = self.emit(Op::JumpIfFalse(0));
+                self.expr(then_branch)?;
+                let to_end = self.emit(Op::Jump(0));
+                self.patch(to_else);
+                self.expr(else_branch)?;
+                self.patch(to_end);
+            }
+
+            // `and`/`or` short-circuit: the right operand is jumped over
+            // when the left one decides the result
+            Expr::Binary {
+                op: BinaryOp::And,
+                left,
+                right,
+            } => {
+                self.expr(left)?;
+                let to_false = self.emit(Op::JumpIfFalse(0));
+                self.expr(right)?;
+                self.emit(Op::Truthy);
+                let to_end = self.emit(Op::Jump(0));
+                self.patch(to_false);
+                self.constant(Value::Boolean(false));
+                self.patch(to_end);
+            }
+
+            Expr::Binary {
+                op: BinaryOp::Or,
+                left,
+                right,
+            } => {
+                self.expr(left)?;
+                let to_right = self.emit(Op::JumpIfFalse(0));
+                self.constant(Value::Boolean(true));
+                let to_end = self.emit(Op::Jump(0));
+                self.patch(to_right);
+                self.expr(right)?;
+                self.emit(Op::Truthy);
+                self.patch(to_end);
+            }
+
+            Expr::Binary { op, left, right } => {
+                self.expr(left)?;
+                self.expr(right)?;
+                self.emit(Op::Binary(*op));
+            }
+
+            Expr::Unary { op, operand } => {
+                self.expr(operand)?;
+                self.emit(Op::Unary(*op));
+            }
+
+            // The parser desugars pipes, but hand-built ASTs may still contain them
+            Expr::Pipe { left, right } => match right.as_ref() {
+                Expr::FunctionCall { name, args } => {
+                    self.expr(left)?;
+                    for arg in args {
+                        self.expr(arg)?;
+                    }
+                    self.call(name, args.len() + 1)?;
+                }
+                Expr::Variable(path) if path.len() == 1 => {
+                    self.expr(left)?;
+                    self.call(&path[0], 1)?;
+                }
+                _ => {
+                    return Err(BackendError::UnsupportedFeature(
+                        "pipe target must be a function call".to_string(),
+                    ))
+                }
+            },
+        }
+        Ok(())
+    }
+
+    fn variable(&mut self, path: &'e [String]) {
+        let Some((root, fields)) = path.split_first() else {
+            self.constant(Value::Nil);
+            return;
+        };
+
+        // Innermost binding wins, matching the interpreter's shadowing rules
+        let mut fields = fields.iter();
+        match self.scope.iter().rposition(|name| name == root) {
+            Some(slot) => match fields.next() {
+                Some(field) => {
+                    let key = self.key(field);
+                    self.emit(Op::LoadLocalField {
+                        slot: slot as u32,
+                        key,
+                    })
+                }
+                None => self.emit(Op::LoadLocal(slot as u32)),
+            },
+            None => {
+                let key = self.key(root);
+                if fields.len() == 0 {
+                    self.emit(Op::LoadData(key))
+                } else {
+                    self.emit(Op::LoadDataOrNil(key))
+                }
+            }
+        };
+
+        for field in fields {
+            let key = self.key(field);
+            self.emit(Op::GetField(key));
+        }
+    }
+
+    fn call(&mut self, name: &str, argc: usize) -> BackendResult<()> {
+        let func = functions::resolve(name, argc)?;
+        self.emit(Op::Call {
+            func: func as u16,
+            argc: argc as u8,
+        });
+        Ok(())
+    }
+
+    fn constant(&mut self, value: Value) {
+        let index = self.constants.len() as u32;
+        self.constants.push(value);
+        self.emit(Op::Const(index));
+    }
+
+    /// Intern a data-path key
+    fn key(&mut self, key: &'e str) -> u32 {
+        if let Some(&id) = self.key_ids.get(key) {
+            return id;
+        }
+        let id = self.keys.len() as u32;
+        self.keys.push(key.to_string());
+        self.key_ids.insert(key, id);
+        id
+    }
+
+    fn emit(&mut self, op: Op) -> usize {
+        self.code.push(op);
+        self.code.len() - 1
+    }
+
+    /// Point a previously emitted jump at the next instruction
+    fn patch(&mut self, at: usize) {
+        let target = self.code.len() as u32;
+        match &mut self.code[at] {
+            Op::JumpIfFalse(t) | Op::Jump(t) => *t = target,
+            _ => unreachable!("patch() called on a non-jump instruction"),
+        }
+    }
+}
+
+/// Execution state for one run of a `BytecodeProgram`
+struct Vm<'a> {
+    program: &'a BytecodeProgram,
+    data: &'a HashMap<String, Value>,
+    /// Owned values stored by `let`, one per `StoreLocal`; jumps only go
+    /// forward, so each is set at most once per run
+    cells: &'a [OnceCell<Value>],
+    stack: Vec<Cow<'a, Value>>,
+    locals: Vec<&'a Value>,
+}
+
+impl<'a> Vm<'a> {
+    fn run(&mut self) -> Result<Value, EvalError> {
+        let program = self.program;
+        let code = &program.code;
+        let mut pc = 0;
+
+        while pc < code.len() {
+            let op = code[pc];
+            pc += 1;
+
+            match op {
+                Op::Const(index) => self
+                    .stack
+                    .push(Cow::Borrowed(&program.constants[index as usize])),
+
+                Op::LoadLocal(slot) => self.stack.push(Cow::Borrowed(self.locals[slot as usize])),
+
+                Op::LoadLocalField { slot, key } => {
+                    let field = match self.locals[slot as usize] {
+                        Value::Dictionary(map) => {
+                            map.get(&program.keys[key as usize]).unwrap_or(&NIL)
+                        }
+                        // Safe navigation: nil if not a dictionary
+                        _ => &NIL,
+                    };
+                    self.stack.push(Cow::Borrowed(field));
+                }
+
+                Op::StoreLocal { slot, cell } => {
+                    self.locals[slot as usize] = match self.pop() {
+                        Cow::Borrowed(value) => value,
+                        Cow::Owned(value) => {
+                            let cell = &self.cells[cell as usize];
+                            if cell.set(value).is_err() {
+                                unreachable!("local stored twice in one run: malformed program");
+                            }
+                            cell.get().expect("the cell was just set")
+                        }
+                    };
+                }
+
+                Op::LoadData(key) => {
+                    let key = &program.keys[key as usize];
+                    match self.data.get(key) {
+                        Some(value) => self.stack.push(Cow::Borrowed(value)),
+                        None => return Err(EvalError::VariableNotFound(key.clone())),
+                    }
+                }
+
+                Op::LoadDataOrNil(key) => {
+                    let value = self.data.get(&program.keys[key as usize]).unwrap_or(&NIL);
+                    self.stack.push(Cow::Borrowed(value));
+                }
+
+                Op::GetField(key) => {
+                    let key = &program.keys[key as usize];
+                    let field = match self.pop() {
+                        Cow::Borrowed(Value::Dictionary(map)) => {
+                            Cow::Borrowed(map.get(key).unwrap_or(&NIL))
+                        }
+                        Cow::Owned(Value::Dictionary(mut map)) => {
+                            Cow::Owned(map.remove(key).unwrap_or(Value::Nil))
+                        }
+                        // Safe navigation: nil if not a dictionary
+                        _ => Cow::Borrowed(&NIL),
+                    };
+                    self.stack.push(field);
+                }
+
+                Op::Binary(op) => {
+                    let right = self.pop();
+                    let left = self.pop();
+                    let result = eval_binary_op(op, &left, &right)?;
+                    self.stack.push(Cow::Owned(result));
+                }
+
+                Op::Unary(op) => {
+                    let operand = self.pop();
+                    let result = eval_unary_op(op, &operand)?;
+                    self.stack.push(Cow::Owned(result));
+                }
+
+                Op::Call { func, argc } => {
+                    let start = self.stack.len() - argc as usize;
+                    let result = metrics::call_function(func as usize, &self.stack[start..])?;
+                    self.stack.truncate(start);
+                    self.stack.push(Cow::Owned(result));
+                }
+
+                Op::MakeArray(len) => {
+                    let start = self.stack.len() - len as usize;
+                    let values = self.stack.drain(start..).map(Cow::into_owned).collect();
+                    self.stack.push(Cow::Owned(Value::Array(values)));
+                }
+
+                Op::MakeDict { start, len } => {
+                    let keys = &program.keys[start as usize..(start + len) as usize];
+                    let values_start = self.stack.len() - len as usize;
+                    let mut map = HashMap::with_capacity(len as usize);
+                    for (key, value) in keys.iter().zip(self.stack.drain(values_start..)) {
+                        map.insert(key.clone(), value.into_owned());
+                    }
+                    self.stack.push(Cow::Owned(Value::Dictionary(map)));
+                }
+
+                Op::Truthy => {
+                    let value = self.pop();
+                    self.stack
+                        .push(Cow::Owned(Value::Boolean(is_truthy(&value))));
+                }
+
+                Op::JumpIfFalse(target) => {
+                    if !is_truthy(&self.pop()) {
+                        pc = target as usize;
+                    }
+                }
+
+                Op::Jump(target) => pc = target as usize,
+            }
+        }
+
+        Ok(self.pop().into_owned())
+    }
+
+    fn pop(&mut self) -> Cow<'a, Value> {
+        self.stack
+            .pop()
+            .expect("bytecode stack underflow: malformed program")
+    }
+}
+
+/// The bytecode VM backend
+pub struct BytecodeBackend;
+
+impl BytecodeBackend {
+    /// Create a new bytecode backend
+    pub fn new() -> Self {
+        Self
+    }
+
+    /// Lower an already compiled (and validated) program
+    pub fn compile_program(&self, program: &CompiledProgram) -> BackendResult<BytecodeProgram> {
+        BytecodeProgram::lower(program.ast())
+    }
+
+    /// Get the capabilities of this backend
+    pub fn capabilities() -> BackendCapabilities {
+        BackendCapabilities {
+            name: "bytecode".to_string(),
+            description: "Stack-based bytecode VM with resolved locals and functions".to_string(),
+            supported_features: vec![
+                "numbers".to_string(),
+                "strings".to_string(),
+                "booleans".to_string(),
+                "symbols".to_string(),
+                "arrays".to_string(),
+                "dictionaries".to_string(),
+                "arithmetic".to_string(),
+                "comparisons".to_string(),
+                "logic".to_string(),
+                "if_expressions".to_string(),
+                "let_bindings".to_string(),
+                "function_calls".to_string(),
+                "pipe_expressions".to_string(),
+                "safe_navigation".to_string(),
+            ],
+            performance_tier: PerformanceTier::Fast,
+            requires_external_deps: false,
+        }
+    }
+}
+
+impl Default for BytecodeBackend {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Backend for BytecodeBackend {
+    type CompiledOutput = BytecodeProgram;
+    type ExecutionResult = Value;
+
+    fn name(&self) -> &str {
+        "bytecode"
+    }
+
+    fn compile(&self, expr: &Expr, symbols: &[&str]) -> BackendResult<Self::CompiledOutput> {
+        let symbols: HashSet<String> = symbols.iter().map(|s| s.to_string()).collect();
+        validate_ast(expr, &symbols)?;
+        BytecodeProgram::lower(expr)
+    }
+
+    fn execute(
+        &self,
+        compiled: &Self::CompiledOutput,
+        data: &HashMap<String, Value>,
+    ) -> BackendResult<Self::ExecutionResult> {
+        compiled.run(data).map_err(BackendError::EvalError)
+    }
+
+    fn supports(&self, expr: &Expr) -> bool {
+        match expr {
+            Expr::Pipe { left, right } => {
+                let valid_target = match right.as_ref() {
+                    Expr::FunctionCall { args, .. } => args.iter().all(|a| self.supports(a)),
+                    Expr::Variable(path) => path.len() == 1,
+                    _ => false,
+                };
+                valid_target && self.supports(left)
+            }
+            Expr::Array(exprs) => exprs.iter().all(|e| self.supports(e)),
+            Expr::Dictionary(pairs) => pairs.iter().all(|(_, e)| self.supports(e)),
+            Expr::FunctionCall { args, .. } => args.iter().all(|a| self.supports(a)),
+            Expr::Let { value, body, .. } => self.supports(value) && self.supports(body),
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                self.supports(condition) && self.supports(then_branch) && self.supports(else_branch)
+            }
+            Expr::Binary { left, right, .. } => self.supports(left) && self.supports(right),
+            Expr::Unary { operand, .. } => self.supports(operand),
+            Expr::Number(_)
+            | Expr::String(_)
+            | Expr::Boolean(_)
+            | Expr::Nil
+            | Expr::Symbol(_)
+            | Expr::Variable(_) => true,
+        }
+    }
+
+    fn description(&self) -> &str {
+        "Stack-based bytecode VM with slot-resolved locals and numeric function dispatch"
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, evaluate};
+
+    fn run(source: &str, symbols: &[&str], data: &HashMap<String, Value>) -> Value {
+        let program = compile(source, symbols).unwrap();
+        let bytecode = BytecodeBackend::new().compile_program(&program).unwrap();
+        bytecode.run(data).unwrap()
+    }
+
+    fn sample_data() -> HashMap<String, Value> {
+        let mut vehicle = HashMap::new();
+        vehicle.insert("value".to_string(), Value::Number(30000.0));
+        vehicle.insert("type".to_string(), Value::String("SPORT".to_string()));
+
+        let mut app = HashMap::new();
+        app.insert("age".to_string(), Value::Number(22.0));
+        app.insert("state".to_string(), Value::String("CA".to_string()));
+        app.insert("vehicle".to_string(), Value::Dictionary(vehicle));
+
+        let mut limits = HashMap::new();
+        limits.insert("max_vehicle_value".to_string(), Value::Number(50000.0));
+        limits.insert(
+            "restricted_states".to_string(),
+            Value::Array(vec![
+                Value::String("NY".to_string()),
+                Value::String("FL".to_string()),
+            ]),
+        );
+
+        let mut data = HashMap::new();
+        data.insert("applicant".to_string(), Value::Dictionary(app));
+        data.insert("limits".to_string(), Value::Dictionary(limits));
+        data.insert(
+            "items".to_string(),
+            Value::Array(vec![
+                Value::Number(3.0),
+                Value::Number(1.0),
+                Value::Number(2.0),
+            ]),
+        );
+        data
+    }
+
+    #[test]
+    fn test_matches_interpreter() {
+        let cases = [
+            "2 + 3 * 4",
+            "let x = 10 in let y = 5 in x * y + 2",
+            "let x = 10 in let x = 20 in x",
+            "[let x = 1 in x, let y = 2 in y]",
+            "applicant.vehicle.value / limits.max_vehicle_value",
+            "applicant.missing.deeper",
+            "applicant.age.not_a_dict",
+            "limits.restricted_states | contains(applicant.state)",
+            "items | sort | reverse | first",
+            "items | sum | round(2)",
+            "\"hello\" | upcase | truncate(3)",
+            "{\"a\": 1, \"b\": applicant.age, \"c\": [1, 2]}",
+            "if applicant.age < 25 and applicant.vehicle.type == 'SPORT' :deny else :approve end",
+            "if nil 1 else if false 2 else 3 end",
+            "not (applicant.age > 18) or -applicant.age < 0",
+            "let app = applicant in let v = app.vehicle in v.value + app.age",
+            "[1, 'two', true, nil, :approve]",
+            "round(3.14159)",
+            "false and 1 / 0",
+            "applicant.age > 18 and applicant.state",
+            "nil or applicant.missing",
+            "applicant.age or 1 / 0",
+            "let d = {\"a\": {\"b\": 1}} in d.a.b + d.a.b",
+            "let n = applicant.age + 1 in [n.field, n + n]",
+        ];
+
+        let data = sample_data();
+        for source in cases {
+            let program = compile(source, &["approve", "deny"]).unwrap();
+            let expected = evaluate(&program, &data).unwrap();
+            let actual = run(source, &["approve", "deny"], &data);
+            assert_eq!(actual, expected, "Mismatch for: {}", source);
+        }
+    }
+
+    #[test]
+    fn test_let_slots_are_reused() {
+        // Each binding is used twice so the optimizer keeps it
+        let source = "[let a = x in a + a, let b = x in let c = b + 1 in b + c + c]";
+        let program = compile(source, &[]).unwrap();
+        let bytecode = BytecodeBackend::new().compile_program(&program).unwrap();
+        assert_eq!(bytecode.local_slots(), 2);
+        let mut data = HashMap::new();
+        data.insert("x".to_string(), Value::Number(1.0));
+        assert_eq!(
+            bytecode.run(&data).unwrap(),
+            Value::Array(vec![Value::Number(2.0), Value::Number(5.0)])
+        );
+    }
+
+    #[test]
+    fn test_local_fields_are_fused() {
+        let source = "let v = {\"value\": x, \"extra\": [x]} in v.value + v.value";
+        let program = compile(source, &[]).unwrap();
+        let bytecode = BytecodeBackend::new().compile_program(&program).unwrap();
+        let fused = bytecode
+            .code()
+            .iter()
+            .filter(|op| matches!(op, Op::LoadLocalField { slot: 0, .. }))
+            .count();
+        assert_eq!(fused, 2);
+        assert!(!bytecode
+            .code()
+            .iter()
+            .any(|op| matches!(op, Op::GetField(_))));
+        let data = HashMap::from([("x".to_string(), Value::Number(2.0))]);
+        assert_eq!(bytecode.run(&data).unwrap(), Value::Number(4.0));
+    }
+
+    #[test]
+    fn test_functions_are_resolved_to_ids() {
+        let program = compile("upcase(name)", &[]).unwrap();
+        let bytecode = BytecodeBackend::new().compile_program(&program).unwrap();
+        let id = functions::lookup("upcase").unwrap() as u16;
+        assert!(bytecode.code().contains(&Op::Call { func: id, argc: 1 }));
+    }
+
+    #[test]
+    fn test_undefined_variable_error() {
+        let program = compile("missing + 1", &[]).unwrap();
+        let bytecode = BytecodeBackend::new().compile_program(&program).unwrap();
+        assert!(matches!(
+            bytecode.run(&HashMap::new()),
+            Err(EvalError::VariableNotFound(name)) if name == "missing"
+        ));
+    }
+
+    #[test]
+    fn test_runtime_errors_propagate() {
+        let program = compile("10 / 0", &[]).unwrap();
+        let bytecode = BytecodeBackend::new().compile_program(&program).unwrap();
+        assert!(matches!(
+            bytecode.run(&HashMap::new()),
+            Err(EvalError::OperatorError(_))
+        ));
+    }
+
+    #[test]
+    fn test_backend_compile_validates() {
+        let backend = BytecodeBackend::new();
+        let expr = amoskeag_parser::parse(":approve").unwrap();
+        assert!(backend.compile(&expr, &[]).is_err());
+        assert!(backend.compile(&expr, &["approve"]).is_ok());
+
+        let expr = amoskeag_parser::parse("no_such_function(1)").unwrap();
+        assert!(backend.compile(&expr, &[]).is_err());
+    }
+
+    #[test]
+    fn test_backend_trait_methods() {
+        let backend = BytecodeBackend::new();
+        let expr = amoskeag_parser::parse("if 10 > 5 :yes else :no end").unwrap();
+        assert!(backend.supports(&expr));
+        let result = backend
+            .compile_and_execute(&expr, &["yes", "no"], &HashMap::new())
+            .unwrap();
+        assert_eq!(result, Value::Symbol("yes".into()));
+        assert_eq!(backend.name(), "bytecode");
+        assert!(!backend.description().is_empty());
+    }
+
+    #[test]
+    fn test_supports_rejects_invalid_pipe_target() {
+        let backend = BytecodeBackend::new();
+        let expr = Expr::Pipe {
+            left: Box::new(Expr::Number(1.0)),
+            right: Box::new(Expr::Number(2.0)),
+        };
+        assert!(!backend.supports(&expr));
+        assert!(BytecodeProgram::lower(&expr).is_err());
+    }
+
+    #[test]
+    fn test_capabilities() {
+        let caps = BytecodeBackend::capabilities();
+        assert_eq!(caps.name, "bytecode");
+        assert_eq!(caps.performance_tier, PerformanceTier::Fast);
+        assert!(!caps.requires_external_deps);
+    }
+}
@@ -0,0 +1,939 @@
+//! Columnar numeric backend
+//!
+//! Spreadsheet-style programs that only do arithmetic, comparisons and
+//! branching over numeric fields can be evaluated a whole batch at a time.
+//! Each referenced data path becomes one contiguous `f64` column and every
+//! node runs as a tight loop over entire columns, which the compiler
+//! auto-vectorizes. `if` branches are evaluated under a lane mask, so a
+//! branch only raises errors for the records that actually take it.
+//!
+//! Programs that use anything else (strings, symbols, collections, most
+//! stdlib functions) cannot be lowered; `ColumnarBackend::supports` reports
+//! whether a program is eligible. Batch evaluation falls back to the row
+//! interpreter for records whose fields are not all numbers, and for any
+//! batch in which an active lane fails.
+
+use super::{Backend, BackendCapabilities, BackendError, BackendResult, PerformanceTier};
+use crate::metrics::{self, BackendSlot};
+use crate::resolve::{resolve_unchecked, Node as RowNode};
+use crate::{eval_node, validate_ast, CompiledProgram, Context, EvalError};
+use amoskeag_parser::{BinaryOp, Expr, UnaryOp};
+use amoskeag_stdlib_functions::sqrt;
+use amoskeag_stdlib_operators::{divide, modulo, Value};
+use std::collections::{HashMap, HashSet};
+
+/// A structure-of-arrays batch: one `f64` column per data path
+///
+/// Columns are keyed by their dotted path, such as `"loan.principal"`.
+#[derive(Debug, Clone, Default)]
+pub struct ColumnBatch {
+    len: usize,
+    columns: HashMap<String, Vec<f64>>,
+}
+
+impl ColumnBatch {
+    /// Create an empty batch of `len` records
+    pub fn new(len: usize) -> Self {
+        Self {
+            len,
+            columns: HashMap::new(),
+        }
+    }
+
+    /// Add the column for a data path
+    ///
+    /// # Panics
+    ///
+    /// Panics if the column length differs from the batch length.
+    pub fn insert(&mut self, path: impl Into<String>, values: Vec<f64>) {
+        assert_eq!(
+            values.len(),
+            self.len,
+            "column length must match batch length"
+        );
+        self.columns.insert(path.into(), values);
+    }
+
+    /// Get the column for a data path
+    pub fn column(&self, path: &str) -> Option<&[f64]> {
+        self.columns.get(path).map(Vec::as_slice)
+    }
+
+    /// Number of records in the batch
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Whether the batch has no records
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+}
+
+/// The result of evaluating a columnar program over a batch
+#[derive(Debug, Clone, PartialEq)]
+pub enum Column {
+    Number(Vec<f64>),
+    Boolean(Vec<bool>),
+}
+
+impl Column {
+    /// Number of records in the column
+    pub fn len(&self) -> usize {
+        match self {
+            Column::Number(values) => values.len(),
+            Column::Boolean(values) => values.len(),
+        }
+    }
+
+    /// Whether the column has no records
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Get the value of one record
+    pub fn value(&self, row: usize) -> Value {
+        match self {
+            Column::Number(values) => Value::Number(values[row]),
+            Column::Boolean(values) => Value::Boolean(values[row]),
+        }
+    }
+
+    fn numbers(self) -> Vec<f64> {
+        match self {
+            Column::Number(values) => values,
+            Column::Boolean(_) => unreachable!("columnar program is type checked"),
+        }
+    }
+
+    fn booleans(self) -> Vec<bool> {
+        match self {
+            Column::Boolean(values) => values,
+            Column::Number(_) => unreachable!("columnar program is type checked"),
+        }
+    }
+}
+
+/// Static type of a columnar node
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Ty {
+    Number,
+    Boolean,
+}
+
+/// Element-wise numeric operator
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Arith {
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Modulo,
+    Power,
+    Max,
+    Min,
+}
+
+/// Element-wise numeric function
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Math {
+    Negate,
+    Abs,
+    Ceil,
+    Floor,
+    Sqrt,
+}
+
+/// A type-checked columnar expression
+#[derive(Debug, Clone)]
+enum Node {
+    Number(f64),
+    Boolean(bool),
+    /// An input column, by index into `ColumnarProgram::inputs`
+    Input(usize),
+    /// A let-bound column, by slot
+    Local(usize),
+    Let {
+        slot: usize,
+        value: Box<Node>,
+        body: Box<Node>,
+    },
+    Arith {
+        op: Arith,
+        left: Box<Node>,
+        right: Box<Node>,
+    },
+    /// Comparison of two number columns
+    Compare {
+        op: BinaryOp,
+        left: Box<Node>,
+        right: Box<Node>,
+    },
+    /// `==`, `!=`, `and` or `or` over two boolean columns
+    Logic {
+        op: BinaryOp,
+        left: Box<Node>,
+        right: Box<Node>,
+    },
+    Not(Box<Node>),
+    Math {
+        op: Math,
+        operand: Box<Node>,
+    },
+    If {
+        condition: Box<Node>,
+        then_branch: Box<Node>,
+        else_branch: Box<Node>,
+    },
+}
+
+/// A numeric-only program lowered for columnar evaluation
+#[derive(Debug, Clone)]
+pub struct ColumnarProgram {
+    root: Node,
+    /// Referenced data paths, indexed by `Node::Input`
+    inputs: Vec<Vec<String>>,
+    /// Row interpreter form of the same program, for fallback
+    fallback: RowNode,
+}
+
+impl ColumnarProgram {
+    /// Lower an expression, or return `None` if it is not numeric-only
+    pub fn lower(expr: &Expr) -> Option<Self> {
+        let mut lowerer = Lowerer::default();
+        let (root, _) = lowerer.expr(expr)?;
+        Some(Self {
+            root,
+            inputs: lowerer.inputs,
+            fallback: resolve_unchecked(expr),
+        })
+    }
+
+    /// Dotted data paths this program reads, one column each
+    pub fn inputs(&self) -> impl Iterator<Item = String> + '_ {
+        self.inputs.iter().map(|path| path.join("."))
+    }
+
+    /// Evaluate the program over a whole batch
+    ///
+    /// Every input path must have a column in the batch. If any record fails
+    /// (for example a division by zero on a branch that record takes), the
+    /// error of one failing record is returned.
+    pub fn run(&self, batch: &ColumnBatch) -> Result<Column, EvalError> {
+        metrics::evaluation(None, BackendSlot::Columnar, || self.run_batch(batch))
+    }
+
+    fn run_batch(&self, batch: &ColumnBatch) -> Result<Column, EvalError> {
+        let mut inputs = Vec::with_capacity(self.inputs.len());
+        for path in self.inputs() {
+            match batch.column(&path) {
+                Some(column) => inputs.push(column),
+                None => return Err(EvalError::VariableNotFound(path)),
+            }
+        }
+
+        let mut lanes = Lanes {
+            len: batch.len(),
+            inputs,
+            locals: Vec::new(),
+        };
+        let mask = vec![true; batch.len()];
+        lanes.eval(&self.root, &mask)
+    }
+
+    /// Evaluate the program against row-oriented records
+    ///
+    /// Records whose input fields are all numbers are evaluated as one
+    /// columnar batch; the rest are evaluated by the row interpreter. If the
+    /// columnar batch fails, every record is re-evaluated by the row
+    /// interpreter so each one gets its own result. Results are in input
+    /// order and identical to calling `evaluate` per record.
+    pub fn evaluate_records(
+        &self,
+        records: &[HashMap<String, Value>],
+    ) -> Vec<Result<Value, EvalError>> {
+        let row = |data: &HashMap<String, Value>| eval_node(&self.fallback, &Context::new(data));
+
+        let (rows, batch) = self.gather(records);
+        let column = match self.run(&batch) {
+            Ok(column) => column,
+            Err(_) => return records.iter().map(row).collect(),
+        };
+
+        let mut results = Vec::with_capacity(records.len());
+        let mut columnar = rows.iter().enumerate().peekable();
+        for (index, data) in records.iter().enumerate() {
+            match columnar.peek() {
+                Some(&(lane, &record)) if record == index => {
+                    results.push(Ok(column.value(lane)));
+                    columnar.next();
+                }
+                _ => results.push(row(data)),
+            }
+        }
+        results
+    }
+
+    /// Build a batch from the records whose inputs are all numbers
+    ///
+    /// Returns the indices of the records included, in order.
+    fn gather(&self, records: &[HashMap<String, Value>]) -> (Vec<usize>, ColumnBatch) {
+        let mut rows = Vec::with_capacity(records.len());
+        let mut columns: Vec<Vec<f64>> = vec![Vec::with_capacity(records.len()); self.inputs.len()];
+
+        'records: for (index, data) in records.iter().enumerate() {
+            for (path, column) in self.inputs.iter().zip(&mut columns) {
+                match lookup_number(data, path) {
+                    Some(n) => column.push(n),
+                    None => {
+                        // Undo this record's partial row
+                        for column in columns.iter_mut() {
+                            column.truncate(rows.len());
+                        }
+                        continue 'records;
+                    }
+                }
+            }
+            rows.push(index);
+        }
+
+        let mut batch = ColumnBatch::new(rows.len());
+        for (path, column) in self.inputs().zip(columns) {
+            batch.insert(path, column);
+        }
+        (rows, batch)
+    }
+}
+
+/// Navigate a data path, returning the number at its end
+fn lookup_number(data: &HashMap<String, Value>, path: &[String]) -> Option<f64> {
+    let (root, fields) = path.split_first()?;
+    let mut current = data.get(root)?;
+    for field in fields {
+        current = match current {
+            Value::Dictionary(map) => map.get(field)?,
+            _ => return None,
+        };
+    }
+    match current {
+        Value::Number(n) => Some(*n),
+        _ => None,
+    }
+}
+
+/// Type checks an AST and lowers it to columnar nodes
+#[derive(Default)]
+struct Lowerer<'e> {
+    inputs: Vec<Vec<String>>,
+    /// Let bindings in scope, innermost last; a binding's slot is its depth
+    scopes: Vec<(&'e str, Ty)>,
+}
+
+impl<'e> Lowerer<'e> {
+    fn expr(&mut self, expr: &'e Expr) -> Option<(Node, Ty)> {
+        Some(match expr {
+            Expr::Number(n) => (Node::Number(*n), Ty::Number),
+            Expr::Boolean(b) => (Node::Boolean(*b), Ty::Boolean),
+
+            Expr::Variable(path) => {
+                let local = match path.as_slice() {
+                    [name] => self.scopes.iter().rposition(|(local, _)| local == name),
+                    // Navigating into a let-bound number always yields nil
+                    [root, ..] if self.scopes.iter().any(|(local, _)| local == root) => {
+                        return None
+                    }
+                    _ => None,
+                };
+                match local {
+                    Some(slot) => (Node::Local(slot), self.scopes[slot].1),
+                    None => (Node::Input(self.input(path)), Ty::Number),
+                }
+            }
+
+            Expr::Let { name, value, body } => {
+                let (value, ty) = self.expr(value)?;
+                let slot = self.scopes.len();
+                self.scopes.push((name, ty));
+                let body = self.expr(body);
+                self.scopes.pop();
+                let (body, body_ty) = body?;
+                (
+                    Node::Let {
+                        slot,
+                        value: Box::new(value),
+                        body: Box::new(body),
+                    },
+                    body_ty,
+                )
+            }
+
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                let condition = self.typed(condition, Ty::Boolean)?;
+                let (then_branch, ty) = self.expr(then_branch)?;
+                let else_branch = self.typed(else_branch, ty)?;
+                (
+                    Node::If {
+                        condition: Box::new(condition),
+                        then_branch: Box::new(then_branch),
+                        else_branch: Box::new(else_branch),
+                    },
+                    ty,
+                )
+            }
+
+            Expr::Binary { op, left, right } => {
+                let arith = match op {
+                    BinaryOp::Add => Some(Arith::Add),
+                    BinaryOp::Subtract => Some(Arith::Subtract),
+                    BinaryOp::Multiply => Some(Arith::Multiply),
+                    BinaryOp::Divide => Some(Arith::Divide),
+                    BinaryOp::Modulo => Some(Arith::Modulo),
+                    BinaryOp::Power => Some(Arith::Power),
+                    _ => None,
+                };
+                if let Some(op) = arith {
+                    return self.arith(op, left, right);
+                }
+
+                let (left, ty) = self.expr(left)?;
+                let right = self.typed(right, ty)?;
+                let (left, right) = (Box::new(left), Box::new(right));
+                let node = match (op, ty) {
+                    (BinaryOp::Equal | BinaryOp::NotEqual, Ty::Boolean)
+                    | (BinaryOp::And | BinaryOp::Or, Ty::Boolean) => Node::Logic {
+                        op: *op,
+                        left,
+                        right,
+                    },
+                    (
+                        BinaryOp::Equal
+                        | BinaryOp::NotEqual
+                        | BinaryOp::Less
+                        | BinaryOp::Greater
+                        | BinaryOp::LessEqual
+                        | BinaryOp::GreaterEqual,
+                        Ty::Number,
+                    ) => Node::Compare {
+                        op: *op,
+                        left,
+                        right,
+                    },
+                    _ => return None,
+                };
+                (node, Ty::Boolean)
+            }
+
+            Expr::Unary { op, operand } => match op {
+                UnaryOp::Negate => self.math(Math::Negate, operand)?,
+                UnaryOp::Not => (
+                    Node::Not(Box::new(self.typed(operand, Ty::Boolean)?)),
+                    Ty::Boolean,
+                ),
+            },
+
+            Expr::FunctionCall { name, args } => match (name.as_str(), args.as_slice()) {
+                ("abs", [x]) => self.math(Math::Abs, x)?,
+                ("ceil", [x]) => self.math(Math::Ceil, x)?,
+                ("floor", [x]) => self.math(Math::Floor, x)?,
+                ("sqrt", [x]) => self.math(Math::Sqrt, x)?,
+                ("power", [x, y]) => self.arith(Arith::Power, x, y)?,
+                ("max", [x, y]) => self.arith(Arith::Max, x, y)?,
+                ("min", [x, y]) => self.arith(Arith::Min, x, y)?,
+                _ => return None,
+            },
+
+            Expr::String(_)
+            | Expr::Nil
+            | Expr::Symbol(_)
+            | Expr::Array(_)
+            | Expr::Dictionary(_)
+            | Expr::Pipe { .. } => return None,
+        })
+    }
+
+    fn typed(&mut self, expr: &'e Expr, expected: Ty) -> Option<Node> {
+        let (node, ty) = self.expr(expr)?;
+        (ty == expected).then_some(node)
+    }
+
+    fn arith(&mut self, op: Arith, left: &'e Expr, right: &'e Expr) -> Option<(Node, Ty)> {
+        let left = self.typed(left, Ty::Number)?;
+        let right = self.typed(right, Ty::Number)?;
+        Some((
+            Node::Arith {
+                op,
+                left: Box::new(left),
+                right: Box::new(right),
+            },
+            Ty::Number,
+        ))
+    }
+
+    fn math(&mut self, op: Math, operand: &'e Expr) -> Option<(Node, Ty)> {
+        let operand = self.typed(operand, Ty::Number)?;
+        Some((
+            Node::Math {
+                op,
+                operand: Box::new(operand),
+            },
+            Ty::Number,
+        ))
+    }
+
+    /// Intern a data path as an input column
+    fn input(&mut self, path: &[String]) -> usize {
+        match self.inputs.iter().position(|p| p == path) {
+            Some(index) => index,
+            None => {
+                self.inputs.push(path.to_vec());
+                self.inputs.len() - 1
+            }
+        }
+    }
+}
+
+/// Evaluation state for one batch
+struct Lanes<'b> {
+    len: usize,
+    inputs: Vec<&'b [f64]>,
+    locals: Vec<Column>,
+}
+
+impl Lanes<'_> {
+    /// Evaluate a node for every lane; only lanes set in `mask` can fail
+    fn eval(&mut self, node: &Node, mask: &[bool]) -> Result<Column, EvalError> {
+        Ok(match node {
+            Node::Number(n) => Column::Number(vec![*n; self.len]),
+            Node::Boolean(b) => Column::Boolean(vec![*b; self.len]),
+            Node::Input(index) => Column::Number(self.inputs[*index].to_vec()),
+            Node::Local(slot) => self.locals[*slot].clone(),
+
+            Node::Let { slot, value, body } => {
+                let value = self.eval(value, mask)?;
+                debug_assert_eq!(*slot, self.locals.len());
+                self.locals.push(value);
+                let body = self.eval(body, mask);
+                self.locals.pop();
+                body?
+            }
+
+            Node::Arith { op, left, right } => {
+                let left = self.eval(left, mask)?.numbers();
+                let right = self.eval(right, mask)?.numbers();
+                Column::Number(arith(*op, left, &right, mask)?)
+            }
+
+            Node::Compare { op, left, right } => {
+                let left = self.eval(left, mask)?.numbers();
+                let right = self.eval(right, mask)?.numbers();
+                let compare: fn(f64, f64) -> bool = match op {
+                    BinaryOp::Equal => |l, r| l == r,
+                    BinaryOp::NotEqual => |l, r| l != r,
+                    BinaryOp::Less => |l, r| l < r,
+                    BinaryOp::Greater => |l, r| l > r,
+                    BinaryOp::LessEqual => |l, r| l <= r,
+                    BinaryOp::GreaterEqual => |l, r| l >= r,
+                    _ => unreachable!("not a comparison"),
+                };
+                Column::Boolean(
+                    left.iter()
+                        .zip(&right)
+                        .map(|(l, r)| compare(*l, *r))
+                        .collect(),
+                )
+            }
+
+            Node::Logic { op, left, right } => {
+                let mut left = self.eval(left, mask)?.booleans();
+
+                // `and`/`or` short-circuit per lane: the right operand is only
+                // active where the left one does not decide the result
+                let right_mask: Vec<bool> = match op {
+                    BinaryOp::And => mask.iter().zip(&left).map(|(m, l)| *m && *l).collect(),
+                    BinaryOp::Or => mask.iter().zip(&left).map(|(m, l)| *m && !*l).collect(),
+                    _ => mask.to_vec(),
+                };
+                if matches!(op, BinaryOp::And | BinaryOp::Or) && !right_mask.contains(&true) {
+                    return Ok(Column::Boolean(left));
+                }
+                let right = self.eval(right, &right_mask)?.booleans();
+                let logic: fn(bool, bool) -> bool = match op {
+                    BinaryOp::Equal => |l, r| l == r,
+                    BinaryOp::NotEqual => |l, r| l != r,
+                    BinaryOp::And => |l, r| l && r,
+                    BinaryOp::Or => |l, r| l || r,
+                    _ => unreachable!("not a logical operator"),
+                };
+                for (l, r) in left.iter_mut().zip(&right) {
+                    *l = logic(*l, *r);
+                }
+                Column::Boolean(left)
+            }
+
+            Node::Not(operand) => {
+                let mut values = self.eval(operand, mask)?.booleans();
+                for v in values.iter_mut() {
+                    *v = !*v;
+                }
+                Column::Boolean(values)
+            }
+
+            Node::Math { op, operand } => {
+                let mut values = self.eval(operand, mask)?.numbers();
+                if *op == Math::Sqrt {
+                    if let Some(n) = failing_lane(&values, mask, |n| n < 0.0) {
+                        sqrt(&Value::Number(n))?;
+                    }
+                }
+                let f: fn(f64) -> f64 = match op {
+                    Math::Negate => |n| -n,
+                    Math::Abs => f64::abs,
+                    Math::Ceil => f64::ceil,
+                    Math::Floor => f64::floor,
+                    Math::Sqrt => f64::sqrt,
+                };
+                for v in values.iter_mut() {
+                    *v = f(*v);
+                }
+                Column::Number(values)
+            }
+
+            Node::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                let condition = self.eval(condition, mask)?.booleans();
+                let then_mask: Vec<bool> =
+                    mask.iter().zip(&condition).map(|(m, c)| *m && *c).collect();
+                let else_mask: Vec<bool> = mask
+                    .iter()
+                    .zip(&condition)
+                    .map(|(m, c)| *m && !*c)
+                    .collect();
+
+                // Skip a branch entirely when no active lane takes it
+                if !then_mask.contains(&true) {
+                    return self.eval(else_branch, &else_mask);
+                }
+                if !else_mask.contains(&true) {
+                    return self.eval(then_branch, &then_mask);
+                }
+
+                let then_values = self.eval(then_branch, &then_mask)?;
+                let else_values = self.eval(else_branch, &else_mask)?;
+                match (then_values, else_values) {
+                    (Column::Number(t), Column::Number(e)) => {
+                        Column::Number(select(&condition, t, &e))
+                    }
+                    (Column::Boolean(t), Column::Boolean(e)) => {
+                        Column::Boolean(select(&condition, t, &e))
+                    }
+                    _ => unreachable!("columnar program is type checked"),
+                }
+            }
+        })
+    }
+}
+
+/// Apply a numeric operator element-wise, reusing the left column
+fn arith(
+    op: Arith,
+    mut left: Vec<f64>,
+    right: &[f64],
+    mask: &[bool],
+) -> Result<Vec<f64>, EvalError> {
+    // Division by zero is an error for any lane that reaches it; report it
+    // exactly as the row interpreter would
+    if matches!(op, Arith::Divide | Arith::Modulo) {
+        let zero = left
+            .iter()
+            .zip(right)
+            .zip(mask)
+            .find(|((_, r), m)| **m && **r == 0.0);
+        if let Some(((l, r), _)) = zero {
+            let (l, r) = (Value::Number(*l), Value::Number(*r));
+            match op {
+                Arith::Divide => divide(&l, &r)?,
+                _ => modulo(&l, &r)?,
+            };
+        }
+    }
+
+    let f: fn(f64, f64) -> f64 = match op {
+        Arith::Add => |l, r| l + r,
+        Arith::Subtract => |l, r| l - r,
+        Arith::Multiply => |l, r| l * r,
+        Arith::Divide => |l, r| l / r,
+        Arith::Modulo => |l, r| l % r,
+        Arith::Power => f64::powf,
+        Arith::Max => f64::max,
+        Arith::Min => f64::min,
+    };
+    for (l, r) in left.iter_mut().zip(right) {
+        *l = f(*l, *r);
+    }
+    Ok(left)
+}
+
+/// Find the value of the first active lane matching `fails`
+fn failing_lane(values: &[f64], mask: &[bool], fails: impl Fn(f64) -> bool) -> Option<f64> {
+    values
+        .iter()
+        .zip(mask)
+        .find(|(v, m)| **m && fails(**v))
+        .map(|(v, _)| *v)
+}
+
+/// Merge two branch columns by condition, reusing the `then` column
+fn select<T: Copy>(condition: &[bool], mut then_values: Vec<T>, else_values: &[T]) -> Vec<T> {
+    for ((t, e), c) in then_values.iter_mut().zip(else_values).zip(condition) {
+        if !*c {
+            *t = *e;
+        }
+    }
+    then_values
+}
+
+/// The columnar numeric backend
+pub struct ColumnarBackend;
+
+impl ColumnarBackend {
+    /// Create a new columnar backend
+    pub fn new() -> Self {
+        Self
+    }
+
+    /// Lower an already compiled (and validated) program
+    pub fn compile_program(&self, program: &CompiledProgram) -> BackendResult<ColumnarProgram> {
+        ColumnarProgram::lower(program.ast()).ok_or_else(not_numeric)
+    }
+
+    /// Get the capabilities of this backend
+    pub fn capabilities() -> BackendCapabilities {
+        BackendCapabilities {
+            name: "columnar".to_string(),
+            description: "Batch evaluation of numeric-only programs over f64 columns".to_string(),
+            supported_features: vec![
+                "numbers".to_string(),
+                "booleans".to_string(),
+                "arithmetic".to_string(),
+                "comparisons".to_string(),
+                "logic".to_string(),
+                "if_expressions".to_string(),
+                "let_bindings".to_string(),
+                "numeric_functions".to_string(),
+                "safe_navigation".to_string(),
+                "batch_evaluation".to_string(),
+            ],
+            performance_tier: PerformanceTier::Fast,
+            requires_external_deps: false,
+        }
+    }
+}
+
+impl Default for ColumnarBackend {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+fn not_numeric() -> BackendError {
+    BackendError::UnsupportedFeature(
+        "columnar evaluation requires a numeric-only program".to_string(),
+    )
+}
+
+impl Backend for ColumnarBackend {
+    type CompiledOutput = ColumnarProgram;
+    type ExecutionResult = Value;
+
+    fn name(&self) -> &str {
+        "columnar"
+    }
+
+    fn compile(&self, expr: &Expr, symbols: &[&str]) -> BackendResult<Self::CompiledOutput> {
+        let symbols: HashSet<String> = symbols.iter().map(|s| s.to_string()).collect();
+        validate_ast(expr, &symbols)?;
+        ColumnarProgram::lower(expr).ok_or_else(not_numeric)
+    }
+
+    /// Execute for a single record, as a batch of one
+    fn execute(
+        &self,
+        compiled: &Self::CompiledOutput,
+        data: &HashMap<String, Value>,
+    ) -> BackendResult<Self::ExecutionResult> {
+        compiled
+            .evaluate_records(std::slice::from_ref(data))
+            .pop()
+            .expect("one result per record")
+            .map_err(BackendError::EvalError)
+    }
+
+    fn supports(&self, expr: &Expr) -> bool {
+        ColumnarProgram::lower(expr).is_some()
+    }
+
+    fn description(&self) -> &str {
+        "Columnar numeric evaluator over structure-of-arrays batches"
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, evaluate};
+
+    fn lower(source: &str) -> Option<ColumnarProgram> {
+        ColumnarBackend::new()
+            .compile_program(&compile(source, &[]).unwrap())
+            .ok()
+    }
+
+    fn loan(principal: f64, rate: f64, years: f64) -> HashMap<String, Value> {
+        let mut loan = HashMap::new();
+        loan.insert("principal".to_string(), Value::Number(principal));
+        loan.insert("rate".to_string(), Value::Number(rate));
+        loan.insert("years".to_string(), Value::Number(years));
+        let mut data = HashMap::new();
+        data.insert("loan".to_string(), Value::Dictionary(loan));
+        data
+    }
+
+    #[test]
+    fn test_eligibility() {
+        let backend = ColumnarBackend::new();
+        let supports = |source: &str| {
+            let program = compile(source, &["a"]).unwrap();
+            backend.supports(program.ast())
+        };
+
+        assert!(supports("x * 2 + y"));
+        assert!(supports("if x > 0 and y > 0 x / y else 0 end"));
+        assert!(supports("let r = rate / 12 in principal * r"));
+        assert!(supports("max(abs(x), sqrt(y))"));
+        assert!(!supports("\"a\" + x"));
+        assert!(!supports(":a"));
+        assert!(!supports("[x, y] | sum"));
+        assert!(!supports("if x 1 else 0 end"));
+        assert!(!supports("if x > 0 1 else true end"));
+        assert!(!supports("let r = 1 in r.field"));
+    }
+
+    #[test]
+    fn test_run_over_columns() {
+        let program = lower("if x > 2 x * 10 else -x end").unwrap();
+        let mut batch = ColumnBatch::new(4);
+        batch.insert("x", vec![1.0, 2.0, 3.0, 4.0]);
+
+        assert_eq!(
+            program.run(&batch).unwrap(),
+            Column::Number(vec![-1.0, -2.0, 30.0, 40.0])
+        );
+    }
+
+    #[test]
+    fn test_run_missing_column() {
+        let program = lower("a.b + 1").unwrap();
+        assert!(matches!(
+            program.run(&ColumnBatch::new(1)),
+            Err(EvalError::VariableNotFound(path)) if path == "a.b"
+        ));
+    }
+
+    #[test]
+    fn test_masked_branch_does_not_fail() {
+        // Only lanes with y == 0 take the else branch, so the division is safe
+        let program = lower("if y != 0 x / y else 0 end").unwrap();
+        let mut batch = ColumnBatch::new(3);
+        batch.insert("x", vec![6.0, 1.0, 9.0]);
+        batch.insert("y", vec![3.0, 0.0, 3.0]);
+
+        assert_eq!(
+            program.run(&batch).unwrap(),
+            Column::Number(vec![2.0, 0.0, 3.0])
+        );
+    }
+
+    #[test]
+    fn test_logical_operators_short_circuit_per_lane() {
+        // The division only runs for lanes where the left operand is true
+        let program = lower("y != 0 and x / y > 1").unwrap();
+        let mut batch = ColumnBatch::new(3);
+        batch.insert("x", vec![6.0, 1.0, 1.0]);
+        batch.insert("y", vec![3.0, 0.0, 3.0]);
+        assert_eq!(
+            program.run(&batch).unwrap(),
+            Column::Boolean(vec![true, false, false])
+        );
+
+        let program = lower("y == 0 or x / y > 1").unwrap();
+        assert_eq!(
+            program.run(&batch).unwrap(),
+            Column::Boolean(vec![true, true, false])
+        );
+    }
+
+    #[test]
+    fn test_active_lane_error() {
+        let program = lower("x / y").unwrap();
+        let mut batch = ColumnBatch::new(2);
+        batch.insert("x", vec![1.0, 1.0]);
+        batch.insert("y", vec![1.0, 0.0]);
+        assert!(matches!(
+            program.run(&batch),
+            Err(EvalError::OperatorError(_))
+        ));
+    }
+
+    #[test]
+    fn test_evaluate_records_matches_interpreter() {
+        let sources = [
+            "let r = loan.rate / 12 in let n = loan.years * 12 in \
+             loan.principal * r * power(1 + r, n) / (power(1 + r, n) - 1)",
+            "if loan.principal > 200000 and not (loan.rate < 0.05) 1 else 0 end",
+            "loan.principal / loan.years",
+            "floor(sqrt(loan.principal)) == ceil(sqrt(loan.principal))",
+        ];
+        let mut records: Vec<_> = (1..50)
+            .map(|i| loan(i as f64 * 10000.0, 0.03 + i as f64 / 1000.0, (i % 5) as f64))
+            .collect();
+        // Non-numeric and missing fields fall back to the row interpreter
+        records[7].insert("loan".to_string(), Value::String("n/a".to_string()));
+        records[9].clear();
+
+        for source in sources {
+            let program = compile(source, &[]).unwrap();
+            let columnar = ColumnarBackend::new().compile_program(&program).unwrap();
+            let results = columnar.evaluate_records(&records);
+            for (data, result) in records.iter().zip(results) {
+                let expected = evaluate(&program, data);
+                match (result, expected) {
+                    (Ok(actual), Ok(expected)) => assert_eq!(actual, expected, "{}", source),
+                    (Err(actual), Err(expected)) => {
+                        assert_eq!(actual.to_string(), expected.to_string(), "{}", source)
+                    }
+                    (actual, expected) => panic!("{}: {:?} vs {:?}", source, actual, expected),
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_backend_execute_single_record() {
+        let backend = ColumnarBackend::new();
+        let program = compile("loan.principal * 2", &[]).unwrap();
+        let compiled = backend.compile(program.ast(), &[]).unwrap();
+        assert_eq!(
+            backend.execute(&compiled, &loan(5.0, 0.0, 1.0)).unwrap(),
+            Value::Number(10.0)
+        );
+        // Missing fields are evaluated by the row interpreter: nil * 2 fails
+        assert!(backend.execute(&compiled, &HashMap::new()).is_err());
+    }
+}
@@ -3,6 +3,8 @@
 //! This module implements the Backend trait for the tree-walking interpreter.
 
 use super::{Backend, BackendError, BackendResult, PerformanceTier};
+use crate::metrics::{self, BackendSlot};
+use crate::resolve::{resolve_unchecked, Node};
 use crate::{compile, evaluate, CompiledProgram};
 use amoskeag_parser::Expr;
 use amoskeag_stdlib_operators::Value;
@@ -127,7 +129,7 @@ impl Default for DirectInterpreterBackend {
 
 /// Wrapper for an AST expression as "compiled" output
 pub struct DirectCompiledProgram {
-    expr: Expr,
+    node: Node,
 }
 
 impl Backend for DirectInterpreterBackend {
@@ -140,7 +142,9 @@ impl Backend for DirectInterpreterBackend {
 
     fn compile(&self, expr: &Expr, _symbols: &[&str]) -> BackendResult<Self::CompiledOutput> {
         // Symbol validation would happen here in a real implementation
-        Ok(DirectCompiledProgram { expr: expr.clone() })
+        Ok(DirectCompiledProgram {
+            node: resolve_unchecked(expr),
+        })
     }
 
     fn execute(
@@ -148,10 +152,13 @@ impl Backend for DirectInterpreterBackend {
         compiled: &Self::CompiledOutput,
         data: &HashMap<String, Value>,
     ) -> BackendResult<Self::ExecutionResult> {
-        use crate::{eval_expr, Context};
+        use crate::{eval_node, Context};
 
-        let context = Context::new(data.clone());
-        eval_expr(&compiled.expr, &context).map_err(BackendError::EvalError)
+        let context = Context::new(data);
+        metrics::evaluation(None, BackendSlot::DirectInterpreter, || {
+            eval_node(&compiled.node, &context)
+        })
+        .map_err(BackendError::EvalError)
     }
 
     fn supports(&self, _expr: &Expr) -> bool {
@@ -217,7 +224,7 @@ mod tests {
         let compiled = backend.compile(&expr, &["yes", "no"]).unwrap();
         let result = backend.execute(&compiled, &data).unwrap();
 
-        assert_eq!(result, Value::Symbol("yes".to_string()));
+        assert_eq!(result, Value::Symbol("yes".into()));
     }
 
     #[test]
@@ -0,0 +1,264 @@
+//! Parallel batch evaluation
+//!
+//! A `CompiledProgram` is immutable once compiled, so one program can be
+//! shared by any number of worker threads. `evaluate_batch` splits a slice of
+//! records into small chunks that idle workers claim one at a time, which
+//! keeps every thread busy even when some records are much slower to
+//! evaluate than others. Results always come back in input order. The
+//! workers are the long-lived threads of `pool`, so neither a batch nor a
+//! window of a stream starts any threads of its own.
+
+use crate::{evaluate, pool, CompiledProgram, EvalError};
+use amoskeag_stdlib_operators::Value;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::thread;
+
+/// Number of records a worker claims at a time
+const CHUNK_SIZE: usize = 64;
+
+/// Evaluate a program against many records in parallel
+///
+/// Each record is evaluated independently, exactly as `evaluate` would, and
+/// the result for `records[i]` is at index `i` of the returned vector. Batches
+/// too small to benefit from parallelism are evaluated on the calling thread.
+pub fn evaluate_batch(
+    program: &CompiledProgram,
+    records: &[HashMap<String, Value>],
+) -> Vec<Result<Value, EvalError>> {
+    evaluate_with_workers(program, records, worker_count(records.len()))
+}
+
+/// Evaluate records on up to `workers` threads
+fn evaluate_with_workers(
+    program: &CompiledProgram,
+    records: &[HashMap<String, Value>],
+    workers: usize,
+) -> Vec<Result<Value, EvalError>> {
+    parallel_map(records, workers, |data| evaluate(program, data))
+}
+
+/// Apply `f` to every item on up to `workers` threads, returning the
+/// results in input order
+///
+/// Workers claim the items in chunks, as [`evaluate_batch`] does with
+/// records, and run on the same long-lived threads, so hosts can spread
+/// their own per-record work, such as decoding and encoding around each
+/// evaluation, without starting threads of their own.
+pub fn parallel_map<T, R, F>(items: &[T], workers: usize, f: F) -> Vec<R>
+where
+    T: Sync,
+    R: Send,
+    F: Fn(&T) -> R + Sync,
+{
+    parallel_map_with(items, workers, CHUNK_SIZE, || (), |(), item| f(item))
+}
+
+/// Apply `f` to every item on up to `workers` threads, with state of each
+/// thread's own, returning the results in input order
+///
+/// Each thread taking part makes its state with `init` and passes it to
+/// every call of `f` it makes. Threads claim `chunk_size` items at a time:
+/// a chunk of one balances best when items take very different times,
+/// while larger chunks cost less per item.
+pub fn parallel_map_with<T, S, R, I, F>(
+    items: &[T],
+    workers: usize,
+    chunk_size: usize,
+    init: I,
+    f: F,
+) -> Vec<R>
+where
+    T: Sync,
+    R: Send,
+    I: Fn() -> S + Sync,
+    F: Fn(&mut S, &T) -> R + Sync,
+{
+    let chunk_size = chunk_size.max(1);
+    let workers = workers.min(items.len().div_ceil(chunk_size));
+    if workers <= 1 {
+        let mut state = init();
+        return items.iter().map(|item| f(&mut state, item)).collect();
+    }
+
+    let chunks: Vec<&[T]> = items.chunks(chunk_size).collect();
+    let next_chunk = AtomicUsize::new(0);
+    let done = Mutex::new(Vec::with_capacity(chunks.len()));
+
+    pool::broadcast(workers - 1, &|| {
+        let mut state = None;
+        let mut claimed = Vec::new();
+        loop {
+            let index = next_chunk.fetch_add(1, Ordering::Relaxed);
+            let Some(chunk) = chunks.get(index) else {
+                break;
+            };
+            // Threads that find nothing left never make their state
+            let state = state.get_or_insert_with(&init);
+            let results: Vec<R> = chunk.iter().map(|item| f(state, item)).collect();
+            claimed.push((index, results));
+        }
+        done.lock().expect("batch worker panicked").extend(claimed);
+    });
+
+    let mut done = done.into_inner().expect("batch worker panicked");
+    done.sort_unstable_by_key(|(index, _)| *index);
+    let mut results = Vec::with_capacity(items.len());
+    for (_, chunk_results) in done {
+        results.extend(chunk_results);
+    }
+    results
+}
+
+/// Evaluate a program against a stream of records, in parallel
+///
+/// Records are pulled from `records` one window at a time and each window is
+/// evaluated with `evaluate_batch`, so memory use stays bounded no matter how
+/// long the stream is. Results are yielded in input order.
+pub fn evaluate_stream<'p, I>(
+    program: &'p CompiledProgram,
+    records: I,
+) -> BatchStream<'p, I::IntoIter>
+where
+    I: IntoIterator<Item = HashMap<String, Value>>,
+{
+    BatchStream {
+        program,
+        records: records.into_iter(),
+        window: window_size(),
+        pending: Vec::new().into_iter(),
+    }
+}
+
+/// Iterator returned by [`evaluate_stream`]
+pub struct BatchStream<'p, I> {
+    program: &'p CompiledProgram,
+    records: I,
+    window: usize,
+    pending: std::vec::IntoIter<Result<Value, EvalError>>,
+}
+
+impl<I> Iterator for BatchStream<'_, I>
+where
+    I: Iterator<Item = HashMap<String, Value>>,
+{
+    type Item = Result<Value, EvalError>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if let Some(result) = self.pending.next() {
+            return Some(result);
+        }
+
+        let window: Vec<_> = self.records.by_ref().take(self.window).collect();
+        if window.is_empty() {
+            return None;
+        }
+        self.pending = evaluate_batch(self.program, &window).into_iter();
+        self.pending.next()
+    }
+}
+
+/// Number of worker threads to use for `len` records
+pub(crate) fn worker_count(len: usize) -> usize {
+    // Asking for the available parallelism costs a system call or more,
+    // which would dominate evaluating a few records
+    if len <= CHUNK_SIZE {
+        return 1;
+    }
+    let available = thread::available_parallelism().map_or(1, |n| n.get());
+    available.min(len.div_ceil(CHUNK_SIZE))
+}
+
+/// Number of records buffered per window of a stream
+fn window_size() -> usize {
+    let available = thread::available_parallelism().map_or(1, |n| n.get());
+    available * CHUNK_SIZE * 4
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::compile;
+
+    fn record(score: f64) -> HashMap<String, Value> {
+        let mut data = HashMap::new();
+        data.insert("score".to_string(), Value::Number(score));
+        data
+    }
+
+    #[test]
+    fn test_evaluate_batch_preserves_order() {
+        let program = compile("score * 2", &[]).unwrap();
+        let records: Vec<_> = (0..1000).map(|i| record(i as f64)).collect();
+
+        for workers in [1, 4] {
+            let results = evaluate_with_workers(&program, &records, workers);
+
+            assert_eq!(results.len(), records.len());
+            for (i, result) in results.into_iter().enumerate() {
+                assert_eq!(result.unwrap(), Value::Number(i as f64 * 2.0));
+            }
+        }
+    }
+
+    #[test]
+    fn test_evaluate_batch_reports_errors_per_record() {
+        let program = compile("score / 1", &[]).unwrap();
+        let mut records: Vec<_> = (0..200).map(|i| record(i as f64)).collect();
+        records[150] = HashMap::new();
+
+        let results = evaluate_with_workers(&program, &records, 3);
+
+        assert!(matches!(
+            &results[150],
+            Err(EvalError::VariableNotFound(name)) if name == "score"
+        ));
+        assert_eq!(results.iter().filter(|r| r.is_ok()).count(), 199);
+    }
+
+    #[test]
+    fn test_parallel_map_with_keeps_state_per_thread() {
+        let items: Vec<usize> = (0..500).collect();
+        for (workers, chunk_size) in [(1, 1), (4, 1), (4, 64)] {
+            // Each call sees the calls its own thread made before it
+            let results = parallel_map_with(
+                &items,
+                workers,
+                chunk_size,
+                || (thread::current().id(), 0),
+                |(id, calls), &item| {
+                    assert_eq!(*id, thread::current().id());
+                    *calls += 1;
+                    (item * 2, *calls)
+                },
+            );
+            let doubled: Vec<usize> = results.iter().map(|&(n, _)| n).collect();
+            assert_eq!(doubled, items.iter().map(|n| n * 2).collect::<Vec<_>>());
+            let calls: usize = results.iter().filter(|&&(_, calls)| calls == 1).count();
+            assert!((1..=workers).contains(&calls));
+        }
+    }
+
+    #[test]
+    fn test_evaluate_batch_empty() {
+        let program = compile("1", &[]).unwrap();
+        assert!(evaluate_batch(&program, &[]).is_empty());
+    }
+
+    #[test]
+    fn test_evaluate_stream_matches_batch() {
+        let program = compile("if score > 500 :high else :low end", &["high", "low"]).unwrap();
+        let records: Vec<_> = (0..3000).map(|i| record(i as f64)).collect();
+
+        let streamed: Vec<_> = evaluate_stream(&program, records.clone())
+            .map(Result::unwrap)
+            .collect();
+        let batched: Vec<_> = evaluate_batch(&program, &records)
+            .into_iter()
+            .map(Result::unwrap)
+            .collect();
+
+        assert_eq!(streamed, batched);
+    }
+}
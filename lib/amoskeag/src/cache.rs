@@ -0,0 +1,290 @@
+//! Compiled program cache
+//!
+//! Hosts that receive rule source with every request can keep a
+//! `ProgramCache` and call `get_or_compile` instead of `compile`. Programs are
+//! keyed by their source and symbol set and handed out as shared
+//! `Arc<CompiledProgram>` handles, so a cached program can be evaluated from
+//! any number of threads. When the cache is full, the least recently used
+//! program is evicted.
+
+use crate::{compile, CompileError, CompiledProgram};
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
+use std::hash::{Hash, Hasher};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+
+/// A bounded, thread-safe cache of compiled programs
+#[derive(Debug)]
+pub struct ProgramCache {
+    capacity: usize,
+    state: Mutex<State>,
+    hits: AtomicU64,
+    misses: AtomicU64,
+    evictions: AtomicU64,
+}
+
+/// Counters reported by [`ProgramCache::stats`]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct CacheStats {
+    /// Lookups answered from the cache
+    pub hits: u64,
+    /// Lookups that had to compile the program
+    pub misses: u64,
+    /// Programs dropped to make room for new ones
+    pub evictions: u64,
+    /// Programs currently cached
+    pub len: usize,
+    /// Maximum number of programs the cache holds
+    pub capacity: usize,
+}
+
+#[derive(Debug, Default)]
+struct State {
+    /// Entries bucketed by key hash; a bucket holds more than one entry only
+    /// when two keys collide
+    entries: HashMap<u64, Vec<Entry>>,
+    len: usize,
+    /// Incremented on every access and stamped on the entry it touches
+    clock: u64,
+}
+
+#[derive(Debug)]
+struct Entry {
+    source: String,
+    /// Sorted and deduplicated, since the symbol list is a set
+    symbols: Vec<String>,
+    program: Arc<CompiledProgram>,
+    last_used: u64,
+}
+
+impl Entry {
+    fn matches(&self, source: &str, symbols: &[&str]) -> bool {
+        self.source == source
+            && self.symbols.len() == symbols.len()
+            && self.symbols.iter().zip(symbols).all(|(a, b)| a == b)
+    }
+}
+
+impl ProgramCache {
+    /// Create a cache that holds up to `capacity` programs
+    ///
+    /// A capacity of zero disables caching: every lookup compiles.
+    pub fn new(capacity: usize) -> Self {
+        ProgramCache {
+            capacity,
+            state: Mutex::new(State::default()),
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            evictions: AtomicU64::new(0),
+        }
+    }
+
+    /// Return the cached program for `source` and `symbols`, compiling and
+    /// caching it on a miss
+    ///
+    /// The order of `symbols` does not matter. Compilation errors are
+    /// returned as-is and are not cached.
+    pub fn get_or_compile(
+        &self,
+        source: &str,
+        symbols: &[&str],
+    ) -> Result<Arc<CompiledProgram>, CompileError> {
+        let mut symbols = symbols.to_vec();
+        symbols.sort_unstable();
+        symbols.dedup();
+        let hash = key_hash(source, &symbols);
+
+        if let Some(program) = self.lookup(hash, source, &symbols) {
+            self.hits.fetch_add(1, Ordering::Relaxed);
+            return Ok(program);
+        }
+        self.misses.fetch_add(1, Ordering::Relaxed);
+
+        // Compile without holding the lock so other lookups aren't blocked
+        let program = Arc::new(compile(source, &symbols)?);
+        if self.capacity == 0 {
+            return Ok(program);
+        }
+
+        let mut state = self.state.lock().unwrap_or_else(|e| e.into_inner());
+        state.clock += 1;
+        let clock = state.clock;
+
+        // Another thread may have compiled the same program meanwhile
+        if let Some(entry) = state
+            .entries
+            .get_mut(&hash)
+            .and_then(|bucket| bucket.iter_mut().find(|e| e.matches(source, &symbols)))
+        {
+            entry.last_used = clock;
+            return Ok(Arc::clone(&entry.program));
+        }
+
+        if state.len >= self.capacity {
+            state.evict_least_recent();
+            self.evictions.fetch_add(1, Ordering::Relaxed);
+        }
+        state.entries.entry(hash).or_default().push(Entry {
+            source: source.to_string(),
+            symbols: symbols.iter().map(|s| s.to_string()).collect(),
+            program: Arc::clone(&program),
+            last_used: clock,
+        });
+        state.len += 1;
+        Ok(program)
+    }
+
+    /// Current counters and size
+    pub fn stats(&self) -> CacheStats {
+        let len = self.state.lock().unwrap_or_else(|e| e.into_inner()).len;
+        CacheStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            evictions: self.evictions.load(Ordering::Relaxed),
+            len,
+            capacity: self.capacity,
+        }
+    }
+
+    /// Drop every cached program
+    ///
+    /// Handles already returned stay valid. Counters are not reset.
+    pub fn clear(&self) {
+        let mut state = self.state.lock().unwrap_or_else(|e| e.into_inner());
+        state.entries.clear();
+        state.len = 0;
+    }
+
+    fn lookup(&self, hash: u64, source: &str, symbols: &[&str]) -> Option<Arc<CompiledProgram>> {
+        let mut state = self.state.lock().unwrap_or_else(|e| e.into_inner());
+        state.clock += 1;
+        let clock = state.clock;
+        let entry = state
+            .entries
+            .get_mut(&hash)?
+            .iter_mut()
+            .find(|e| e.matches(source, symbols))?;
+        entry.last_used = clock;
+        Some(Arc::clone(&entry.program))
+    }
+}
+
+impl State {
+    /// Remove the entry with the oldest access stamp
+    ///
+    /// This scans every entry, which is cheap at the few hundred programs a
+    /// cache is expected to hold and only happens on a miss.
+    fn evict_least_recent(&mut self) {
+        let oldest = self
+            .entries
+            .iter()
+            .flat_map(|(hash, bucket)| {
+                bucket
+                    .iter()
+                    .enumerate()
+                    .map(move |(i, e)| (e.last_used, *hash, i))
+            })
+            .min();
+
+        if let Some((_, hash, index)) = oldest {
+            let bucket = self.entries.get_mut(&hash).expect("bucket exists");
+            bucket.swap_remove(index);
+            if bucket.is_empty() {
+                self.entries.remove(&hash);
+            }
+            self.len -= 1;
+        }
+    }
+}
+
+fn key_hash(source: &str, symbols: &[&str]) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    source.hash(&mut hasher);
+    symbols.hash(&mut hasher);
+    hasher.finish()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::evaluate;
+    use amoskeag_stdlib_operators::Value;
+    use std::thread;
+
+    #[test]
+    fn test_cache_hits_share_the_program() {
+        let cache = ProgramCache::new(10);
+        let first = cache.get_or_compile("x + 1", &[]).unwrap();
+        let second = cache.get_or_compile("x + 1", &[]).unwrap();
+
+        assert!(Arc::ptr_eq(&first, &second));
+        let stats = cache.stats();
+        assert_eq!((stats.hits, stats.misses, stats.len), (1, 1, 1));
+    }
+
+    #[test]
+    fn test_cache_key_includes_symbols() {
+        let cache = ProgramCache::new(10);
+        assert!(cache.get_or_compile(":approve", &[]).is_err());
+        let a = cache
+            .get_or_compile(":approve", &["approve", "deny"])
+            .unwrap();
+        let b = cache
+            .get_or_compile(":approve", &["deny", "approve"])
+            .unwrap();
+        let c = cache.get_or_compile(":approve", &["approve"]).unwrap();
+
+        assert!(Arc::ptr_eq(&a, &b));
+        assert!(!Arc::ptr_eq(&a, &c));
+        // The failed compile counts as a miss but isn't cached
+        assert_eq!(cache.stats().misses, 3);
+        assert_eq!(cache.stats().len, 2);
+    }
+
+    #[test]
+    fn test_cache_evicts_least_recently_used() {
+        let cache = ProgramCache::new(2);
+        let a = cache.get_or_compile("1", &[]).unwrap();
+        cache.get_or_compile("2", &[]).unwrap();
+        cache.get_or_compile("1", &[]).unwrap();
+        cache.get_or_compile("3", &[]).unwrap();
+
+        let stats = cache.stats();
+        assert_eq!((stats.len, stats.evictions), (2, 1));
+        // "1" was used more recently than "2", so it survived
+        assert!(Arc::ptr_eq(&a, &cache.get_or_compile("1", &[]).unwrap()));
+        cache.get_or_compile("2", &[]).unwrap();
+        assert_eq!(cache.stats().misses, 4);
+    }
+
+    #[test]
+    fn test_zero_capacity_disables_caching() {
+        let cache = ProgramCache::new(0);
+        cache.get_or_compile("1", &[]).unwrap();
+        cache.get_or_compile("1", &[]).unwrap();
+        let stats = cache.stats();
+        assert_eq!((stats.hits, stats.misses, stats.len), (0, 2, 0));
+    }
+
+    #[test]
+    fn test_cache_is_shared_across_threads() {
+        let cache = ProgramCache::new(4);
+        thread::scope(|scope| {
+            for _ in 0..4 {
+                scope.spawn(|| {
+                    for i in 0..50 {
+                        let source = format!("{} * 2", i % 3);
+                        let program = cache.get_or_compile(&source, &[]).unwrap();
+                        let result = evaluate(&program, &HashMap::new()).unwrap();
+                        assert_eq!(result, Value::Number((i % 3) as f64 * 2.0));
+                    }
+                });
+            }
+        });
+
+        let stats = cache.stats();
+        assert_eq!(stats.hits + stats.misses, 200);
+        assert_eq!(stats.len, 3);
+    }
+}
@@ -0,0 +1,862 @@
+//! C ABI
+//!
+//! The static and dynamic libraries export these functions for hosts that
+//! embed Amoskeag from C, C++ or anything else with a C FFI; `amoskeag.h`
+//! declares them. A host compiles or loads a program once, as an
+//! `AmoskeagProgram`, and creates an `AmoskeagEvaluator` from it for each
+//! thread that evaluates it.
+//!
+//! Data and results cross the boundary as binary records (see `record`),
+//! so no JSON is encoded or parsed per call. An evaluator keeps its record
+//! table, its result buffer and its error message from one call to the
+//! next, and only decodes the fields of a record the program reads.
+//! Results are written into a buffer the caller owns, so once the
+//! evaluator's buffers have grown to fit, the only allocations left in a
+//! call are the values themselves, and the keys of a record the previous
+//! one didn't have.
+//!
+//! Every function is safe to call with null pointers, which are reported as
+//! `AMOSKEAG_INVALID_ARGUMENT`, or ignored by the functions that free. No
+//! panic unwinds into the host: one caught in an evaluation is reported as
+//! `AMOSKEAG_PANIC`, and elsewhere as the function's failure value.
+
+use crate::record::{self, write_str};
+use crate::{compile, evaluate, CompiledProgram};
+use amoskeag_stdlib_operators::Value;
+use std::collections::HashMap;
+use std::ffi::{c_char, c_int, CStr, CString};
+use std::fmt::Display;
+use std::io::Write;
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::Arc;
+
+/// The call succeeded
+pub const AMOSKEAG_OK: c_int = 0;
+/// Evaluation failed; the evaluator's error describes why
+pub const AMOSKEAG_EVAL_ERROR: c_int = 1;
+/// A record couldn't be decoded
+pub const AMOSKEAG_INVALID_RECORD: c_int = 2;
+/// The result doesn't fit in the buffer; the length it needs was written
+pub const AMOSKEAG_BUFFER_TOO_SMALL: c_int = 3;
+/// A required pointer was null
+pub const AMOSKEAG_INVALID_ARGUMENT: c_int = 4;
+/// The library panicked; the evaluator's error describes it, and the
+/// evaluator can still be used
+pub const AMOSKEAG_PANIC: c_int = 5;
+
+/// A compiled program, shared by any number of evaluators and threads
+pub struct AmoskeagProgram(Arc<CompiledProgram>);
+
+/// Evaluates one program, reusing its buffers from call to call
+///
+/// An evaluator is used by one thread at a time.
+pub struct AmoskeagEvaluator {
+    program: Arc<CompiledProgram>,
+    /// The data of the record being evaluated
+    data: HashMap<String, Value>,
+    /// The previous record's entries while the next one is decoded, which
+    /// lends it their keys
+    spare: HashMap<String, Value>,
+    /// The encoded result, before it is copied to the caller
+    output: Vec<u8>,
+    /// The last error, NUL-terminated
+    error: Vec<u8>,
+}
+
+impl AmoskeagEvaluator {
+    fn set_error(&mut self, error: impl Display) {
+        self.error.clear();
+        let _ = write!(self.error, "{}", error);
+        // The message ends at its first NUL, wherever that is
+        self.error.push(0);
+    }
+
+    /// Make one call, reporting a panic in it as `AMOSKEAG_PANIC`
+    fn guarded(&mut self, call: impl FnOnce(&mut Self) -> c_int) -> c_int {
+        match catch(|| call(self)) {
+            Ok(status) => status,
+            Err(message) => {
+                self.output.clear();
+                self.set_error(message);
+                AMOSKEAG_PANIC
+            }
+        }
+    }
+
+    /// Decode the record at the start of `bytes` and evaluate it, returning
+    /// the bytes after the record
+    fn evaluate<'b>(
+        &mut self,
+        bytes: &'b [u8],
+    ) -> Result<(&'b [u8], Result<Value, String>), String> {
+        let paths = Some(self.program.required_paths());
+        let rest = record::decode_data_into(bytes, paths, &mut self.data, &mut self.spare)
+            .map_err(|e| e.to_string())?;
+        let result = evaluate(&self.program, &self.data).map_err(|e| e.to_string());
+        Ok((rest, result))
+    }
+
+    /// Copy the encoded result to the caller's buffer, if it fits
+    ///
+    /// # Safety
+    /// `out` must be valid for `capacity` bytes of writes, or null when
+    /// `capacity` is 0, and `out_len` must be valid for a write.
+    unsafe fn copy_output(&self, out: *mut u8, capacity: usize, out_len: *mut usize) -> c_int {
+        *out_len = self.output.len();
+        if self.output.len() > capacity {
+            return AMOSKEAG_BUFFER_TOO_SMALL;
+        }
+        if !self.output.is_empty() {
+            std::ptr::copy_nonoverlapping(self.output.as_ptr(), out, self.output.len());
+        }
+        AMOSKEAG_OK
+    }
+}
+
+/// Run `f`, returning the message of a panic in it rather than letting it
+/// unwind into the host
+fn catch<T>(f: impl FnOnce() -> T) -> Result<T, String> {
+    panic::catch_unwind(AssertUnwindSafe(f)).map_err(|payload| {
+        let message = payload
+            .downcast_ref::<&str>()
+            .copied()
+            .or_else(|| payload.downcast_ref::<String>().map(String::as_str))
+            .unwrap_or("unknown cause");
+        format!("Internal error: {}", message)
+    })
+}
+
+/// The bytes at `ptr`, allowing a null pointer for an empty slice
+///
+/// # Safety
+/// `ptr` must be valid for `len` bytes of reads unless `len` is 0.
+unsafe fn bytes<'a>(ptr: *const u8, len: usize) -> Option<&'a [u8]> {
+    match (ptr.is_null(), len) {
+        (_, 0) => Some(&[]),
+        (true, _) => None,
+        (false, _) => Some(std::slice::from_raw_parts(ptr, len)),
+    }
+}
+
+/// Store `error` in `*error_out` as a string owned by the caller, if
+/// `error_out` isn't null
+///
+/// # Safety
+/// `error_out` must be null or valid for a write.
+unsafe fn report(error_out: *mut *mut c_char, error: impl Display) {
+    if !error_out.is_null() {
+        let message = error.to_string().replace('\0', " ");
+        *error_out = CString::new(message).expect("NULs are replaced").into_raw();
+    }
+}
+
+fn into_handle(program: CompiledProgram) -> *mut AmoskeagProgram {
+    Box::into_raw(Box::new(AmoskeagProgram(Arc::new(program))))
+}
+
+/// Compile the program in `source`, `source_len` bytes of UTF-8
+///
+/// `symbols` is an array of `symbol_count` NUL-terminated symbol names the
+/// program may use; it may be null when `symbol_count` is 0. Returns the
+/// program, to be freed with `amoskeag_program_free`, or null on failure,
+/// storing a message to be freed with `amoskeag_string_free` in
+/// `*error_out` unless `error_out` is null.
+///
+/// # Safety
+/// `source` must be valid for `source_len` bytes of reads, `symbols` valid
+/// for `symbol_count` pointers to NUL-terminated strings, and `error_out`
+/// null or valid for a write.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_program_compile(
+    source: *const u8,
+    source_len: usize,
+    symbols: *const *const c_char,
+    symbol_count: usize,
+    error_out: *mut *mut c_char,
+) -> *mut AmoskeagProgram {
+    catch(|| {
+        let Some(source) = bytes(source, source_len) else {
+            report(error_out, "source is null");
+            return std::ptr::null_mut();
+        };
+        let Ok(source) = std::str::from_utf8(source) else {
+            report(error_out, "source is not valid UTF-8");
+            return std::ptr::null_mut();
+        };
+        if symbols.is_null() && symbol_count > 0 {
+            report(error_out, "symbols is null");
+            return std::ptr::null_mut();
+        }
+        let mut names = Vec::with_capacity(symbol_count);
+        for i in 0..symbol_count {
+            let symbol = *symbols.add(i);
+            match (!symbol.is_null()).then(|| CStr::from_ptr(symbol).to_str()) {
+                Some(Ok(name)) => names.push(name),
+                _ => {
+                    report(error_out, format!("symbol {} is not a UTF-8 string", i));
+                    return std::ptr::null_mut();
+                }
+            }
+        }
+
+        match compile(source, &names) {
+            Ok(program) => into_handle(program),
+            Err(e) => {
+                report(error_out, e);
+                std::ptr::null_mut()
+            }
+        }
+    })
+    .unwrap_or_else(|message| {
+        report(error_out, message);
+        std::ptr::null_mut()
+    })
+}
+
+/// Load a program precompiled with `amoskeag compile`, from `len` bytes
+///
+/// Returns the program, to be freed with `amoskeag_program_free`, or null
+/// on failure, storing a message in `*error_out` as
+/// `amoskeag_program_compile` does.
+///
+/// # Safety
+/// `bytes` must be valid for `len` bytes of reads, and `error_out` null or
+/// valid for a write.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_program_load(
+    artifact: *const u8,
+    len: usize,
+    error_out: *mut *mut c_char,
+) -> *mut AmoskeagProgram {
+    catch(|| {
+        let Some(artifact) = bytes(artifact, len) else {
+            report(error_out, "artifact is null");
+            return std::ptr::null_mut();
+        };
+        match CompiledProgram::from_bytes(artifact) {
+            Ok(program) => into_handle(program),
+            Err(e) => {
+                report(error_out, e);
+                std::ptr::null_mut()
+            }
+        }
+    })
+    .unwrap_or_else(|message| {
+        report(error_out, message);
+        std::ptr::null_mut()
+    })
+}
+
+/// Free a program
+///
+/// Evaluators created from it keep working: each holds its own reference.
+///
+/// # Safety
+/// `program` must be null or returned by `amoskeag_program_compile` or
+/// `amoskeag_program_load`, and not already freed.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_program_free(program: *mut AmoskeagProgram) {
+    if !program.is_null() {
+        let _ = catch(|| drop(Box::from_raw(program)));
+    }
+}
+
+/// Report the metrics of `program`'s evaluations under `name`, a
+/// NUL-terminated string, as `CompiledProgram::set_metrics_name` does
+///
+/// Returns `AMOSKEAG_OK`, also when the program already has a name or the
+/// library is built without the `metrics` feature, or
+/// `AMOSKEAG_INVALID_ARGUMENT` if either pointer is null or `name` isn't
+/// UTF-8, or `AMOSKEAG_PANIC`.
+///
+/// # Safety
+/// `program` must be null or a live program, and `name` null or a
+/// NUL-terminated string.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_program_set_metrics_name(
+    program: *const AmoskeagProgram,
+    name: *const c_char,
+) -> c_int {
+    let Some(program) = program.as_ref() else {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    };
+    if name.is_null() {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    }
+    let Ok(name) = CStr::from_ptr(name).to_str() else {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    };
+    catch(|| program.0.set_metrics_name(name)).map_or(AMOSKEAG_PANIC, |()| AMOSKEAG_OK)
+}
+
+/// Free a string returned by this library
+///
+/// # Safety
+/// `string` must be null or a string returned by this library, and not
+/// already freed.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_string_free(string: *mut c_char) {
+    if !string.is_null() {
+        let _ = catch(|| drop(CString::from_raw(string)));
+    }
+}
+
+/// Create an evaluator of `program`, or return null if `program` is null
+/// or the evaluator can't be made
+///
+/// # Safety
+/// `program` must be null or a live program.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_evaluator_new(
+    program: *const AmoskeagProgram,
+) -> *mut AmoskeagEvaluator {
+    let Some(program) = program.as_ref() else {
+        return std::ptr::null_mut();
+    };
+    catch(|| {
+        Box::into_raw(Box::new(AmoskeagEvaluator {
+            program: Arc::clone(&program.0),
+            data: HashMap::new(),
+            spare: HashMap::new(),
+            output: Vec::new(),
+            error: vec![0],
+        }))
+    })
+    .unwrap_or(std::ptr::null_mut())
+}
+
+/// Free an evaluator
+///
+/// # Safety
+/// `evaluator` must be null or returned by `amoskeag_evaluator_new`, and
+/// not already freed.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_evaluator_free(evaluator: *mut AmoskeagEvaluator) {
+    if !evaluator.is_null() {
+        let _ = catch(|| drop(Box::from_raw(evaluator)));
+    }
+}
+
+/// The message of the last error the evaluator reported
+///
+/// The string belongs to the evaluator and is valid until its next call.
+/// It is empty before any error, and null if `evaluator` is null.
+///
+/// # Safety
+/// `evaluator` must be null or a live evaluator.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_evaluator_error(
+    evaluator: *const AmoskeagEvaluator,
+) -> *const c_char {
+    match evaluator.as_ref() {
+        Some(evaluator) => evaluator.error.as_ptr().cast(),
+        None => std::ptr::null(),
+    }
+}
+
+/// Evaluate the program with the data in one record
+///
+/// On success the result, encoded as a record value, is written to `out`
+/// and its length to `*out_len`. If it is longer than `capacity`, nothing
+/// is written to `out`, the length it needs is written to `*out_len`, and
+/// `AMOSKEAG_BUFFER_TOO_SMALL` is returned; copy the result into a larger
+/// buffer with `amoskeag_evaluator_output`. Evaluation errors return `AMOSKEAG_EVAL_ERROR` and a record
+/// that doesn't decode `AMOSKEAG_INVALID_RECORD`, with the message in
+/// `amoskeag_evaluator_error`.
+///
+/// # Safety
+/// `evaluator` must be a live evaluator not in use by another thread,
+/// `record` valid for `record_len` bytes of reads, `out` valid for
+/// `capacity` bytes of writes, and `out_len` valid for a write.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_evaluate(
+    evaluator: *mut AmoskeagEvaluator,
+    record: *const u8,
+    record_len: usize,
+    out: *mut u8,
+    capacity: usize,
+    out_len: *mut usize,
+) -> c_int {
+    let (Some(evaluator), Some(record)) = (evaluator.as_mut(), bytes(record, record_len)) else {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    };
+    if out_len.is_null() || (out.is_null() && capacity > 0) {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    }
+
+    evaluator.guarded(|evaluator| {
+        evaluator.output.clear();
+        let result = match evaluator.evaluate(record) {
+            Ok((rest, _)) if !rest.is_empty() => {
+                evaluator.set_error("Record is malformed: trailing bytes");
+                return AMOSKEAG_INVALID_RECORD;
+            }
+            Ok((_, result)) => result,
+            Err(e) => {
+                evaluator.set_error(e);
+                return AMOSKEAG_INVALID_RECORD;
+            }
+        };
+        match result {
+            Ok(value) => {
+                record::encode_value(&value, &mut evaluator.output);
+                evaluator.copy_output(out, capacity, out_len)
+            }
+            Err(e) => {
+                evaluator.set_error(e);
+                AMOSKEAG_EVAL_ERROR
+            }
+        }
+    })
+}
+
+/// Evaluate the program with each of `count` records, in one call
+///
+/// `records` holds the records one after another. The results are written
+/// to `out` in the same order, each as a status byte followed by either the
+/// result value, after `AMOSKEAG_OK`, or the error message, after
+/// `AMOSKEAG_EVAL_ERROR`, encoded as a varint length and UTF-8 bytes. A
+/// record failing to evaluate doesn't stop the others.
+///
+/// Returns `AMOSKEAG_OK` when every record was evaluated, and
+/// `AMOSKEAG_BUFFER_TOO_SMALL` as `amoskeag_evaluate` does, keeping the
+/// results for `amoskeag_evaluator_output`. If a record
+/// doesn't decode, none of the results are written and
+/// `AMOSKEAG_INVALID_RECORD` is returned, with a message naming the record
+/// in `amoskeag_evaluator_error`.
+///
+/// # Safety
+/// As for `amoskeag_evaluate`, with `records` valid for `records_len` bytes
+/// of reads.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_evaluate_batch(
+    evaluator: *mut AmoskeagEvaluator,
+    records: *const u8,
+    records_len: usize,
+    count: usize,
+    out: *mut u8,
+    capacity: usize,
+    out_len: *mut usize,
+) -> c_int {
+    let (Some(evaluator), Some(mut records)) = (evaluator.as_mut(), bytes(records, records_len))
+    else {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    };
+    if out_len.is_null() || (out.is_null() && capacity > 0) {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    }
+
+    evaluator.guarded(|evaluator| {
+        // The results are built up in the output buffer, which the evaluator
+        // doesn't use while evaluating
+        let mut output = std::mem::take(&mut evaluator.output);
+        output.clear();
+        for index in 0..count {
+            match evaluator.evaluate(records) {
+                Ok((rest, result)) => {
+                    records = rest;
+                    match result {
+                        Ok(value) => {
+                            output.push(AMOSKEAG_OK as u8);
+                            record::encode_value(&value, &mut output);
+                        }
+                        Err(message) => {
+                            output.push(AMOSKEAG_EVAL_ERROR as u8);
+                            write_str(&mut output, &message);
+                        }
+                    }
+                }
+                Err(e) => {
+                    evaluator.output = output;
+                    evaluator.output.clear();
+                    evaluator.set_error(format_args!("Record {}: {}", index, e));
+                    return AMOSKEAG_INVALID_RECORD;
+                }
+            }
+        }
+        evaluator.output = output;
+        if !records.is_empty() {
+            evaluator.output.clear();
+            evaluator.set_error(format_args!("More than {} records", count));
+            return AMOSKEAG_INVALID_RECORD;
+        }
+        evaluator.copy_output(out, capacity, out_len)
+    })
+}
+
+/// Copy the result of the evaluator's last call to `out`
+///
+/// After `AMOSKEAG_BUFFER_TOO_SMALL` this fills a larger buffer without
+/// evaluating again. It writes the result and its length, or reports
+/// `AMOSKEAG_BUFFER_TOO_SMALL`, as `amoskeag_evaluate` and
+/// `amoskeag_evaluate_batch` do. After a call that failed there is no
+/// result, and its length is 0.
+///
+/// # Safety
+/// `evaluator` must be a live evaluator not in use by another thread, `out`
+/// valid for `capacity` bytes of writes, and `out_len` valid for a write.
+#[no_mangle]
+pub unsafe extern "C" fn amoskeag_evaluator_output(
+    evaluator: *const AmoskeagEvaluator,
+    out: *mut u8,
+    capacity: usize,
+    out_len: *mut usize,
+) -> c_int {
+    let Some(evaluator) = evaluator.as_ref() else {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    };
+    if out_len.is_null() || (out.is_null() && capacity > 0) {
+        return AMOSKEAG_INVALID_ARGUMENT;
+    }
+    evaluator.copy_output(out, capacity, out_len)
+}
+
+/// A snapshot of the built-in metrics, as JSON
+///
+/// Returns a string to be freed with `amoskeag_string_free`, or null if the
+/// snapshot fails. Exported only when the library is built with the
+/// `metrics` feature.
+#[cfg(feature = "metrics")]
+#[no_mangle]
+pub extern "C" fn amoskeag_metrics_json() -> *mut c_char {
+    catch(|| owned_string(crate::metrics_snapshot().to_json().to_string()))
+        .unwrap_or(std::ptr::null_mut())
+}
+
+/// A snapshot of the built-in metrics, in the Prometheus text format
+///
+/// Returns a string to be freed with `amoskeag_string_free`, or null as
+/// `amoskeag_metrics_json` does. Exported only when the library is built
+/// with the `metrics` feature.
+#[cfg(feature = "metrics")]
+#[no_mangle]
+pub extern "C" fn amoskeag_metrics_prometheus() -> *mut c_char {
+    catch(|| owned_string(crate::metrics_snapshot().to_prometheus()))
+        .unwrap_or(std::ptr::null_mut())
+}
+
+#[cfg(feature = "metrics")]
+fn owned_string(text: String) -> *mut c_char {
+    CString::new(text.replace('\0', " "))
+        .expect("NULs are replaced")
+        .into_raw()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{data_from_json_str, value_from_record};
+    use amoskeag_stdlib_operators::Symbol;
+    use std::ptr;
+
+    fn record(json: &str) -> Vec<u8> {
+        let mut out = Vec::new();
+        record::encode_data(&data_from_json_str(json).unwrap(), &mut out);
+        out
+    }
+
+    fn program(source: &str, symbols: &[&CStr]) -> *mut AmoskeagProgram {
+        let symbols: Vec<*const c_char> = symbols.iter().map(|s| s.as_ptr()).collect();
+        unsafe {
+            amoskeag_program_compile(
+                source.as_ptr(),
+                source.len(),
+                symbols.as_ptr(),
+                symbols.len(),
+                ptr::null_mut(),
+            )
+        }
+    }
+
+    fn error(evaluator: *const AmoskeagEvaluator) -> String {
+        unsafe { CStr::from_ptr(amoskeag_evaluator_error(evaluator)) }
+            .to_string_lossy()
+            .into_owned()
+    }
+
+    #[test]
+    fn test_evaluate() {
+        let program = program(
+            "if score > 5 then :approve else :deny end",
+            &[c"approve", c"deny"],
+        );
+        assert!(!program.is_null());
+        let evaluator = unsafe { amoskeag_evaluator_new(program) };
+        // The evaluator keeps the program alive
+        unsafe { amoskeag_program_free(program) };
+
+        let mut out = [0u8; 64];
+        let mut len = 0;
+        for (json, expected) in [(r#"{"score": 7}"#, "approve"), (r#"{"score": 2}"#, "deny")] {
+            let input = record(json);
+            let status = unsafe {
+                amoskeag_evaluate(
+                    evaluator,
+                    input.as_ptr(),
+                    input.len(),
+                    out.as_mut_ptr(),
+                    out.len(),
+                    &mut len,
+                )
+            };
+            assert_eq!(status, AMOSKEAG_OK);
+            assert_eq!(
+                value_from_record(&out[..len]).unwrap(),
+                Value::Symbol(Symbol::new(expected))
+            );
+        }
+
+        // Too small a buffer reports the length needed
+        let input = record(r#"{"score": 7}"#);
+        let status = unsafe {
+            amoskeag_evaluate(
+                evaluator,
+                input.as_ptr(),
+                input.len(),
+                out.as_mut_ptr(),
+                2,
+                &mut len,
+            )
+        };
+        assert_eq!(status, AMOSKEAG_BUFFER_TOO_SMALL);
+        assert_eq!(len, 1 + 1 + "approve".len());
+        // The result is kept, to copy out without evaluating again
+        let status =
+            unsafe { amoskeag_evaluator_output(evaluator, out.as_mut_ptr(), out.len(), &mut len) };
+        assert_eq!(status, AMOSKEAG_OK);
+        assert_eq!(
+            value_from_record(&out[..len]).unwrap(),
+            Value::Symbol(Symbol::new("approve"))
+        );
+
+        let input = record(r#"{"score": "high"}"#);
+        let status = unsafe {
+            amoskeag_evaluate(
+                evaluator,
+                input.as_ptr(),
+                input.len(),
+                out.as_mut_ptr(),
+                64,
+                &mut len,
+            )
+        };
+        assert_eq!(status, AMOSKEAG_EVAL_ERROR);
+        assert!(error(evaluator).starts_with("Operator error"));
+        let status =
+            unsafe { amoskeag_evaluator_output(evaluator, out.as_mut_ptr(), out.len(), &mut len) };
+        assert_eq!((status, len), (AMOSKEAG_OK, 0));
+
+        let status = unsafe {
+            amoskeag_evaluate(evaluator, [7].as_ptr(), 1, out.as_mut_ptr(), 64, &mut len)
+        };
+        assert_eq!(status, AMOSKEAG_INVALID_RECORD);
+        assert_eq!(error(evaluator), "Record is truncated");
+
+        let status = unsafe {
+            amoskeag_evaluate(
+                ptr::null_mut(),
+                [0].as_ptr(),
+                1,
+                out.as_mut_ptr(),
+                64,
+                &mut len,
+            )
+        };
+        assert_eq!(status, AMOSKEAG_INVALID_ARGUMENT);
+        unsafe { amoskeag_evaluator_free(evaluator) };
+    }
+
+    #[test]
+    fn test_evaluate_batch() {
+        let program = program("total / count", &[]);
+        let evaluator = unsafe { amoskeag_evaluator_new(program) };
+        let mut input = Vec::new();
+        for json in [
+            r#"{"total": 10, "count": 4}"#,
+            r#"{"total": 1, "count": 0}"#,
+            "null",
+        ] {
+            input.extend(record(json));
+        }
+
+        let mut out = vec![0u8; 256];
+        let mut len = 0;
+        let status = unsafe {
+            amoskeag_evaluate_batch(
+                evaluator,
+                input.as_ptr(),
+                input.len(),
+                3,
+                out.as_mut_ptr(),
+                out.len(),
+                &mut len,
+            )
+        };
+        assert_eq!(status, AMOSKEAG_OK);
+        assert_eq!(out[0], AMOSKEAG_OK as u8);
+        assert_eq!(value_from_record(&out[1..10]).unwrap(), Value::Number(2.5));
+        assert_eq!(out[10], AMOSKEAG_EVAL_ERROR as u8);
+        let message_len = usize::from(out[11]);
+        assert!(std::str::from_utf8(&out[12..12 + message_len])
+            .unwrap()
+            .contains("Division by zero"));
+        let rest = &out[12 + message_len..len];
+        assert_eq!(rest[0], AMOSKEAG_EVAL_ERROR as u8);
+        assert!(String::from_utf8_lossy(&rest[2..]).contains("Variable 'total' not found"));
+
+        // Results that don't fit are kept for amoskeag_evaluator_output
+        let expected = out[..len].to_vec();
+        let mut small = [0u8; 4];
+        let status = unsafe {
+            amoskeag_evaluate_batch(
+                evaluator,
+                input.as_ptr(),
+                input.len(),
+                3,
+                small.as_mut_ptr(),
+                small.len(),
+                &mut len,
+            )
+        };
+        assert_eq!((status, len), (AMOSKEAG_BUFFER_TOO_SMALL, expected.len()));
+        let status =
+            unsafe { amoskeag_evaluator_output(evaluator, out.as_mut_ptr(), out.len(), &mut len) };
+        assert_eq!(status, AMOSKEAG_OK);
+        assert_eq!(&out[..len], expected);
+
+        // Fewer records than the count, or more
+        for count in [4, 2] {
+            let status = unsafe {
+                amoskeag_evaluate_batch(
+                    evaluator,
+                    input.as_ptr(),
+                    input.len(),
+                    count,
+                    out.as_mut_ptr(),
+                    out.len(),
+                    &mut len,
+                )
+            };
+            assert_eq!(status, AMOSKEAG_INVALID_RECORD);
+        }
+        assert_eq!(error(evaluator), "More than 2 records");
+
+        unsafe {
+            amoskeag_evaluator_free(evaluator);
+            amoskeag_program_free(program);
+        }
+    }
+
+    #[test]
+    fn test_panics_become_statuses() {
+        let program = program("x + 1", &[]);
+        let evaluator = unsafe { amoskeag_evaluator_new(program) };
+        let status = unsafe { &mut *evaluator }.guarded(|_| panic!("stack underflow"));
+        assert_eq!(status, AMOSKEAG_PANIC);
+        assert_eq!(error(evaluator), "Internal error: stack underflow");
+
+        // The evaluator still works
+        let input = record(r#"{"x": 1}"#);
+        let mut out = [0u8; 16];
+        let mut len = 0;
+        let status = unsafe {
+            amoskeag_evaluate(
+                evaluator,
+                input.as_ptr(),
+                input.len(),
+                out.as_mut_ptr(),
+                out.len(),
+                &mut len,
+            )
+        };
+        assert_eq!(status, AMOSKEAG_OK);
+        assert_eq!(value_from_record(&out[..len]).unwrap(), Value::Number(2.0));
+        assert_eq!(
+            catch::<()>(|| panic!("{}", 7)).unwrap_err(),
+            "Internal error: 7"
+        );
+        unsafe {
+            amoskeag_evaluator_free(evaluator);
+            amoskeag_program_free(program);
+        }
+    }
+
+    #[test]
+    fn test_compile_and_load_errors() {
+        let mut message = ptr::null_mut();
+        let source = "1 +";
+        let program = unsafe {
+            amoskeag_program_compile(source.as_ptr(), source.len(), ptr::null(), 0, &mut message)
+        };
+        assert!(program.is_null());
+        assert!(unsafe { CStr::from_ptr(message) }
+            .to_str()
+            .unwrap()
+            .starts_with("Parser error"));
+        unsafe { amoskeag_string_free(message) };
+
+        let artifact = compile("x * 2", &[]).unwrap().to_bytes();
+        let program =
+            unsafe { amoskeag_program_load(artifact.as_ptr(), artifact.len(), ptr::null_mut()) };
+        assert!(!program.is_null());
+        unsafe { amoskeag_program_free(program) };
+
+        let program = unsafe { amoskeag_program_load(source.as_ptr(), 3, &mut message) };
+        assert!(program.is_null());
+        assert_eq!(
+            unsafe { CStr::from_ptr(message) }.to_str().unwrap(),
+            "Not a precompiled Amoskeag program"
+        );
+        unsafe { amoskeag_string_free(message) };
+    }
+
+    #[test]
+    fn test_set_metrics_name_arguments() {
+        let program = program("1", &[]);
+        let status = unsafe { amoskeag_program_set_metrics_name(program, ptr::null()) };
+        assert_eq!(status, AMOSKEAG_INVALID_ARGUMENT);
+        let status = unsafe { amoskeag_program_set_metrics_name(ptr::null(), c"x".as_ptr()) };
+        assert_eq!(status, AMOSKEAG_INVALID_ARGUMENT);
+        let status = unsafe { amoskeag_program_set_metrics_name(program, c"x".as_ptr()) };
+        assert_eq!(status, AMOSKEAG_OK);
+        unsafe { amoskeag_program_free(program) };
+    }
+
+    #[cfg(feature = "metrics")]
+    #[test]
+    fn test_metrics() {
+        let program = program("1 + 1", &[]);
+        let evaluator = unsafe { amoskeag_evaluator_new(program) };
+        // Naming the shared program also names its evaluators' evaluations
+        let name = c"ffi-test-metrics";
+        assert_eq!(
+            unsafe { amoskeag_program_set_metrics_name(program, name.as_ptr()) },
+            AMOSKEAG_OK
+        );
+        let mut out = [0u8; 16];
+        let mut len = 0;
+        let status = unsafe {
+            amoskeag_evaluate(evaluator, [0].as_ptr(), 1, out.as_mut_ptr(), 16, &mut len)
+        };
+        assert_eq!(status, AMOSKEAG_OK);
+
+        let json = amoskeag_metrics_json();
+        let text = unsafe { CStr::from_ptr(json) }.to_str().unwrap();
+        let metrics: serde_json::Value = serde_json::from_str(text).unwrap();
+        assert!(metrics["evaluate"]["count"].as_u64().unwrap() >= 1);
+        assert!(metrics["programs"]
+            .as_array()
+            .unwrap()
+            .iter()
+            .any(|program| program["name"] == "ffi-test-metrics"));
+        let prometheus = amoskeag_metrics_prometheus();
+        let text = unsafe { CStr::from_ptr(prometheus) }.to_str().unwrap();
+        assert!(text.contains("amoskeag_evaluate_seconds_count{backend=\"interpreter\"}"));
+        unsafe {
+            amoskeag_string_free(json);
+            amoskeag_string_free(prometheus);
+            amoskeag_evaluator_free(evaluator);
+            amoskeag_program_free(program);
+        }
+    }
+}
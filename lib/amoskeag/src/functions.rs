@@ -0,0 +1,549 @@
+//! Standard library function table
+//!
+//! Every stdlib function callable from Amoskeag is listed here once, in a
+//! fixed order, with its arity. A function's position in `FUNCTIONS` is its
+//! numeric id: compilation resolves each call site to an id, and evaluation
+//! dispatches on the id instead of the name.
+
+use crate::{CompileError, EvalError};
+use amoskeag_stdlib_functions::*;
+use std::borrow::Cow;
+use std::collections::HashMap;
+use std::sync::OnceLock;
+
+/// Signature shared by all stdlib function entry points
+///
+/// Arguments are passed as borrowed-or-owned values so callers never need to
+/// copy their inputs to make a call.
+pub(crate) type FunctionImpl = fn(&[Cow<'_, Value>]) -> Result<Value, EvalError>;
+
+/// A stdlib function entry
+pub(crate) struct Function {
+    /// Name used to call the function from Amoskeag source
+    pub name: &'static str,
+    /// Minimum number of arguments
+    pub min_args: usize,
+    /// Maximum number of arguments
+    pub max_args: usize,
+    /// Implementation
+    pub call: FunctionImpl,
+}
+
+/// All stdlib functions, indexed by function id
+pub(crate) static FUNCTIONS: &[Function] = &[
+    // String functions
+    Function {
+        name: "upcase",
+        min_args: 1,
+        max_args: 1,
+        call: |a| upcase(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "downcase",
+        min_args: 1,
+        max_args: 1,
+        call: |a| downcase(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "capitalize",
+        min_args: 1,
+        max_args: 1,
+        call: |a| capitalize(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "strip",
+        min_args: 1,
+        max_args: 1,
+        call: |a| strip(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "split",
+        min_args: 2,
+        max_args: 2,
+        call: |a| split(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "join",
+        min_args: 2,
+        max_args: 2,
+        call: |a| join(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "truncate",
+        min_args: 2,
+        max_args: 2,
+        call: |a| truncate(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "replace",
+        min_args: 3,
+        max_args: 3,
+        call: |a| replace(&a[0], &a[1], &a[2]).map_err(EvalError::from),
+    },
+    // Numeric functions
+    Function {
+        name: "abs",
+        min_args: 1,
+        max_args: 1,
+        call: |a| abs(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "ceil",
+        min_args: 1,
+        max_args: 1,
+        call: |a| ceil(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "floor",
+        min_args: 1,
+        max_args: 1,
+        call: |a| floor(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "round",
+        min_args: 1,
+        max_args: 2,
+        call: |a| {
+            if a.len() == 2 {
+                round(&a[0], &a[1]).map_err(EvalError::from)
+            } else {
+                round(&a[0], &Value::Number(0.0)).map_err(EvalError::from)
+            }
+        },
+    },
+    Function {
+        name: "plus",
+        min_args: 2,
+        max_args: 2,
+        call: |a| plus(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "minus",
+        min_args: 2,
+        max_args: 2,
+        call: |a| minus(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "times",
+        min_args: 2,
+        max_args: 2,
+        call: |a| times(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "divided_by",
+        min_args: 2,
+        max_args: 2,
+        call: |a| divided_by(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "modulo",
+        min_args: 2,
+        max_args: 2,
+        call: |a| modulo_fn(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "max",
+        min_args: 2,
+        max_args: 2,
+        call: |a| max(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "min",
+        min_args: 2,
+        max_args: 2,
+        call: |a| min(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "array_min",
+        min_args: 1,
+        max_args: 1,
+        call: |a| array_min(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "array_max",
+        min_args: 1,
+        max_args: 1,
+        call: |a| array_max(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "power",
+        min_args: 2,
+        max_args: 2,
+        call: |a| power(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "sqrt",
+        min_args: 1,
+        max_args: 1,
+        call: |a| sqrt(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "log",
+        min_args: 1,
+        max_args: 1,
+        call: |a| log(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "log10",
+        min_args: 1,
+        max_args: 1,
+        call: |a| log10(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "ln",
+        min_args: 1,
+        max_args: 1,
+        call: |a| ln(&a[0]).map_err(EvalError::from),
+    },
+    // Collection functions
+    Function {
+        name: "size",
+        min_args: 1,
+        max_args: 1,
+        call: |a| size(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "first",
+        min_args: 1,
+        max_args: 1,
+        call: |a| first(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "last",
+        min_args: 1,
+        max_args: 1,
+        call: |a| last(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "contains",
+        min_args: 2,
+        max_args: 2,
+        call: |a| contains(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "sum",
+        min_args: 1,
+        max_args: 1,
+        call: |a| sum(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "avg",
+        min_args: 1,
+        max_args: 1,
+        call: |a| avg(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "sort",
+        min_args: 1,
+        max_args: 1,
+        call: |a| sort(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "keys",
+        min_args: 1,
+        max_args: 1,
+        call: |a| keys(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "values",
+        min_args: 1,
+        max_args: 1,
+        call: |a| values(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "reverse",
+        min_args: 1,
+        max_args: 1,
+        call: |a| reverse(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "at",
+        min_args: 2,
+        max_args: 2,
+        call: |a| at(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "uniq",
+        min_args: 1,
+        max_args: 1,
+        call: |a| uniq(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "group_by",
+        min_args: 2,
+        max_args: 2,
+        call: |a| group_by(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "map",
+        min_args: 2,
+        max_args: 2,
+        call: |a| map(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    // Logic functions
+    Function {
+        name: "choose",
+        min_args: 2,
+        max_args: 2,
+        call: |a| choose(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "if_then_else",
+        min_args: 3,
+        max_args: 3,
+        call: |a| if_then_else(&a[0], &a[1], &a[2]).map_err(EvalError::from),
+    },
+    Function {
+        name: "is_number",
+        min_args: 1,
+        max_args: 1,
+        call: |a| Ok(is_number(&a[0])),
+    },
+    Function {
+        name: "is_string",
+        min_args: 1,
+        max_args: 1,
+        call: |a| Ok(is_string(&a[0])),
+    },
+    Function {
+        name: "is_boolean",
+        min_args: 1,
+        max_args: 1,
+        call: |a| Ok(is_boolean(&a[0])),
+    },
+    Function {
+        name: "is_nil",
+        min_args: 1,
+        max_args: 1,
+        call: |a| Ok(is_nil(&a[0])),
+    },
+    Function {
+        name: "is_array",
+        min_args: 1,
+        max_args: 1,
+        call: |a| Ok(is_array(&a[0])),
+    },
+    Function {
+        name: "is_dictionary",
+        min_args: 1,
+        max_args: 1,
+        call: |a| Ok(is_dictionary(&a[0])),
+    },
+    Function {
+        name: "coalesce",
+        min_args: 2,
+        max_args: 2,
+        call: |a| Ok(coalesce(&a[0], &a[1])),
+    },
+    Function {
+        name: "default",
+        min_args: 2,
+        max_args: 2,
+        call: |a| Ok(default(&a[0], &a[1])),
+    },
+    // Financial functions - Time Value of Money
+    Function {
+        name: "pmt",
+        min_args: 4,
+        max_args: 4,
+        call: |a| pmt(&a[0], &a[1], &a[2], &a[3]).map_err(EvalError::from),
+    },
+    Function {
+        name: "pv",
+        min_args: 3,
+        max_args: 3,
+        call: |a| pv(&a[0], &a[1], &a[2]).map_err(EvalError::from),
+    },
+    Function {
+        name: "fv",
+        min_args: 4,
+        max_args: 4,
+        call: |a| fv(&a[0], &a[1], &a[2], &a[3]).map_err(EvalError::from),
+    },
+    Function {
+        name: "nper",
+        min_args: 3,
+        max_args: 3,
+        call: |a| nper(&a[0], &a[1], &a[2]).map_err(EvalError::from),
+    },
+    Function {
+        name: "rate",
+        min_args: 3,
+        max_args: 3,
+        call: |a| rate(&a[0], &a[1], &a[2]).map_err(EvalError::from),
+    },
+    // Financial functions - Investment Analysis
+    Function {
+        name: "npv",
+        min_args: 2,
+        max_args: 2,
+        call: |a| npv(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "irr",
+        min_args: 1,
+        max_args: 1,
+        call: |a| irr(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "mirr",
+        min_args: 3,
+        max_args: 3,
+        call: |a| mirr(&a[0], &a[1], &a[2]).map_err(EvalError::from),
+    },
+    // Financial functions - Depreciation
+    Function {
+        name: "sln",
+        min_args: 3,
+        max_args: 3,
+        call: |a| sln(&a[0], &a[1], &a[2]).map_err(EvalError::from),
+    },
+    Function {
+        name: "ddb",
+        min_args: 4,
+        max_args: 4,
+        call: |a| ddb(&a[0], &a[1], &a[2], &a[3]).map_err(EvalError::from),
+    },
+    Function {
+        name: "db",
+        min_args: 5,
+        max_args: 5,
+        call: |a| db(&a[0], &a[1], &a[2], &a[3], &a[4]).map_err(EvalError::from),
+    },
+    // Financial functions - Payment Components
+    Function {
+        name: "ipmt",
+        min_args: 5,
+        max_args: 5,
+        call: |a| ipmt(&a[0], &a[1], &a[2], &a[3], &a[4]).map_err(EvalError::from),
+    },
+    Function {
+        name: "ppmt",
+        min_args: 5,
+        max_args: 5,
+        call: |a| ppmt(&a[0], &a[1], &a[2], &a[3], &a[4]).map_err(EvalError::from),
+    },
+    Function {
+        name: "cumipmt",
+        min_args: 6,
+        max_args: 6,
+        call: |a| cumipmt(&a[0], &a[1], &a[2], &a[3], &a[4], &a[5]).map_err(EvalError::from),
+    },
+    Function {
+        name: "cumprinc",
+        min_args: 6,
+        max_args: 6,
+        call: |a| cumprinc(&a[0], &a[1], &a[2], &a[3], &a[4], &a[5]).map_err(EvalError::from),
+    },
+    Function {
+        name: "amortization_schedule",
+        min_args: 4,
+        max_args: 4,
+        call: |a| amortization_schedule(&a[0], &a[1], &a[2], &a[3]).map_err(EvalError::from),
+    },
+    // Financial functions - Interest Rate Conversion
+    Function {
+        name: "effect",
+        min_args: 2,
+        max_args: 2,
+        call: |a| effect(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "nominal",
+        min_args: 2,
+        max_args: 2,
+        call: |a| nominal(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    // Date functions
+    Function {
+        name: "date_now",
+        min_args: 0,
+        max_args: 0,
+        call: |_| date_now().map_err(EvalError::from),
+    },
+    Function {
+        name: "date_format",
+        min_args: 2,
+        max_args: 2,
+        call: |a| date_format(&a[0], &a[1]).map_err(EvalError::from),
+    },
+    Function {
+        name: "date_trunc",
+        min_args: 1,
+        max_args: 1,
+        call: |a| date_trunc(&a[0]).map_err(EvalError::from),
+    },
+    Function {
+        name: "date_parse",
+        min_args: 1,
+        max_args: 1,
+        call: |a| date_parse(&a[0]).map_err(EvalError::from),
+    },
+];
+
+/// Resolve a function name to its id (its index in `FUNCTIONS`)
+///
+/// The name index is built on first use and shared for the life of the
+/// process, so lookups are a single hash probe.
+pub(crate) fn lookup(name: &str) -> Option<usize> {
+    static INDEX: OnceLock<HashMap<&'static str, usize>> = OnceLock::new();
+    INDEX
+        .get_or_init(|| {
+            FUNCTIONS
+                .iter()
+                .enumerate()
+                .map(|(id, f)| (f.name, id))
+                .collect()
+        })
+        .get(name)
+        .copied()
+}
+
+/// Resolve a call site to a function id, checking that it exists and that
+/// `arg_count` is within its arity
+pub(crate) fn resolve(name: &str, arg_count: usize) -> Result<usize, CompileError> {
+    let id = lookup(name).ok_or_else(|| CompileError::UndefinedFunction {
+        function: name.to_string(),
+    })?;
+
+    let function = &FUNCTIONS[id];
+    if arg_count < function.min_args || arg_count > function.max_args {
+        let expected = if function.min_args == function.max_args {
+            format!("{}", function.min_args)
+        } else {
+            format!("{}-{}", function.min_args, function.max_args)
+        };
+        return Err(CompileError::ArityMismatch {
+            function: name.to_string(),
+            expected,
+            actual: arg_count,
+        });
+    }
+    Ok(id)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_function_names_are_unique() {
+        for (id, function) in FUNCTIONS.iter().enumerate() {
+            assert_eq!(lookup(function.name), Some(id), "{}", function.name);
+        }
+    }
+
+    #[test]
+    fn test_resolve_checks_arity() {
+        assert_eq!(resolve("round", 1).unwrap(), lookup("round").unwrap());
+        assert!(resolve("round", 2).is_ok());
+        assert!(matches!(
+            resolve("round", 3),
+            Err(CompileError::ArityMismatch { expected, actual: 3, .. }) if expected == "1-2"
+        ));
+        assert!(matches!(
+            resolve("nope", 0),
+            Err(CompileError::UndefinedFunction { .. })
+        ));
+    }
+}
@@ -0,0 +1,516 @@
+//! JSON decoding straight into `Value`
+//!
+//! Hosts usually receive their data as JSON. Parsing it into a
+//! `serde_json::Value` and then converting that tree holds two copies of
+//! every payload and walks it twice. The functions here build `Value`s as the
+//! JSON is parsed, moving each string into place rather than copying it.
+//!
+//! `DataSeed` and `ValueSeed` are the serde entry points, so formats other
+//! than JSON can decode into `Value` the same way. Nesting deeper than
+//! `MAX_JSON_DEPTH` is rejected before it can exhaust the stack.
+//!
+//! The `_projected` functions and `ProjectedDataSeed` decode only the
+//! fields in a program's `required_paths`; everything else is skipped
+//! without being copied. Skipped subtrees are still checked to be valid
+//! JSON, but not against the depth limit.
+
+use crate::paths::DataPaths;
+use amoskeag_stdlib_operators::Value;
+use serde::de::{self, DeserializeSeed, Deserializer, IgnoredAny, MapAccess, SeqAccess, Visitor};
+use std::collections::HashMap;
+use std::fmt;
+use std::io;
+use thiserror::Error;
+
+/// Maximum nesting depth of decoded values
+pub const MAX_JSON_DEPTH: usize = 100;
+
+/// A JSON document that could not be decoded
+#[derive(Error, Debug)]
+#[error("Failed to parse JSON data: {0}")]
+pub struct JsonError(#[from] serde_json::Error);
+
+/// Decode a JSON object into a data dictionary
+///
+/// `null` decodes to an empty dictionary. Any other top-level value is an
+/// error, since the data of a program is always a dictionary.
+pub fn data_from_json_str(json: &str) -> Result<HashMap<String, Value>, JsonError> {
+    decode(&mut serde_json::Deserializer::from_str(json), DataSeed)
+}
+
+/// Decode a JSON object into a data dictionary, from UTF-8 bytes
+pub fn data_from_json_slice(json: &[u8]) -> Result<HashMap<String, Value>, JsonError> {
+    decode(&mut serde_json::Deserializer::from_slice(json), DataSeed)
+}
+
+/// Decode a JSON object into a data dictionary, from a reader
+///
+/// The reader is read to the end; buffer it if it isn't already. Decoding
+/// from a slice is faster when the whole document is in memory anyway.
+pub fn data_from_json_reader<R: io::Read>(reader: R) -> Result<HashMap<String, Value>, JsonError> {
+    decode(&mut serde_json::Deserializer::from_reader(reader), DataSeed)
+}
+
+/// Decode the parts of a JSON data dictionary in `paths`
+///
+/// Fields outside `paths` are left out. A value that `paths` only reaches
+/// into but that isn't an object decodes as nil, since reaching into it
+/// gives nil either way. The program the paths come from evaluates exactly
+/// as it would on the full data.
+pub fn data_from_json_str_projected(
+    json: &str,
+    paths: &DataPaths,
+) -> Result<HashMap<String, Value>, JsonError> {
+    decode(
+        &mut serde_json::Deserializer::from_str(json),
+        ProjectedDataSeed { paths },
+    )
+}
+
+/// Decode the parts of a JSON data dictionary in `paths`, from UTF-8 bytes
+pub fn data_from_json_slice_projected(
+    json: &[u8],
+    paths: &DataPaths,
+) -> Result<HashMap<String, Value>, JsonError> {
+    decode(
+        &mut serde_json::Deserializer::from_slice(json),
+        ProjectedDataSeed { paths },
+    )
+}
+
+/// Decode any JSON value
+pub fn value_from_json_str(json: &str) -> Result<Value, JsonError> {
+    decode(
+        &mut serde_json::Deserializer::from_str(json),
+        ValueSeed::default(),
+    )
+}
+
+fn decode<'de, R, S>(
+    deserializer: &mut serde_json::Deserializer<R>,
+    seed: S,
+) -> Result<S::Value, JsonError>
+where
+    R: serde_json::de::Read<'de>,
+    S: DeserializeSeed<'de>,
+{
+    let value = seed.deserialize(&mut *deserializer)?;
+    // Reject trailing characters, as serde_json::from_str does
+    deserializer.end()?;
+    Ok(value)
+}
+
+/// Deserializes a data dictionary: a map of values, or null for an empty one
+#[derive(Debug, Clone, Copy, Default)]
+pub struct DataSeed;
+
+impl<'de> DeserializeSeed<'de> for DataSeed {
+    type Value = HashMap<String, Value>;
+
+    fn deserialize<D: Deserializer<'de>>(self, deserializer: D) -> Result<Self::Value, D::Error> {
+        deserializer.deserialize_any(DataVisitor)
+    }
+}
+
+struct DataVisitor;
+
+impl<'de> Visitor<'de> for DataVisitor {
+    type Value = HashMap<String, Value>;
+
+    fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.write_str("a JSON object")
+    }
+
+    fn visit_unit<E: de::Error>(self) -> Result<Self::Value, E> {
+        Ok(HashMap::new())
+    }
+
+    fn visit_none<E: de::Error>(self) -> Result<Self::Value, E> {
+        Ok(HashMap::new())
+    }
+
+    fn visit_map<A: MapAccess<'de>>(self, map: A) -> Result<Self::Value, A::Error> {
+        // The data dictionary's values are the first level of nesting
+        visit_entries(map, 0)
+    }
+}
+
+/// Deserializes any value, counting its depth against `MAX_JSON_DEPTH`
+#[derive(Debug, Clone, Copy, Default)]
+pub struct ValueSeed {
+    /// Nesting depth of the value being decoded
+    depth: usize,
+}
+
+impl<'de> DeserializeSeed<'de> for ValueSeed {
+    type Value = Value;
+
+    fn deserialize<D: Deserializer<'de>>(self, deserializer: D) -> Result<Value, D::Error> {
+        if self.depth > MAX_JSON_DEPTH {
+            return Err(de::Error::custom(format!(
+                "JSON nesting too deep (max {} levels)",
+                MAX_JSON_DEPTH
+            )));
+        }
+        deserializer.deserialize_any(ValueVisitor { depth: self.depth })
+    }
+}
+
+struct ValueVisitor {
+    depth: usize,
+}
+
+impl<'de> Visitor<'de> for ValueVisitor {
+    type Value = Value;
+
+    fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.write_str("a JSON value")
+    }
+
+    fn visit_unit<E: de::Error>(self) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_none<E: de::Error>(self) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_bool<E: de::Error>(self, b: bool) -> Result<Value, E> {
+        Ok(Value::Boolean(b))
+    }
+
+    fn visit_i64<E: de::Error>(self, n: i64) -> Result<Value, E> {
+        Ok(Value::Number(n as f64))
+    }
+
+    fn visit_u64<E: de::Error>(self, n: u64) -> Result<Value, E> {
+        Ok(Value::Number(n as f64))
+    }
+
+    fn visit_f64<E: de::Error>(self, n: f64) -> Result<Value, E> {
+        // JSON has no NaN or infinity, but other formats do
+        if n.is_nan() {
+            return Err(E::custom("JSON number converted to NaN"));
+        }
+        if n.is_infinite() {
+            return Err(E::custom("JSON number converted to infinity"));
+        }
+        Ok(Value::Number(n))
+    }
+
+    fn visit_str<E: de::Error>(self, s: &str) -> Result<Value, E> {
+        Ok(Value::String(s.to_string()))
+    }
+
+    fn visit_string<E: de::Error>(self, s: String) -> Result<Value, E> {
+        Ok(Value::String(s))
+    }
+
+    fn visit_seq<A: SeqAccess<'de>>(self, mut seq: A) -> Result<Value, A::Error> {
+        let mut items = Vec::with_capacity(seq.size_hint().unwrap_or(0));
+        let seed = ValueSeed {
+            depth: self.depth + 1,
+        };
+        while let Some(item) = seq.next_element_seed(seed)? {
+            items.push(item);
+        }
+        Ok(Value::Array(items))
+    }
+
+    fn visit_map<A: MapAccess<'de>>(self, map: A) -> Result<Value, A::Error> {
+        visit_entries(map, self.depth + 1).map(Value::Dictionary)
+    }
+}
+
+/// Deserializes the parts of a data dictionary in `paths`
+#[derive(Debug, Clone, Copy)]
+pub struct ProjectedDataSeed<'p> {
+    pub paths: &'p DataPaths,
+}
+
+impl<'de> DeserializeSeed<'de> for ProjectedDataSeed<'_> {
+    type Value = HashMap<String, Value>;
+
+    fn deserialize<D: Deserializer<'de>>(self, deserializer: D) -> Result<Self::Value, D::Error> {
+        deserializer.deserialize_any(ProjectedDataVisitor { paths: self.paths })
+    }
+}
+
+struct ProjectedDataVisitor<'p> {
+    paths: &'p DataPaths,
+}
+
+impl<'de> Visitor<'de> for ProjectedDataVisitor<'_> {
+    type Value = HashMap<String, Value>;
+
+    fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.write_str("a JSON object")
+    }
+
+    fn visit_unit<E: de::Error>(self) -> Result<Self::Value, E> {
+        Ok(HashMap::new())
+    }
+
+    fn visit_none<E: de::Error>(self) -> Result<Self::Value, E> {
+        Ok(HashMap::new())
+    }
+
+    fn visit_map<A: MapAccess<'de>>(self, map: A) -> Result<Self::Value, A::Error> {
+        visit_projected_entries(map, self.paths, 0)
+    }
+}
+
+/// Deserializes the parts of a value in `paths`, which doesn't read it whole
+#[derive(Clone, Copy)]
+struct ProjectedValueSeed<'p> {
+    paths: &'p DataPaths,
+    depth: usize,
+}
+
+impl<'de> DeserializeSeed<'de> for ProjectedValueSeed<'_> {
+    type Value = Value;
+
+    fn deserialize<D: Deserializer<'de>>(self, deserializer: D) -> Result<Value, D::Error> {
+        if self.depth > MAX_JSON_DEPTH {
+            return Err(de::Error::custom(format!(
+                "JSON nesting too deep (max {} levels)",
+                MAX_JSON_DEPTH
+            )));
+        }
+        deserializer.deserialize_any(self)
+    }
+}
+
+/// Only the fields of an object can be reached; any other value is nil
+impl<'de> Visitor<'de> for ProjectedValueSeed<'_> {
+    type Value = Value;
+
+    fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.write_str("a JSON value")
+    }
+
+    fn visit_unit<E: de::Error>(self) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_none<E: de::Error>(self) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_bool<E: de::Error>(self, _: bool) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_i64<E: de::Error>(self, _: i64) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_u64<E: de::Error>(self, _: u64) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_f64<E: de::Error>(self, _: f64) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_str<E: de::Error>(self, _: &str) -> Result<Value, E> {
+        Ok(Value::Nil)
+    }
+
+    fn visit_seq<A: SeqAccess<'de>>(self, seq: A) -> Result<Value, A::Error> {
+        IgnoredAny.visit_seq(seq)?;
+        Ok(Value::Nil)
+    }
+
+    fn visit_map<A: MapAccess<'de>>(self, map: A) -> Result<Value, A::Error> {
+        visit_projected_entries(map, self.paths, self.depth + 1).map(Value::Dictionary)
+    }
+}
+
+/// Collect the entries of a map in `paths`, whose values are at `depth`
+fn visit_projected_entries<'de, A: MapAccess<'de>>(
+    mut map: A,
+    paths: &DataPaths,
+    depth: usize,
+) -> Result<HashMap<String, Value>, A::Error> {
+    let mut entries = HashMap::new();
+    while let Some(key) = map.next_key::<Key>()? {
+        let Some(field) = paths.get(&key.0) else {
+            map.next_value::<IgnoredAny>()?;
+            continue;
+        };
+        let value = if field.is_whole() {
+            map.next_value_seed(ValueSeed { depth })?
+        } else {
+            map.next_value_seed(ProjectedValueSeed {
+                paths: field,
+                depth,
+            })?
+        };
+        entries.insert(key.0.into_owned(), value);
+    }
+    Ok(entries)
+}
+
+/// A map key, borrowed from the input when possible so that skipped keys
+/// are never copied
+struct Key<'de>(std::borrow::Cow<'de, str>);
+
+impl<'de> de::Deserialize<'de> for Key<'de> {
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> Result<Self, D::Error> {
+        struct KeyVisitor;
+
+        impl<'de> Visitor<'de> for KeyVisitor {
+            type Value = Key<'de>;
+
+            fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+                f.write_str("a string key")
+            }
+
+            fn visit_borrowed_str<E: de::Error>(self, s: &'de str) -> Result<Key<'de>, E> {
+                Ok(Key(s.into()))
+            }
+
+            fn visit_str<E: de::Error>(self, s: &str) -> Result<Key<'de>, E> {
+                Ok(Key(s.to_string().into()))
+            }
+
+            fn visit_string<E: de::Error>(self, s: String) -> Result<Key<'de>, E> {
+                Ok(Key(s.into()))
+            }
+        }
+
+        deserializer.deserialize_str(KeyVisitor)
+    }
+}
+
+/// Collect the entries of a map whose values are at `depth`
+fn visit_entries<'de, A: MapAccess<'de>>(
+    mut map: A,
+    depth: usize,
+) -> Result<HashMap<String, Value>, A::Error> {
+    let mut entries = HashMap::with_capacity(map.size_hint().unwrap_or(0));
+    while let Some(key) = map.next_key::<String>()? {
+        let value = map.next_value_seed(ValueSeed { depth })?;
+        // The last of duplicate keys wins, as with serde_json::Value
+        entries.insert(key, value);
+    }
+    Ok(entries)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_json_decodes_every_type() {
+        let data = data_from_json_str(
+            r#"{"n": 42, "neg": -2.5, "big": 18446744073709551615, "s": "hié",
+                "t": true, "nil": null, "items": [1, {"k": "v"}, []], "empty": {}}"#,
+        )
+        .unwrap();
+        assert_eq!(data["n"], Value::Number(42.0));
+        assert_eq!(data["neg"], Value::Number(-2.5));
+        assert_eq!(data["big"], Value::Number(u64::MAX as f64));
+        assert_eq!(data["s"], Value::String("hié".to_string()));
+        assert_eq!(data["t"], Value::Boolean(true));
+        assert_eq!(data["nil"], Value::Nil);
+        assert_eq!(
+            data["items"],
+            Value::Array(vec![
+                Value::Number(1.0),
+                Value::Dictionary(HashMap::from([(
+                    "k".to_string(),
+                    Value::String("v".to_string())
+                )])),
+                Value::Array(vec![]),
+            ])
+        );
+        assert_eq!(data["empty"], Value::Dictionary(HashMap::new()));
+    }
+
+    #[test]
+    fn test_json_matches_serde_json_value() {
+        let json = r#"{"a": [1, 2.5, "x", null, {"b": [true, false]}], "a2": {"a": 1, "a": 2}}"#;
+        let via_tree: serde_json::Value = serde_json::from_str(json).unwrap();
+        let direct = data_from_json_str(json).unwrap();
+        assert_eq!(direct["a2"], value_from_json_str(r#"{"a": 2}"#).unwrap());
+        assert_eq!(
+            Value::Dictionary(direct),
+            ValueSeed::default().deserialize(&via_tree).unwrap()
+        );
+        assert_eq!(
+            data_from_json_slice(json.as_bytes()).unwrap(),
+            data_from_json_reader(json.as_bytes()).unwrap()
+        );
+    }
+
+    #[test]
+    fn test_json_top_level_must_be_an_object() {
+        assert!(data_from_json_str("null").unwrap().is_empty());
+        for json in ["[1, 2]", "\"s\"", "42", "true", "{} {}", "{invalid}", ""] {
+            let error = data_from_json_str(json).unwrap_err().to_string();
+            assert!(
+                error.starts_with("Failed to parse JSON data: "),
+                "{}: {}",
+                json,
+                error
+            );
+        }
+        assert_eq!(value_from_json_str("[]").unwrap(), Value::Array(vec![]));
+    }
+
+    #[test]
+    fn test_json_depth_limit() {
+        let nested =
+            |depth: usize| format!("{{\"v\": {}1{}}}", "[".repeat(depth), "]".repeat(depth));
+        assert!(data_from_json_str(&nested(MAX_JSON_DEPTH)).is_ok());
+        let error = data_from_json_str(&nested(MAX_JSON_DEPTH + 1)).unwrap_err();
+        assert!(
+            error.to_string().contains("JSON nesting too deep"),
+            "{}",
+            error
+        );
+    }
+
+    #[test]
+    fn test_projected_decoding_evaluates_the_same() {
+        let json = r#"{
+            "applicant": {"age": 30, "name": "Al", "vehicle": {"value": 9000, "make": "VW"},
+                          "history": [{"claims": 2}], "notes": "x"},
+            "env": {"limits": {"max": 10000, "min": 1}, "region": "NE"},
+            "scalar": 5, "list": [1, 2], "unused": {"deep": [[[1]]]}
+        }"#;
+        let full = data_from_json_str(json).unwrap();
+        for source in [
+            "applicant.vehicle.value < env.limits.max and applicant.age > 20",
+            "let v = applicant.vehicle in v.value + size(env.limits)",
+            "let a = applicant in a.history | size",
+            "scalar.field",
+            "list.x",
+            "let s = scalar in s.field",
+            "missing.path",
+            "missing",
+            "let m = missing in 1",
+            "applicant | keys | size",
+        ] {
+            let program = crate::compile(source, &[]).unwrap();
+            let projected = data_from_json_str_projected(json, program.required_paths()).unwrap();
+            assert!(!projected.contains_key("unused"), "{}", source);
+            assert_eq!(
+                format!("{:?}", crate::evaluate(&program, &projected)),
+                format!("{:?}", crate::evaluate(&program, &full)),
+                "{}",
+                source
+            );
+        }
+
+        let program = crate::compile("applicant.vehicle.value", &[]).unwrap();
+        let projected =
+            data_from_json_slice_projected(json.as_bytes(), program.required_paths()).unwrap();
+        assert_eq!(
+            Value::Dictionary(projected),
+            value_from_json_str(r#"{"applicant": {"vehicle": {"value": 9000}}}"#).unwrap()
+        );
+    }
+}
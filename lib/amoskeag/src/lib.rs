@@ -3,23 +3,125 @@
 //! This is the main crate that provides the compile and evaluate API for Amoskeag programs.
 //! It combines the lexer, parser, and standard library to provide a complete execution environment.
 
+mod artifact;
 pub mod backend;
+mod batch;
+mod cache;
+mod ffi;
+mod functions;
+mod json;
+mod limits;
+mod machine;
+mod metrics;
+pub mod native;
+mod optimize;
+mod paths;
+mod pipeline;
+mod pool;
+mod profile;
+mod record;
+mod render;
+mod resolve;
+mod ruleset;
+mod workbook;
 
 use amoskeag_lexer::Lexer;
-use amoskeag_parser::{BinaryOp, Expr, Parser, UnaryOp};
+use amoskeag_parser::{BinaryOp, Expr, ParseError, Parser, UnaryOp};
 use amoskeag_stdlib_functions::FunctionError;
-use amoskeag_stdlib_operators::{OperatorError, Value};
+use amoskeag_stdlib_operators::{add_owned, OperatorError, Value};
+use limits::Budget;
+use metrics::BackendSlot;
+use profile::Recorder;
+use resolve::Node;
+use std::borrow::Cow;
 use std::collections::{HashMap, HashSet};
 use thiserror::Error;
 
 // Re-export the Value type for convenience
+pub use amoskeag_stdlib_operators::Symbol as AmoskeagSymbol;
 pub use amoskeag_stdlib_operators::Value as AmoskeagValue;
 
+// Re-export precompiled program loading
+pub use artifact::ArtifactError;
+
+// Re-export batch evaluation
+pub use batch::{evaluate_batch, evaluate_stream, parallel_map, parallel_map_with, BatchStream};
+
+// Re-export the program cache
+pub use cache::{CacheStats, ProgramCache};
+
+// Re-export JSON decoding
+pub use json::{
+    data_from_json_reader, data_from_json_slice, data_from_json_slice_projected,
+    data_from_json_str, data_from_json_str_projected, value_from_json_str, DataSeed, JsonError,
+    ProjectedDataSeed, ValueSeed, MAX_JSON_DEPTH,
+};
+
+// Re-export evaluation limits
+pub use limits::EvalLimits;
+
+// Re-export the data paths manifest
+pub use paths::DataPaths;
+
+// Re-export binary records
+pub use record::{
+    data_from_record, data_from_record_projected, encode_data, encode_value, value_from_record,
+    RecordError, MAX_RECORD_DEPTH,
+};
+
+// Re-export streaming rendering
+pub use render::{render, RenderError};
+
+// Re-export incremental recalculation
+pub use workbook::{Workbook, WorkbookError};
+
+// Re-export rule sets
+pub use ruleset::{RuleSet, RuleSetError};
+
+// Re-export the profiler
+pub use profile::{CountingAllocator, FunctionProfile, Profile, ProfiledProgram, SiteProfile};
+
+// Re-export the metrics snapshot
+#[cfg(feature = "metrics")]
+pub use metrics::{
+    snapshot as metrics_snapshot, BackendMetrics, FunctionMetrics, LatencyHistogram,
+    MetricsSnapshot, ProgramMetrics,
+};
+
 // Re-export backend types
 pub use backend::{
     Backend, BackendCapabilities, BackendError, BackendRegistry, BackendResult, PerformanceTier,
 };
 
+/// Include rules compiled to native code by a build script
+///
+/// The build script of the including crate compiles a set of rules with
+/// `amoskeag_transpiler::build::Rules`, which writes them as Rust source to
+/// `OUT_DIR`. This macro includes that source: a function per rule, plus
+/// `RULES`, the names of the rules, and `evaluate`, which dispatches by
+/// name. Without an argument it includes the default output,
+/// `amoskeag_rules.rs`; with one, the output of that name.
+///
+/// The generated code has its own `use` items, so it belongs in a module
+/// of its own:
+///
+/// ```ignore
+/// mod rules {
+///     amoskeag::include_rules!();
+/// }
+///
+/// let premium = rules::evaluate("premium", &data).expect("no such rule")?;
+/// ```
+#[macro_export]
+macro_rules! include_rules {
+    () => {
+        $crate::include_rules!("amoskeag_rules");
+    };
+    ($name:literal) => {
+        include!(concat!(env!("OUT_DIR"), "/", $name, ".rs"));
+    };
+}
+
 /// Errors that can occur during compilation
 #[derive(Error, Debug)]
 pub enum CompileError {
@@ -60,13 +162,30 @@ pub enum EvalError {
 
     #[error("Invalid dictionary key: {0}")]
     InvalidDictionaryKey(String),
+
+    #[error("Evaluation exceeded the depth limit of {0}")]
+    DepthLimitExceeded(usize),
+
+    #[error("Evaluation exceeded the step limit of {0}")]
+    StepLimitExceeded(u64),
+
+    #[error("Evaluation was cancelled")]
+    Cancelled,
 }
 
 /// A compiled Amoskeag program, ready for evaluation
+#[derive(Debug)]
 pub struct CompiledProgram {
+    /// The validated AST after constant folding
     ast: Expr,
-    #[allow(dead_code)]
+    /// The AST with function calls resolved, as evaluated by the interpreter
+    resolved: Node,
+    /// The parts of the data the program reads
+    paths: DataPaths,
+    /// The symbols the program was validated against
     symbols: HashSet<String>,
+    /// Where evaluations of the program are counted
+    metrics: metrics::ProgramHandle,
 }
 
 impl CompiledProgram {
@@ -76,61 +195,113 @@ impl CompiledProgram {
     pub fn ast(&self) -> &Expr {
         &self.ast
     }
+
+    /// Get the parts of the data dictionary the program reads
+    ///
+    /// Data outside these paths can be left out without changing any result,
+    /// so hosts can skip decoding it, for instance with
+    /// [`data_from_json_str_projected`].
+    pub fn required_paths(&self) -> &DataPaths {
+        &self.paths
+    }
+
+    /// Report the metrics of this program's evaluations under `name`
+    ///
+    /// Unless named, a program's evaluations are only counted in the totals
+    /// and by backend. Programs given the same name are reported together,
+    /// and a name stays registered for the life of the process, so names
+    /// should come from a fixed set, such as rule file paths. Without the
+    /// `metrics` feature, this does nothing.
+    ///
+    /// A program is named at most once: later calls, including ones racing
+    /// with the first, keep the first name. It takes `&self`, so a program
+    /// can be named after it is shared, such as from [`ProgramCache`].
+    pub fn set_metrics_name(&self, name: &str) {
+        self.metrics.set_name(name);
+    }
 }
 
 /// The execution context for evaluating an Amoskeag program
-pub struct Context {
-    /// Local variable bindings (from let expressions)
-    locals: HashMap<String, Value>,
+///
+/// Scopes form a parent-linked chain of frames: each `let` pushes one frame
+/// holding a single binding, so creating a child scope is O(1) regardless of
+/// how many bindings are in scope or how large the data dictionary is. The
+/// data dictionary itself is borrowed for the whole evaluation, and a binding
+/// to existing data (`let app = applicant`) borrows it rather than copying.
+pub struct Context<'a> {
+    /// The local binding introduced by this frame (from a let expression)
+    local: Option<(&'a str, Cow<'a, Value>)>,
+    /// The enclosing scope, if any
+    parent: Option<&'a Context<'a>>,
     /// The data dictionary (implicit context)
-    data: HashMap<String, Value>,
+    data: &'a HashMap<String, Value>,
+    /// Where probes record their timings, when profiling
+    recorder: Option<&'a Recorder>,
+    /// The limits charged for each node, when evaluating with limits; only
+    /// `machine` checks them
+    budget: Option<&'a Budget<'a>>,
+    /// The values of the subexpressions shared by a `RuleSet`, when
+    /// evaluating one
+    shared: Option<&'a ruleset::Shared<'a>>,
 }
 
-impl Context {
-    /// Create a new context with the given data
-    pub fn new(data: HashMap<String, Value>) -> Self {
+impl<'a> Context<'a> {
+    /// Create a new context that borrows the given data
+    pub fn new(data: &'a HashMap<String, Value>) -> Self {
         Self {
-            locals: HashMap::new(),
+            local: None,
+            parent: None,
             data,
+            recorder: None,
+            budget: None,
+            shared: None,
         }
     }
 
-    /// Create a child context with a new local binding
-    fn with_local(&self, name: String, value: Value) -> Self {
-        let mut locals = self.locals.clone();
-        locals.insert(name, value);
+    /// Create a context that records the probes of a profiled program
+    pub(crate) fn profiled(data: &'a HashMap<String, Value>, recorder: &'a Recorder) -> Self {
         Self {
-            locals,
-            data: self.data.clone(),
+            recorder: Some(recorder),
+            ..Self::new(data)
         }
     }
 
-    /// Look up a variable in the context
-    /// Resolution order: locals -> data -> nil
-    ///
-    /// # Safety
-    /// This method implements safe navigation - it never fails,
-    /// returning Nil for undefined variables instead of an error.
-    fn lookup(&self, name: &str) -> Value {
-        debug_assert!(!name.is_empty(), "lookup() called with empty name");
-
-        // 1. Check local scope
-        if let Some(value) = self.locals.get(name) {
-            return value.clone();
+    /// Create a child context with a new local binding
+    fn with_local<'b>(&'b self, name: &'b str, value: Cow<'b, Value>) -> Context<'b> {
+        Context {
+            local: Some((name, value)),
+            parent: Some(self),
+            data: self.data,
+            recorder: self.recorder,
+            budget: self.budget,
+            shared: self.shared,
         }
+    }
 
-        // 2. Check data dictionary
-        if let Some(value) = self.data.get(name) {
-            return value.clone();
+    /// Find a local binding, searching from the innermost frame outwards
+    fn find_local(&self, name: &str) -> Option<&Value> {
+        let mut frame = Some(self);
+        while let Some(ctx) = frame {
+            if let Some((local_name, value)) = &ctx.local {
+                if *local_name == name {
+                    return Some(value.as_ref());
+                }
+            }
+            frame = ctx.parent;
         }
-
-        // 3. Return nil if not found (safe navigation)
-        Value::Nil
+        None
     }
 
-    fn contains(&self, name: &str) -> bool {
-        debug_assert!(!name.is_empty(), "contains() called with empty name");
-        self.locals.contains_key(name) || self.data.contains_key(name)
+    /// Look up a variable in the context
+    /// Resolution order: locals -> data
+    ///
+    /// The value is returned by reference; callers decide whether they need
+    /// to copy it. Returns `None` for undefined variables.
+    fn lookup(&self, name: &str) -> Option<&Value> {
+        debug_assert!(!name.is_empty(), "lookup() called with empty name");
+
+        // 1. Check local scope, then 2. the data dictionary
+        self.find_local(name).or_else(|| self.data.get(name))
     }
 }
 
@@ -145,212 +316,45 @@ impl Context {
 ///
 /// A compiled program or a compilation error
 pub fn compile(source: &str, symbols: &[&str]) -> Result<CompiledProgram, CompileError> {
-    // Parse the source code
-    let mut lexer = Lexer::new(source);
-    let tokens = lexer
-        .tokenize()
-        .map_err(|e| CompileError::LexerError(e.to_string()))?;
+    metrics::compilation(|| compile_source(source, symbols))
+}
 
-    let mut parser = Parser::new(tokens);
-    let ast = parser
-        .parse()
-        .map_err(|e| CompileError::ParserError(e.to_string()))?;
+fn compile_source(source: &str, symbols: &[&str]) -> Result<CompiledProgram, CompileError> {
+    // Parse the source code, pulling tokens from the lexer as needed
+    let ast = Parser::from_lexer(Lexer::new(source))
+        .and_then(|mut parser| parser.parse())
+        .map_err(parse_error)?;
 
     // Build the symbol table
     let symbol_table: HashSet<String> = symbols.iter().map(|s| s.to_string()).collect();
 
-    // Validate symbols and functions in the AST
+    // Validate symbols and functions against the program as written, then
+    // fold constants and resolve each call to its function id
     validate_ast(&ast, &symbol_table)?;
+    let ast = optimize::optimize(ast);
+    let resolved = resolve::resolve_unchecked(&ast);
+    let paths = paths::required_paths(&ast);
 
     Ok(CompiledProgram {
         ast,
+        resolved,
+        paths,
         symbols: symbol_table,
+        metrics: metrics::program_unnamed(),
     })
 }
 
-/// Validate the AST for undefined symbols and functions
-fn validate_ast(expr: &Expr, symbols: &HashSet<String>) -> Result<(), CompileError> {
-    match expr {
-        Expr::Symbol(s) => {
-            if !symbols.contains(s) {
-                return Err(CompileError::UndefinedSymbol { symbol: s.clone() });
-            }
-            Ok(())
-        }
-
-        Expr::Array(exprs) => {
-            for e in exprs {
-                validate_ast(e, symbols)?;
-            }
-            Ok(())
-        }
-
-        Expr::Dictionary(pairs) => {
-            for (_, e) in pairs {
-                validate_ast(e, symbols)?;
-            }
-            Ok(())
-        }
-
-        Expr::FunctionCall { name, args } => {
-            // Validate function exists and has correct arity
-            validate_function_call(name, args.len())?;
-
-            // Validate arguments
-            for arg in args {
-                validate_ast(arg, symbols)?;
-            }
-            Ok(())
-        }
-
-        Expr::Let { value, body, .. } => {
-            validate_ast(value, symbols)?;
-            validate_ast(body, symbols)?;
-            Ok(())
-        }
-
-        Expr::If {
-            condition,
-            then_branch,
-            else_branch,
-        } => {
-            validate_ast(condition, symbols)?;
-            validate_ast(then_branch, symbols)?;
-            validate_ast(else_branch, symbols)?;
-            Ok(())
-        }
-
-        Expr::Binary { left, right, .. } => {
-            validate_ast(left, symbols)?;
-            validate_ast(right, symbols)?;
-            Ok(())
-        }
-
-        Expr::Unary { operand, .. } => validate_ast(operand, symbols),
-
-        Expr::Pipe { left, right } => {
-            validate_ast(left, symbols)?;
-            validate_ast(right, symbols)?;
-            Ok(())
-        }
-
-        // Literals and variables don't need validation
-        Expr::Number(_) | Expr::String(_) | Expr::Boolean(_) | Expr::Nil | Expr::Variable(_) => {
-            Ok(())
-        }
+/// Report a parse failure as a compile error
+pub(crate) fn parse_error(e: ParseError) -> CompileError {
+    match e {
+        ParseError::LexError(e) => CompileError::LexerError(e.to_string()),
+        e => CompileError::ParserError(e.to_string()),
     }
 }
 
-/// Validate a function call (existence and arity)
-fn validate_function_call(name: &str, arg_count: usize) -> Result<(), CompileError> {
-    // Define function signatures (name -> (min_args, max_args))
-    // For variadic functions, min and max are different
-    let function_signatures: HashMap<&str, (usize, usize)> = [
-        // String functions
-        ("upcase", (1, 1)),
-        ("downcase", (1, 1)),
-        ("capitalize", (1, 1)),
-        ("strip", (1, 1)),
-        ("split", (2, 2)),
-        ("join", (2, 2)),
-        ("truncate", (2, 2)),
-        ("replace", (3, 3)),
-        // Numeric functions
-        ("abs", (1, 1)),
-        ("ceil", (1, 1)),
-        ("floor", (1, 1)),
-        ("round", (1, 2)),
-        ("plus", (2, 2)),
-        ("minus", (2, 2)),
-        ("times", (2, 2)),
-        ("divided_by", (2, 2)),
-        ("modulo", (2, 2)),
-        ("max", (2, 2)),
-        ("min", (2, 2)),
-        ("array_min", (1, 1)),
-        ("array_max", (1, 1)),
-        ("power", (2, 2)),
-        ("sqrt", (1, 1)),
-        ("log", (1, 1)),
-        ("log10", (1, 1)),
-        ("ln", (1, 1)),
-        // Collection functions
-        ("size", (1, 1)),
-        ("first", (1, 1)),
-        ("last", (1, 1)),
-        ("contains", (2, 2)),
-        ("sum", (1, 1)),
-        ("avg", (1, 1)),
-        ("sort", (1, 1)),
-        ("keys", (1, 1)),
-        ("values", (1, 1)),
-        ("reverse", (1, 1)),
-        ("at", (2, 2)),
-        ("uniq", (1, 1)),
-        ("group_by", (2, 2)),
-        ("map", (2, 2)),
-        // Logic functions
-        ("choose", (2, 2)),
-        ("if_then_else", (3, 3)),
-        ("is_number", (1, 1)),
-        ("is_string", (1, 1)),
-        ("is_boolean", (1, 1)),
-        ("is_nil", (1, 1)),
-        ("is_array", (1, 1)),
-        ("is_dictionary", (1, 1)),
-        ("coalesce", (2, 2)),
-        ("default", (2, 2)),
-        // Financial functions - Time Value of Money
-        ("pmt", (4, 4)),
-        ("pv", (3, 3)),
-        ("fv", (4, 4)),
-        ("nper", (3, 3)),
-        ("rate", (3, 3)),
-        // Financial functions - Investment Analysis
-        ("npv", (2, 2)),
-        ("irr", (1, 1)),
-        ("mirr", (3, 3)),
-        // Financial functions - Depreciation
-        ("sln", (3, 3)),
-        ("ddb", (4, 4)),
-        ("db", (5, 5)),
-        // Financial functions - Payment Components
-        ("ipmt", (5, 5)),
-        ("ppmt", (5, 5)),
-        ("cumipmt", (6, 6)),
-        ("cumprinc", (6, 6)),
-        // Financial functions - Interest Rate Conversion
-        ("effect", (2, 2)),
-        ("nominal", (2, 2)),
-        // Date functions
-        ("date_now", (0, 0)),
-        ("date_format", (2, 2)),
-        ("date_trunc", (1, 1)),
-        ("date_parse", (1, 1)),
-    ]
-    .iter()
-    .cloned()
-    .collect();
-
-    if let Some((min_args, max_args)) = function_signatures.get(name) {
-        if arg_count < *min_args || arg_count > *max_args {
-            let expected = if min_args == max_args {
-                format!("{}", min_args)
-            } else {
-                format!("{}-{}", min_args, max_args)
-            };
-            return Err(CompileError::ArityMismatch {
-                function: name.to_string(),
-                expected,
-                actual: arg_count,
-            });
-        }
-        Ok(())
-    } else {
-        Err(CompileError::UndefinedFunction {
-            function: name.to_string(),
-        })
-    }
+/// Validate the AST for undefined symbols and functions
+pub(crate) fn validate_ast(expr: &Expr, symbols: &HashSet<String>) -> Result<(), CompileError> {
+    resolve::validate(expr, symbols)
 }
 
 /// Evaluate a compiled Amoskeag program
@@ -367,146 +371,275 @@ pub fn evaluate(
     program: &CompiledProgram,
     data: &HashMap<String, Value>,
 ) -> Result<Value, EvalError> {
-    let context = Context::new(data.clone());
-    eval_expr(&program.ast, &context)
+    let context = Context::new(data);
+    metrics::evaluation(Some(&program.metrics), BackendSlot::Interpreter, || {
+        eval_node(&program.resolved, &context)
+    })
+}
+
+/// Evaluate a compiled Amoskeag program within `limits`
+///
+/// Behaves like [`evaluate`], except that the evaluation fails with
+/// `EvalError::DepthLimitExceeded`, `EvalError::StepLimitExceeded` or
+/// `EvalError::Cancelled` as soon as it breaks one of the limits.
+///
+/// The whole evaluation runs on the explicit stack of `machine`, which
+/// checks the limits at every node, so `evaluate` never pays for them.
+pub fn evaluate_with_limits(
+    program: &CompiledProgram,
+    data: &HashMap<String, Value>,
+    limits: &EvalLimits,
+) -> Result<Value, EvalError> {
+    let budget = Budget::new(limits);
+    let context = Context {
+        budget: Some(&budget),
+        ..Context::new(data)
+    };
+    metrics::evaluation(Some(&program.metrics), BackendSlot::Interpreter, || {
+        machine::eval_node_ref(&program.resolved, &context, 0).map(Cow::into_owned)
+    })
 }
 
 /// Evaluate an expression in a given context
 ///
-/// This function is public to allow backend implementations to use it directly.
+/// This function is public to allow backends to evaluate an AST directly.
+/// The expression is not validated: undefined functions and arity mismatches
+/// are reported as evaluation errors.
 pub fn eval_expr(expr: &Expr, context: &Context) -> Result<Value, EvalError> {
-    match expr {
-        // Literals
-        Expr::Number(n) => Ok(Value::Number(*n)),
-        Expr::String(s) => Ok(Value::String(s.clone())),
-        Expr::Boolean(b) => Ok(Value::Boolean(*b)),
-        Expr::Nil => Ok(Value::Nil),
-        Expr::Symbol(s) => Ok(Value::Symbol(s.clone())),
-
-        // Array literal
-        Expr::Array(exprs) => {
-            let mut values = Vec::new();
-            for e in exprs {
-                values.push(eval_expr(e, context)?);
-            }
-            Ok(Value::Array(values))
-        }
+    eval_node(&resolve::resolve_unchecked(expr), context)
+}
 
-        // Dictionary literal
-        Expr::Dictionary(pairs) => {
-            let mut map = HashMap::new();
-            for (key, value_expr) in pairs {
-                let value = eval_expr(value_expr, context)?;
-                map.insert(key.clone(), value);
-            }
-            Ok(Value::Dictionary(map))
-        }
+/// Evaluate a resolved expression in a given context
+pub(crate) fn eval_node(node: &Node, context: &Context) -> Result<Value, EvalError> {
+    eval_node_ref(node, context, 0).map(Cow::into_owned)
+}
+
+/// Nesting depth past which evaluation moves from native recursion to the
+/// explicit stack of `machine`
+///
+/// Recursion is the faster of the two for the shallow trees most programs
+/// are, and stopping it here bounds the native stack an evaluation uses.
+const NATIVE_DEPTH: usize = 64;
 
-        // Variable access (with dot navigation)
-        //
-        // # Safe Navigation
-        // Implements safe navigation: accessing undefined variables or invalid
-        // paths returns Nil instead of an error, preventing null pointer exceptions.
-        Expr::Variable(path) => {
-            if path.is_empty() {
-                return Ok(Value::Nil);
+/// Evaluate a resolved expression, borrowing the result where possible
+///
+/// Variable accesses resolve to a reference into the data dictionary or a
+/// local binding instead of a copy, so navigating `applicant.vehicle.value`
+/// never clones the `applicant` subtree. Literals are borrowed from the
+/// program. Only values that are newly computed are returned as `Cow::Owned`.
+///
+/// `depth` is the number of unfinished expressions around `node`. At
+/// `NATIVE_DEPTH`, the rest of the subtree is handed to `machine`.
+fn eval_node_ref<'c>(
+    mut node: &'c Node,
+    context: &'c Context<'_>,
+    depth: usize,
+) -> Result<Cow<'c, Value>, EvalError> {
+    if depth == NATIVE_DEPTH {
+        return machine::eval_node_ref(node, context, depth);
+    }
+    // Branches and untimed probes continue here instead of recursing
+    loop {
+        return match node {
+            Node::Literal(value) => Ok(Cow::Borrowed(value)),
+
+            // Array literal
+            Node::Array(nodes) => eval_array(nodes, context, depth + 1).map(Cow::Owned),
+
+            // Dictionary literal
+            Node::Dictionary(pairs) => eval_dictionary(pairs, context, depth + 1).map(Cow::Owned),
+
+            // Variable access (with dot navigation)
+            //
+            // # Safe Navigation
+            // Implements safe navigation: accessing undefined variables or invalid
+            // paths returns Nil instead of an error, preventing null pointer exceptions.
+            Node::Variable(path) => {
+                if path.is_empty() {
+                    return Ok(Cow::Owned(Value::Nil));
+                }
+
+                // Look up the root variable; a simple variable (no dots) must exist
+                let mut current = match context.lookup(&path[0]) {
+                    Some(value) => value,
+                    None if path.len() == 1 => {
+                        return Err(EvalError::VariableNotFound(path[0].clone()))
+                    }
+                    None => return Ok(Cow::Owned(Value::Nil)),
+                };
+
+                // Navigate the path by reference with safe navigation semantics
+                for key in &path[1..] {
+                    current = match current {
+                        Value::Dictionary(map) => match map.get(key) {
+                            Some(value) => value,
+                            None => return Ok(Cow::Owned(Value::Nil)),
+                        },
+                        _ => return Ok(Cow::Owned(Value::Nil)), // Safe navigation: nil if not a dictionary
+                    };
+                }
+
+                Ok(Cow::Borrowed(current))
             }
 
-            // If it's a simple variable (no dots), check if it exists
-            if path.len() == 1 && !context.contains(&path[0]) {
-                return Err(EvalError::VariableNotFound(path[0].clone()));
+            // Function call, dispatched by the id resolved at compile time
+            Node::Call { func, args } => {
+                let arg_values: Result<Vec<_>, _> = args
+                    .iter()
+                    .map(|a| eval_node_ref(a, context, depth + 1))
+                    .collect();
+                let arg_values = arg_values?;
+                metrics::call_function(*func, &arg_values).map(Cow::Owned)
             }
 
-            // Look up the root variable
-            let mut current = context.lookup(&path[0]);
+            // Let binding
+            //
+            // The body result may borrow from the new frame, which ends here,
+            // so it is returned owned.
+            Node::Let { name, value, body } => {
+                let val = eval_node_ref(value, context, depth + 1)?;
+                let new_context = context.with_local(name, val);
+                eval_node_ref(body, &new_context, depth + 1)
+                    .map(|value| Cow::Owned(value.into_owned()))
+            }
 
-            // Navigate the path with safe navigation semantics
-            for key in &path[1..] {
-                current = match current {
-                    Value::Dictionary(ref map) => map.get(key).cloned().unwrap_or(Value::Nil),
-                    _ => Value::Nil, // Safe navigation: return nil if not a dictionary
+            // If expression
+            Node::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                let cond_value = eval_node_ref(condition, context, depth + 1)?;
+                node = if is_truthy(&cond_value) {
+                    then_branch
+                } else {
+                    else_branch
                 };
+                continue;
             }
 
-            Ok(current)
-        }
+            // Logical operators short-circuit: the right operand is only
+            // evaluated when the left one does not decide the result
+            Node::Binary {
+                op: op @ (BinaryOp::And | BinaryOp::Or),
+                left,
+                right,
+            } => {
+                let left_truthy = is_truthy(&*eval_node_ref(left, context, depth + 1)?);
+                let result = match op {
+                    BinaryOp::And => {
+                        left_truthy && is_truthy(&*eval_node_ref(right, context, depth + 1)?)
+                    }
+                    _ => left_truthy || is_truthy(&*eval_node_ref(right, context, depth + 1)?),
+                };
+                Ok(Cow::Owned(Value::Boolean(result)))
+            }
 
-        // Function call
-        Expr::FunctionCall { name, args } => {
-            let arg_values: Result<Vec<_>, _> =
-                args.iter().map(|a| eval_expr(a, context)).collect();
-            let arg_values = arg_values?;
-            call_function(name, &arg_values)
-        }
+            // Binary operations
+            Node::Binary { op, left, right } => {
+                let left_val = eval_node_ref(left, context, depth + 1)?;
+                let right_val = eval_node_ref(right, context, depth + 1)?;
+                eval_binary_op(*op, &left_val, &right_val).map(Cow::Owned)
+            }
 
-        // Let binding
-        Expr::Let { name, value, body } => {
-            let val = eval_expr(value, context)?;
-            let new_context = context.with_local(name.clone(), val);
-            eval_expr(body, &new_context)
-        }
+            // A chain of `+`, adding each operand to one sum in place
+            Node::Add(operands) => eval_sum(operands, context, depth + 1).map(Cow::Owned),
 
-        // If expression
-        Expr::If {
-            condition,
-            then_branch,
-            else_branch,
-        } => {
-            let cond_value = eval_expr(condition, context)?;
-            let is_truthy = match cond_value {
-                Value::Boolean(b) => b,
-                Value::Nil => false,
-                _ => true, // Everything else is truthy
-            };
-
-            if is_truthy {
-                eval_expr(then_branch, context)
-            } else {
-                eval_expr(else_branch, context)
+            // Unary operations
+            Node::Unary { op, operand } => {
+                let val = eval_node_ref(operand, context, depth + 1)?;
+                eval_unary_op(*op, &val).map(Cow::Owned)
             }
-        }
 
-        // Binary operations
-        Expr::Binary { op, left, right } => {
-            let left_val = eval_expr(left, context)?;
-            let right_val = eval_expr(right, context)?;
-            eval_binary_op(*op, &left_val, &right_val)
-        }
+            // Fused collection calls, copying only the final result
+            Node::Pipeline {
+                source,
+                stages,
+                sink,
+            } => {
+                let source = eval_node_ref(source, context, depth + 1)?;
+                pipeline::run(&source, stages, *sink).map(Cow::Owned)
+            }
 
-        // Unary operations
-        Expr::Unary { op, operand } => {
-            let val = eval_expr(operand, context)?;
-            eval_unary_op(*op, &val)
-        }
+            // Membership in a literal array, with the same result as `contains`
+            Node::Member { set, value } => {
+                let value = eval_node_ref(value, context, depth + 1)?;
+                Ok(Cow::Owned(Value::Boolean(set.contains(&value))))
+            }
 
-        // Pipe expression (this should have been transformed by the parser,
-        // but we handle it here for completeness)
-        Expr::Pipe { left, right } => {
-            let left_val = eval_expr(left, context)?;
-
-            // The right side should be a function call
-            match right.as_ref() {
-                Expr::FunctionCall { name, args } => {
-                    // Prepend the left value as the first argument
-                    let mut new_args = vec![left_val];
-                    for arg in args {
-                        new_args.push(eval_expr(arg, context)?);
-                    }
-                    call_function(name, &new_args)
-                }
-                Expr::Variable(path) if path.len() == 1 => {
-                    // Simple function name without args
-                    call_function(&path[0], &[left_val])
+            // A profiled node, timed when a recorder is attached
+            Node::Probe { site, node: inner } => match context.recorder {
+                Some(recorder) => {
+                    recorder.enter();
+                    let result = eval_node_ref(inner, context, depth + 1);
+                    recorder.exit(*site);
+                    result
                 }
-                _ => {
-                    // Invalid pipe target
-                    Err(EvalError::TypeError {
-                        expected: "function call".to_string(),
-                        got: "expression".to_string(),
-                    })
+                None => {
+                    node = inner;
+                    continue;
                 }
+            },
+
+            // A subexpression shared between rules, evaluated once
+            Node::Shared(slot) => {
+                ruleset::shared_value(*slot, context, depth + 1).map(Cow::Borrowed)
             }
-        }
+
+            Node::Invalid { expected, got } => Err(EvalError::TypeError {
+                expected: expected.clone(),
+                got: got.clone(),
+            }),
+        };
+    }
+}
+
+// The nodes below are evaluated out of line, so that what they keep on the
+// stack isn't part of every level of the recursive walk
+
+#[inline(never)]
+fn eval_array(nodes: &[Node], context: &Context<'_>, depth: usize) -> Result<Value, EvalError> {
+    let mut values = Vec::with_capacity(nodes.len());
+    for n in nodes {
+        values.push(eval_node_ref(n, context, depth)?.into_owned());
+    }
+    Ok(Value::Array(values))
+}
+
+#[inline(never)]
+fn eval_dictionary(
+    pairs: &[(String, Node)],
+    context: &Context<'_>,
+    depth: usize,
+) -> Result<Value, EvalError> {
+    let mut map = HashMap::with_capacity(pairs.len());
+    for (key, value_node) in pairs {
+        let value = eval_node_ref(value_node, context, depth)?.into_owned();
+        map.insert(key.clone(), value);
+    }
+    Ok(Value::Dictionary(map))
+}
+
+/// Evaluate the operands of a chain of `+` in order, adding each to the sum
+/// of those before it
+#[inline(never)]
+fn eval_sum(operands: &[Node], context: &Context<'_>, depth: usize) -> Result<Value, EvalError> {
+    let mut sum = eval_node_ref(&operands[0], context, depth)?.into_owned();
+    for operand in &operands[1..] {
+        let value = eval_node_ref(operand, context, depth)?;
+        sum = add_owned(sum, &value)?;
+    }
+    Ok(sum)
+}
+
+/// Truthiness used by conditions and logical operators
+///
+/// `false` and `nil` are falsy; every other value is truthy.
+pub(crate) fn is_truthy(value: &Value) -> bool {
+    match value {
+        Value::Boolean(b) => *b,
+        Value::Nil => false,
+        _ => true, // Everything else is truthy
     }
 }
 
@@ -515,7 +648,11 @@ pub fn eval_expr(expr: &Expr, context: &Context) -> Result<Value, EvalError> {
 /// # Defensive Programming
 /// All operations are validated by the stdlib operators module.
 /// Division by zero and other invalid operations return appropriate errors.
-fn eval_binary_op(op: BinaryOp, left: &Value, right: &Value) -> Result<Value, EvalError> {
+pub(crate) fn eval_binary_op(
+    op: BinaryOp,
+    left: &Value,
+    right: &Value,
+) -> Result<Value, EvalError> {
     use amoskeag_stdlib_operators::*;
 
     match op {
@@ -537,7 +674,7 @@ fn eval_binary_op(op: BinaryOp, left: &Value, right: &Value) -> Result<Value, Ev
 }
 
 /// Evaluate a unary operation
-fn eval_unary_op(op: UnaryOp, operand: &Value) -> Result<Value, EvalError> {
+pub(crate) fn eval_unary_op(op: UnaryOp, operand: &Value) -> Result<Value, EvalError> {
     use amoskeag_stdlib_operators::*;
 
     match op {
@@ -552,126 +689,6 @@ fn eval_unary_op(op: UnaryOp, operand: &Value) -> Result<Value, EvalError> {
     }
 }
 
-/// Call a standard library function
-fn call_function(name: &str, args: &[Value]) -> Result<Value, EvalError> {
-    use amoskeag_stdlib_functions::*;
-
-    match name {
-        // String functions
-        "upcase" => upcase(&args[0]).map_err(EvalError::from),
-        "downcase" => downcase(&args[0]).map_err(EvalError::from),
-        "capitalize" => capitalize(&args[0]).map_err(EvalError::from),
-        "strip" => strip(&args[0]).map_err(EvalError::from),
-        "split" => split(&args[0], &args[1]).map_err(EvalError::from),
-        "join" => join(&args[0], &args[1]).map_err(EvalError::from),
-        "truncate" => truncate(&args[0], &args[1]).map_err(EvalError::from),
-        "replace" => replace(&args[0], &args[1], &args[2]).map_err(EvalError::from),
-
-        // Numeric functions
-        "abs" => abs(&args[0]).map_err(EvalError::from),
-        "ceil" => ceil(&args[0]).map_err(EvalError::from),
-        "floor" => floor(&args[0]).map_err(EvalError::from),
-        "round" => {
-            if args.len() == 2 {
-                round(&args[0], &args[1]).map_err(EvalError::from)
-            } else {
-                round(&args[0], &Value::Number(0.0)).map_err(EvalError::from)
-            }
-        }
-        "plus" => plus(&args[0], &args[1]).map_err(EvalError::from),
-        "minus" => minus(&args[0], &args[1]).map_err(EvalError::from),
-        "times" => times(&args[0], &args[1]).map_err(EvalError::from),
-        "divided_by" => divided_by(&args[0], &args[1]).map_err(EvalError::from),
-        "modulo" => modulo_fn(&args[0], &args[1]).map_err(EvalError::from),
-        "max" => max(&args[0], &args[1]).map_err(EvalError::from),
-        "min" => min(&args[0], &args[1]).map_err(EvalError::from),
-        "array_min" => array_min(&args[0]).map_err(EvalError::from),
-        "array_max" => array_max(&args[0]).map_err(EvalError::from),
-        "power" => power(&args[0], &args[1]).map_err(EvalError::from),
-        "sqrt" => sqrt(&args[0]).map_err(EvalError::from),
-        "log" => log(&args[0]).map_err(EvalError::from),
-        "log10" => log10(&args[0]).map_err(EvalError::from),
-        "ln" => ln(&args[0]).map_err(EvalError::from),
-
-        // Collection functions
-        "size" => size(&args[0]).map_err(EvalError::from),
-        "first" => first(&args[0]).map_err(EvalError::from),
-        "last" => last(&args[0]).map_err(EvalError::from),
-        "contains" => contains(&args[0], &args[1]).map_err(EvalError::from),
-        "sum" => sum(&args[0]).map_err(EvalError::from),
-        "avg" => avg(&args[0]).map_err(EvalError::from),
-        "sort" => sort(&args[0]).map_err(EvalError::from),
-        "keys" => keys(&args[0]).map_err(EvalError::from),
-        "values" => values(&args[0]).map_err(EvalError::from),
-        "reverse" => reverse(&args[0]).map_err(EvalError::from),
-        "at" => at(&args[0], &args[1]).map_err(EvalError::from),
-        "uniq" => uniq(&args[0]).map_err(EvalError::from),
-        "group_by" => group_by(&args[0], &args[1]).map_err(EvalError::from),
-        "map" => map(&args[0], &args[1]).map_err(EvalError::from),
-
-        // Logic functions
-        "choose" => choose(&args[0], &args[1]).map_err(EvalError::from),
-        "if_then_else" => if_then_else(&args[0], &args[1], &args[2]).map_err(EvalError::from),
-        "is_number" => Ok(is_number(&args[0])),
-        "is_string" => Ok(is_string(&args[0])),
-        "is_boolean" => Ok(is_boolean(&args[0])),
-        "is_nil" => Ok(is_nil(&args[0])),
-        "is_array" => Ok(is_array(&args[0])),
-        "is_dictionary" => Ok(is_dictionary(&args[0])),
-        "coalesce" => Ok(coalesce(&args[0], &args[1])),
-        "default" => Ok(default(&args[0], &args[1])),
-
-        // Financial functions - Time Value of Money
-        "pmt" => pmt(&args[0], &args[1], &args[2], &args[3]).map_err(EvalError::from),
-        "pv" => pv(&args[0], &args[1], &args[2]).map_err(EvalError::from),
-        "fv" => fv(&args[0], &args[1], &args[2], &args[3]).map_err(EvalError::from),
-        "nper" => nper(&args[0], &args[1], &args[2]).map_err(EvalError::from),
-        "rate" => rate(&args[0], &args[1], &args[2]).map_err(EvalError::from),
-
-        // Financial functions - Investment Analysis
-        "npv" => npv(&args[0], &args[1]).map_err(EvalError::from),
-        "irr" => irr(&args[0]).map_err(EvalError::from),
-        "mirr" => mirr(&args[0], &args[1], &args[2]).map_err(EvalError::from),
-
-        // Financial functions - Depreciation
-        "sln" => sln(&args[0], &args[1], &args[2]).map_err(EvalError::from),
-        "ddb" => ddb(&args[0], &args[1], &args[2], &args[3]).map_err(EvalError::from),
-        "db" => db(&args[0], &args[1], &args[2], &args[3], &args[4]).map_err(EvalError::from),
-
-        // Financial functions - Payment Components
-        "ipmt" => ipmt(&args[0], &args[1], &args[2], &args[3], &args[4]).map_err(EvalError::from),
-        "ppmt" => ppmt(&args[0], &args[1], &args[2], &args[3], &args[4]).map_err(EvalError::from),
-        "cumipmt" => cumipmt(&args[0], &args[1], &args[2], &args[3], &args[4], &args[5])
-            .map_err(EvalError::from),
-        "cumprinc" => cumprinc(&args[0], &args[1], &args[2], &args[3], &args[4], &args[5])
-            .map_err(EvalError::from),
-
-        // Financial functions - Interest Rate Conversion
-        "effect" => effect(&args[0], &args[1]).map_err(EvalError::from),
-        "nominal" => nominal(&args[0], &args[1]).map_err(EvalError::from),
-
-        // Date functions
-        "date_now" => {
-            if args.is_empty() {
-                date_now().map_err(EvalError::from)
-            } else {
-                Err(EvalError::TypeError {
-                    expected: "0 arguments".to_string(),
-                    got: format!("{} arguments", args.len()),
-                })
-            }
-        }
-        "date_format" => date_format(&args[0], &args[1]).map_err(EvalError::from),
-        "date_trunc" => date_trunc(&args[0]).map_err(EvalError::from),
-        "date_parse" => date_parse(&args[0]).map_err(EvalError::from),
-
-        _ => Err(EvalError::TypeError {
-            expected: "known function".to_string(),
-            got: name.to_string(),
-        }),
-    }
-}
-
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -727,7 +744,7 @@ mod tests {
         data.insert("driver".to_string(), Value::Dictionary(driver));
 
         let result = evaluate(&program, &data).unwrap();
-        assert_eq!(result, Value::Symbol("continue".to_string()));
+        assert_eq!(result, Value::Symbol("continue".into()));
     }
 
     #[test]
@@ -1047,6 +1064,38 @@ mod tests {
         assert_eq!(result, Value::Number(42.0));
     }
 
+    #[test]
+    fn test_nesting_limit() {
+        let depth = amoskeag_parser::MAX_NESTING_DEPTH - 1;
+        let data = HashMap::from([("x".to_string(), Value::Number(1.0))]);
+        for source in [
+            format!("{}x{}", "(".repeat(depth), ")".repeat(depth)),
+            format!("{}x{}", "1 + (".repeat(depth), ")".repeat(depth)),
+            format!(
+                "{}x{}",
+                "if true then ".repeat(depth),
+                " else 0 end".repeat(depth)
+            ),
+            format!("x{}", " | abs".repeat(depth)),
+        ] {
+            let program = compile(&source, &[]).unwrap();
+            assert!(evaluate(&program, &data).is_ok());
+        }
+
+        // Far deeper programs are rejected before any pass can overflow
+        for source in [
+            format!("{}x", "(".repeat(100_000)),
+            format!("{}x", "x * (".repeat(100_000)),
+            format!("{}x", "not ".repeat(100_000)),
+            format!("x{}", " | abs".repeat(100_000)),
+        ] {
+            assert!(matches!(
+                compile(&source, &[]),
+                Err(CompileError::ParserError(_))
+            ));
+        }
+    }
+
     #[test]
     fn test_pipe_chain_multiple() {
         let source = r#""HELLO" | downcase | capitalize"#;
@@ -1069,6 +1118,155 @@ mod tests {
         assert_eq!(result, Value::Number(20.0));
     }
 
+    #[test]
+    fn test_let_scope_does_not_leak() {
+        let source = "[let x = 1 in x, x]";
+        let program = compile(source, &[]).unwrap();
+        let mut data = HashMap::new();
+        data.insert("x".to_string(), Value::Number(5.0));
+        let result = evaluate(&program, &data).unwrap();
+        assert_eq!(
+            result,
+            Value::Array(vec![Value::Number(1.0), Value::Number(5.0)])
+        );
+    }
+
+    #[test]
+    fn test_chained_lets_see_outer_bindings() {
+        let mut source = String::from("let v0 = base\n");
+        for i in 1..20 {
+            source.push_str(&format!("let v{} = v{} + 1\n", i, i - 1));
+        }
+        source.push_str("v19 + v0");
+        let program = compile(&source, &[]).unwrap();
+        let mut data = HashMap::new();
+        data.insert("base".to_string(), Value::Number(1.0));
+        let result = evaluate(&program, &data).unwrap();
+        assert_eq!(result, Value::Number(21.0));
+    }
+
+    #[test]
+    fn test_context_with_local_borrows_data() {
+        let mut data = HashMap::new();
+        data.insert("x".to_string(), Value::Number(1.0));
+        let root = Context::new(&data);
+        let child = root.with_local("y", Cow::Owned(Value::Number(2.0)));
+        let grandchild = child.with_local("x", Cow::Owned(Value::Number(3.0)));
+
+        assert!(std::ptr::eq(grandchild.data, &data));
+        assert_eq!(grandchild.lookup("x"), Some(&Value::Number(3.0)));
+        assert_eq!(grandchild.lookup("y"), Some(&Value::Number(2.0)));
+        assert_eq!(child.lookup("x"), Some(&Value::Number(1.0)));
+        assert!(child.lookup("z").is_none());
+    }
+
+    #[test]
+    fn test_let_binding_borrows_data() {
+        let mut applicant = HashMap::new();
+        applicant.insert("age".to_string(), Value::Number(30.0));
+        let mut data = HashMap::new();
+        data.insert("applicant".to_string(), Value::Dictionary(applicant));
+
+        // The frame a let pushes holds the evaluated value as-is, so a
+        // binding to existing data is a reference into the dictionary
+        let program = compile("applicant", &[]).unwrap();
+        let context = Context::new(&data);
+        let bound = eval_node_ref(&program.resolved, &context, 0).unwrap();
+        let frame = context.with_local("app", bound);
+        assert!(std::ptr::eq(
+            frame.lookup("app").unwrap(),
+            &data["applicant"]
+        ));
+
+        let program = compile("let app = applicant in app.age", &[]).unwrap();
+        assert_eq!(evaluate(&program, &data).unwrap(), Value::Number(30.0));
+    }
+
+    #[test]
+    fn test_eval_node_ref_borrows_data() {
+        let mut vehicle = HashMap::new();
+        vehicle.insert("value".to_string(), Value::Number(30000.0));
+        let mut applicant = HashMap::new();
+        applicant.insert("vehicle".to_string(), Value::Dictionary(vehicle));
+        let mut data = HashMap::new();
+        data.insert("applicant".to_string(), Value::Dictionary(applicant));
+
+        let program = compile("if true applicant.vehicle else nil end", &[]).unwrap();
+        let context = Context::new(&data);
+        let result = eval_node_ref(&program.resolved, &context, 0).unwrap();
+
+        let expected = match &data["applicant"] {
+            Value::Dictionary(map) => &map["vehicle"],
+            _ => unreachable!(),
+        };
+        match result {
+            Cow::Borrowed(value) => assert!(std::ptr::eq(value, expected)),
+            Cow::Owned(_) => panic!("Expected a borrowed value"),
+        }
+
+        // Missing paths are still nil, undefined simple variables still an error
+        let program = compile("applicant.missing.value", &[]).unwrap();
+        assert_eq!(
+            eval_node_ref(&program.resolved, &context, 0)
+                .unwrap()
+                .into_owned(),
+            Value::Nil
+        );
+        let program = compile("missing", &[]).unwrap();
+        assert!(matches!(
+            eval_node_ref(&program.resolved, &context, 0),
+            Err(EvalError::VariableNotFound(_))
+        ));
+    }
+
+    #[test]
+    fn test_eval_expr_reports_unresolved_calls_at_run_time() {
+        let mut parser = Parser::new(Lexer::new("nope(1)").tokenize().unwrap());
+        let expr = parser.parse().unwrap();
+        let data = HashMap::new();
+        assert!(matches!(
+            eval_expr(&expr, &Context::new(&data)),
+            Err(EvalError::TypeError { got, .. }) if got == "nope"
+        ));
+    }
+
+    #[test]
+    fn test_logical_operators_short_circuit() {
+        let data = HashMap::new();
+        let eval = |source: &str| evaluate(&compile(source, &[]).unwrap(), &data);
+
+        // The right operand would fail if it were evaluated
+        assert_eq!(eval("false and 1 / 0").unwrap(), Value::Boolean(false));
+        assert_eq!(eval("nil and missing").unwrap(), Value::Boolean(false));
+        assert_eq!(eval("true or 1 / 0").unwrap(), Value::Boolean(true));
+        assert_eq!(eval("1 or missing").unwrap(), Value::Boolean(true));
+
+        // Otherwise the result is the truthiness of the right operand
+        assert_eq!(eval("true and nil").unwrap(), Value::Boolean(false));
+        assert_eq!(eval("false or 0").unwrap(), Value::Boolean(true));
+        assert!(eval("true and 1 / 0").is_err());
+        assert!(eval("false or missing").is_err());
+    }
+
+    #[test]
+    fn test_contains_on_literal_set() {
+        let program = compile(
+            "contains(['NH', 'VT', 'ME', 'MA', 'CT', 'RI', 'NY', 'NJ', 0], state)",
+            &[],
+        )
+        .unwrap();
+        let eval = |state: Value| {
+            let mut data = HashMap::new();
+            data.insert("state".to_string(), state);
+            evaluate(&program, &data).unwrap()
+        };
+
+        assert_eq!(eval(Value::String("VT".to_string())), Value::Boolean(true));
+        assert_eq!(eval(Value::String("CA".to_string())), Value::Boolean(false));
+        assert_eq!(eval(Value::Number(-0.0)), Value::Boolean(true));
+        assert_eq!(eval(Value::Symbol("VT".into())), Value::Boolean(false));
+    }
+
     #[test]
     fn test_array_of_mixed_types() {
         let source = r#"[1, "hello", true, nil, :symbol]"#;
@@ -1082,7 +1280,7 @@ mod tests {
             assert_eq!(arr[1], Value::String("hello".to_string()));
             assert_eq!(arr[2], Value::Boolean(true));
             assert_eq!(arr[3], Value::Nil);
-            assert_eq!(arr[4], Value::Symbol("symbol".to_string()));
+            assert_eq!(arr[4], Value::Symbol("symbol".into()));
         } else {
             panic!("Expected array");
         }
@@ -1368,4 +1566,43 @@ mod tests {
         let result = evaluate(&program, &data).unwrap();
         assert_eq!(result, Value::String("Hello".to_string()));
     }
+
+    #[test]
+    fn test_long_chains_on_a_small_stack() {
+        // Generated rules: an `else if` ladder, a chain of lets, and a sum
+        let n = 1000;
+        let ladder = (0..n)
+            .map(|i| format!("if x == {} then {} else ", i, i * 2))
+            .collect::<String>()
+            + "-1 end";
+        let lets = (1..n)
+            .map(|i| format!("let a{} = a{} + 1 in ", i, i - 1))
+            .collect::<String>();
+        let lets = format!("let a0 = x in {}a{} * 2", lets, n - 1);
+        let sum = (0..n).map(|i| format!(" + x * {}", i)).collect::<String>();
+        let sum = format!("x{}", sum);
+
+        let data = HashMap::from([("x".to_string(), Value::Number(7.0))]);
+        let results = std::thread::scope(|scope| {
+            std::thread::Builder::new()
+                .stack_size(512 * 1024)
+                .spawn_scoped(scope, || {
+                    [&ladder, &lets, &sum].map(|source| {
+                        let program = compile(source, &[]).unwrap();
+                        evaluate(&program, &data).unwrap()
+                    })
+                })
+                .unwrap()
+                .join()
+                .unwrap()
+        });
+        assert_eq!(
+            results,
+            [
+                Value::Number(14.0),
+                Value::Number(2.0 * (7.0 + 999.0)),
+                Value::Number(7.0 + 7.0 * 499_500.0),
+            ]
+        );
+    }
 }
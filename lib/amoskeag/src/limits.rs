@@ -0,0 +1,96 @@
+//! Evaluation limits
+//!
+//! Hosts that evaluate untrusted or machine-generated rules can bound each
+//! evaluation with `EvalLimits`: how deeply expressions may nest, how many
+//! nodes may be evaluated, and a flag that interrupts the evaluation from
+//! another thread. An evaluation with limits runs on the explicit stack of
+//! `machine`, which charges every node it evaluates to a `Budget`.
+
+use crate::EvalError;
+use std::cell::Cell;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+
+/// Number of steps between two checks of the cancellation flag; a power of two
+const CANCEL_CHECK_INTERVAL: u64 = 1024;
+
+/// Bounds on the work a single evaluation may do
+///
+/// Every limit is off by default. Limits are checked before each node is
+/// evaluated, so an evaluation that hits one stops without starting any
+/// further operator or function call.
+///
+/// ```
+/// use amoskeag::{compile, evaluate_with_limits, AmoskeagValue, EvalError, EvalLimits};
+/// use std::collections::HashMap;
+///
+/// // Five nodes: two operators and three variables
+/// let program = compile("(a + b) * c", &[]).unwrap();
+/// let data: HashMap<_, _> = ["a", "b", "c"]
+///     .map(|name| (name.to_string(), AmoskeagValue::Number(1.0)))
+///     .into_iter()
+///     .collect();
+///
+/// let limits = EvalLimits {
+///     max_steps: Some(4),
+///     ..EvalLimits::default()
+/// };
+/// let result = evaluate_with_limits(&program, &data, &limits);
+/// assert!(matches!(result, Err(EvalError::StepLimitExceeded(4))));
+///
+/// let limits = EvalLimits {
+///     max_steps: Some(5),
+///     ..EvalLimits::default()
+/// };
+/// assert!(evaluate_with_limits(&program, &data, &limits).is_ok());
+/// ```
+#[derive(Debug, Clone, Default)]
+pub struct EvalLimits {
+    /// Deepest nesting of unfinished expressions, such as an operator
+    /// waiting for its operands or a `let` whose body is being evaluated
+    pub max_depth: Option<usize>,
+    /// Most nodes evaluated
+    pub max_steps: Option<u64>,
+    /// Stops the evaluation with `EvalError::Cancelled` once set, from any
+    /// thread; checked every 1024 steps
+    pub cancel: Option<Arc<AtomicBool>>,
+}
+
+/// The state of one evaluation's limits
+pub(crate) struct Budget<'a> {
+    max_depth: usize,
+    max_steps: u64,
+    steps: Cell<u64>,
+    cancel: Option<&'a AtomicBool>,
+}
+
+impl<'a> Budget<'a> {
+    pub(crate) fn new(limits: &'a EvalLimits) -> Self {
+        Self {
+            max_depth: limits.max_depth.unwrap_or(usize::MAX),
+            max_steps: limits.max_steps.unwrap_or(u64::MAX),
+            steps: Cell::new(0),
+            cancel: limits.cancel.as_deref(),
+        }
+    }
+
+    /// Charge one node evaluated at `depth`
+    pub(crate) fn step(&self, depth: usize) -> Result<(), EvalError> {
+        if depth > self.max_depth {
+            return Err(EvalError::DepthLimitExceeded(self.max_depth));
+        }
+        let steps = self.steps.get();
+        if steps == self.max_steps {
+            return Err(EvalError::StepLimitExceeded(self.max_steps));
+        }
+        self.steps.set(steps + 1);
+        if steps & (CANCEL_CHECK_INTERVAL - 1) == 0
+            && self
+                .cancel
+                .is_some_and(|cancel| cancel.load(Ordering::Relaxed))
+        {
+            return Err(EvalError::Cancelled);
+        }
+        Ok(())
+    }
+}
@@ -0,0 +1,750 @@
+//! Explicit-stack evaluation
+//!
+//! The interpreter evaluates the resolved `Node` tree recursively, which is
+//! the fastest way to walk it, but only up to `NATIVE_DEPTH` levels. Deeper
+//! subtrees are evaluated here, without recursing: the work still to do is
+//! kept on a stack of tasks, innermost last, and the values computed so far
+//! on a stack of operands. However deeply a program nests, its evaluation
+//! uses a bounded amount of native stack, so it is safe on small
+//! worker-thread stacks. Evaluations with limits run here from the root,
+//! since every node the machine evaluates is charged to the `Budget`.
+//!
+//! The branch an `if` takes is evaluated in place of the `if`, so a ladder
+//! of `else if`s is no deeper than a single `if`. A `let` holds one level of
+//! depth while its body is evaluated.
+//!
+//! Values are borrowed as they are by the recursive walk: a variable is a
+//! reference into the data dictionary or an enclosing binding, a literal a
+//! reference into the program, and a value computed for a `let` is kept
+//! once on the locals stack and referred to by its slot.
+
+use crate::limits::Budget;
+use crate::metrics;
+use crate::pipeline::{self, Sink, Stage};
+use crate::profile::Recorder;
+use crate::resolve::Node;
+use crate::ruleset;
+use crate::{eval_binary_op, eval_unary_op, is_truthy, Context, EvalError};
+use amoskeag_parser::{BinaryOp, UnaryOp};
+use amoskeag_stdlib_functions::ValueSet;
+use amoskeag_stdlib_operators::{add_owned, Value};
+use std::borrow::Cow;
+use std::collections::HashMap;
+use std::iter;
+
+/// Shared nil for missing paths, so they never allocate
+static NIL: Value = Value::Nil;
+
+/// Evaluate a resolved expression nested `depth` levels deep, borrowing the
+/// result where possible
+pub(crate) fn eval_node_ref<'c>(
+    node: &'c Node,
+    context: &'c Context<'_>,
+    depth: usize,
+) -> Result<Cow<'c, Value>, EvalError> {
+    let mut machine = Machine {
+        context,
+        recorder: context.recorder,
+        budget: context.budget,
+        tasks: Vec::new(),
+        operands: Vec::new(),
+        locals: Vec::new(),
+        depth,
+    };
+    match machine.run(node) {
+        Ok(Operand::Borrowed(value)) => Ok(Cow::Borrowed(value)),
+        Ok(Operand::Owned(value)) => Ok(Cow::Owned(value)),
+        Ok(Operand::Local { .. }) => unreachable!("every let is closed by the end"),
+        Err(e) => {
+            machine.unwind();
+            Err(e)
+        }
+    }
+}
+
+/// A value on the operand or locals stack
+enum Operand<'a> {
+    /// A value of the data dictionary or the program
+    Borrowed(&'a Value),
+    /// A value computed by this evaluation
+    Owned(Value),
+    /// The value at `path` inside the owned local in `slot`
+    Local { slot: usize, path: &'a [String] },
+}
+
+impl Operand<'_> {
+    fn get<'s>(&'s self, locals: &'s [(&str, Operand<'_>)]) -> &'s Value {
+        match self {
+            Operand::Borrowed(value) => value,
+            Operand::Owned(value) => value,
+            Operand::Local { slot, path } => match &locals[*slot].1 {
+                Operand::Owned(value) => navigate(value, path),
+                _ => unreachable!("locals refer to owned slots"),
+            },
+        }
+    }
+
+    fn lend<'s>(&'s self, locals: &'s [(&str, Operand<'_>)]) -> Cow<'s, Value> {
+        Cow::Borrowed(self.get(locals))
+    }
+
+    fn into_value(self, locals: &[(&str, Operand<'_>)]) -> Value {
+        match self {
+            Operand::Owned(value) => value,
+            operand => operand.get(locals).clone(),
+        }
+    }
+}
+
+/// Work left to do
+///
+/// Every task but `Eval` continues an expression whose subexpressions have
+/// been evaluated, taking their values off the operand stack.
+enum Task<'a> {
+    /// Evaluate a node, pushing its value
+    Eval(&'a Node),
+    /// Collect the last `len` values into an array
+    Array(usize),
+    Dictionary(&'a [(String, Node)]),
+    Call {
+        func: usize,
+        argc: usize,
+    },
+    /// Bind the value of a `let` and evaluate its body
+    Bind {
+        name: &'a str,
+        body: &'a Node,
+    },
+    /// Close the innermost `let` scope
+    Unbind,
+    /// Evaluate the branch of an `if` its condition selects
+    Branch {
+        then_branch: &'a Node,
+        else_branch: &'a Node,
+    },
+    /// Evaluate the right operand of `and`/`or` unless the left decides
+    Logical {
+        op: BinaryOp,
+        right: &'a Node,
+    },
+    /// Replace a value with its truthiness
+    Truthy,
+    Binary(BinaryOp),
+    /// Add the top value to the sum below it; the slice starts with the
+    /// operand that value is of and holds those still to add after it
+    Add(&'a [Node]),
+    Unary(UnaryOp),
+    Pipeline {
+        stages: &'a [Stage],
+        sink: Sink,
+    },
+    Member(&'a ValueSet),
+    /// Stop timing the probe of a site
+    Exit(usize),
+}
+
+struct Machine<'a> {
+    context: &'a Context<'a>,
+    recorder: Option<&'a Recorder>,
+    budget: Option<&'a Budget<'a>>,
+    /// Work left to do, innermost last
+    tasks: Vec<Task<'a>>,
+    /// Values computed and not yet consumed
+    operands: Vec<Operand<'a>>,
+    /// Values bound by the lets of this subtree, innermost last
+    locals: Vec<(&'a str, Operand<'a>)>,
+    /// Nesting of the recursive walk this subtree is in, plus the number of
+    /// tasks other than `Eval` on the task stack
+    depth: usize,
+}
+
+impl<'a> Machine<'a> {
+    fn run(&mut self, node: &'a Node) -> Result<Operand<'a>, EvalError> {
+        self.eval(node)?;
+        while let Some(task) = self.tasks.pop() {
+            match task {
+                Task::Eval(node) => self.eval(node)?,
+                task => {
+                    self.depth -= 1;
+                    self.resume(task)?;
+                }
+            }
+        }
+        Ok(self.pop())
+    }
+
+    /// Start evaluating a node: push its value, or the tasks that compute it
+    fn eval(&mut self, node: &'a Node) -> Result<(), EvalError> {
+        self.step(self.depth)?;
+        if self.leaf(node)? {
+            return Ok(());
+        }
+
+        match node {
+            Node::Literal(_) | Node::Variable(_) => unreachable!("leaf() evaluates these"),
+
+            Node::Array(nodes) => self.children(Task::Array(nodes.len()), nodes.iter()),
+
+            Node::Dictionary(pairs) => {
+                self.children(Task::Dictionary(pairs), pairs.iter().map(|(_, node)| node))
+            }
+
+            Node::Call { func, args } => self.children(
+                Task::Call {
+                    func: *func,
+                    argc: args.len(),
+                },
+                args.iter(),
+            ),
+
+            Node::Let { name, value, body } => {
+                self.children(Task::Bind { name, body }, iter::once(&**value))
+            }
+
+            Node::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => self.children(
+                Task::Branch {
+                    then_branch,
+                    else_branch,
+                },
+                iter::once(&**condition),
+            ),
+
+            Node::Binary {
+                op: op @ (BinaryOp::And | BinaryOp::Or),
+                left,
+                right,
+            } => self.children(Task::Logical { op: *op, right }, iter::once(&**left)),
+
+            Node::Binary { op, left, right } => {
+                self.children(Task::Binary(*op), [&**left, &**right].into_iter())
+            }
+
+            // Charged as the operators it stands for, one level deep
+            Node::Add(operands) => {
+                for _ in 2..operands.len() {
+                    self.step(self.depth)?;
+                }
+                self.children(Task::Add(&operands[1..]), operands[..2].iter())
+            }
+
+            Node::Unary { op, operand } => self.children(Task::Unary(*op), iter::once(&**operand)),
+
+            Node::Pipeline {
+                source,
+                stages,
+                sink,
+            } => self.children(
+                Task::Pipeline {
+                    stages,
+                    sink: *sink,
+                },
+                iter::once(&**source),
+            ),
+
+            Node::Member { set, value } => self.children(Task::Member(set), iter::once(&**value)),
+
+            // A profiled node, timed when a recorder is attached
+            Node::Probe { site, node } => {
+                if let Some(recorder) = self.recorder {
+                    self.enter(Task::Exit(*site));
+                    recorder.enter();
+                }
+                self.tasks.push(Task::Eval(node));
+                Ok(())
+            }
+
+            // A subexpression shared between rules, evaluated once
+            Node::Shared(slot) => {
+                let value = ruleset::shared_value(*slot, self.context, self.depth)?;
+                self.operands.push(Operand::Borrowed(value));
+                Ok(())
+            }
+
+            Node::Invalid { expected, got } => Err(EvalError::TypeError {
+                expected: expected.clone(),
+                got: got.clone(),
+            }),
+        }
+    }
+
+    /// Push the value of a literal or variable and return true, or return
+    /// false for any other node
+    ///
+    /// Leaves never go through the task stack, which saves a push and a pop
+    /// for most nodes.
+    #[inline]
+    fn leaf(&mut self, node: &'a Node) -> Result<bool, EvalError> {
+        let operand = match node {
+            Node::Literal(value) => Operand::Borrowed(value),
+            // Variable access, with safe navigation: a missing path is nil
+            Node::Variable(path) => self.variable(path)?,
+            _ => return Ok(false),
+        };
+        self.operands.push(operand);
+        Ok(true)
+    }
+
+    /// Evaluate `nodes` in order, then continue with `task`
+    ///
+    /// Leading leaves are evaluated in place, and `task` runs at once if
+    /// they are all there is. Otherwise the rest of the nodes are pushed
+    /// after `task`, last to first, so they run first to last.
+    fn children<I>(&mut self, task: Task<'a>, mut nodes: I) -> Result<(), EvalError>
+    where
+        I: DoubleEndedIterator<Item = &'a Node>,
+    {
+        while let Some(node) = nodes.next() {
+            if !matches!(node, Node::Literal(_) | Node::Variable(_)) {
+                self.enter(task);
+                for node in nodes.rev() {
+                    self.tasks.push(Task::Eval(node));
+                }
+                self.tasks.push(Task::Eval(node));
+                return Ok(());
+            }
+            self.step(self.depth + 1)?;
+            self.leaf(node)?;
+        }
+        self.resume(task)
+    }
+
+    /// Charge one node evaluated at `depth` to the budget, if there is one
+    fn step(&self, depth: usize) -> Result<(), EvalError> {
+        match self.budget {
+            Some(budget) => budget.step(depth),
+            None => Ok(()),
+        }
+    }
+
+    /// Continue an expression whose subexpressions have been evaluated
+    fn resume(&mut self, task: Task<'a>) -> Result<(), EvalError> {
+        let value = match task {
+            Task::Eval(_) => unreachable!("run() evaluates nodes"),
+
+            Task::Array(len) => {
+                let start = self.operands.len() - len;
+                let items = self
+                    .operands
+                    .drain(start..)
+                    .map(|operand| operand.into_value(&self.locals))
+                    .collect();
+                Value::Array(items)
+            }
+
+            Task::Dictionary(pairs) => {
+                let start = self.operands.len() - pairs.len();
+                let mut map = HashMap::with_capacity(pairs.len());
+                for ((key, _), operand) in pairs.iter().zip(self.operands.drain(start..)) {
+                    map.insert(key.clone(), operand.into_value(&self.locals));
+                }
+                Value::Dictionary(map)
+            }
+
+            // Arguments are lent to the function, so calls with up to three
+            // of them need no argument vector
+            Task::Call { func, argc } => {
+                let start = self.operands.len() - argc;
+                let call = |args: &[Cow<'_, Value>]| metrics::call_function(func, args);
+                let locals = &self.locals;
+                let arg = |operand| Operand::lend(operand, locals);
+                let result = match &self.operands[start..] {
+                    [] => call(&[]),
+                    [a] => call(&[arg(a)]),
+                    [a, b] => call(&[arg(a), arg(b)]),
+                    [a, b, c] => call(&[arg(a), arg(b), arg(c)]),
+                    args => call(&args.iter().map(arg).collect::<Vec<_>>()),
+                }?;
+                self.operands.truncate(start);
+                result
+            }
+
+            Task::Bind { name, body } => {
+                let value = self.pop();
+                self.locals.push((name, value));
+                self.enter(Task::Unbind);
+                self.tasks.push(Task::Eval(body));
+                return Ok(());
+            }
+
+            // The body's value may point into the closing local, which is
+            // moved out rather than copied
+            Task::Unbind => {
+                let (_, local) = self.locals.pop().expect("unbind() matches bind()");
+                let slot = self.locals.len();
+                let top = self.operands.last_mut().expect("a let body has a value");
+                if let Operand::Local { slot: s, path } = *top {
+                    if s == slot {
+                        let Operand::Owned(value) = local else {
+                            unreachable!("locals refer to owned slots");
+                        };
+                        *top = Operand::Owned(take_path(value, path));
+                    }
+                }
+                return Ok(());
+            }
+
+            Task::Branch {
+                then_branch,
+                else_branch,
+            } => {
+                let condition = self.pop();
+                let branch = if is_truthy(condition.get(&self.locals)) {
+                    then_branch
+                } else {
+                    else_branch
+                };
+                self.tasks.push(Task::Eval(branch));
+                return Ok(());
+            }
+
+            // Logical operators short-circuit: the right operand is only
+            // evaluated when the left one does not decide the result
+            Task::Logical { op, right } => {
+                let left = is_truthy(self.pop().get(&self.locals));
+                if left == (op == BinaryOp::Or) {
+                    Value::Boolean(left)
+                } else {
+                    return self.children(Task::Truthy, iter::once(right));
+                }
+            }
+
+            Task::Truthy => Value::Boolean(is_truthy(self.pop().get(&self.locals))),
+
+            Task::Binary(op) => {
+                let right = self.pop();
+                let left = self.pop();
+                eval_binary_op(op, left.get(&self.locals), right.get(&self.locals))?
+            }
+
+            Task::Add(operands) => {
+                let right = self.pop();
+                let sum = self.pop().into_value(&self.locals);
+                let sum = add_owned(sum, right.get(&self.locals))?;
+                if let [_, rest @ ..] = operands {
+                    if let Some(next) = rest.first() {
+                        self.operands.push(Operand::Owned(sum));
+                        return self.children(Task::Add(rest), iter::once(next));
+                    }
+                }
+                sum
+            }
+
+            Task::Unary(op) => eval_unary_op(op, self.pop().get(&self.locals))?,
+
+            // Fused collection calls, copying only the final result
+            Task::Pipeline { stages, sink } => {
+                pipeline::run(self.pop().get(&self.locals), stages, sink)?
+            }
+
+            // Membership in a literal array, with the same result as `contains`
+            Task::Member(set) => Value::Boolean(set.contains(self.pop().get(&self.locals))),
+
+            Task::Exit(site) => {
+                self.recorder
+                    .expect("probes are timed with a recorder")
+                    .exit(site);
+                return Ok(());
+            }
+        };
+        self.operands.push(Operand::Owned(value));
+        Ok(())
+    }
+
+    /// Push a task that continues an unfinished expression
+    fn enter(&mut self, task: Task<'a>) {
+        self.depth += 1;
+        self.tasks.push(task);
+    }
+
+    /// Resolve a variable path against the locals, then the context
+    ///
+    /// A missing simple variable is an error; any other missing path is nil.
+    fn variable(&self, path: &'a [String]) -> Result<Operand<'a>, EvalError> {
+        let Some((root, rest)) = path.split_first() else {
+            return Ok(Operand::Borrowed(&NIL));
+        };
+
+        if let Some(slot) = self
+            .locals
+            .iter()
+            .rposition(|(name, _)| *name == root.as_str())
+        {
+            return Ok(match &self.locals[slot].1 {
+                Operand::Borrowed(value) => Operand::Borrowed(navigate(value, rest)),
+                Operand::Owned(_) => Operand::Local { slot, path: rest },
+                Operand::Local { slot, path } if rest.is_empty() => {
+                    Operand::Local { slot: *slot, path }
+                }
+                // A path into a path into a local; rare enough to copy
+                alias => Operand::Owned(navigate(alias.get(&self.locals), rest).clone()),
+            });
+        }
+
+        match self.context.lookup(root) {
+            Some(value) => Ok(Operand::Borrowed(navigate(value, rest))),
+            None if rest.is_empty() => Err(EvalError::VariableNotFound(root.clone())),
+            None => Ok(Operand::Borrowed(&NIL)),
+        }
+    }
+
+    fn pop(&mut self) -> Operand<'a> {
+        self.operands
+            .pop()
+            .expect("operand stack underflow: malformed program")
+    }
+
+    /// Close the probes of an evaluation that failed, innermost first, so
+    /// the recorder's timings stay balanced
+    fn unwind(&mut self) {
+        if let Some(recorder) = self.recorder {
+            for task in self.tasks.drain(..).rev() {
+                if let Task::Exit(site) = task {
+                    recorder.exit(site);
+                }
+            }
+        }
+    }
+}
+
+/// Follow a path of dictionary keys, or nil if it leaves the dictionaries
+fn navigate<'v>(mut value: &'v Value, path: &[String]) -> &'v Value {
+    for key in path {
+        value = match value {
+            Value::Dictionary(map) => map.get(key).unwrap_or(&NIL),
+            _ => return &NIL,
+        };
+    }
+    value
+}
+
+/// `navigate` on an owned value, moving the result out
+fn take_path(mut value: Value, path: &[String]) -> Value {
+    for key in path {
+        value = match value {
+            Value::Dictionary(mut map) => map.remove(key).unwrap_or(Value::Nil),
+            _ => return Value::Nil,
+        };
+    }
+    value
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, eval_node, evaluate_with_limits, EvalLimits, ProfiledProgram};
+    use std::sync::atomic::AtomicBool;
+    use std::sync::Arc;
+    use std::thread;
+
+    fn data() -> HashMap<String, Value> {
+        let item = |price: f64| {
+            Value::Dictionary(HashMap::from([("price".to_string(), Value::Number(price))]))
+        };
+        HashMap::from([
+            ("x".to_string(), Value::Number(3.0)),
+            ("name".to_string(), Value::String("ada".to_string())),
+            (
+                "applicant".to_string(),
+                Value::Dictionary(HashMap::from([(
+                    "vehicle".to_string(),
+                    Value::Dictionary(HashMap::from([(
+                        "value".to_string(),
+                        Value::Number(20000.0),
+                    )])),
+                )])),
+            ),
+            (
+                "items".to_string(),
+                Value::Array(vec![item(5.0), item(2.0), item(9.0)]),
+            ),
+        ])
+    }
+
+    /// Evaluate `source` with the machine from the root and with the
+    /// recursive walk, which must agree
+    fn both(source: &str) -> Result<Value, EvalError> {
+        let program = compile(source, &["high", "low"]).unwrap();
+        let data = data();
+        let context = Context::new(&data);
+        let machine = eval_node_ref(&program.resolved, &context, 0).map(Cow::into_owned);
+        let recursive = eval_node(&program.resolved, &context);
+        match (&machine, &recursive) {
+            (Ok(a), Ok(b)) => assert_eq!(a, b, "{}", source),
+            (Err(a), Err(b)) => assert_eq!(a.to_string(), b.to_string(), "{}", source),
+            _ => panic!("{}: {:?} != {:?}", source, machine, recursive),
+        }
+        machine
+    }
+
+    #[test]
+    fn test_machine_matches_recursive_evaluation() {
+        let sources = [
+            "x",
+            "x + 1 * x - 2",
+            "name + \": \" + x + \" of \" + (x + 1) + [x]",
+            "x + x + x + name + x",
+            "x + x + name + missing",
+            "x + nil + missing",
+            "[x, x * 2, name, [1, x]]",
+            r#"{"a": x, "b": {"c": name}, "d": 1}"#,
+            "if x > 2 then :high else :low end",
+            "if x > 5 then 1 else if x > 2 then 2 else 3 end end",
+            "x > 5 and missing",
+            "x > 2 or missing",
+            "x > 2 and not (x > 5)",
+            "-x",
+            "date_now() != nil",
+            "upcase(name)",
+            "power(x, 2)",
+            "replace(name, 'a', 'o')",
+            "ipmt(0.01, 1, 12, x * 1000, 0)",
+            "if_then_else(x > 1, name, 0)",
+            "items | map('price') | sort | first",
+            "contains([1, 2, 3], x)",
+            "contains(['bob', 'ada'], name)",
+            "applicant.vehicle.value / 2",
+            "applicant.missing.value",
+            "let v = applicant.vehicle in v.value + v.value",
+            // Owned locals, borrowed by their uses and moved out at the end
+            r#"let d = {"a": {"b": x + 1}} in d.a.b * 2"#,
+            r#"let d = {"a": {"b": x + 1}} in d.a"#,
+            r#"let d = {"a": {"b": x + 1}} in let e = d.a in e.b + e.missing.c"#,
+            "let x = x * 2 in let y = x + 1 in [x, y, x * y]",
+            "let xs = items | map('price') in if size(xs) > 2 then xs | sum else 0 end",
+            // Errors
+            "missing",
+            "x + name",
+            "let a = [1] in a + 1",
+            "upcase(x)",
+        ];
+        for source in sources {
+            let _ = both(source);
+        }
+        assert_eq!(both("let a = x + 1 in a * a").unwrap(), Value::Number(16.0));
+    }
+
+    /// A program nested `depth` levels deep: `x + (x + (... + x))`
+    fn nested(depth: usize) -> Node {
+        let mut node = Node::Variable(vec!["x".to_string()]);
+        for _ in 0..depth {
+            node = Node::Binary {
+                op: BinaryOp::Add,
+                left: Box::new(Node::Variable(vec!["x".to_string()])),
+                right: Box::new(node),
+            };
+        }
+        node
+    }
+
+    #[test]
+    fn test_deep_programs_on_a_small_stack() {
+        let node = nested(10_000);
+        let data = HashMap::from([("x".to_string(), Value::Number(1.0))]);
+        let result = thread::scope(|scope| {
+            thread::Builder::new()
+                .stack_size(512 * 1024)
+                .spawn_scoped(scope, || eval_node(&node, &Context::new(&data)))
+                .unwrap()
+                .join()
+                .unwrap()
+        });
+        assert_eq!(result.unwrap(), Value::Number(10_001.0));
+    }
+
+    #[test]
+    fn test_limits() {
+        let data = data();
+        let limits = |max_depth, max_steps| EvalLimits {
+            max_depth,
+            max_steps,
+            cancel: None,
+        };
+
+        // Each let holds a level while its body is evaluated, so the
+        // operands of `b * b` and `c + c` are four levels deep
+        let program = compile(
+            "let a = x + 1 in let b = a * a in let c = b * b in c + c",
+            &[],
+        )
+        .unwrap();
+        assert!(evaluate_with_limits(&program, &data, &limits(Some(4), None)).is_ok());
+        assert!(matches!(
+            evaluate_with_limits(&program, &data, &limits(Some(3), None)),
+            Err(EvalError::DepthLimitExceeded(3))
+        ));
+
+        // A chain of `+` is charged as its three operators, and holds a
+        // single level however long it is
+        let program = compile("name + x + x + [x]", &[]).unwrap();
+        assert!(matches!(program.resolved, Node::Add(_)));
+        assert!(evaluate_with_limits(&program, &data, &limits(Some(2), Some(8))).is_ok());
+        assert!(matches!(
+            evaluate_with_limits(&program, &data, &limits(None, Some(7))),
+            Err(EvalError::StepLimitExceeded(7))
+        ));
+        assert!(matches!(
+            evaluate_with_limits(&program, &data, &limits(Some(1), None)),
+            Err(EvalError::DepthLimitExceeded(1))
+        ));
+
+        // Only the branch taken is charged: `if`, `>`, `x`, `2` and `x`
+        let program = compile("if x > 2 then x else [x, x, x, x] end", &[]).unwrap();
+        assert!(evaluate_with_limits(&program, &data, &limits(None, Some(5))).is_ok());
+
+        // Deeper than NATIVE_DEPTH
+        let node = nested(1_000);
+        for (max_depth, max_steps, expected) in [
+            (Some(1_000), None, None),
+            (Some(999), None, Some("depth limit of 999")),
+            (None, Some(2_001), None),
+            (None, Some(2_000), Some("step limit of 2000")),
+        ] {
+            let limits = limits(max_depth, max_steps);
+            let budget = Budget::new(&limits);
+            let context = Context {
+                budget: Some(&budget),
+                ..Context::new(&data)
+            };
+            let result = eval_node_ref(&node, &context, 0).map(Cow::into_owned);
+            match expected {
+                None => assert_eq!(result.unwrap(), Value::Number(3003.0)),
+                Some(message) => assert!(result.unwrap_err().to_string().contains(message)),
+            }
+        }
+    }
+
+    #[test]
+    fn test_cancellation() {
+        let program = compile("x + 1", &[]).unwrap();
+        let cancel = Arc::new(AtomicBool::new(true));
+        let limits = EvalLimits {
+            cancel: Some(cancel.clone()),
+            ..EvalLimits::default()
+        };
+        assert!(matches!(
+            evaluate_with_limits(&program, &data(), &limits),
+            Err(EvalError::Cancelled)
+        ));
+        cancel.store(false, std::sync::atomic::Ordering::Relaxed);
+        assert_eq!(
+            evaluate_with_limits(&program, &data(), &limits).unwrap(),
+            Value::Number(4.0)
+        );
+    }
+
+    #[test]
+    fn test_failed_deep_evaluation_closes_its_probes() {
+        // Deep enough that the innermost probes are timed by the machine
+        let source = format!("{}missing{}", "(1 + ".repeat(80), ")".repeat(80));
+        let program = ProfiledProgram::compile(&source, &[]).unwrap();
+        assert!(program.evaluate(&HashMap::new()).is_err());
+        let profile = program.profile();
+        let sums: Vec<_> = profile.sites().iter().filter(|s| s.label == "+").collect();
+        assert_eq!(sums.len(), 80);
+        assert!(sums.iter().all(|site| site.calls == 1));
+    }
+}
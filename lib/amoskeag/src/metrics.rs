@@ -0,0 +1,1156 @@
+//! Built-in metrics
+//!
+//! With the `metrics` feature, the crate measures itself as it runs: the
+//! time each `compile` takes, the time each evaluation takes on each
+//! backend and for each named program, the heap allocations evaluations make,
+//! and how often each standard library function is called and for how
+//! long. [`snapshot`] adds it all up at any moment, as a
+//! [`MetricsSnapshot`] a host can print, serve as JSON, or expose to
+//! Prometheus.
+//!
+//! Recording takes no lock. Each thread records into a shard of its own,
+//! atomic counters and histograms that only it writes, with plain loads
+//! and stores rather than read-modify-write instructions, so threads never
+//! contend for a cache line; when a thread exits, its shard is added to
+//! the totals of exited threads. A snapshot reads every live shard and
+//! those totals. Only the counters of a program are shared, by the threads
+//! that evaluate it.
+//!
+//! Reading the clock is most of the cost of a measurement, so while every
+//! evaluation and function call is counted, only one call in
+//! `FUNCTION_SAMPLE` of each function on each thread is timed, and the
+//! time spent in a function is estimated from those calls.
+//!
+//! Latencies are kept in log-linear histograms, in the manner of HDR
+//! histograms: eight buckets for each power of two nanoseconds, from a
+//! nanosecond to about eighteen minutes, so a histogram takes a fixed
+//! 2.4 KB and any quantile read from it is within 7% of the true value.
+//!
+//! Allocations are counted only when [`CountingAllocator`] is the global
+//! allocator.
+//!
+//! Without the feature, every hook here is an empty inline function and
+//! programs carry no counters, so nothing is timed or stored.
+//!
+//! [`CountingAllocator`]: crate::CountingAllocator
+
+use crate::functions::FUNCTIONS;
+use crate::EvalError;
+use amoskeag_stdlib_operators::Value;
+use std::borrow::Cow;
+
+#[cfg(feature = "metrics")]
+use crate::profile;
+#[cfg(feature = "metrics")]
+use std::collections::BTreeMap;
+#[cfg(feature = "metrics")]
+use std::fmt::{self, Write};
+#[cfg(feature = "metrics")]
+use std::sync::atomic::{AtomicU64, Ordering};
+#[cfg(feature = "metrics")]
+use std::sync::{Arc, Mutex, MutexGuard, OnceLock};
+#[cfg(feature = "metrics")]
+use std::time::{Duration, Instant};
+
+/// The backends whose evaluations are timed
+#[derive(Debug, Clone, Copy)]
+pub(crate) enum BackendSlot {
+    Interpreter,
+    Bytecode,
+    Columnar,
+    DirectInterpreter,
+}
+
+#[cfg(feature = "metrics")]
+impl BackendSlot {
+    const ALL: [BackendSlot; 4] = [
+        BackendSlot::Interpreter,
+        BackendSlot::Bytecode,
+        BackendSlot::Columnar,
+        BackendSlot::DirectInterpreter,
+    ];
+
+    /// The `Backend::name` of the backend
+    fn name(self) -> &'static str {
+        match self {
+            BackendSlot::Interpreter => "interpreter",
+            BackendSlot::Bytecode => "bytecode",
+            BackendSlot::Columnar => "columnar",
+            BackendSlot::DirectInterpreter => "direct-interpreter",
+        }
+    }
+}
+
+/// The counters a compiled program records its evaluations into
+///
+/// A program has counters of its own only once it is named, so compiling
+/// one touches no shared state, and the registry only ever holds one entry
+/// per name the host chooses. The name is set at most once, through a shared
+/// reference, so a program can be named after it is cached or handed to
+/// other threads.
+#[cfg(feature = "metrics")]
+pub(crate) struct ProgramHandle(OnceLock<Arc<ProgramStats>>);
+
+/// The counters a compiled program records its evaluations into
+#[cfg(not(feature = "metrics"))]
+#[derive(Debug)]
+pub(crate) struct ProgramHandle;
+
+#[cfg(feature = "metrics")]
+impl fmt::Debug for ProgramHandle {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let name = self.0.get().map(|stats| &stats.name);
+        f.debug_tuple("ProgramHandle").field(&name).finish()
+    }
+}
+
+/// The counters of a program that hasn't been named, which are none
+#[cfg(feature = "metrics")]
+pub(crate) fn program_unnamed() -> ProgramHandle {
+    ProgramHandle(OnceLock::new())
+}
+
+#[cfg(feature = "metrics")]
+impl ProgramHandle {
+    /// Count evaluations with the programs named `name`, unless the program
+    /// already has a name
+    pub(crate) fn set_name(&self, name: &str) {
+        if self.0.get().is_some() {
+            return;
+        }
+        let stats = {
+            let mut programs = lock(&PROGRAMS);
+            let stats = programs
+                .entry(name.to_string())
+                .or_insert_with(|| Arc::new(ProgramStats::new(name)));
+            Arc::clone(stats)
+        };
+        // A name set by another thread meanwhile wins
+        let _ = self.0.set(stats);
+    }
+}
+
+#[cfg(not(feature = "metrics"))]
+#[inline(always)]
+pub(crate) fn program_unnamed() -> ProgramHandle {
+    ProgramHandle
+}
+
+#[cfg(not(feature = "metrics"))]
+impl ProgramHandle {
+    #[inline(always)]
+    pub(crate) fn set_name(&self, _name: &str) {}
+}
+
+/// Run `compile`, timing it as a compilation
+#[cfg(feature = "metrics")]
+pub(crate) fn compilation<T, E>(compile: impl FnOnce() -> Result<T, E>) -> Result<T, E> {
+    let start = Instant::now();
+    let result = compile();
+    let nanos = nanos_since(start);
+    let failed = result.is_err();
+    with_shard(|shard| shard.compile.record(nanos, failed, Writers::One));
+    result
+}
+
+/// Run `evaluate`, timing it as an evaluation on `backend`, and of
+/// `program` if given
+#[cfg(feature = "metrics")]
+pub(crate) fn evaluation<T, E>(
+    program: Option<&ProgramHandle>,
+    backend: BackendSlot,
+    evaluate: impl FnOnce() -> Result<T, E>,
+) -> Result<T, E> {
+    let allocated = profile::allocations();
+    let start = Instant::now();
+    let result = evaluate();
+    let nanos = nanos_since(start);
+    let allocations = profile::allocations().wrapping_sub(allocated);
+    let failed = result.is_err();
+
+    with_shard(|shard| {
+        shard.backends[backend as usize].record(nanos, failed, Writers::One);
+        Writers::One.add(&shard.allocations, allocations);
+    });
+    if let Some(stats) = program.and_then(|program| program.0.get()) {
+        stats.latency.record(nanos, failed, Writers::Many);
+        Writers::Many.add(&stats.allocations, allocations);
+    }
+    result
+}
+
+/// One call in this many of each function on each thread is timed; a
+/// power of two
+#[cfg(feature = "metrics")]
+const FUNCTION_SAMPLE: u64 = 16;
+
+/// Call the standard library function `func`, counting the call and
+/// timing it if it is sampled
+#[cfg(feature = "metrics")]
+pub(crate) fn call_function(func: usize, args: &[Cow<'_, Value>]) -> Result<Value, EvalError> {
+    let call = FUNCTIONS[func].call;
+    let sampled = SHARD
+        .try_with(|local| {
+            let calls = &local.0.functions[func].calls;
+            let previous = load(calls);
+            Writers::One.add(calls, 1);
+            previous & (FUNCTION_SAMPLE - 1) == 0
+        })
+        .unwrap_or(false);
+    if !sampled {
+        return call(args);
+    }
+
+    let start = Instant::now();
+    let result = call(args);
+    let nanos = nanos_since(start);
+    with_shard(|shard| {
+        let counters = &shard.functions[func];
+        Writers::One.add(&counters.timed_calls, 1);
+        Writers::One.add(&counters.timed_nanos, nanos);
+    });
+    result
+}
+
+#[cfg(not(feature = "metrics"))]
+#[inline(always)]
+pub(crate) fn compilation<T, E>(compile: impl FnOnce() -> Result<T, E>) -> Result<T, E> {
+    compile()
+}
+
+#[cfg(not(feature = "metrics"))]
+#[inline(always)]
+pub(crate) fn evaluation<T, E>(
+    _program: Option<&ProgramHandle>,
+    _backend: BackendSlot,
+    evaluate: impl FnOnce() -> Result<T, E>,
+) -> Result<T, E> {
+    evaluate()
+}
+
+#[cfg(not(feature = "metrics"))]
+#[inline(always)]
+pub(crate) fn call_function(func: usize, args: &[Cow<'_, Value>]) -> Result<Value, EvalError> {
+    (FUNCTIONS[func].call)(args)
+}
+
+/// Read every counter recorded so far
+///
+/// Counters only grow, so the difference of two snapshots is what
+/// happened between them.
+#[cfg(feature = "metrics")]
+pub fn snapshot() -> MetricsSnapshot {
+    let mut snapshot = MetricsSnapshot::default();
+    let mut functions = vec![FunctionTotals::default(); FUNCTIONS.len()];
+    {
+        // Exiting threads retire their shards under this lock, so each
+        // shard is read exactly once
+        let shards = lock(&SHARDS);
+        retired().add_to(&mut snapshot, &mut functions);
+        for shard in shards.iter() {
+            shard.add_to(&mut snapshot, &mut functions);
+        }
+    }
+    snapshot
+        .backends
+        .retain(|backend| backend.latency.count() > 0);
+    for backend in &snapshot.backends {
+        snapshot.evaluate.merge(&backend.latency);
+        snapshot.evaluate_errors += backend.errors;
+    }
+    snapshot.functions = FUNCTIONS
+        .iter()
+        .zip(functions)
+        .filter(|(_, totals)| totals.calls > 0)
+        .map(|(function, totals)| FunctionMetrics {
+            name: function.name,
+            calls: totals.calls,
+            time: totals.estimated_time(),
+        })
+        .collect();
+
+    let counts_allocations = profile::counts_allocations();
+    if !counts_allocations {
+        snapshot.allocations = None;
+    }
+    snapshot.programs = lock(&PROGRAMS)
+        .values()
+        .map(|stats| ProgramMetrics {
+            name: stats.name.clone(),
+            latency: stats.latency.histogram.read(),
+            errors: load(&stats.latency.errors),
+            allocations: counts_allocations.then(|| load(&stats.allocations)),
+        })
+        .filter(|program| program.latency.count() > 0)
+        .collect();
+    snapshot
+}
+
+/// Every counter recorded up to a moment, as returned by [`snapshot`]
+#[cfg(feature = "metrics")]
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct MetricsSnapshot {
+    /// Time spent in each call to `compile`
+    pub compile: LatencyHistogram,
+    /// Calls to `compile` that failed
+    pub compile_errors: u64,
+    /// Time spent in each evaluation, on every backend
+    pub evaluate: LatencyHistogram,
+    /// Evaluations that failed, on every backend
+    pub evaluate_errors: u64,
+    /// Evaluations by backend, for each backend that has evaluated anything
+    pub backends: Vec<BackendMetrics>,
+    /// Evaluations by program, for each program named with
+    /// `CompiledProgram::set_metrics_name` and evaluated through the
+    /// interpreter, sorted by name
+    pub programs: Vec<ProgramMetrics>,
+    /// Calls of each standard library function that has been called
+    pub functions: Vec<FunctionMetrics>,
+    /// Heap allocations made by evaluations, or `None` unless
+    /// `CountingAllocator` is the global allocator
+    pub allocations: Option<u64>,
+}
+
+/// Evaluations on one backend
+#[cfg(feature = "metrics")]
+#[derive(Debug, Clone, PartialEq)]
+pub struct BackendMetrics {
+    /// The backend's `Backend::name`
+    pub name: &'static str,
+    /// Time spent in each evaluation
+    pub latency: LatencyHistogram,
+    /// Evaluations that failed
+    pub errors: u64,
+}
+
+/// Evaluations of one program
+#[cfg(feature = "metrics")]
+#[derive(Debug, Clone, PartialEq)]
+pub struct ProgramMetrics {
+    /// The name given with `CompiledProgram::set_metrics_name`
+    pub name: String,
+    /// Time spent in each evaluation
+    pub latency: LatencyHistogram,
+    /// Evaluations that failed
+    pub errors: u64,
+    /// Heap allocations made by evaluations, or `None` unless
+    /// `CountingAllocator` is the global allocator
+    pub allocations: Option<u64>,
+}
+
+/// Calls of one standard library function
+#[cfg(feature = "metrics")]
+#[derive(Debug, Clone, PartialEq)]
+pub struct FunctionMetrics {
+    /// The function's name
+    pub name: &'static str,
+    /// Number of calls
+    pub calls: u64,
+    /// Time spent in the function itself, its arguments already evaluated,
+    /// estimated from the calls that were timed
+    pub time: Duration,
+}
+
+#[cfg(feature = "metrics")]
+impl MetricsSnapshot {
+    /// The snapshot as JSON, with times in nanoseconds
+    ///
+    /// Each histogram is summarized by its count, sum, maximum, and 50th,
+    /// 90th and 99th percentiles.
+    pub fn to_json(&self) -> serde_json::Value {
+        use serde_json::json;
+
+        json!({
+            "compile": self.compile.to_json(),
+            "compile_errors": self.compile_errors,
+            "evaluate": self.evaluate.to_json(),
+            "evaluate_errors": self.evaluate_errors,
+            "backends": self.backends.iter().map(|backend| json!({
+                "name": backend.name,
+                "latency": backend.latency.to_json(),
+                "errors": backend.errors,
+            })).collect::<Vec<_>>(),
+            "programs": self.programs.iter().map(|program| json!({
+                "name": program.name,
+                "latency": program.latency.to_json(),
+                "errors": program.errors,
+                "allocations": program.allocations,
+            })).collect::<Vec<_>>(),
+            "functions": self.functions.iter().map(|function| json!({
+                "name": function.name,
+                "calls": function.calls,
+                "time_ns": duration_nanos(function.time),
+            })).collect::<Vec<_>>(),
+            "allocations": self.allocations,
+        })
+    }
+
+    /// The snapshot in the Prometheus text exposition format
+    ///
+    /// Latencies are exported as summaries in seconds, with the 50th, 90th
+    /// and 99th percentiles, and counts as counters, all prefixed with
+    /// `amoskeag_`.
+    pub fn to_prometheus(&self) -> String {
+        let mut out = String::new();
+
+        summary_header(&mut out, "compile_seconds", "Time spent compiling programs");
+        self.compile.write_summary(&mut out, "compile_seconds", "");
+        counter_header(&mut out, "compile_errors_total", "Compilations that failed");
+        sample(&mut out, "compile_errors_total", "", self.compile_errors);
+
+        summary_header(
+            &mut out,
+            "evaluate_seconds",
+            "Time spent evaluating, by backend",
+        );
+        for backend in &self.backends {
+            let labels = label("backend", backend.name);
+            backend
+                .latency
+                .write_summary(&mut out, "evaluate_seconds", &labels);
+        }
+        counter_header(
+            &mut out,
+            "evaluate_errors_total",
+            "Evaluations that failed, by backend",
+        );
+        for backend in &self.backends {
+            let labels = label("backend", backend.name);
+            sample(&mut out, "evaluate_errors_total", &labels, backend.errors);
+        }
+
+        summary_header(
+            &mut out,
+            "program_evaluate_seconds",
+            "Time spent evaluating, by program",
+        );
+        for program in &self.programs {
+            let labels = label("program", &program.name);
+            program
+                .latency
+                .write_summary(&mut out, "program_evaluate_seconds", &labels);
+        }
+        counter_header(
+            &mut out,
+            "program_evaluate_errors_total",
+            "Evaluations that failed, by program",
+        );
+        for program in &self.programs {
+            let labels = label("program", &program.name);
+            sample(
+                &mut out,
+                "program_evaluate_errors_total",
+                &labels,
+                program.errors,
+            );
+        }
+
+        counter_header(
+            &mut out,
+            "function_calls_total",
+            "Calls of standard library functions",
+        );
+        for function in &self.functions {
+            let labels = label("function", function.name);
+            sample(&mut out, "function_calls_total", &labels, function.calls);
+        }
+        counter_header(
+            &mut out,
+            "function_seconds_total",
+            "Time spent in standard library functions",
+        );
+        for function in &self.functions {
+            let labels = label("function", function.name);
+            let seconds = function.time.as_secs_f64();
+            sample(&mut out, "function_seconds_total", &labels, seconds);
+        }
+
+        if let Some(allocations) = self.allocations {
+            counter_header(
+                &mut out,
+                "allocations_total",
+                "Heap allocations made by evaluations",
+            );
+            sample(&mut out, "allocations_total", "", allocations);
+            counter_header(
+                &mut out,
+                "program_allocations_total",
+                "Heap allocations made by evaluations, by program",
+            );
+            for program in &self.programs {
+                let labels = label("program", &program.name);
+                let allocations = program.allocations.unwrap_or(0);
+                sample(&mut out, "program_allocations_total", &labels, allocations);
+            }
+        }
+        out
+    }
+}
+
+/// Latencies recorded into a log-linear histogram
+#[cfg(feature = "metrics")]
+#[derive(Debug, Clone, PartialEq)]
+pub struct LatencyHistogram {
+    counts: Vec<u64>,
+    sum_ns: u64,
+    max_ns: u64,
+}
+
+#[cfg(feature = "metrics")]
+impl Default for LatencyHistogram {
+    fn default() -> Self {
+        LatencyHistogram {
+            counts: vec![0; BUCKETS],
+            sum_ns: 0,
+            max_ns: 0,
+        }
+    }
+}
+
+#[cfg(feature = "metrics")]
+impl LatencyHistogram {
+    /// Number of latencies recorded
+    pub fn count(&self) -> u64 {
+        self.counts.iter().sum()
+    }
+
+    /// Sum of the latencies recorded
+    pub fn sum(&self) -> Duration {
+        Duration::from_nanos(self.sum_ns)
+    }
+
+    /// Longest latency recorded
+    pub fn max(&self) -> Duration {
+        Duration::from_nanos(self.max_ns)
+    }
+
+    /// Mean of the latencies recorded, or zero if there are none
+    pub fn mean(&self) -> Duration {
+        match self.count() {
+            0 => Duration::ZERO,
+            count => Duration::from_nanos(self.sum_ns / count),
+        }
+    }
+
+    /// The latency at quantile `q`, from 0 to 1, or zero if none are
+    /// recorded
+    ///
+    /// It is the middle of the bucket holding that latency, so it is
+    /// within 7% of the true value, and never more than [`max`].
+    ///
+    /// [`max`]: LatencyHistogram::max
+    pub fn quantile(&self, q: f64) -> Duration {
+        let count = self.count();
+        if count == 0 {
+            return Duration::ZERO;
+        }
+        let rank = ((q.clamp(0.0, 1.0) * count as f64).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (bucket, &n) in self.counts.iter().enumerate() {
+            seen += n;
+            if seen >= rank {
+                let (low, high) = bucket_range(bucket);
+                let middle = low + (high - low - 1) / 2;
+                return Duration::from_nanos(middle.min(self.max_ns));
+            }
+        }
+        self.max()
+    }
+
+    /// The buckets holding any latency, as the range of latencies each
+    /// covers, from its lower bound up to its exclusive upper bound, and
+    /// the number of latencies in it
+    pub fn buckets(&self) -> impl Iterator<Item = (Duration, Duration, u64)> + '_ {
+        self.counts
+            .iter()
+            .enumerate()
+            .filter(|(_, &n)| n > 0)
+            .map(|(bucket, &n)| {
+                let (low, high) = bucket_range(bucket);
+                (Duration::from_nanos(low), Duration::from_nanos(high), n)
+            })
+    }
+
+    fn merge(&mut self, other: &LatencyHistogram) {
+        for (count, n) in self.counts.iter_mut().zip(&other.counts) {
+            *count += n;
+        }
+        self.sum_ns += other.sum_ns;
+        self.max_ns = self.max_ns.max(other.max_ns);
+    }
+
+    fn to_json(&self) -> serde_json::Value {
+        serde_json::json!({
+            "count": self.count(),
+            "sum_ns": self.sum_ns,
+            "max_ns": self.max_ns,
+            "p50_ns": duration_nanos(self.quantile(0.5)),
+            "p90_ns": duration_nanos(self.quantile(0.9)),
+            "p99_ns": duration_nanos(self.quantile(0.99)),
+        })
+    }
+
+    fn write_summary(&self, out: &mut String, name: &str, labels: &str) {
+        let separator = if labels.is_empty() { "" } else { "," };
+        for q in QUANTILES {
+            let _ = writeln!(
+                out,
+                "amoskeag_{}{{{}{}quantile=\"{}\"}} {}",
+                name,
+                labels,
+                separator,
+                q,
+                self.quantile(q).as_secs_f64()
+            );
+        }
+        sample(
+            out,
+            &format!("{}_sum", name),
+            labels,
+            self.sum().as_secs_f64(),
+        );
+        sample(out, &format!("{}_count", name), labels, self.count());
+    }
+}
+
+/// The quantiles reported for each histogram
+#[cfg(feature = "metrics")]
+const QUANTILES: [f64; 3] = [0.5, 0.9, 0.99];
+
+#[cfg(feature = "metrics")]
+fn summary_header(out: &mut String, name: &str, help: &str) {
+    let _ = writeln!(out, "# HELP amoskeag_{} {}", name, help);
+    let _ = writeln!(out, "# TYPE amoskeag_{} summary", name);
+}
+
+#[cfg(feature = "metrics")]
+fn counter_header(out: &mut String, name: &str, help: &str) {
+    let _ = writeln!(out, "# HELP amoskeag_{} {}", name, help);
+    let _ = writeln!(out, "# TYPE amoskeag_{} counter", name);
+}
+
+#[cfg(feature = "metrics")]
+fn sample(out: &mut String, name: &str, labels: &str, value: impl fmt::Display) {
+    if labels.is_empty() {
+        let _ = writeln!(out, "amoskeag_{} {}", name, value);
+    } else {
+        let _ = writeln!(out, "amoskeag_{}{{{}}} {}", name, labels, value);
+    }
+}
+
+/// A Prometheus label, its value escaped
+#[cfg(feature = "metrics")]
+fn label(name: &str, value: &str) -> String {
+    let value = value
+        .replace('\\', "\\\\")
+        .replace('"', "\\\"")
+        .replace('\n', "\\n");
+    format!("{}=\"{}\"", name, value)
+}
+
+#[cfg(feature = "metrics")]
+fn duration_nanos(duration: Duration) -> u64 {
+    u64::try_from(duration.as_nanos()).unwrap_or(u64::MAX)
+}
+
+/// Each power of two is split into `1 << SUB_BUCKET_BITS` buckets
+#[cfg(feature = "metrics")]
+const SUB_BUCKET_BITS: u32 = 3;
+
+#[cfg(feature = "metrics")]
+const SUB_BUCKETS: usize = 1 << SUB_BUCKET_BITS;
+
+/// Latencies of `1 << MAX_EXPONENT` nanoseconds or more share the last
+/// bucket
+#[cfg(feature = "metrics")]
+const MAX_EXPONENT: u32 = 40;
+
+#[cfg(feature = "metrics")]
+const BUCKETS: usize = SUB_BUCKETS * (MAX_EXPONENT - SUB_BUCKET_BITS + 1) as usize;
+
+/// The bucket of a latency of `nanos`
+///
+/// The first `SUB_BUCKETS` buckets hold one value each. After them, each
+/// power of two has `SUB_BUCKETS` buckets, told apart by the bits after
+/// the leading one.
+#[cfg(feature = "metrics")]
+fn bucket(nanos: u64) -> usize {
+    if nanos < SUB_BUCKETS as u64 {
+        return nanos as usize;
+    }
+    let exponent = 63 - nanos.leading_zeros();
+    if exponent >= MAX_EXPONENT {
+        return BUCKETS - 1;
+    }
+    let shift = exponent - SUB_BUCKET_BITS;
+    let mantissa = (nanos >> shift) as usize & (SUB_BUCKETS - 1);
+    (shift as usize + 1) * SUB_BUCKETS + mantissa
+}
+
+/// The latencies in `bucket`, from the lower bound to the exclusive upper
+/// bound
+#[cfg(feature = "metrics")]
+fn bucket_range(bucket: usize) -> (u64, u64) {
+    let group = bucket / SUB_BUCKETS;
+    let mantissa = (bucket % SUB_BUCKETS) as u64;
+    if group == 0 {
+        return (mantissa, mantissa + 1);
+    }
+    let width = 1u64 << (group - 1);
+    let low = (SUB_BUCKETS as u64 + mantissa) * width;
+    (low, low + width)
+}
+
+/// A histogram of atomics
+#[cfg(feature = "metrics")]
+struct Histogram {
+    buckets: [AtomicU64; BUCKETS],
+    sum_ns: AtomicU64,
+    max_ns: AtomicU64,
+}
+
+#[cfg(feature = "metrics")]
+impl Histogram {
+    fn new() -> Self {
+        Histogram {
+            buckets: std::array::from_fn(|_| AtomicU64::new(0)),
+            sum_ns: AtomicU64::new(0),
+            max_ns: AtomicU64::new(0),
+        }
+    }
+
+    fn record(&self, nanos: u64, writers: Writers) {
+        writers.add(&self.buckets[bucket(nanos)], 1);
+        writers.add(&self.sum_ns, nanos);
+        writers.max(&self.max_ns, nanos);
+    }
+
+    fn read(&self) -> LatencyHistogram {
+        LatencyHistogram {
+            counts: self.buckets.iter().map(load).collect(),
+            sum_ns: load(&self.sum_ns),
+            max_ns: load(&self.max_ns),
+        }
+    }
+
+    fn retire_into(&self, into: &Histogram) {
+        for (total, count) in into.buckets.iter().zip(&self.buckets) {
+            add(total, load(count));
+        }
+        add(&into.sum_ns, load(&self.sum_ns));
+        into.max_ns.fetch_max(load(&self.max_ns), Ordering::Relaxed);
+    }
+}
+
+/// Latencies of an operation, and how many times it failed
+#[cfg(feature = "metrics")]
+struct Latency {
+    histogram: Histogram,
+    errors: AtomicU64,
+}
+
+#[cfg(feature = "metrics")]
+impl Latency {
+    fn new() -> Self {
+        Latency {
+            histogram: Histogram::new(),
+            errors: AtomicU64::new(0),
+        }
+    }
+
+    fn record(&self, nanos: u64, failed: bool, writers: Writers) {
+        self.histogram.record(nanos, writers);
+        if failed {
+            writers.add(&self.errors, 1);
+        }
+    }
+
+    fn retire_into(&self, into: &Latency) {
+        self.histogram.retire_into(&into.histogram);
+        add(&into.errors, load(&self.errors));
+    }
+}
+
+#[cfg(feature = "metrics")]
+#[derive(Default)]
+struct FunctionCounters {
+    calls: AtomicU64,
+    timed_calls: AtomicU64,
+    timed_nanos: AtomicU64,
+}
+
+/// The counters of a function, added up over every shard
+#[cfg(feature = "metrics")]
+#[derive(Debug, Clone, Default)]
+struct FunctionTotals {
+    calls: u64,
+    timed_calls: u64,
+    timed_nanos: u64,
+}
+
+#[cfg(feature = "metrics")]
+impl FunctionTotals {
+    fn add(&mut self, counters: &FunctionCounters) {
+        self.calls += load(&counters.calls);
+        self.timed_calls += load(&counters.timed_calls);
+        self.timed_nanos += load(&counters.timed_nanos);
+    }
+
+    fn estimated_time(&self) -> Duration {
+        if self.timed_calls == 0 {
+            return Duration::ZERO;
+        }
+        let nanos =
+            u128::from(self.timed_nanos) * u128::from(self.calls) / u128::from(self.timed_calls);
+        Duration::from_nanos(u64::try_from(nanos).unwrap_or(u64::MAX))
+    }
+}
+
+/// The counters one thread records into
+#[cfg(feature = "metrics")]
+struct Shard {
+    compile: Latency,
+    backends: [Latency; BackendSlot::ALL.len()],
+    allocations: AtomicU64,
+    /// Indexed by function id
+    functions: Box<[FunctionCounters]>,
+}
+
+#[cfg(feature = "metrics")]
+impl Shard {
+    fn new() -> Self {
+        Shard {
+            compile: Latency::new(),
+            backends: std::array::from_fn(|_| Latency::new()),
+            allocations: AtomicU64::new(0),
+            functions: FUNCTIONS
+                .iter()
+                .map(|_| FunctionCounters::default())
+                .collect(),
+        }
+    }
+
+    fn add_to(&self, snapshot: &mut MetricsSnapshot, functions: &mut [FunctionTotals]) {
+        snapshot.compile.merge(&self.compile.histogram.read());
+        snapshot.compile_errors += load(&self.compile.errors);
+
+        if snapshot.backends.is_empty() {
+            snapshot.backends = BackendSlot::ALL
+                .iter()
+                .map(|backend| BackendMetrics {
+                    name: backend.name(),
+                    latency: LatencyHistogram::default(),
+                    errors: 0,
+                })
+                .collect();
+        }
+        for (metrics, latency) in snapshot.backends.iter_mut().zip(&self.backends) {
+            metrics.latency.merge(&latency.histogram.read());
+            metrics.errors += load(&latency.errors);
+        }
+
+        *snapshot.allocations.get_or_insert(0) += load(&self.allocations);
+
+        for (totals, counters) in functions.iter_mut().zip(self.functions.iter()) {
+            totals.add(counters);
+        }
+    }
+
+    fn retire_into(&self, into: &Shard) {
+        self.compile.retire_into(&into.compile);
+        for (latency, total) in self.backends.iter().zip(&into.backends) {
+            latency.retire_into(total);
+        }
+        add(&into.allocations, load(&self.allocations));
+        for (counters, total) in self.functions.iter().zip(into.functions.iter()) {
+            add(&total.calls, load(&counters.calls));
+            add(&total.timed_calls, load(&counters.timed_calls));
+            add(&total.timed_nanos, load(&counters.timed_nanos));
+        }
+    }
+}
+
+/// The counters of a program, shared by every thread evaluating it
+#[cfg(feature = "metrics")]
+struct ProgramStats {
+    name: String,
+    latency: Latency,
+    allocations: AtomicU64,
+}
+
+#[cfg(feature = "metrics")]
+impl ProgramStats {
+    fn new(name: &str) -> Self {
+        ProgramStats {
+            name: name.to_string(),
+            latency: Latency::new(),
+            allocations: AtomicU64::new(0),
+        }
+    }
+}
+
+/// The shards of the live threads
+#[cfg(feature = "metrics")]
+static SHARDS: Mutex<Vec<Arc<Shard>>> = Mutex::new(Vec::new());
+
+/// The counters of every program, by name
+#[cfg(feature = "metrics")]
+static PROGRAMS: Mutex<BTreeMap<String, Arc<ProgramStats>>> = Mutex::new(BTreeMap::new());
+
+/// The totals of the threads that have exited
+#[cfg(feature = "metrics")]
+fn retired() -> &'static Shard {
+    static RETIRED: OnceLock<Shard> = OnceLock::new();
+    RETIRED.get_or_init(Shard::new)
+}
+
+/// The current thread's shard, registered on first use
+#[cfg(feature = "metrics")]
+struct LocalShard(Arc<Shard>);
+
+#[cfg(feature = "metrics")]
+impl LocalShard {
+    fn register() -> Self {
+        let shard = Arc::new(Shard::new());
+        lock(&SHARDS).push(Arc::clone(&shard));
+        LocalShard(shard)
+    }
+}
+
+#[cfg(feature = "metrics")]
+impl Drop for LocalShard {
+    fn drop(&mut self) {
+        let mut shards = lock(&SHARDS);
+        shards.retain(|shard| !Arc::ptr_eq(shard, &self.0));
+        self.0.retire_into(retired());
+    }
+}
+
+#[cfg(feature = "metrics")]
+thread_local! {
+    static SHARD: LocalShard = LocalShard::register();
+}
+
+/// Record into the current thread's shard, unless the thread is exiting
+#[cfg(feature = "metrics")]
+fn with_shard(record: impl FnOnce(&Shard)) {
+    let _ = SHARD.try_with(|local| record(&local.0));
+}
+
+#[cfg(feature = "metrics")]
+fn lock<T>(mutex: &Mutex<T>) -> MutexGuard<'_, T> {
+    mutex.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+/// Which threads write a counter
+#[cfg(feature = "metrics")]
+#[derive(Clone, Copy)]
+enum Writers {
+    /// Only the thread that owns it, so a load and a store will do
+    One,
+    /// Any thread
+    Many,
+}
+
+#[cfg(feature = "metrics")]
+impl Writers {
+    fn add(self, counter: &AtomicU64, n: u64) {
+        match self {
+            Writers::One => counter.store(load(counter).wrapping_add(n), Ordering::Relaxed),
+            Writers::Many => add(counter, n),
+        }
+    }
+
+    fn max(self, counter: &AtomicU64, n: u64) {
+        match self {
+            Writers::One if n > load(counter) => counter.store(n, Ordering::Relaxed),
+            Writers::One => {}
+            Writers::Many => {
+                counter.fetch_max(n, Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+#[cfg(feature = "metrics")]
+fn add(counter: &AtomicU64, n: u64) {
+    counter.fetch_add(n, Ordering::Relaxed);
+}
+
+#[cfg(feature = "metrics")]
+fn load(counter: &AtomicU64) -> u64 {
+    counter.load(Ordering::Relaxed)
+}
+
+#[cfg(feature = "metrics")]
+fn nanos_since(start: Instant) -> u64 {
+    duration_nanos(start.elapsed())
+}
+
+#[cfg(all(test, feature = "metrics"))]
+mod tests {
+    use super::*;
+    use crate::backend::bytecode::BytecodeBackend;
+    use crate::backend::columnar::ColumnarBackend;
+    use crate::backend::interpreter::{DirectInterpreterBackend, InterpreterBackend};
+    use crate::{compile, evaluate, Backend};
+    use std::collections::HashMap;
+    use std::thread;
+
+    #[test]
+    fn test_buckets_cover_every_latency() {
+        let mut previous = 0;
+        for nanos in (0..100_000).chain([1 << 39, (1 << 40) - 1, 1 << 40, u64::MAX]) {
+            let bucket = bucket(nanos);
+            assert!(bucket >= previous && bucket < BUCKETS);
+            previous = bucket;
+            let (low, high) = bucket_range(bucket);
+            if bucket < BUCKETS - 1 {
+                assert!(
+                    low <= nanos && nanos < high,
+                    "{} in {}..{}",
+                    nanos,
+                    low,
+                    high
+                );
+                // Within one part in SUB_BUCKETS of the latency
+                assert!((high - low) * SUB_BUCKETS as u64 <= low.max(SUB_BUCKETS as u64));
+            }
+        }
+        assert_eq!(bucket_range(BUCKETS - 1).1, 1 << MAX_EXPONENT);
+    }
+
+    #[test]
+    fn test_quantiles() {
+        let histogram = Histogram::new();
+        assert_eq!(histogram.read().quantile(0.5), Duration::ZERO);
+        for nanos in 1..=1000 {
+            histogram.record(nanos * 1000, Writers::One);
+        }
+        let read = histogram.read();
+        assert_eq!(read.count(), 1000);
+        assert_eq!(read.max(), Duration::from_micros(1000));
+        assert_eq!(read.mean(), Duration::from_nanos(500_500));
+        for (q, expected) in [(0.5, 500_000.0), (0.9, 900_000.0), (0.99, 990_000.0)] {
+            let nanos = read.quantile(q).as_nanos() as f64;
+            assert!(
+                (nanos - expected).abs() / expected < 0.07,
+                "{} {}",
+                q,
+                nanos
+            );
+        }
+        assert_eq!(read.quantile(1.0), read.max());
+        assert_eq!(read.buckets().map(|(_, _, n)| n).sum::<u64>(), 1000);
+    }
+
+    #[test]
+    fn test_backend_names_match_the_backends() {
+        let names: Vec<_> = BackendSlot::ALL.iter().map(|b| b.name()).collect();
+        assert_eq!(
+            names,
+            [
+                InterpreterBackend::new().name(),
+                BytecodeBackend::new().name(),
+                ColumnarBackend::new().name(),
+                DirectInterpreterBackend::new().name(),
+            ]
+        );
+    }
+
+    #[test]
+    fn test_only_named_programs_are_registered() {
+        let program = compile("x + 1", &[]).unwrap();
+        assert!(program.metrics.0.get().is_none());
+        let loaded = crate::CompiledProgram::from_bytes(&program.to_bytes()).unwrap();
+        assert!(loaded.metrics.0.get().is_none());
+
+        // A shared program can be named, once
+        let shared = Arc::new(loaded);
+        shared.set_metrics_name("metrics-test-named");
+        shared.set_metrics_name("metrics-test-renamed");
+        assert_eq!(shared.metrics.0.get().unwrap().name, "metrics-test-named");
+        let programs = lock(&PROGRAMS);
+        assert!(programs.contains_key("metrics-test-named"));
+        assert!(!programs.contains_key("metrics-test-renamed"));
+    }
+
+    #[test]
+    fn test_snapshot_counts_evaluations() {
+        let program = compile("round(x / 3, 2)", &[]).unwrap();
+        program.set_metrics_name("metrics-test-rounding");
+        let failing = compile("missing + 1", &[]).unwrap();
+        failing.set_metrics_name("metrics-test-failing");
+        let data = HashMap::from([("x".to_string(), Value::Number(10.0))]);
+
+        let before = snapshot();
+        thread::scope(|scope| {
+            for _ in 0..4 {
+                scope.spawn(|| {
+                    for _ in 0..25 {
+                        assert_eq!(evaluate(&program, &data).unwrap(), Value::Number(3.33));
+                    }
+                    assert!(evaluate(&failing, &data).is_err());
+                });
+            }
+        });
+        let after = snapshot();
+
+        // The threads have exited, so their counts come from the retired totals
+        let program = |snapshot: &MetricsSnapshot, name: &str| {
+            snapshot
+                .programs
+                .iter()
+                .find(|program| program.name == name)
+                .cloned()
+        };
+        let rounding = program(&after, "metrics-test-rounding").unwrap();
+        assert_eq!(rounding.latency.count(), 100);
+        assert_eq!(rounding.errors, 0);
+        let failed = program(&after, "metrics-test-failing").unwrap();
+        assert_eq!((failed.latency.count(), failed.errors), (4, 4));
+        assert!(program(&before, "metrics-test-rounding").is_none());
+
+        assert!(after.evaluate.count() >= before.evaluate.count() + 104);
+        assert!(after.evaluate_errors >= before.evaluate_errors + 4);
+        let calls = |snapshot: &MetricsSnapshot| {
+            snapshot
+                .functions
+                .iter()
+                .find(|function| function.name == "round")
+                .map_or(0, |function| function.calls)
+        };
+        assert!(calls(&after) >= calls(&before) + 100);
+        let round = after.functions.iter().find(|f| f.name == "round").unwrap();
+        assert!(round.time > Duration::ZERO);
+        assert!(after.compile.count() >= 2);
+    }
+
+    #[test]
+    fn test_exports() {
+        let program = compile("upcase(name)", &[]).unwrap();
+        let name = "metrics-test-exports";
+        program.set_metrics_name(name);
+        let data = HashMap::from([("name".to_string(), Value::String("a\"b".to_string()))]);
+        evaluate(&program, &data).unwrap();
+
+        let snapshot = snapshot();
+        let json = snapshot.to_json();
+        assert!(json["evaluate"]["count"].as_u64().unwrap() >= 1);
+        assert!(json["programs"]
+            .as_array()
+            .unwrap()
+            .iter()
+            .any(|program| program["name"] == name));
+
+        let text = snapshot.to_prometheus();
+        assert!(text.contains("# TYPE amoskeag_evaluate_seconds summary\n"));
+        assert!(text.contains("amoskeag_evaluate_seconds_count{backend=\"interpreter\"} "));
+        assert!(text.contains(&format!(
+            "amoskeag_program_evaluate_seconds{{program=\"{}\",quantile=\"0.99\"}} ",
+            name
+        )));
+        assert!(text.contains("amoskeag_function_calls_total{function=\"upcase\"} "));
+        assert_eq!(label("program", "a\"b\\c\n"), "program=\"a\\\"b\\\\c\\n\"");
+    }
+}
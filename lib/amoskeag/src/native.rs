@@ -0,0 +1,303 @@
+//! Runtime support for rules compiled to Rust
+//!
+//! `amoskeag-transpiler` turns rules into Rust functions at build time, to
+//! be linked into the host as native code. Where it can tell from the
+//! program that an expression is a number or a boolean, the generated code
+//! works on plain `f64` and `bool` locals. Everything else goes through the
+//! functions here, which share their implementation with the interpreter,
+//! so a compiled rule returns what `evaluate` returns for the same program
+//! and data, errors included.
+//!
+//! These functions are public for the generated code; hosts don't need to
+//! call them. The generated code names the stdlib functions it calls, and
+//! `function_id` turns each name into an id when that code is compiled, so
+//! the ids always match the version of this crate the rules are built
+//! against.
+
+use crate::functions::FUNCTIONS;
+use crate::{eval_binary_op, is_truthy};
+use amoskeag_stdlib_operators::OperatorError;
+use std::collections::HashMap;
+
+pub use crate::EvalError;
+pub use amoskeag_parser::BinaryOp;
+pub use amoskeag_stdlib_operators::{Symbol, Value};
+pub use std::borrow::Cow;
+
+/// The data dictionary a compiled rule reads
+pub type Data = HashMap<String, Value>;
+
+/// The id of the stdlib function `name`, for a call with `arg_count`
+/// arguments
+///
+/// Generated code assigns each id to a constant, so every function a rule
+/// calls is resolved when the rule is compiled against this crate: a call
+/// to an undefined function, or with the wrong number of arguments, fails
+/// the build.
+///
+/// # Panics
+/// Panics if there is no such function or it can't take `arg_count`
+/// arguments.
+pub const fn function_id(name: &str, arg_count: usize) -> usize {
+    let mut id = 0;
+    while id < FUNCTIONS.len() {
+        let function = &FUNCTIONS[id];
+        if str_eq(function.name, name) {
+            if arg_count < function.min_args || arg_count > function.max_args {
+                panic!("Amoskeag function called with the wrong number of arguments");
+            }
+            return id;
+        }
+        id += 1;
+    }
+    panic!("Amoskeag function is not defined");
+}
+
+const fn str_eq(a: &str, b: &str) -> bool {
+    let (a, b) = (a.as_bytes(), b.as_bytes());
+    if a.len() != b.len() {
+        return false;
+    }
+    let mut i = 0;
+    while i < a.len() {
+        if a[i] != b[i] {
+            return false;
+        }
+        i += 1;
+    }
+    true
+}
+
+/// Call the stdlib function `id` with `args`
+#[inline]
+pub fn call(id: usize, args: &[Cow<'_, Value>]) -> Result<Value, EvalError> {
+    (FUNCTIONS[id].call)(args)
+}
+
+static NIL: Value = Value::Nil;
+
+/// The field `key` of a value looked up in the data, if it is a dictionary
+/// with that field
+///
+/// Generated code looks up each data path a rule reads once, before
+/// evaluating it, one key at a time from the lookup of its parent.
+#[inline]
+pub fn child<'d>(parent: Option<&'d Value>, key: &str) -> Option<&'d Value> {
+    match parent {
+        Some(Value::Dictionary(map)) => map.get(key),
+        _ => None,
+    }
+}
+
+/// The value of the top-level variable `name`, looked up in the data
+///
+/// A missing variable read on its own is the one error in navigation.
+#[inline]
+pub fn found<'d>(value: Option<&'d Value>, name: &str) -> Result<Cow<'d, Value>, EvalError> {
+    match value {
+        Some(value) => Ok(Cow::Borrowed(value)),
+        None => Err(EvalError::VariableNotFound(name.to_string())),
+    }
+}
+
+/// The value at a path looked up in the data, or `nil` if there is none
+///
+/// Navigation is safe, as in the interpreter: a missing field, or a field
+/// of something that isn't a dictionary, is `nil`.
+#[inline]
+pub fn or_nil(value: Option<&Value>) -> Cow<'_, Value> {
+    Cow::Borrowed(value.unwrap_or(&NIL))
+}
+
+/// The value at `path` inside `value`, or `nil` if there is none
+#[inline]
+pub fn field<'v>(value: &'v Value, path: &[&str]) -> Cow<'v, Value> {
+    let mut current = value;
+    for key in path {
+        current = match current {
+            Value::Dictionary(map) => match map.get(*key) {
+                Some(value) => value,
+                None => return Cow::Owned(Value::Nil),
+            },
+            _ => return Cow::Owned(Value::Nil),
+        };
+    }
+    Cow::Borrowed(current)
+}
+
+/// A newly computed value
+#[inline]
+pub fn owned(value: Value) -> Cow<'static, Value> {
+    Cow::Owned(value)
+}
+
+/// A value borrowed from the data, a local, or a literal
+#[inline]
+pub fn borrowed(value: &Value) -> Cow<'_, Value> {
+    Cow::Borrowed(value)
+}
+
+/// Truthiness used by conditions and logical operators
+#[inline]
+pub fn truthy(value: &Value) -> bool {
+    is_truthy(value)
+}
+
+/// Apply a binary operator other than `and` and `or`
+#[inline]
+pub fn binary(op: BinaryOp, left: &Value, right: &Value) -> Result<Value, EvalError> {
+    eval_binary_op(op, left, right)
+}
+
+/// The operands of the arithmetic operator `op` as numbers
+///
+/// Fails with the interpreter's error when either isn't a number.
+#[inline]
+pub fn numbers(op: BinaryOp, left: &Value, right: &Value) -> Result<(f64, f64), EvalError> {
+    match (left, right) {
+        (Value::Number(l), Value::Number(r)) => Ok((*l, *r)),
+        _ => Err(operand_error(op, left, right)),
+    }
+}
+
+#[cold]
+fn operand_error(op: BinaryOp, left: &Value, right: &Value) -> EvalError {
+    match eval_binary_op(op, left, right) {
+        Err(e) => e,
+        // Only `+` accepts operands that aren't both numbers, and its
+        // numeric form is only used when the left one is a number
+        Ok(value) => EvalError::TypeError {
+            expected: "Number".to_string(),
+            got: value.type_name().to_string(),
+        },
+    }
+}
+
+/// Numeric division, failing on a zero divisor as `/` does
+#[inline]
+pub fn divide(left: f64, right: f64) -> Result<f64, EvalError> {
+    if right == 0.0 {
+        Err(OperatorError::DivisionByZero.into())
+    } else {
+        Ok(left / right)
+    }
+}
+
+/// Numeric remainder, failing on a zero divisor as `%` does
+#[inline]
+pub fn modulo(left: f64, right: f64) -> Result<f64, EvalError> {
+    if right == 0.0 {
+        Err(OperatorError::DivisionByZero.into())
+    } else {
+        Ok(left % right)
+    }
+}
+
+/// Apply the ordering operator `op`: `<`, `>`, `<=` or `>=`
+#[inline]
+pub fn compare(op: BinaryOp, left: &Value, right: &Value) -> Result<bool, EvalError> {
+    match (left, right) {
+        (Value::Number(l), Value::Number(r)) => Ok(match op {
+            BinaryOp::Less => l < r,
+            BinaryOp::Greater => l > r,
+            BinaryOp::LessEqual => l <= r,
+            _ => l >= r,
+        }),
+        _ => match eval_binary_op(op, left, right)? {
+            Value::Boolean(b) => Ok(b),
+            value => Err(EvalError::TypeError {
+                expected: "Boolean".to_string(),
+                got: value.type_name().to_string(),
+            }),
+        },
+    }
+}
+
+/// Whether two values are equal, as `==` decides
+#[inline]
+pub fn equal(left: &Value, right: &Value) -> bool {
+    left == right
+}
+
+/// Negate a number, failing as unary `-` does for anything else
+#[inline]
+pub fn negate(value: &Value) -> Result<f64, EvalError> {
+    match value {
+        Value::Number(n) => Ok(-n),
+        _ => Err(EvalError::TypeError {
+            expected: "Number".to_string(),
+            got: value.type_name().to_string(),
+        }),
+    }
+}
+
+/// The error for an expression that can't be evaluated, such as a pipe
+/// into something other than a function
+#[cold]
+pub fn invalid(expected: &str, got: &str) -> Result<Cow<'static, Value>, EvalError> {
+    Err(EvalError::TypeError {
+        expected: expected.to_string(),
+        got: got.to_string(),
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, evaluate};
+
+    #[test]
+    fn test_navigation_matches_the_interpreter() {
+        let data = crate::data_from_json_str(r#"{"a": {"b": 1}, "n": 2}"#).unwrap();
+        for path in [&["a", "b"][..], &["a", "c"], &["n", "x"], &["missing", "x"]] {
+            let program = compile(&path.join("."), &[]).unwrap();
+            let (root, rest) = path.split_first().unwrap();
+            let value = rest.iter().fold(data.get(*root), |v, key| child(v, key));
+            assert_eq!(
+                or_nil(value).into_owned(),
+                evaluate(&program, &data).unwrap()
+            );
+        }
+        assert!(matches!(
+            found(data.get("missing"), "missing"),
+            Err(EvalError::VariableNotFound(name)) if name == "missing"
+        ));
+    }
+
+    #[test]
+    fn test_numeric_errors_match_the_interpreter() {
+        let text = Value::String("x".to_string());
+        let one = Value::Number(1.0);
+        for op in [BinaryOp::Subtract, BinaryOp::Multiply, BinaryOp::Add] {
+            assert_eq!(
+                numbers(op, &one, &text).unwrap_err().to_string(),
+                binary(op, &one, &text).unwrap_err().to_string()
+            );
+        }
+        assert_eq!(numbers(BinaryOp::Add, &one, &one).unwrap(), (1.0, 1.0));
+        assert_eq!(
+            divide(1.0, 0.0).unwrap_err().to_string(),
+            binary(BinaryOp::Divide, &one, &Value::Number(0.0))
+                .unwrap_err()
+                .to_string()
+        );
+        assert_eq!(
+            compare(BinaryOp::Less, &text, &one)
+                .unwrap_err()
+                .to_string(),
+            binary(BinaryOp::Less, &text, &one).unwrap_err().to_string()
+        );
+        assert!(compare(BinaryOp::GreaterEqual, &text, &text).unwrap());
+    }
+
+    #[test]
+    fn test_function_id() {
+        const UPCASE: usize = function_id("upcase", 1);
+        let args = [Cow::Owned(Value::String("a".to_string()))];
+        assert_eq!(call(UPCASE, &args).unwrap(), Value::String("A".to_string()));
+        assert_eq!(function_id("round", 1), function_id("round", 2));
+        for (name, arg_count) in [("upcase", 2), ("nope", 1)] {
+            assert!(std::panic::catch_unwind(|| function_id(name, arg_count)).is_err());
+        }
+    }
+}
@@ -0,0 +1,709 @@
+//! AST optimization
+//!
+//! `compile` runs this pass after validation. Every Amoskeag function except
+//! `date_now` is pure, so any subtree whose inputs are all literals can be
+//! evaluated once at compile time. The pass:
+//!
+//! - folds operators and stdlib calls whose operands are literals
+//! - prunes `if` branches and `and`/`or` operands decided by a literal
+//! - propagates literal `let` values into the body, and inlines any other
+//!   `let` whose single use is evaluated unconditionally
+//!
+//! A subtree whose evaluation fails (such as `1 / 0`) is left in place so the
+//! error is still raised at run time. A `let` value that could fail is never
+//! moved into a branch that might skip it, nor behind anything else that
+//! could fail first, so the same error is reported either way.
+
+use crate::functions::{self, FUNCTIONS};
+use crate::{eval_binary_op, eval_unary_op, is_truthy};
+use amoskeag_parser::{BinaryOp, Expr};
+use amoskeag_stdlib_operators::Value;
+use std::borrow::Cow;
+use std::collections::HashSet;
+
+/// Functions that must never be evaluated at compile time
+pub(crate) const IMPURE_FUNCTIONS: &[&str] = &["date_now"];
+
+/// Optimize a validated AST
+pub(crate) fn optimize(expr: Expr) -> Expr {
+    match expr {
+        Expr::Array(items) => Expr::Array(items.into_iter().map(optimize).collect()),
+
+        Expr::Dictionary(pairs) => Expr::Dictionary(
+            pairs
+                .into_iter()
+                .map(|(key, value)| (key, optimize(value)))
+                .collect(),
+        ),
+
+        Expr::FunctionCall { name, args } => {
+            let args: Vec<Expr> = args.into_iter().map(optimize).collect();
+            fold_call(&name, &args).unwrap_or(Expr::FunctionCall { name, args })
+        }
+
+        Expr::Let { .. } | Expr::If { .. } | Expr::Binary { .. } => chain(expr),
+
+        Expr::Unary { op, operand } => {
+            let operand = optimize(*operand);
+            literal(&operand)
+                .and_then(|value| eval_unary_op(op, &value).ok())
+                .map(to_expr)
+                .unwrap_or(Expr::Unary {
+                    op,
+                    operand: Box::new(operand),
+                })
+        }
+
+        Expr::Pipe { left, right } => Expr::Pipe {
+            left: Box::new(optimize(*left)),
+            right: Box::new(optimize(*right)),
+        },
+
+        Expr::Number(_)
+        | Expr::String(_)
+        | Expr::Boolean(_)
+        | Expr::Nil
+        | Expr::Symbol(_)
+        | Expr::Variable(_) => expr,
+    }
+}
+
+/// An expression on a chain, waiting for the next expression along it
+enum Link {
+    /// A `let` waiting for its body
+    Let { name: String, value: Expr },
+    /// An `if` waiting for its `else` branch
+    If { condition: Expr, then_branch: Expr },
+    /// A binary operator waiting for its left operand
+    Binary { op: BinaryOp, right: Expr },
+}
+
+impl Link {
+    /// The expression with `expr` as the next link of the chain
+    fn wrap(self, expr: Expr) -> Expr {
+        match self {
+            Link::Let { name, value } => Expr::Let {
+                name,
+                value: Box::new(value),
+                body: Box::new(expr),
+            },
+            Link::If {
+                condition,
+                then_branch,
+            } => Expr::If {
+                condition: Box::new(condition),
+                then_branch: Box::new(then_branch),
+                else_branch: Box::new(expr),
+            },
+            Link::Binary { op, right } => Expr::Binary {
+                op,
+                left: Box::new(expr),
+                right: Box::new(right),
+            },
+        }
+    }
+}
+
+/// Optimize a chain of `let` bodies, `else` branches and left operands in a
+/// loop, so that long generated chains don't take native stack in
+/// proportion (see `resolve::Resolver::chain`)
+fn chain(mut expr: Expr) -> Expr {
+    let mut links = Vec::new();
+    let mut expr = loop {
+        expr = match expr {
+            Expr::Let { name, value, body } => {
+                let value = optimize(*value);
+                links.push(Link::Let { name, value });
+                *body
+            }
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                let condition = optimize(*condition);
+                match literal(&condition) {
+                    // The branch taken replaces the `if`
+                    Some(value) if is_truthy(&value) => *then_branch,
+                    Some(_) => *else_branch,
+                    None => {
+                        let then_branch = optimize(*then_branch);
+                        links.push(Link::If {
+                            condition,
+                            then_branch,
+                        });
+                        *else_branch
+                    }
+                }
+            }
+            Expr::Binary { op, left, right } => {
+                links.push(Link::Binary { op, right: *right });
+                *left
+            }
+            expr => break optimize(expr),
+        };
+    };
+
+    for link in links.into_iter().rev() {
+        expr = match link {
+            Link::Let { name, value } => inline_let(name, value, expr),
+            Link::Binary { op, right } => binary(op, expr, right),
+            link => link.wrap(expr),
+        };
+    }
+    expr
+}
+
+/// Optimize a binary operation whose left operand is already optimized
+fn binary(op: BinaryOp, left: Expr, right: Expr) -> Expr {
+    // A literal left operand that decides `and`/`or` makes the right
+    // operand dead code
+    if let (BinaryOp::And | BinaryOp::Or, Some(value)) = (op, literal(&left)) {
+        let truthy = is_truthy(&value);
+        if (op == BinaryOp::And) != truthy {
+            return Expr::Boolean(truthy);
+        }
+    }
+
+    let right = optimize(right);
+    let folded = match (literal(&left), literal(&right)) {
+        (Some(l), Some(r)) => match op {
+            BinaryOp::And => Some(Value::Boolean(is_truthy(&l) && is_truthy(&r))),
+            BinaryOp::Or => Some(Value::Boolean(is_truthy(&l) || is_truthy(&r))),
+            _ => eval_binary_op(op, &l, &r).ok(),
+        },
+        _ => None,
+    };
+    folded.map(to_expr).unwrap_or(Expr::Binary {
+        op,
+        left: Box::new(left),
+        right: Box::new(right),
+    })
+}
+
+/// Evaluate a pure stdlib call whose arguments are all literals
+fn fold_call(name: &str, args: &[Expr]) -> Option<Expr> {
+    if IMPURE_FUNCTIONS.contains(&name) {
+        return None;
+    }
+    let func = functions::resolve(name, args.len()).ok()?;
+    let values: Option<Vec<Cow<'_, Value>>> =
+        args.iter().map(|a| literal(a).map(Cow::Owned)).collect();
+    (FUNCTIONS[func].call)(&values?).ok().map(to_expr)
+}
+
+/// Inline or drop a let binding where that cannot change the result
+fn inline_let(name: String, value: Expr, body: Expr) -> Expr {
+    let keep = |value: Expr, body: Expr| Expr::Let {
+        name: name.clone(),
+        value: Box::new(value),
+        body: Box::new(body),
+    };
+
+    // A literal can't fail, so it can be substituted at every use
+    if let Some(constant) = literal(&value) {
+        return match substitute(&body, &name, &Replacement::Literal(&constant), &[]) {
+            Some(body) => optimize(body),
+            None => keep(value, body),
+        };
+    }
+
+    // Any other value is only moved if it is evaluated exactly once and
+    // unconditionally, so an error it raises is never skipped or repeated,
+    // and, unless it can't fail, only to where the body reads it before
+    // anything else that could fail
+    let mut uses = Uses::default();
+    count_uses(&body, &name, false, &mut uses);
+    if uses.count != 1 || uses.conditional {
+        return keep(value, body);
+    }
+    if !cannot_fail(&value) && !used_first(&body, &name) {
+        return keep(value, body);
+    }
+
+    let mut free = HashSet::new();
+    free_roots(&value, &mut Vec::new(), &mut free);
+    let free: Vec<&str> = free.iter().map(String::as_str).collect();
+    match substitute(&body, &name, &Replacement::Expr(&value), &free) {
+        Some(body) => optimize(body),
+        None => keep(value, body),
+    }
+}
+
+/// The value a let-bound name is replaced with
+enum Replacement<'a> {
+    Literal(&'a Value),
+    Expr(&'a Expr),
+}
+
+#[derive(Default)]
+struct Uses {
+    count: usize,
+    /// Whether any use sits in a branch or short-circuited operand
+    conditional: bool,
+}
+
+/// Count the uses of a let-bound name, respecting shadowing
+///
+/// Chains are followed in a loop, as by `chain`.
+fn count_uses(mut expr: &Expr, name: &str, mut conditional: bool, uses: &mut Uses) {
+    loop {
+        match expr {
+            Expr::Variable(path) => {
+                if path[0] == name {
+                    uses.count += 1;
+                    uses.conditional |= conditional;
+                }
+                return;
+            }
+            Expr::Let {
+                name: inner,
+                value,
+                body,
+            } => {
+                count_uses(value, name, conditional, uses);
+                if inner == name {
+                    return;
+                }
+                expr = body;
+            }
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                count_uses(condition, name, conditional, uses);
+                count_uses(then_branch, name, true, uses);
+                conditional = true;
+                expr = else_branch;
+            }
+            Expr::Binary { op, left, right } => {
+                let short_circuits = matches!(op, BinaryOp::And | BinaryOp::Or);
+                count_uses(right, name, conditional || short_circuits, uses);
+                expr = left;
+            }
+            _ => return for_each_child(expr, |child| count_uses(child, name, conditional, uses)),
+        }
+    }
+}
+
+/// Whether evaluating an expression never raises an error
+///
+/// Literals, and variable paths with a field, which navigate safely to nil.
+fn cannot_fail(expr: &Expr) -> bool {
+    matches!(expr, Expr::Variable(path) if path.len() > 1) || literal(expr).is_some()
+}
+
+/// Whether a use of `name` is the first part of `expr` evaluated that could
+/// fail
+///
+/// Chains are followed in a loop, as by `chain`.
+fn used_first(mut expr: &Expr, name: &str) -> bool {
+    // Whether a subexpression can be evaluated before the use
+    let skippable =
+        |e: &Expr| cannot_fail(e) && !matches!(e, Expr::Variable(path) if path[0] == name);
+    loop {
+        match expr {
+            Expr::Variable(path) => return path[0] == name,
+            Expr::Let {
+                name: inner,
+                value,
+                body,
+            } => {
+                if !skippable(value) {
+                    expr = value;
+                } else if inner == name {
+                    return false;
+                } else {
+                    expr = body;
+                }
+            }
+            Expr::If { condition, .. } => expr = condition,
+            Expr::Binary { left, right, .. } | Expr::Pipe { left, right } => {
+                expr = if skippable(left) { right } else { left };
+            }
+            Expr::Unary { operand, .. } => expr = operand,
+            Expr::Array(items) | Expr::FunctionCall { args: items, .. } => {
+                return items
+                    .iter()
+                    .find(|item| !skippable(item))
+                    .is_some_and(|item| used_first(item, name));
+            }
+            Expr::Dictionary(pairs) => {
+                return pairs
+                    .iter()
+                    .map(|(_, value)| value)
+                    .find(|value| !skippable(value))
+                    .is_some_and(|value| used_first(value, name));
+            }
+            Expr::Number(_) | Expr::String(_) | Expr::Boolean(_) | Expr::Nil | Expr::Symbol(_) => {
+                return false
+            }
+        }
+    }
+}
+
+/// Collect the variable roots an expression reads from its enclosing scope
+///
+/// Chains are followed in a loop, as by `chain`.
+fn free_roots<'e>(mut expr: &'e Expr, bound: &mut Vec<&'e str>, free: &mut HashSet<String>) {
+    let scope = bound.len();
+    loop {
+        match expr {
+            Expr::Variable(path) => {
+                if !bound.contains(&path[0].as_str()) {
+                    free.insert(path[0].clone());
+                }
+                break;
+            }
+            Expr::Let { name, value, body } => {
+                free_roots(value, bound, free);
+                bound.push(name);
+                expr = body;
+            }
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                free_roots(condition, bound, free);
+                free_roots(then_branch, bound, free);
+                expr = else_branch;
+            }
+            Expr::Binary { left, right, .. } => {
+                free_roots(right, bound, free);
+                expr = left;
+            }
+            _ => {
+                for_each_child(expr, |child| free_roots(child, bound, free));
+                break;
+            }
+        }
+    }
+    bound.truncate(scope);
+}
+
+/// Replace uses of `name` in `expr`
+///
+/// Returns `None` if a use can't be replaced faithfully: the replacement
+/// reads a variable that is shadowed at the use site, or the use navigates
+/// into a value that has no equivalent path.
+fn substitute(expr: &Expr, name: &str, with: &Replacement<'_>, free: &[&str]) -> Option<Expr> {
+    let sub = |e: &Expr| substitute(e, name, with, free).map(Box::new);
+    Some(match expr {
+        Expr::Variable(path) if path[0] == name => {
+            let fields = &path[1..];
+            match with {
+                Replacement::Literal(value) => to_expr(navigate(value, fields)),
+                Replacement::Expr(e) if fields.is_empty() => (*e).clone(),
+                // `x.f` with `x = a.b` is `a.b.f`; both are nil if `a` is
+                // missing. A one-segment root must exist, so `a.f` is not
+                // equivalent to `x.f` with `x = a`.
+                Replacement::Expr(Expr::Variable(inner)) if inner.len() > 1 => {
+                    Expr::Variable(inner.iter().chain(fields).cloned().collect())
+                }
+                Replacement::Expr(_) => return None,
+            }
+        }
+        Expr::Let { .. } | Expr::If { .. } | Expr::Binary { .. } => {
+            return substitute_chain(expr, name, with, free)
+        }
+        Expr::Array(items) => Expr::Array(
+            items
+                .iter()
+                .map(|e| substitute(e, name, with, free))
+                .collect::<Option<_>>()?,
+        ),
+        Expr::Dictionary(pairs) => Expr::Dictionary(
+            pairs
+                .iter()
+                .map(|(k, e)| Some((k.clone(), substitute(e, name, with, free)?)))
+                .collect::<Option<_>>()?,
+        ),
+        Expr::FunctionCall { name: func, args } => Expr::FunctionCall {
+            name: func.clone(),
+            args: args
+                .iter()
+                .map(|e| substitute(e, name, with, free))
+                .collect::<Option<_>>()?,
+        },
+        Expr::Unary { op, operand } => Expr::Unary {
+            op: *op,
+            operand: sub(operand)?,
+        },
+        Expr::Pipe { left, right } => Expr::Pipe {
+            left: sub(left)?,
+            right: sub(right)?,
+        },
+        Expr::Number(_)
+        | Expr::String(_)
+        | Expr::Boolean(_)
+        | Expr::Nil
+        | Expr::Symbol(_)
+        | Expr::Variable(_) => expr.clone(),
+    })
+}
+
+/// `substitute` along a chain, in a loop as by `chain`
+fn substitute_chain(
+    mut expr: &Expr,
+    name: &str,
+    with: &Replacement<'_>,
+    free: &[&str],
+) -> Option<Expr> {
+    let mut links = Vec::new();
+    let mut expr = loop {
+        match expr {
+            Expr::Let {
+                name: inner,
+                value,
+                body,
+            } => {
+                links.push(Link::Let {
+                    name: inner.clone(),
+                    value: substitute(value, name, with, free)?,
+                });
+                if inner == name {
+                    break body.as_ref().clone();
+                }
+                if free.contains(&inner.as_str()) && mentions(body, name) {
+                    // The inner binding would capture the replacement
+                    return None;
+                }
+                expr = body;
+            }
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                links.push(Link::If {
+                    condition: substitute(condition, name, with, free)?,
+                    then_branch: substitute(then_branch, name, with, free)?,
+                });
+                expr = else_branch;
+            }
+            Expr::Binary { op, left, right } => {
+                links.push(Link::Binary {
+                    op: *op,
+                    right: substitute(right, name, with, free)?,
+                });
+                expr = left;
+            }
+            expr => break substitute(expr, name, with, free)?,
+        }
+    };
+
+    for link in links.into_iter().rev() {
+        expr = link.wrap(expr);
+    }
+    Some(expr)
+}
+
+/// Whether `name` is read anywhere in `expr` (ignoring shadowing)
+fn mentions(expr: &Expr, name: &str) -> bool {
+    let mut uses = Uses::default();
+    count_uses(expr, name, false, &mut uses);
+    uses.count > 0
+}
+
+fn for_each_child<'e>(expr: &'e Expr, mut f: impl FnMut(&'e Expr)) {
+    match expr {
+        Expr::Array(items) => items.iter().for_each(f),
+        Expr::Dictionary(pairs) => pairs.iter().for_each(|(_, e)| f(e)),
+        Expr::FunctionCall { args, .. } => args.iter().for_each(f),
+        Expr::Let { value, body, .. } => {
+            f(value);
+            f(body);
+        }
+        Expr::If {
+            condition,
+            then_branch,
+            else_branch,
+        } => {
+            f(condition);
+            f(then_branch);
+            f(else_branch);
+        }
+        Expr::Binary { left, right, .. } | Expr::Pipe { left, right } => {
+            f(left);
+            f(right);
+        }
+        Expr::Unary { operand, .. } => f(operand),
+        Expr::Number(_)
+        | Expr::String(_)
+        | Expr::Boolean(_)
+        | Expr::Nil
+        | Expr::Symbol(_)
+        | Expr::Variable(_) => {}
+    }
+}
+
+/// Safe navigation into a literal value
+fn navigate(value: &Value, fields: &[String]) -> Value {
+    let mut current = value;
+    for field in fields {
+        current = match current {
+            Value::Dictionary(map) => match map.get(field) {
+                Some(value) => value,
+                None => return Value::Nil,
+            },
+            _ => return Value::Nil,
+        };
+    }
+    current.clone()
+}
+
+/// The value of a literal expression, if it is one
+fn literal(expr: &Expr) -> Option<Value> {
+    Some(match expr {
+        Expr::Number(n) => Value::Number(*n),
+        Expr::String(s) => Value::String(s.clone()),
+        Expr::Boolean(b) => Value::Boolean(*b),
+        Expr::Nil => Value::Nil,
+        Expr::Symbol(s) => Value::Symbol(s.into()),
+        Expr::Array(items) => Value::Array(items.iter().map(literal).collect::<Option<_>>()?),
+        Expr::Dictionary(pairs) => Value::Dictionary(
+            pairs
+                .iter()
+                .map(|(k, e)| Some((k.clone(), literal(e)?)))
+                .collect::<Option<_>>()?,
+        ),
+        _ => return None,
+    })
+}
+
+/// The literal expression for a value
+fn to_expr(value: Value) -> Expr {
+    match value {
+        Value::Number(n) => Expr::Number(n),
+        Value::String(s) => Expr::String(s),
+        Value::Boolean(b) => Expr::Boolean(b),
+        Value::Nil => Expr::Nil,
+        Value::Symbol(s) => Expr::Symbol(s.to_string()),
+        Value::Array(items) => Expr::Array(items.into_iter().map(to_expr).collect()),
+        Value::Dictionary(map) => {
+            let mut pairs: Vec<_> = map.into_iter().map(|(k, v)| (k, to_expr(v))).collect();
+            pairs.sort_by(|a, b| a.0.cmp(&b.0));
+            Expr::Dictionary(pairs)
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use amoskeag_lexer::Lexer;
+    use amoskeag_parser::Parser;
+
+    fn opt(source: &str) -> Expr {
+        let tokens = Lexer::new(source).tokenize().unwrap();
+        optimize(Parser::new(tokens).parse().unwrap())
+    }
+
+    fn parse(source: &str) -> Expr {
+        let tokens = Lexer::new(source).tokenize().unwrap();
+        Parser::new(tokens).parse().unwrap()
+    }
+
+    #[test]
+    fn test_folds_literal_subtrees() {
+        assert_eq!(opt("0.05 / 12 * 12"), Expr::Number(0.05 / 12.0 * 12.0));
+        assert_eq!(opt("round(100 * 1.08, 2)"), Expr::Number(108.0));
+        assert_eq!(opt("'a' | upcase"), Expr::String("A".to_string()));
+        assert_eq!(opt("[3, 1, 2] | sort | first"), Expr::Number(1.0));
+        assert_eq!(opt("not (1 > 2)"), Expr::Boolean(true));
+        assert_eq!(opt("x * (2 + 3)"), parse("x * 5"));
+    }
+
+    #[test]
+    fn test_keeps_failing_and_impure_subtrees() {
+        assert_eq!(opt("1 / 0"), parse("1 / 0"));
+        assert_eq!(
+            opt("sqrt(0 - 1)"),
+            Expr::FunctionCall {
+                name: "sqrt".to_string(),
+                args: vec![Expr::Number(-1.0)],
+            }
+        );
+        assert_eq!(opt("date_now()"), parse("date_now()"));
+    }
+
+    #[test]
+    fn test_prunes_constant_branches() {
+        assert_eq!(opt("if true x else y end"), parse("x"));
+        assert_eq!(opt("if nil x else if 1 > 0 y else z end end"), parse("y"));
+        assert_eq!(opt("false and expensive(x)"), Expr::Boolean(false));
+        assert_eq!(opt("true or expensive(x)"), Expr::Boolean(true));
+        assert_eq!(opt("true and x"), parse("true and x"));
+    }
+
+    #[test]
+    fn test_propagates_literal_lets() {
+        assert_eq!(opt("let rate = 0.06 / 12 in rate * 2"), Expr::Number(0.01));
+        assert_eq!(
+            opt("let x = 2 in if y x else x * x end"),
+            parse("if y 2 else 4 end")
+        );
+        assert_eq!(
+            opt("let d = {'a': {'b': 1}} in d.a.b + d.c"),
+            parse("1 + nil")
+        );
+    }
+
+    #[test]
+    fn test_inlines_single_unconditional_use() {
+        assert_eq!(opt("let v = a.b * 2 in v + 1"), parse("a.b * 2 + 1"));
+        assert_eq!(opt("let v = a.b in v.c"), parse("a.b.c"));
+        // Used twice, used conditionally, or could change meaning: kept
+        for source in [
+            "let v = a * 2 in v + v",
+            "let v = a * 2 in if c v else 0 end",
+            "let v = a * 2 in c and v",
+            "let v = a in v.c",
+            "let v = a * 2 in let a = b * 3 in v + a + a",
+        ] {
+            assert_eq!(opt(source), parse(source), "{}", source);
+        }
+    }
+
+    #[test]
+    fn test_inlining_keeps_the_first_error() {
+        use crate::backend::interpreter::DirectInterpreterBackend;
+        use crate::backend::Backend;
+        use std::collections::HashMap;
+
+        let run = |expr: &Expr| {
+            let backend = DirectInterpreterBackend::new();
+            let compiled = backend.compile(expr, &[]).unwrap();
+            backend
+                .execute(&compiled, &HashMap::new())
+                .map_err(|e| e.to_string())
+        };
+        for source in [
+            "let v = x / 0 in missing + v",
+            "let v = 1 / 0 in [missing, v]",
+            "let v = 1 / 0 in upcase(missing) + v",
+            "let v = 1 / 0 in let w = missing in w + v",
+            "let v = missing in (1 / 0) + v",
+        ] {
+            let parsed = parse(source);
+            assert!(run(&parsed).is_err(), "{}", source);
+            assert_eq!(run(&opt(source)), run(&parsed), "{}", source);
+        }
+
+        // Anything that can't fail may still be evaluated before the use
+        assert_eq!(opt("let v = a / 2 in 1 + v"), parse("1 + a / 2"));
+        assert_eq!(opt("let v = a.b in missing + v"), parse("missing + a.b"));
+        assert_eq!(
+            opt("let v = a / 2 in [1, c.d, v]"),
+            parse("[1, c.d, a / 2]")
+        );
+    }
+
+    #[test]
+    fn test_respects_shadowing() {
+        assert_eq!(opt("let x = 1 in let x = y in x + 1"), parse("y + 1"));
+        assert_eq!(opt("let x = 1 in [let x = 2 in x, x]"), parse("[2, 1]"));
+    }
+}
@@ -0,0 +1,286 @@
+//! Data paths read by a program
+//!
+//! Evaluation only ever reaches into the data dictionary through variable
+//! paths such as `applicant.vehicle.value`, so the parts of the data a
+//! program can read are known once it is compiled. `compile` records them
+//! as a `DataPaths` tree, which hosts use to skip decoding everything else:
+//! a rule that reads 8 fields of a 400-field document only needs those 8.
+//!
+//! The tree is conservative. A value bound by `let` to a path is followed
+//! through its uses (`let v = applicant.vehicle in v.value` reads only
+//! `applicant.vehicle.value`), but a value passed to a function or an
+//! operator is read in full.
+
+use amoskeag_parser::Expr;
+use std::collections::BTreeMap;
+
+/// The parts of a data dictionary that a program reads
+///
+/// Each node describes a value: either the whole value is read, or only
+/// some of its fields are, as described by their own nodes. The root is the
+/// data dictionary itself.
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct DataPaths {
+    whole: bool,
+    fields: BTreeMap<String, DataPaths>,
+}
+
+static WHOLE: DataPaths = DataPaths {
+    whole: true,
+    fields: BTreeMap::new(),
+};
+
+impl DataPaths {
+    /// Whether the whole value is read, including everything beneath it
+    pub fn is_whole(&self) -> bool {
+        self.whole
+    }
+
+    /// What is read of the field `key`, or `None` if it isn't read at all
+    ///
+    /// Every field of a value read whole is itself read whole.
+    pub fn get(&self, key: &str) -> Option<&DataPaths> {
+        if self.whole {
+            Some(&WHOLE)
+        } else {
+            self.fields.get(key)
+        }
+    }
+
+    /// The fields read, by name
+    ///
+    /// Empty when the whole value is read.
+    pub fn fields(&self) -> impl Iterator<Item = (&str, &DataPaths)> {
+        self.fields.iter().map(|(key, node)| (key.as_str(), node))
+    }
+
+    /// The paths read, dotted and sorted, such as `applicant.vehicle.value`
+    ///
+    /// Each path is read in full, including everything beneath it, except
+    /// that a value bound by `let` and never used is only checked for
+    /// presence.
+    pub fn paths(&self) -> Vec<String> {
+        let mut paths = Vec::new();
+        for (key, node) in &self.fields {
+            node.collect(&mut key.clone(), &mut paths);
+        }
+        paths
+    }
+
+    fn collect(&self, prefix: &mut String, paths: &mut Vec<String>) {
+        // A value with no fields read is only checked for presence
+        if self.whole || self.fields.is_empty() {
+            paths.push(prefix.clone());
+            return;
+        }
+        for (key, node) in &self.fields {
+            let len = prefix.len();
+            prefix.push('.');
+            prefix.push_str(key);
+            node.collect(prefix, paths);
+            prefix.truncate(len);
+        }
+    }
+
+    /// Record that the data has a value at `root`, without reading it
+    ///
+    /// A missing top-level variable is an error, so its presence matters
+    /// even when none of its fields are read.
+    fn touch(&mut self, root: &str) {
+        if !self.whole && !self.fields.contains_key(root) {
+            self.fields.insert(root.to_string(), DataPaths::default());
+        }
+    }
+
+    /// Record that the value at `path` is read in full
+    fn insert(&mut self, path: &[String]) {
+        let mut node = self;
+        for key in path {
+            if node.whole {
+                return;
+            }
+            node = node.fields.entry(key.clone()).or_default();
+        }
+        node.whole = true;
+        node.fields.clear();
+    }
+}
+
+/// What a name in scope refers to
+enum Binding {
+    /// The value at a path of the data
+    Alias(Vec<String>),
+    /// A value computed by the program
+    Local,
+}
+
+/// The data paths read by a program
+pub(crate) fn required_paths(expr: &Expr) -> DataPaths {
+    let mut walker = Walker {
+        paths: DataPaths::default(),
+        scope: Vec::new(),
+    };
+    walker.expr(expr);
+    walker.paths
+}
+
+struct Walker<'e> {
+    paths: DataPaths,
+    /// Names bound by enclosing lets, innermost last
+    scope: Vec<(&'e str, Binding)>,
+}
+
+impl<'e> Walker<'e> {
+    /// The data path a variable refers to, or `None` for a local value
+    fn data_path(&self, path: &[String]) -> Option<Vec<String>> {
+        let (root, rest) = path.split_first()?;
+        match self.scope.iter().rev().find(|(name, _)| name == root) {
+            Some((_, Binding::Local)) => None,
+            Some((_, Binding::Alias(prefix))) => Some(prefix.iter().chain(rest).cloned().collect()),
+            None => Some(path.to_vec()),
+        }
+    }
+
+    /// Record the paths `expr` reads
+    ///
+    /// Chains of `let` bodies, `else` branches and left operands are
+    /// followed in a loop, so long generated chains don't take native stack
+    /// in proportion. What is recorded doesn't depend on the order.
+    fn expr(&mut self, mut expr: &'e Expr) {
+        let scope = self.scope.len();
+        loop {
+            match expr {
+                Expr::Let { name, value, body } => {
+                    // Binding a path reads nothing until the name is used
+                    let binding = match value.as_ref() {
+                        Expr::Variable(path) => match self.data_path(path) {
+                            Some(path) => {
+                                if let [root] = path.as_slice() {
+                                    self.paths.touch(root);
+                                }
+                                Binding::Alias(path)
+                            }
+                            None => Binding::Local,
+                        },
+                        value => {
+                            self.expr(value);
+                            Binding::Local
+                        }
+                    };
+                    self.scope.push((name, binding));
+                    expr = body;
+                }
+                Expr::If {
+                    condition,
+                    then_branch,
+                    else_branch,
+                } => {
+                    self.expr(condition);
+                    self.expr(then_branch);
+                    expr = else_branch;
+                }
+                Expr::Binary { left, right, .. } => {
+                    self.expr(right);
+                    expr = left;
+                }
+                expr => {
+                    self.leaf(expr);
+                    break;
+                }
+            }
+        }
+        self.scope.truncate(scope);
+    }
+
+    /// Record the paths read by an expression that isn't a chain link
+    fn leaf(&mut self, expr: &'e Expr) {
+        match expr {
+            Expr::Number(_) | Expr::String(_) | Expr::Boolean(_) | Expr::Nil | Expr::Symbol(_) => {}
+            Expr::Array(items) => items.iter().for_each(|e| self.expr(e)),
+            Expr::Dictionary(pairs) => pairs.iter().for_each(|(_, e)| self.expr(e)),
+            Expr::Variable(path) => {
+                if let Some(path) = self.data_path(path) {
+                    self.paths.insert(&path);
+                }
+            }
+            Expr::FunctionCall { args, .. } => args.iter().for_each(|e| self.expr(e)),
+            Expr::Unary { operand, .. } => self.expr(operand),
+            Expr::Pipe { left, right } => {
+                self.expr(left);
+                // The right side names a function; only its arguments read data
+                if let Expr::FunctionCall { args, .. } = right.as_ref() {
+                    args.iter().for_each(|e| self.expr(e));
+                }
+            }
+            Expr::Let { .. } | Expr::If { .. } | Expr::Binary { .. } => self.expr(expr),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use amoskeag_parser::parse;
+
+    fn paths(source: &str) -> Vec<String> {
+        required_paths(&parse(source).unwrap()).paths()
+    }
+
+    #[test]
+    fn test_required_paths() {
+        assert_eq!(
+            paths("if applicant.age >= 18 and applicant.vehicle.value < env.limits.max then 1 else 0 end"),
+            ["applicant.age", "applicant.vehicle.value", "env.limits.max"]
+        );
+        // A value used whole covers every path beneath it
+        assert_eq!(
+            paths("[applicant.vehicle.value, size(applicant.vehicle), applicant.vehicle.make]"),
+            ["applicant.vehicle"]
+        );
+        assert_eq!(paths("items | map('price') | sum"), ["items"]);
+        assert!(paths("1 + 2").is_empty());
+    }
+
+    #[test]
+    fn test_required_paths_follow_lets() {
+        assert_eq!(
+            paths("let v = applicant.vehicle in v.value + v.age"),
+            ["applicant.vehicle.age", "applicant.vehicle.value"]
+        );
+        assert_eq!(
+            paths("let a = applicant in let v = a.vehicle in v.value"),
+            ["applicant.vehicle.value"]
+        );
+        // Locals shadow the data, and computed values read nothing more
+        assert_eq!(
+            paths(r#"let applicant = {"age": age} in let t = total * 2 in applicant.age + t.x"#),
+            ["age", "total"]
+        );
+        assert_eq!(
+            paths("let v = applicant.vehicle in size(v)"),
+            ["applicant.vehicle"]
+        );
+        // Binding a missing top-level name fails, so its presence is kept
+        let tree = required_paths(&parse("let a = applicant in 1").unwrap());
+        assert!(tree
+            .get("applicant")
+            .is_some_and(|a| a.fields().next().is_none()));
+    }
+
+    #[test]
+    fn test_data_paths_get() {
+        let tree = required_paths(&parse("applicant.vehicle.value + size(env)").unwrap());
+        let applicant = tree.get("applicant").unwrap();
+        assert!(!applicant.is_whole());
+        assert!(applicant
+            .get("vehicle")
+            .unwrap()
+            .get("value")
+            .unwrap()
+            .is_whole());
+        assert!(applicant.get("name").is_none());
+        // Everything beneath a value read whole is read
+        assert!(tree.get("env").unwrap().get("anything").unwrap().is_whole());
+        assert!(tree.get("other").is_none());
+    }
+}
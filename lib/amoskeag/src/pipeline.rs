@@ -0,0 +1,296 @@
+//! Fused collection pipelines
+//!
+//! A pipe chain such as `items | map('price') | sort | reverse | first`
+//! desugars to nested calls, and each call would copy the whole array it
+//! returns. The resolver folds chains of the collection functions below into
+//! a single `Node::Pipeline`, which runs every stage over references into
+//! the source array and copies only the final result. Stages that can't
+//! change the result are dropped: `reverse | first` takes the last element,
+//! and `sort | first` is a scan for the minimum.
+//!
+//! A fused chain returns the same values and raises the same errors as the
+//! calls it replaces.
+
+use crate::{functions, resolve::Node, EvalError};
+use amoskeag_stdlib_functions::{sort_refs, sorted_end, FunctionError};
+use amoskeag_stdlib_operators::Value;
+
+/// A step that turns one array into another
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) enum Stage {
+    /// `map(key)` with a literal key
+    Map(String),
+    Sort,
+    Reverse,
+}
+
+/// What a pipeline returns from its final array
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub(crate) enum Sink {
+    /// The array itself
+    Collect,
+    First,
+    Last,
+    /// `sort | first`
+    Min,
+    /// `sort | last`
+    Max,
+    Size,
+    Sum,
+}
+
+enum Step {
+    Stage(Stage),
+    Sink(Sink),
+}
+
+/// Fold a call into a pipeline when it extends a chain of collection
+/// functions, or give the arguments back
+///
+/// A chain needs at least two calls; a lone `sort(x)` stays a plain call.
+pub(crate) fn fuse(func: usize, mut args: Vec<Node>) -> Result<Node, Vec<Node>> {
+    let Some(next) = step(func, &args) else {
+        return Err(args);
+    };
+    let chained = match args.first() {
+        Some(Node::Pipeline {
+            sink: Sink::Collect,
+            ..
+        }) => true,
+        Some(Node::Call { func, args }) => matches!(step(*func, args), Some(Step::Stage(_))),
+        _ => false,
+    };
+    if !chained {
+        return Err(args);
+    }
+
+    let (source, mut stages) = match args.swap_remove(0) {
+        Node::Pipeline { source, stages, .. } => (source, stages),
+        Node::Call { func, mut args } => {
+            let Some(Step::Stage(stage)) = step(func, &args) else {
+                unreachable!("checked above");
+            };
+            (Box::new(args.swap_remove(0)), vec![stage])
+        }
+        _ => unreachable!("checked above"),
+    };
+
+    let sink = match next {
+        Step::Stage(stage) => {
+            stages.push(stage);
+            Sink::Collect
+        }
+        Step::Sink(sink) => simplify(&mut stages, sink),
+    };
+    Ok(Node::Pipeline {
+        source,
+        stages,
+        sink,
+    })
+}
+
+/// Drop trailing stages whose effect `sink` can take over
+fn simplify(stages: &mut Vec<Stage>, mut sink: Sink) -> Sink {
+    // Reversing only swaps the ends and can't fail on an array
+    while stages.last() == Some(&Stage::Reverse) {
+        sink = match sink {
+            Sink::First => Sink::Last,
+            Sink::Last => Sink::First,
+            Sink::Size => Sink::Size,
+            // The sum depends on the order the numbers are added in
+            _ => return sink,
+        };
+        stages.pop();
+    }
+    if stages.last() == Some(&Stage::Sort) {
+        sink = match sink {
+            Sink::First => Sink::Min,
+            Sink::Last => Sink::Max,
+            _ => return sink,
+        };
+        stages.pop();
+    }
+    sink
+}
+
+/// The pipeline step for a call, if the function can be fused
+fn step(func: usize, args: &[Node]) -> Option<Step> {
+    let name = functions::FUNCTIONS[func].name;
+    Some(match (name, args) {
+        ("map", [_, Node::Literal(Value::String(key))]) => Step::Stage(Stage::Map(key.clone())),
+        ("sort", [_]) => Step::Stage(Stage::Sort),
+        ("reverse", [_]) => Step::Stage(Stage::Reverse),
+        ("first", [_]) => Step::Sink(Sink::First),
+        ("last", [_]) => Step::Sink(Sink::Last),
+        ("size", [_]) => Step::Sink(Sink::Size),
+        ("sum", [_]) => Step::Sink(Sink::Sum),
+        _ => return None,
+    })
+}
+
+static NIL: Value = Value::Nil;
+
+/// Run a pipeline over the value of its source
+pub(crate) fn run(source: &Value, stages: &[Stage], sink: Sink) -> Result<Value, EvalError> {
+    // Every fused function rejects a non-array input the same way
+    let Value::Array(items) = source else {
+        return Err(FunctionError::TypeError {
+            expected: "Array".to_string(),
+            got: source.type_name().to_string(),
+        }
+        .into());
+    };
+
+    let mut view: Vec<&Value> = items.iter().collect();
+    for stage in stages {
+        match stage {
+            Stage::Map(key) => {
+                for item in view.iter_mut() {
+                    *item = match item {
+                        Value::Dictionary(dict) => dict.get(key).unwrap_or(&NIL),
+                        _ => {
+                            return Err(FunctionError::TypeError {
+                                expected: "Array of Dictionaries".to_string(),
+                                got: format!("Array containing {}", item.type_name()),
+                            }
+                            .into())
+                        }
+                    };
+                }
+            }
+            Stage::Sort => sort_refs(&mut view)?,
+            Stage::Reverse => view.reverse(),
+        }
+    }
+
+    let end = |item: Option<&&Value>| item.map_or(Value::Nil, |v| (*v).clone());
+    Ok(match sink {
+        Sink::Collect => Value::Array(view.into_iter().cloned().collect()),
+        Sink::First => end(view.first()),
+        Sink::Last => end(view.last()),
+        Sink::Min => end(sorted_end(&view, false)?.as_ref()),
+        Sink::Max => end(sorted_end(&view, true)?.as_ref()),
+        Sink::Size => Value::Number(view.len() as f64),
+        Sink::Sum => {
+            let mut total = 0.0;
+            for item in view {
+                match item {
+                    Value::Number(n) => total += n,
+                    _ => {
+                        return Err(FunctionError::TypeError {
+                            expected: "Array of Numbers".to_string(),
+                            got: format!("Array containing {}", item.type_name()),
+                        }
+                        .into())
+                    }
+                }
+            }
+            Value::Number(total)
+        }
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, evaluate, resolve::resolve_unchecked};
+    use amoskeag_lexer::Lexer;
+    use amoskeag_parser::Parser;
+    use std::borrow::Cow;
+    use std::collections::HashMap;
+
+    fn resolve(source: &str) -> Node {
+        let tokens = Lexer::new(source).tokenize().unwrap();
+        resolve_unchecked(&Parser::new(tokens).parse().unwrap())
+    }
+
+    fn item(price: Value) -> Value {
+        Value::Dictionary(HashMap::from([("price".to_string(), price)]))
+    }
+
+    #[test]
+    fn test_chains_are_fused() {
+        let node = resolve("items | map('price') | sort | reverse | first");
+        assert!(matches!(
+            node,
+            Node::Pipeline { stages, sink: Sink::Max, .. } if stages == [Stage::Map("price".to_string())]
+        ));
+        assert!(matches!(
+            resolve("items | reverse | first"),
+            Node::Pipeline { stages, sink: Sink::Last, .. } if stages.is_empty()
+        ));
+        assert!(matches!(
+            resolve("items | reverse | sum"),
+            Node::Pipeline { stages, sink: Sink::Sum, .. } if stages == [Stage::Reverse]
+        ));
+        // A single call has nothing to fuse with
+        assert!(matches!(resolve("items | sort"), Node::Call { .. }));
+        assert!(matches!(resolve("first(items)"), Node::Call { .. }));
+    }
+
+    /// Run each function of `chain` in turn through the function table
+    fn call_chain(chain: &str, items: &Value) -> Result<Value, EvalError> {
+        let mut value = items.clone();
+        for step in chain.split(" | ") {
+            let mut args = vec![Cow::Owned(value)];
+            let name = match step.split_once('(') {
+                Some((name, _)) => {
+                    args.push(Cow::Owned(Value::String("price".to_string())));
+                    name
+                }
+                None => step,
+            };
+            value = (functions::FUNCTIONS[functions::lookup(name).unwrap()].call)(&args)?;
+        }
+        Ok(value)
+    }
+
+    #[test]
+    fn test_fused_chains_match_the_calls() {
+        let prices = [3.0, -0.0, 1.0, 0.0, 3.0, f64::NAN];
+        let arrays = [
+            Value::Array(prices.iter().map(|&p| item(Value::Number(p))).collect()),
+            Value::Array(
+                prices[..5]
+                    .iter()
+                    .map(|&p| item(Value::Number(p)))
+                    .collect(),
+            ),
+            Value::Array(
+                ["b", "a", "c", "a"]
+                    .iter()
+                    .map(|s| item(Value::String(s.to_string())))
+                    .collect(),
+            ),
+            Value::Array(vec![item(Value::Number(1.0)), Value::Number(2.0)]),
+            Value::Array(vec![item(Value::Number(1.0)), item(Value::Nil)]),
+            Value::Array(vec![]),
+            Value::String("items".to_string()),
+        ];
+        let chains = [
+            "map('price') | sort | first",
+            "map('price') | sort | last",
+            "map('price') | sort | reverse | first",
+            "map('price') | reverse | sort | last",
+            "map('price') | reverse | first",
+            "map('price') | reverse | size",
+            "map('price') | reverse | sum",
+            "map('price') | sum",
+            "map('price') | sort | reverse",
+            "reverse | map('price') | last",
+        ];
+
+        for chain in chains {
+            let fused = compile(&format!("items | {}", chain), &[]).unwrap();
+            assert!(matches!(fused.resolved, Node::Pipeline { .. }), "{}", chain);
+
+            for items in &arrays {
+                let data = HashMap::from([("items".to_string(), items.clone())]);
+                // Debug output tells NaN and -0.0 apart where == can't
+                let expected = format!("{:?}", call_chain(chain, items).map_err(|e| e.to_string()));
+                let actual = format!("{:?}", evaluate(&fused, &data).map_err(|e| e.to_string()));
+                assert_eq!(actual, expected, "{} on {:?}", chain, items);
+            }
+        }
+    }
+}
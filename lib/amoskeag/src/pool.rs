@@ -0,0 +1,226 @@
+//! Long-lived worker threads
+//!
+//! `batch::parallel_map_with` runs for every batch, every window of a
+//! stream, every level of a workbook recalculation and every window of the
+//! CLI's NDJSON batches, and starting OS threads each time would often cost
+//! more than the evaluation itself. The pool starts
+//! threads as calls first ask for them, which `batch::worker_count` bounds
+//! by the number of cores, and lends them to whichever calls are running.
+//!
+//! A job borrows from its caller's stack, as a scoped thread would. That is
+//! sound because `broadcast` does not return until no thread is running the
+//! job, and a helper that picks the job up after that skips it.
+
+use std::any::Any;
+use std::collections::VecDeque;
+use std::mem;
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::{Arc, Condvar, Mutex, MutexGuard};
+use std::thread;
+
+type Work<'a> = dyn Fn() + Sync + 'a;
+
+/// Run `work` on the calling thread and on up to `helpers` pool threads,
+/// returning once every run of it has finished
+///
+/// `work` must share the work out itself, such as by claiming chunks from
+/// an atomic counter: helpers that are still busy when the calling thread
+/// finishes never run it at all. A panic in any run is resumed here.
+pub(crate) fn broadcast(helpers: usize, work: &Work<'_>) {
+    let pool = &POOL;
+    let helpers = pool.grow(helpers).min(helpers);
+    if helpers == 0 {
+        return work();
+    }
+
+    // SAFETY: the pointer is only followed by runs started before `close`,
+    // and `close` waits for all of them, so it never outlives `work`
+    let job = Arc::new(Job {
+        work: unsafe { mem::transmute::<*const Work<'_>, *const Work<'static>>(work) },
+        state: Mutex::new(State::default()),
+        finished: Condvar::new(),
+    });
+    {
+        let mut queue = pool.lock();
+        queue.extend((0..helpers).map(|_| Arc::clone(&job)));
+    }
+    pool.available.notify_all();
+
+    let result = panic::catch_unwind(AssertUnwindSafe(work));
+    pool.lock().retain(|queued| !Arc::ptr_eq(queued, &job));
+    let helper_panic = job.close();
+    if let Err(payload) = result {
+        panic::resume_unwind(payload);
+    }
+    if let Some(payload) = helper_panic {
+        panic::resume_unwind(payload);
+    }
+}
+
+struct Pool {
+    queue: Mutex<VecDeque<Arc<Job>>>,
+    available: Condvar,
+    /// How many threads have been started
+    threads: Mutex<usize>,
+}
+
+impl Pool {
+    /// Start threads until there are at least `threads`, returning how many
+    /// there are
+    fn grow(&'static self, threads: usize) -> usize {
+        let mut started = self.threads.lock().unwrap_or_else(|e| e.into_inner());
+        while *started < threads {
+            let spawned = thread::Builder::new()
+                .name(format!("amoskeag-worker-{}", *started))
+                .spawn(|| self.serve());
+            // A thread that fails to start only leaves more for the caller
+            if spawned.is_err() {
+                break;
+            }
+            *started += 1;
+        }
+        *started
+    }
+
+    fn lock(&self) -> MutexGuard<'_, VecDeque<Arc<Job>>> {
+        self.queue.lock().unwrap_or_else(|e| e.into_inner())
+    }
+
+    fn serve(&self) {
+        loop {
+            let job = {
+                let mut queue = self.lock();
+                loop {
+                    if let Some(job) = queue.pop_front() {
+                        break job;
+                    }
+                    queue = self
+                        .available
+                        .wait(queue)
+                        .unwrap_or_else(|e| e.into_inner());
+                }
+            };
+            job.run();
+        }
+    }
+}
+
+static POOL: Pool = Pool {
+    queue: Mutex::new(VecDeque::new()),
+    available: Condvar::new(),
+    threads: Mutex::new(0),
+};
+
+/// One call's work, queued once per helper it asked for
+struct Job {
+    work: *const Work<'static>,
+    state: Mutex<State>,
+    finished: Condvar,
+}
+
+// SAFETY: `work` points to a `Sync` closure, and is only followed while its
+// caller is blocked in `broadcast`
+unsafe impl Send for Job {}
+unsafe impl Sync for Job {}
+
+#[derive(Default)]
+struct State {
+    /// Set once the caller is done with its own run; later helpers skip it
+    closed: bool,
+    running: usize,
+    panic: Option<Box<dyn Any + Send>>,
+}
+
+impl Job {
+    fn lock(&self) -> MutexGuard<'_, State> {
+        self.state.lock().unwrap_or_else(|e| e.into_inner())
+    }
+
+    fn run(&self) {
+        {
+            let mut state = self.lock();
+            if state.closed {
+                return;
+            }
+            state.running += 1;
+        }
+        // SAFETY: the job isn't closed, so the caller is still waiting
+        let work = unsafe { &*self.work };
+        let result = panic::catch_unwind(AssertUnwindSafe(work));
+
+        let mut state = self.lock();
+        state.running -= 1;
+        if let Err(payload) = result {
+            state.panic.get_or_insert(payload);
+        }
+        if state.running == 0 {
+            self.finished.notify_all();
+        }
+    }
+
+    /// Stop helpers from starting, wait for the running ones, and return the
+    /// first panic among them
+    fn close(&self) -> Option<Box<dyn Any + Send>> {
+        let mut state = self.lock();
+        state.closed = true;
+        while state.running > 0 {
+            state = self.finished.wait(state).unwrap_or_else(|e| e.into_inner());
+        }
+        state.panic.take()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::HashSet;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    #[test]
+    fn test_broadcast_reuses_threads() {
+        let threads = Mutex::new(HashSet::new());
+        for _ in 0..50 {
+            let next = AtomicUsize::new(0);
+            broadcast(8, &|| {
+                while next.fetch_add(1, Ordering::Relaxed) < 100 {
+                    threads.lock().unwrap().insert(thread::current().id());
+                }
+            });
+            assert!(next.load(Ordering::Relaxed) >= 100);
+        }
+        let started = *POOL.threads.lock().unwrap();
+        assert!(threads.into_inner().unwrap().len() <= started + 1);
+    }
+
+    #[test]
+    fn test_broadcast_nests() {
+        let total = AtomicUsize::new(0);
+        let outer = AtomicUsize::new(0);
+        broadcast(4, &|| {
+            while outer.fetch_add(1, Ordering::Relaxed) < 8 {
+                let inner = AtomicUsize::new(0);
+                broadcast(4, &|| {
+                    while inner.fetch_add(1, Ordering::Relaxed) < 8 {
+                        total.fetch_add(1, Ordering::Relaxed);
+                    }
+                });
+            }
+        });
+        assert_eq!(total.into_inner(), 64);
+    }
+
+    #[test]
+    fn test_broadcast_resumes_panics() {
+        let result = panic::catch_unwind(|| {
+            broadcast(4, &|| panic!("worker failed"));
+        });
+        assert!(result.is_err());
+
+        // The pool still works afterwards
+        let runs = AtomicUsize::new(0);
+        broadcast(4, &|| {
+            runs.fetch_add(1, Ordering::Relaxed);
+        });
+        assert!(runs.into_inner() >= 1);
+    }
+}
@@ -0,0 +1,668 @@
+//! Evaluation profiler
+//!
+//! A [`ProfiledProgram`] is compiled with a probe around every expression
+//! that isn't a literal. Evaluating it records, for each expression, how
+//! many times it ran, the time spent in it with and without its
+//! subexpressions, and the heap allocations it made, together with its line
+//! and column in the source. A [`Profile`] presents the totals as a top-N
+//! table, per-function totals, or folded stacks for flamegraph tools.
+//!
+//! Profiling is opt-in and costs nothing otherwise: programs built by
+//! `compile` contain no probes. A profiled program is neither constant
+//! folded nor fused, so every expression as written shows up in the
+//! profile, and its times can be somewhat higher than those of the same
+//! program built by `compile`.
+//!
+//! Allocations are counted by [`CountingAllocator`], which a binary opts into
+//! as its global allocator. Without it, allocation counts are not recorded.
+
+use crate::resolve::{resolve_probed, Node};
+use crate::{eval_node, parse_error, validate_ast, CompileError, Context, EvalError};
+use amoskeag_lexer::Lexer;
+use amoskeag_parser::{Expr, Parser, Position};
+use amoskeag_stdlib_operators::Value;
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::{Cell, RefCell};
+use std::collections::{HashMap, HashSet};
+use std::fmt::Write;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+/// A program compiled for profiling
+///
+/// Evaluating it returns the same results as the program built by `compile`
+/// and adds the evaluation's counters to the program's running totals.
+/// Evaluations can run concurrently: each one records into its own counters
+/// and merges them when it finishes. A service can keep a profiled copy of
+/// a rule and route a sample of its requests through it.
+#[derive(Debug)]
+pub struct ProfiledProgram {
+    resolved: Node,
+    sites: Vec<Site>,
+    totals: Mutex<Totals>,
+}
+
+impl ProfiledProgram {
+    /// Compile a program for profiling
+    ///
+    /// The program is validated exactly as by `compile`.
+    pub fn compile(source: &str, symbols: &[&str]) -> Result<ProfiledProgram, CompileError> {
+        let (expr, positions) = Parser::from_lexer(Lexer::new(source))
+            .and_then(|mut parser| parser.parse_with_positions())
+            .map_err(parse_error)?;
+
+        let symbol_table: HashSet<String> = symbols.iter().map(|s| s.to_string()).collect();
+        validate_ast(&expr, &symbol_table)?;
+
+        let (resolved, sites) = resolve_probed(&expr, Sites::new(positions));
+        let sites = sites.sites;
+        Ok(ProfiledProgram {
+            resolved,
+            totals: Mutex::new(Totals::new(sites.len())),
+            sites,
+        })
+    }
+
+    /// Evaluate the program, recording a profile of the evaluation
+    pub fn evaluate(&self, data: &HashMap<String, Value>) -> Result<Value, EvalError> {
+        let recorder = Recorder::new(self.sites.len());
+        let result = eval_node(&self.resolved, &Context::profiled(data, &recorder));
+
+        let counters = recorder.state.into_inner().counters;
+        let mut totals = self.totals.lock().unwrap_or_else(|e| e.into_inner());
+        totals.evaluations += 1;
+        for (total, counter) in totals.counters.iter_mut().zip(counters) {
+            total.add(&counter);
+        }
+        result
+    }
+
+    /// The totals of every evaluation so far
+    pub fn profile(&self) -> Profile {
+        let totals = self.totals.lock().unwrap_or_else(|e| e.into_inner());
+        let sites = self
+            .sites
+            .iter()
+            .zip(&totals.counters)
+            .map(|(site, counters)| SiteProfile {
+                label: site.label.clone(),
+                function: site.function.clone(),
+                line: site.position.line,
+                column: site.position.column,
+                parent: site.parent,
+                calls: counters.calls,
+                total: Duration::from_nanos(counters.total_ns),
+                self_time: Duration::from_nanos(counters.self_ns),
+                allocations: counters.allocations,
+                self_allocations: counters.self_allocations,
+            })
+            .collect();
+        Profile {
+            evaluations: totals.evaluations,
+            counts_allocations: counts_allocations(),
+            sites,
+        }
+    }
+
+    /// Discard the totals recorded so far
+    pub fn reset(&self) {
+        let mut totals = self.totals.lock().unwrap_or_else(|e| e.into_inner());
+        *totals = Totals::new(self.sites.len());
+    }
+}
+
+/// Profiling totals for a program
+#[derive(Debug, Clone)]
+pub struct Profile {
+    evaluations: u64,
+    counts_allocations: bool,
+    sites: Vec<SiteProfile>,
+}
+
+/// Profiling totals for one expression of a program
+#[derive(Debug, Clone, PartialEq)]
+pub struct SiteProfile {
+    /// What the expression is, such as `upcase()`, `+`, `let total`, or
+    /// `applicant.age`
+    pub label: String,
+    /// The stdlib function, for a function call
+    pub function: Option<String>,
+    /// Line of the expression in the source
+    pub line: u32,
+    /// Column of the expression in the source
+    pub column: u32,
+    /// The enclosing expression, as an index into [`Profile::sites`]
+    pub parent: Option<usize>,
+    /// Number of times the expression was evaluated
+    pub calls: u64,
+    /// Time spent evaluating the expression, including its subexpressions
+    pub total: Duration,
+    /// Time spent in the expression itself
+    pub self_time: Duration,
+    /// Heap allocations made while evaluating the expression, including its
+    /// subexpressions
+    pub allocations: u64,
+    /// Heap allocations made by the expression itself
+    pub self_allocations: u64,
+}
+
+/// Profiling totals for one stdlib function, over all its call sites
+#[derive(Debug, Clone, PartialEq)]
+pub struct FunctionProfile {
+    pub name: String,
+    pub calls: u64,
+    /// Time spent in calls, including the evaluation of their arguments;
+    /// a call nested in a call to the same function is not counted twice
+    pub total: Duration,
+    pub allocations: u64,
+}
+
+impl Profile {
+    /// Number of evaluations the totals cover
+    pub fn evaluations(&self) -> u64 {
+        self.evaluations
+    }
+
+    /// Whether allocations were counted (see [`CountingAllocator`])
+    pub fn counts_allocations(&self) -> bool {
+        self.counts_allocations
+    }
+
+    /// Every expression of the program that isn't a literal, in source
+    /// order, including those that were never evaluated
+    pub fn sites(&self) -> &[SiteProfile] {
+        &self.sites
+    }
+
+    /// Up to `limit` evaluated expressions, by decreasing self time
+    pub fn hottest(&self, limit: usize) -> Vec<&SiteProfile> {
+        let mut sites: Vec<&SiteProfile> = self.sites.iter().filter(|s| s.calls > 0).collect();
+        sites.sort_by(|a, b| b.self_time.cmp(&a.self_time));
+        sites.truncate(limit);
+        sites
+    }
+
+    /// Totals for each stdlib function that was called, by decreasing time
+    pub fn functions(&self) -> Vec<FunctionProfile> {
+        let mut functions: Vec<FunctionProfile> = Vec::new();
+        for (index, site) in self.sites.iter().enumerate() {
+            let Some(name) = &site.function else {
+                continue;
+            };
+            if site.calls == 0 {
+                continue;
+            }
+            let position = match functions.iter().position(|f| &f.name == name) {
+                Some(position) => position,
+                None => {
+                    functions.push(FunctionProfile {
+                        name: name.clone(),
+                        calls: 0,
+                        total: Duration::ZERO,
+                        allocations: 0,
+                    });
+                    functions.len() - 1
+                }
+            };
+            let function = &mut functions[position];
+            function.calls += site.calls;
+            // An inner call's time is already part of the outer call's
+            if !self
+                .ancestors(index)
+                .any(|a| a.function.as_ref() == Some(name))
+            {
+                function.total += site.total;
+                function.allocations += site.allocations;
+            }
+        }
+        functions.sort_by(|a, b| b.total.cmp(&a.total));
+        functions
+    }
+
+    /// Folded stacks, one line per evaluated expression, for flamegraph tools
+    ///
+    /// Each line is the chain of enclosing expressions from the outermost
+    /// one, separated by `;`, then the expression's self time in
+    /// nanoseconds: the input format of `flamegraph.pl` and `inferno`.
+    pub fn folded(&self) -> String {
+        let mut folded = String::new();
+        for (index, site) in self.sites.iter().enumerate() {
+            if site.calls == 0 {
+                continue;
+            }
+            let mut frames: Vec<String> = self.ancestors(index).map(frame).collect();
+            frames.reverse();
+            frames.push(frame(site));
+            let _ = writeln!(folded, "{} {}", frames.join(";"), site.self_time.as_nanos());
+        }
+        folded
+    }
+
+    /// A table of the `limit` hottest expressions and of the functions called
+    pub fn table(&self, limit: usize) -> String {
+        let allocations = |n: u64| {
+            if self.counts_allocations {
+                n.to_string()
+            } else {
+                "-".to_string()
+            }
+        };
+
+        let mut table = format!(
+            "Profile of {} evaluation{}\n\n",
+            self.evaluations,
+            if self.evaluations == 1 { "" } else { "s" }
+        );
+        let _ = writeln!(
+            table,
+            "{:>12} {:>12} {:>10} {:>10}  {:<10} expression",
+            "self", "total", "calls", "allocs", "location"
+        );
+        for site in self.hottest(limit) {
+            let _ = writeln!(
+                table,
+                "{:>12} {:>12} {:>10} {:>10}  {:<10} {}",
+                format_duration(site.self_time),
+                format_duration(site.total),
+                site.calls,
+                allocations(site.self_allocations),
+                format!("{}:{}", site.line, site.column),
+                site.label
+            );
+        }
+
+        let functions = self.functions();
+        if !functions.is_empty() {
+            let _ = writeln!(
+                table,
+                "\n{:>12} {:>10} {:>10}  function",
+                "total", "calls", "allocs"
+            );
+            for function in functions {
+                let _ = writeln!(
+                    table,
+                    "{:>12} {:>10} {:>10}  {}",
+                    format_duration(function.total),
+                    function.calls,
+                    allocations(function.allocations),
+                    function.name
+                );
+            }
+        }
+        table
+    }
+
+    /// The enclosing expressions of a site, innermost first
+    fn ancestors(&self, index: usize) -> impl Iterator<Item = &SiteProfile> {
+        let mut parent = self.sites[index].parent;
+        std::iter::from_fn(move || {
+            let site = &self.sites[parent?];
+            parent = site.parent;
+            Some(site)
+        })
+    }
+}
+
+/// A site as a folded-stack frame; `;` separates frames, so none may contain it
+fn frame(site: &SiteProfile) -> String {
+    format!(
+        "{} ({}:{})",
+        site.label.replace(';', ","),
+        site.line,
+        site.column
+    )
+}
+
+fn format_duration(duration: Duration) -> String {
+    let nanos = duration.as_nanos();
+    if nanos >= 1_000_000_000 {
+        format!("{:.2}s", duration.as_secs_f64())
+    } else if nanos >= 1_000_000 {
+        format!("{:.2}ms", nanos as f64 / 1e6)
+    } else if nanos >= 1_000 {
+        format!("{:.2}µs", nanos as f64 / 1e3)
+    } else {
+        format!("{}ns", nanos)
+    }
+}
+
+/// A global allocator that counts allocations for the profiler
+///
+/// It forwards to the system allocator and adds a thread-local increment to
+/// each allocation and reallocation. Install it in a binary to see
+/// allocation counts in profiles, and in metrics with the `metrics`
+/// feature:
+///
+/// ```
+/// #[global_allocator]
+/// static ALLOCATOR: amoskeag::CountingAllocator = amoskeag::CountingAllocator;
+/// # fn main() {}
+/// ```
+pub struct CountingAllocator;
+
+thread_local! {
+    static ALLOCATIONS: Cell<u64> = const { Cell::new(0) };
+}
+
+static ALLOCATOR_INSTALLED: AtomicBool = AtomicBool::new(false);
+
+fn count_allocation() {
+    let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+    if !ALLOCATOR_INSTALLED.load(Ordering::Relaxed) {
+        ALLOCATOR_INSTALLED.store(true, Ordering::Relaxed);
+    }
+}
+
+/// Allocations made so far by the current thread
+pub(crate) fn allocations() -> u64 {
+    ALLOCATIONS.try_with(Cell::get).unwrap_or(0)
+}
+
+/// Whether `CountingAllocator` is the global allocator
+pub(crate) fn counts_allocations() -> bool {
+    ALLOCATOR_INSTALLED.load(Ordering::Relaxed)
+}
+
+// SAFETY: every method forwards to the system allocator with the same
+// arguments; counting touches only a thread-local `Cell` and an atomic,
+// neither of which allocates.
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        count_allocation();
+        System.alloc(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        count_allocation();
+        System.alloc_zeroed(layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        count_allocation();
+        System.realloc(ptr, layout, new_size)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+}
+
+/// Static information about a profiled expression
+#[derive(Debug, Clone)]
+struct Site {
+    label: String,
+    function: Option<String>,
+    position: Position,
+    parent: Option<usize>,
+}
+
+/// The sites of a program, registered by the resolver as it visits each
+/// expression
+#[derive(Debug, Default)]
+pub(crate) struct Sites {
+    /// Source position of each expression, in pre-order
+    positions: Vec<Position>,
+    sites: Vec<Site>,
+    /// Expressions being resolved, innermost last
+    open: Vec<usize>,
+}
+
+impl Sites {
+    fn new(positions: Vec<Position>) -> Self {
+        Sites {
+            positions,
+            ..Default::default()
+        }
+    }
+
+    /// Register an expression before resolving its subexpressions
+    pub(crate) fn enter(&mut self, expr: &Expr) -> usize {
+        let id = self.sites.len();
+        let function = match expr {
+            Expr::FunctionCall { name, .. } => Some(name.clone()),
+            _ => None,
+        };
+        self.sites.push(Site {
+            label: label(expr),
+            function,
+            position: self.positions.get(id).copied().unwrap_or_default(),
+            parent: self.open.last().copied(),
+        });
+        self.open.push(id);
+        id
+    }
+
+    /// Finish the expression registered last
+    pub(crate) fn exit(&mut self) {
+        self.open.pop();
+    }
+}
+
+fn label(expr: &Expr) -> String {
+    match expr {
+        Expr::Number(n) => n.to_string(),
+        Expr::String(s) => format!("{:?}", s),
+        Expr::Boolean(b) => b.to_string(),
+        Expr::Nil => "nil".to_string(),
+        Expr::Symbol(s) => format!(":{}", s),
+        Expr::Array(_) => "[...]".to_string(),
+        Expr::Dictionary(_) => "{...}".to_string(),
+        Expr::Variable(path) => path.join("."),
+        Expr::FunctionCall { name, .. } => format!("{}()", name),
+        Expr::Let { name, .. } => format!("let {}", name),
+        Expr::If { .. } => "if".to_string(),
+        Expr::Binary { op, .. } => op.to_string(),
+        Expr::Unary { op, .. } => op.to_string(),
+        Expr::Pipe { .. } => "|".to_string(),
+    }
+}
+
+/// Counters for one site
+#[derive(Debug, Clone, Copy, Default)]
+struct Counters {
+    calls: u64,
+    total_ns: u64,
+    self_ns: u64,
+    allocations: u64,
+    self_allocations: u64,
+}
+
+impl Counters {
+    fn add(&mut self, other: &Counters) {
+        self.calls += other.calls;
+        self.total_ns += other.total_ns;
+        self.self_ns += other.self_ns;
+        self.allocations += other.allocations;
+        self.self_allocations += other.self_allocations;
+    }
+}
+
+#[derive(Debug)]
+struct Totals {
+    evaluations: u64,
+    counters: Vec<Counters>,
+}
+
+impl Totals {
+    fn new(sites: usize) -> Self {
+        Totals {
+            evaluations: 0,
+            counters: vec![Counters::default(); sites],
+        }
+    }
+}
+
+/// Records one evaluation of a profiled program
+pub(crate) struct Recorder {
+    state: RefCell<RecorderState>,
+}
+
+struct RecorderState {
+    counters: Vec<Counters>,
+    /// Probes being evaluated, innermost last
+    stack: Vec<Frame>,
+}
+
+struct Frame {
+    start: Instant,
+    allocations: u64,
+    child_ns: u64,
+    child_allocations: u64,
+}
+
+impl Recorder {
+    fn new(sites: usize) -> Self {
+        // Preallocated, so recording never allocates during evaluation. No
+        // site can be nested in itself, so the stack is at most `sites` deep.
+        Recorder {
+            state: RefCell::new(RecorderState {
+                counters: vec![Counters::default(); sites],
+                stack: Vec::with_capacity(sites),
+            }),
+        }
+    }
+
+    /// Start timing a probe
+    pub(crate) fn enter(&self) {
+        let allocations = allocations();
+        self.state.borrow_mut().stack.push(Frame {
+            start: Instant::now(),
+            allocations,
+            child_ns: 0,
+            child_allocations: 0,
+        });
+    }
+
+    /// Stop timing the probe of `site`, started by the matching `enter`
+    pub(crate) fn exit(&self, site: usize) {
+        let end = Instant::now();
+        let allocations = allocations();
+        let mut state = self.state.borrow_mut();
+        let frame = state.stack.pop().expect("exit() matches enter()");
+        let total_ns = u64::try_from((end - frame.start).as_nanos()).unwrap_or(u64::MAX);
+        let total_allocations = allocations - frame.allocations;
+
+        let counters = &mut state.counters[site];
+        counters.calls += 1;
+        counters.total_ns += total_ns;
+        counters.self_ns += total_ns.saturating_sub(frame.child_ns);
+        counters.allocations += total_allocations;
+        counters.self_allocations += total_allocations.saturating_sub(frame.child_allocations);
+
+        if let Some(parent) = state.stack.last_mut() {
+            parent.child_ns += total_ns;
+            parent.child_allocations += total_allocations;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, evaluate};
+
+    fn data() -> HashMap<String, Value> {
+        let items = (1..=3)
+            .map(|n| Value::Dictionary(HashMap::from([("n".to_string(), Value::Number(n as f64))])))
+            .collect();
+        HashMap::from([("items".to_string(), Value::Array(items))])
+    }
+
+    const SOURCE: &str =
+        "let xs = items | map('n') in\n  if size(xs) > 2 then xs | sum else upcase('none') end";
+
+    fn site<'p>(profile: &'p Profile, label: &str) -> &'p SiteProfile {
+        profile
+            .sites()
+            .iter()
+            .find(|s| s.label == label)
+            .unwrap_or_else(|| panic!("no site {}", label))
+    }
+
+    #[test]
+    fn test_profile_counts_and_locates_expressions() {
+        let program = ProfiledProgram::compile(SOURCE, &[]).unwrap();
+        for _ in 0..3 {
+            assert_eq!(program.evaluate(&data()).unwrap(), Value::Number(6.0));
+        }
+
+        let profile = program.profile();
+        assert_eq!(profile.evaluations(), 3);
+        let sum = site(&profile, "sum()");
+        assert_eq!((sum.calls, sum.line, sum.column), (3, 2, 29));
+        assert_eq!(site(&profile, "map()").column, 18);
+        assert_eq!(site(&profile, ">").calls, 3);
+        // The branch not taken is listed but never evaluated
+        assert_eq!(site(&profile, "upcase()").calls, 0);
+
+        let root = &profile.sites()[0];
+        assert_eq!((root.label.as_str(), root.parent), ("let xs", None));
+        assert!(root.total >= sum.total);
+        assert!(profile.hottest(100).iter().all(|s| s.calls > 0));
+
+        let names: Vec<String> = profile.functions().into_iter().map(|f| f.name).collect();
+        let mut sorted = names.clone();
+        sorted.sort();
+        assert_eq!(sorted, ["map", "size", "sum"]);
+    }
+
+    #[test]
+    fn test_profile_folded_stacks() {
+        let program = ProfiledProgram::compile(SOURCE, &[]).unwrap();
+        program.evaluate(&data()).unwrap();
+        let folded = program.profile().folded();
+        assert!(
+            folded
+                .lines()
+                .any(|l| l.starts_with("let xs (1:1);if (2:3);sum() (2:29);xs (2:24) ")),
+            "{}",
+            folded
+        );
+        // Every line ends in a sample count
+        assert!(folded
+            .lines()
+            .all(|l| l.rsplit_once(' ').unwrap().1.parse::<u64>().is_ok()));
+    }
+
+    #[test]
+    fn test_profiled_program_matches_compile() {
+        for source in [
+            SOURCE,
+            "items | map('n') | sort | reverse | first",
+            "contains([1, 2, 3, 4, 5, 6, 7, 8], size(items))",
+            "let a = 1 + 2 in items | at(a)",
+            "1 / 0",
+            "nope.path",
+        ] {
+            let profiled = ProfiledProgram::compile(source, &[]).unwrap();
+            let plain = compile(source, &[]).unwrap();
+            assert_eq!(
+                format!("{:?}", profiled.evaluate(&data())),
+                format!("{:?}", evaluate(&plain, &data())),
+                "{}",
+                source
+            );
+        }
+        assert!(matches!(
+            ProfiledProgram::compile(":nope", &[]),
+            Err(CompileError::UndefinedSymbol { .. })
+        ));
+    }
+
+    #[test]
+    fn test_profile_reset_and_table() {
+        let program = ProfiledProgram::compile(SOURCE, &[]).unwrap();
+        program.evaluate(&data()).unwrap();
+        let table = program.profile().table(5);
+        assert!(table.starts_with("Profile of 1 evaluation\n"), "{}", table);
+        assert!(table.contains("function"), "{}", table);
+        // Five sites plus the header and the blank line after the title
+        assert_eq!(table.split("\n\n").nth(1).unwrap().lines().count(), 6);
+
+        program.reset();
+        let profile = program.profile();
+        assert_eq!(profile.evaluations(), 0);
+        assert!(profile.sites().iter().all(|s| s.calls == 0));
+    }
+}
@@ -0,0 +1,487 @@
+//! Binary records
+//!
+//! A compact, self-delimiting encoding of `Value`s for hosts that embed
+//! Amoskeag through the C ABI. Records need no parsing of text: numbers
+//! are stored as IEEE 754 doubles and strings by length, so decoding one is
+//! a single pass that copies each string once, and a host can write one
+//! without a JSON encoder.
+//!
+//! Every value is a tag byte followed by its contents:
+//!
+//! | Tag | Value      | Contents                                        |
+//! |-----|------------|-------------------------------------------------|
+//! | 0   | nil        |                                                 |
+//! | 1   | false      |                                                 |
+//! | 2   | true       |                                                 |
+//! | 3   | number     | 8 bytes, little-endian `f64`                    |
+//! | 4   | string     | length, then that many bytes of UTF-8           |
+//! | 5   | symbol     | length, then that many bytes of UTF-8           |
+//! | 6   | array      | count, then that many values                    |
+//! | 7   | dictionary | count, then that many (key, value) pairs        |
+//!
+//! Lengths and counts are unsigned LEB128 varints, and a key is encoded as
+//! a length and its UTF-8 bytes, without a tag. A record, the data of one
+//! evaluation, is a dictionary value; nil is accepted as an empty one.
+//! Nesting deeper than `MAX_RECORD_DEPTH` is rejected.
+
+use crate::paths::DataPaths;
+use amoskeag_stdlib_operators::{Symbol, Value};
+use std::collections::HashMap;
+use thiserror::Error;
+
+/// Maximum nesting depth of decoded values
+pub const MAX_RECORD_DEPTH: usize = 100;
+
+const NIL: u8 = 0;
+const FALSE: u8 = 1;
+const TRUE: u8 = 2;
+const NUMBER: u8 = 3;
+const STRING: u8 = 4;
+const SYMBOL: u8 = 5;
+const ARRAY: u8 = 6;
+const DICTIONARY: u8 = 7;
+
+/// Errors that can occur decoding a record
+#[derive(Error, Debug, PartialEq)]
+pub enum RecordError {
+    #[error("Record is truncated")]
+    Truncated,
+
+    #[error("Record is malformed: {0}")]
+    Malformed(&'static str),
+
+    #[error("Record nesting too deep (max {MAX_RECORD_DEPTH} levels)")]
+    TooDeep,
+
+    #[error("Record is not a dictionary")]
+    NotADictionary,
+}
+
+/// Append the encoding of `value` to `out`
+pub fn encode_value(value: &Value, out: &mut Vec<u8>) {
+    match value {
+        Value::Nil => out.push(NIL),
+        Value::Boolean(false) => out.push(FALSE),
+        Value::Boolean(true) => out.push(TRUE),
+        Value::Number(n) => {
+            out.push(NUMBER);
+            out.extend_from_slice(&n.to_le_bytes());
+        }
+        Value::String(s) => {
+            out.push(STRING);
+            write_str(out, s);
+        }
+        Value::Symbol(symbol) => {
+            out.push(SYMBOL);
+            write_str(out, symbol.as_str());
+        }
+        Value::Array(items) => {
+            out.push(ARRAY);
+            write_varint(out, items.len());
+            for item in items {
+                encode_value(item, out);
+            }
+        }
+        Value::Dictionary(map) => encode_data(map, out),
+    }
+}
+
+/// Append the encoding of a data dictionary to `out`, as a record
+pub fn encode_data(data: &HashMap<String, Value>, out: &mut Vec<u8>) {
+    out.push(DICTIONARY);
+    write_varint(out, data.len());
+    for (key, value) in data {
+        write_str(out, key);
+        encode_value(value, out);
+    }
+}
+
+/// Decode a value encoded by [`encode_value`]
+///
+/// # Errors
+/// Returns an error if `bytes` isn't exactly one well-formed value.
+pub fn value_from_record(bytes: &[u8]) -> Result<Value, RecordError> {
+    let mut reader = Reader { bytes };
+    let value = reader.value(0)?;
+    reader.finish()?;
+    Ok(value)
+}
+
+/// Decode a record into a data dictionary
+///
+/// # Errors
+/// Returns an error if `bytes` isn't exactly one well-formed dictionary or
+/// nil.
+pub fn data_from_record(bytes: &[u8]) -> Result<HashMap<String, Value>, RecordError> {
+    let mut data = HashMap::new();
+    let mut reader = Reader { bytes };
+    reader.data(None, &mut data, None)?;
+    reader.finish()?;
+    Ok(data)
+}
+
+/// Decode the parts of a record in `paths` into a data dictionary
+///
+/// Behaves like [`data_from_json_str_projected`](crate::data_from_json_str_projected):
+/// fields outside `paths` are skipped without being copied, and the
+/// program the paths come from evaluates exactly as it would on the full
+/// data.
+pub fn data_from_record_projected(
+    bytes: &[u8],
+    paths: &DataPaths,
+) -> Result<HashMap<String, Value>, RecordError> {
+    let mut data = HashMap::new();
+    let mut reader = Reader { bytes };
+    reader.data(Some(paths), &mut data, None)?;
+    reader.finish()?;
+    Ok(data)
+}
+
+/// Decode the record at the start of `bytes` into `data`, replacing what it
+/// held, and return the bytes after it
+///
+/// `spare` is scratch space kept with `data` between calls. The entries of
+/// the previous record are moved there, and each key this record shares
+/// with it is moved back rather than copied. Between them, the two tables
+/// stay allocated from one record to the next, so with records that share
+/// their keys, the only allocations are the values.
+pub(crate) fn decode_data_into<'b>(
+    bytes: &'b [u8],
+    paths: Option<&DataPaths>,
+    data: &mut HashMap<String, Value>,
+    spare: &mut HashMap<String, Value>,
+) -> Result<&'b [u8], RecordError> {
+    std::mem::swap(data, spare);
+    data.clear();
+    let mut reader = Reader { bytes };
+    let result = reader.data(paths, data, Some(spare));
+    // The keys left over were in the previous record only
+    spare.clear();
+    result?;
+    Ok(reader.bytes)
+}
+
+pub(crate) fn write_varint(out: &mut Vec<u8>, n: usize) {
+    let mut n = n as u64;
+    while n >= 0x80 {
+        out.push(n as u8 | 0x80);
+        n >>= 7;
+    }
+    out.push(n as u8);
+}
+
+pub(crate) fn write_str(out: &mut Vec<u8>, s: &str) {
+    write_varint(out, s.len());
+    out.extend_from_slice(s.as_bytes());
+}
+
+/// Reads values front to back
+struct Reader<'b> {
+    bytes: &'b [u8],
+}
+
+impl<'b> Reader<'b> {
+    fn finish(&self) -> Result<(), RecordError> {
+        if self.bytes.is_empty() {
+            Ok(())
+        } else {
+            Err(RecordError::Malformed("trailing bytes"))
+        }
+    }
+
+    fn bytes(&mut self, len: usize) -> Result<&'b [u8], RecordError> {
+        if len > self.bytes.len() {
+            return Err(RecordError::Truncated);
+        }
+        let (head, rest) = self.bytes.split_at(len);
+        self.bytes = rest;
+        Ok(head)
+    }
+
+    fn byte(&mut self) -> Result<u8, RecordError> {
+        Ok(self.bytes(1)?[0])
+    }
+
+    /// A count or length; callers check it against what is there before
+    /// allocating for it
+    fn varint(&mut self) -> Result<usize, RecordError> {
+        let mut n: u64 = 0;
+        for shift in (0..64).step_by(7) {
+            let byte = self.byte()?;
+            n |= u64::from(byte & 0x7f) << shift;
+            if byte & 0x80 == 0 {
+                return usize::try_from(n).map_err(|_| RecordError::Malformed("count too large"));
+            }
+        }
+        Err(RecordError::Malformed("varint too long"))
+    }
+
+    fn str(&mut self) -> Result<&'b str, RecordError> {
+        let len = self.varint()?;
+        std::str::from_utf8(self.bytes(len)?).map_err(|_| RecordError::Malformed("invalid UTF-8"))
+    }
+
+    /// A record: a dictionary, or nil for an empty one, decoded into `data`
+    ///
+    /// Keys found in `spare` are moved from it instead of copied.
+    fn data(
+        &mut self,
+        paths: Option<&DataPaths>,
+        data: &mut HashMap<String, Value>,
+        spare: Option<&mut HashMap<String, Value>>,
+    ) -> Result<(), RecordError> {
+        match self.byte()? {
+            NIL => Ok(()),
+            DICTIONARY => self.entries(paths, data, 1, spare),
+            _ => Err(RecordError::NotADictionary),
+        }
+    }
+
+    /// The entries of a dictionary whose values are at `depth`; only those
+    /// in `paths` when there are paths
+    ///
+    /// Keys found in `spare` are moved from it instead of copied.
+    fn entries(
+        &mut self,
+        paths: Option<&DataPaths>,
+        map: &mut HashMap<String, Value>,
+        depth: usize,
+        mut spare: Option<&mut HashMap<String, Value>>,
+    ) -> Result<(), RecordError> {
+        let count = self.varint()?;
+        // Every entry takes at least two bytes
+        map.reserve(count.min(self.bytes.len() / 2));
+        for _ in 0..count {
+            let key = self.str()?;
+            let value = match paths.map(|paths| paths.get(key)) {
+                None => self.value(depth)?,
+                Some(None) => {
+                    self.skip(depth)?;
+                    continue;
+                }
+                Some(Some(field)) if field.is_whole() => self.value(depth)?,
+                Some(Some(field)) => self.projected(field, depth)?,
+            };
+            let key = match spare
+                .as_deref_mut()
+                .and_then(|spare| spare.remove_entry(key))
+            {
+                Some((key, _)) => key,
+                None => key.to_string(),
+            };
+            map.insert(key, value);
+        }
+        Ok(())
+    }
+
+    fn value(&mut self, depth: usize) -> Result<Value, RecordError> {
+        if depth > MAX_RECORD_DEPTH {
+            return Err(RecordError::TooDeep);
+        }
+        Ok(match self.byte()? {
+            NIL => Value::Nil,
+            FALSE => Value::Boolean(false),
+            TRUE => Value::Boolean(true),
+            NUMBER => Value::Number(f64::from_le_bytes(
+                self.bytes(8)?.try_into().expect("8 bytes"),
+            )),
+            STRING => Value::String(self.str()?.to_string()),
+            // Records come from outside, so their names mustn't grow the
+            // process-wide symbol table
+            SYMBOL => Value::Symbol(Symbol::lookup(self.str()?)),
+            ARRAY => {
+                let count = self.varint()?;
+                // Every value takes at least a byte
+                let mut items = Vec::with_capacity(count.min(self.bytes.len()));
+                for _ in 0..count {
+                    items.push(self.value(depth + 1)?);
+                }
+                Value::Array(items)
+            }
+            DICTIONARY => {
+                let mut map = HashMap::new();
+                self.entries(None, &mut map, depth + 1, None)?;
+                Value::Dictionary(map)
+            }
+            _ => return Err(RecordError::Malformed("unknown tag")),
+        })
+    }
+
+    /// The parts of a value in `paths`, which doesn't read it whole
+    ///
+    /// Only the fields of a dictionary can be reached; any other value is
+    /// nil.
+    fn projected(&mut self, paths: &DataPaths, depth: usize) -> Result<Value, RecordError> {
+        if depth > MAX_RECORD_DEPTH {
+            return Err(RecordError::TooDeep);
+        }
+        if self.bytes.first() == Some(&DICTIONARY) {
+            self.byte()?;
+            let mut map = HashMap::new();
+            self.entries(Some(paths), &mut map, depth + 1, None)?;
+            Ok(Value::Dictionary(map))
+        } else {
+            self.skip(depth)?;
+            Ok(Value::Nil)
+        }
+    }
+
+    /// Step over a value without decoding it
+    ///
+    /// Skipped values are checked to be well-formed, but their strings
+    /// aren't checked to be UTF-8.
+    fn skip(&mut self, depth: usize) -> Result<(), RecordError> {
+        if depth > MAX_RECORD_DEPTH {
+            return Err(RecordError::TooDeep);
+        }
+        match self.byte()? {
+            NIL | FALSE | TRUE => {}
+            NUMBER => {
+                self.bytes(8)?;
+            }
+            STRING | SYMBOL => {
+                let len = self.varint()?;
+                self.bytes(len)?;
+            }
+            ARRAY => {
+                for _ in 0..self.varint()? {
+                    self.skip(depth + 1)?;
+                }
+            }
+            DICTIONARY => {
+                for _ in 0..self.varint()? {
+                    let len = self.varint()?;
+                    self.bytes(len)?;
+                    self.skip(depth + 1)?;
+                }
+            }
+            _ => return Err(RecordError::Malformed("unknown tag")),
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, data_from_json_str, evaluate};
+
+    const DATA: &str = r#"{
+        "applicant": {"age": 34, "name": "Ada", "tags": ["a", "b"], "vehicle": {"value": 12000.5}},
+        "flags": [true, false, null],
+        "env": {"limits": {"max": 50000}},
+        "empty": {}
+    }"#;
+
+    fn encoded(data: &HashMap<String, Value>) -> Vec<u8> {
+        let mut out = Vec::new();
+        encode_data(data, &mut out);
+        out
+    }
+
+    #[test]
+    fn test_round_trip() {
+        let mut data = data_from_json_str(DATA).unwrap();
+        data.insert("status".to_string(), Value::Symbol(Symbol::new("approved")));
+        let bytes = encoded(&data);
+        assert_eq!(data_from_record(&bytes).unwrap(), data);
+        assert_eq!(
+            value_from_record(&bytes).unwrap(),
+            Value::Dictionary(data.clone())
+        );
+        assert!(data_from_record(&[NIL]).unwrap().is_empty());
+    }
+
+    #[test]
+    fn test_decoded_symbols_match_program_symbols() {
+        let program = compile("if status == :approved then 1 else 2 end", &["approved"]).unwrap();
+        for (name, expected) in [("approved", 1.0), ("record-only-symbol", 2.0)] {
+            let data = HashMap::from([("status".to_string(), Value::Symbol(Symbol::lookup(name)))]);
+            let decoded = data_from_record(&encoded(&data)).unwrap();
+            assert_eq!(decoded, data);
+            assert_eq!(
+                evaluate(&program, &decoded).unwrap(),
+                Value::Number(expected)
+            );
+        }
+    }
+
+    #[test]
+    fn test_decoding_into_reused_tables() {
+        let records = [
+            r#"{"a": 1, "b": "x"}"#,
+            r#"{"b": "y", "c": [2]}"#,
+            "{}",
+            r#"{"a": 3}"#,
+        ];
+        let (mut data, mut spare) = (HashMap::new(), HashMap::new());
+        for json in records {
+            let expected = data_from_json_str(json).unwrap();
+            let bytes = encoded(&expected);
+            let rest = decode_data_into(&bytes, None, &mut data, &mut spare).unwrap();
+            assert!(rest.is_empty());
+            // Keys only the previous record had are gone
+            assert_eq!(data, expected, "{}", json);
+            assert!(spare.is_empty());
+        }
+
+        // A repeated key keeps its last value, as with a fresh table
+        let mut bytes = vec![DICTIONARY, 2];
+        for n in [1.0f64, 2.0] {
+            write_str(&mut bytes, "a");
+            bytes.push(NUMBER);
+            bytes.extend_from_slice(&n.to_le_bytes());
+        }
+        decode_data_into(&bytes, None, &mut data, &mut spare).unwrap();
+        assert_eq!(data, HashMap::from([("a".to_string(), Value::Number(2.0))]));
+    }
+
+    #[test]
+    fn test_projected_decoding_matches_full_data() {
+        let data = data_from_json_str(DATA).unwrap();
+        let bytes = encoded(&data);
+        for source in [
+            "applicant.vehicle.value + env.limits.max",
+            "size(applicant.tags) + applicant.age",
+            "applicant.name.first",
+            "let a = applicant in a.age",
+        ] {
+            let program = compile(source, &[]).unwrap();
+            let projected = data_from_record_projected(&bytes, program.required_paths()).unwrap();
+            assert!(!projected.contains_key("flags"));
+            assert_eq!(
+                evaluate(&program, &projected).unwrap(),
+                evaluate(&program, &data).unwrap()
+            );
+        }
+    }
+
+    #[test]
+    fn test_malformed_records_are_rejected() {
+        let bytes = encoded(&data_from_json_str(DATA).unwrap());
+        for len in 0..bytes.len() {
+            assert!(data_from_record(&bytes[..len]).is_err());
+        }
+        assert_eq!(
+            data_from_record(&[TRUE]).unwrap_err(),
+            RecordError::NotADictionary
+        );
+        assert_eq!(
+            data_from_record(&[NIL, NIL]).unwrap_err(),
+            RecordError::Malformed("trailing bytes")
+        );
+        assert_eq!(
+            data_from_record(&[DICTIONARY, 1, 1, b'k', 99]).unwrap_err(),
+            RecordError::Malformed("unknown tag")
+        );
+        assert_eq!(
+            data_from_record(&[DICTIONARY, 1, 1, 0xff, NIL]).unwrap_err(),
+            RecordError::Malformed("invalid UTF-8")
+        );
+
+        let mut deep = vec![DICTIONARY, 1, 1, b'k'];
+        deep.extend([ARRAY, 1].repeat(MAX_RECORD_DEPTH + 1));
+        deep.push(NIL);
+        assert_eq!(data_from_record(&deep).unwrap_err(), RecordError::TooDeep);
+    }
+}
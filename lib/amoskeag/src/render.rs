@@ -0,0 +1,227 @@
+//! Streaming rendering into a writer
+//!
+//! Templates build their output with `+`, as in `"<h1>" + title + "</h1>"`,
+//! and a host usually writes the resulting string out at once. `render`
+//! writes the same text, but never builds that string: once the sum of a
+//! chain of `+` is a string, every operand added after it can only be
+//! appended to it, so each is written to the writer as soon as it is
+//! evaluated. Branches of an `if` and bodies of a `let` are rendered the
+//! same way, as are operands that are themselves chains, so a page is
+//! written in one pass, in time linear in its length, through the caller's
+//! buffer.
+//!
+//! ```
+//! use amoskeag::{compile, render, AmoskeagValue as Value};
+//! use std::collections::HashMap;
+//!
+//! let program = compile(r#""Hello, " + name + "! You have " + count + " messages.""#, &[])
+//!     .unwrap();
+//! let data = HashMap::from([
+//!     ("name".to_string(), Value::String("Ada".to_string())),
+//!     ("count".to_string(), Value::Number(3.0)),
+//! ]);
+//!
+//! let mut page = Vec::new();
+//! render(&program, &data, &mut page).unwrap();
+//! assert_eq!(page, b"Hello, Ada! You have 3 messages.");
+//! ```
+
+use crate::metrics::{self, BackendSlot};
+use crate::resolve::Node;
+use crate::{eval_node_ref, is_truthy, CompiledProgram, Context, EvalError, NATIVE_DEPTH};
+use amoskeag_stdlib_operators::{add_owned, Value};
+use std::borrow::Cow;
+use std::collections::HashMap;
+use std::io::{self, Write};
+use thiserror::Error;
+
+/// Errors that can occur rendering a program
+#[derive(Error, Debug)]
+pub enum RenderError {
+    #[error(transparent)]
+    Eval(#[from] EvalError),
+
+    #[error("Failed to write output: {0}")]
+    Io(#[from] io::Error),
+}
+
+/// Evaluate a compiled program, writing its result to `out`
+///
+/// Writes exactly the text of `evaluate(program, data)?.to_string()`: a
+/// string as it is, and any other value as it is displayed, the way `+`
+/// appends it to a string. Many small writes are made, so `out` should be
+/// buffered.
+///
+/// # Errors
+///
+/// Fails as `evaluate` would, or if writing fails. Text rendered before the
+/// failure has already been written.
+pub fn render<W: Write>(
+    program: &CompiledProgram,
+    data: &HashMap<String, Value>,
+    out: &mut W,
+) -> Result<(), RenderError> {
+    let context = Context::new(data);
+    metrics::evaluation(Some(&program.metrics), BackendSlot::Interpreter, || {
+        render_node(&program.resolved, &context, 0, out)
+    })
+}
+
+/// Render a resolved expression nested `depth` levels deep
+fn render_node<W: Write>(
+    mut node: &Node,
+    context: &Context<'_>,
+    depth: usize,
+    out: &mut W,
+) -> Result<(), RenderError> {
+    // Deeper nodes are evaluated whole, which bounds the native stack
+    if depth < NATIVE_DEPTH {
+        // Branches continue here instead of recursing
+        loop {
+            match node {
+                Node::If {
+                    condition,
+                    then_branch,
+                    else_branch,
+                } => {
+                    let condition = eval_node_ref(condition, context, depth + 1)?;
+                    node = if is_truthy(&condition) {
+                        then_branch
+                    } else {
+                        else_branch
+                    };
+                }
+                Node::Let { name, value, body } => {
+                    let value = eval_node_ref(value, context, depth + 1)?;
+                    let context = context.with_local(name, value);
+                    return render_node(body, &context, depth + 1, out);
+                }
+                Node::Add(operands) => return render_sum(operands, context, depth + 1, out),
+                _ => break,
+            }
+        }
+    }
+    let value = eval_node_ref(node, context, depth)?;
+    write_value(&value, out)
+}
+
+/// Render a chain of `+`
+///
+/// Operands are added up as `eval_sum` would until the sum is a string.
+/// From there on, each is rendered straight after it.
+fn render_sum<W: Write>(
+    operands: &[Node],
+    context: &Context<'_>,
+    depth: usize,
+    out: &mut W,
+) -> Result<(), RenderError> {
+    let mut sum = eval_node_ref(&operands[0], context, depth)?;
+    let mut rest = operands[1..].iter();
+    while !matches!(*sum, Value::String(_)) {
+        let Some(operand) = rest.next() else {
+            return write_value(&sum, out);
+        };
+        let value = eval_node_ref(operand, context, depth)?;
+        sum = Cow::Owned(add_owned(sum.into_owned(), &value).map_err(EvalError::from)?);
+    }
+    write_value(&sum, out)?;
+    for operand in rest {
+        render_node(operand, context, depth, out)?;
+    }
+    Ok(())
+}
+
+fn write_value<W: Write>(value: &Value, out: &mut W) -> Result<(), RenderError> {
+    match value {
+        Value::String(s) => out.write_all(s.as_bytes())?,
+        value => write!(out, "{}", value)?,
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{compile, evaluate};
+
+    fn data() -> HashMap<String, Value> {
+        HashMap::from([
+            ("name".to_string(), Value::String("Ada".to_string())),
+            ("x".to_string(), Value::Number(2.5)),
+            ("admin".to_string(), Value::Boolean(true)),
+            (
+                "tags".to_string(),
+                Value::Array(vec![Value::String("a".to_string())]),
+            ),
+        ])
+    }
+
+    fn rendered(source: &str) -> Result<String, RenderError> {
+        let program = compile(source, &["ok"]).unwrap();
+        let mut out = Vec::new();
+        render(&program, &data(), &mut out)?;
+        Ok(String::from_utf8(out).unwrap())
+    }
+
+    #[test]
+    fn test_render_matches_evaluate() {
+        let sources = [
+            "name",
+            "x",
+            ":ok",
+            "tags",
+            "name + \"!\"",
+            "\"<b>\" + name + \"</b> \" + x + tags + nil + admin",
+            "x + x + x",
+            "if admin \"Welcome back, \" + name + \"!\" else \"Welcome\" end",
+            "let greeting = \"Hi \" + name in greeting + \", \" + x + \" points\"",
+            "\"a\" + (\"b\" + name + \"c\") + (if admin x + 1 + 2 else 0 end) + \"d\"",
+            "let name = upcase(name) in \"<p>\" + name + \"</p>\"",
+        ];
+        let data = data();
+        for source in sources {
+            let program = compile(source, &["ok"]).unwrap();
+            let expected = evaluate(&program, &data).unwrap().to_string();
+            assert_eq!(rendered(source).unwrap(), expected, "{}", source);
+        }
+    }
+
+    #[test]
+    fn test_render_errors() {
+        assert!(matches!(
+            rendered("x + nil + name + missing"),
+            Err(RenderError::Eval(EvalError::OperatorError(_)))
+        ));
+        assert!(matches!(
+            rendered("name + \" \" + missing"),
+            Err(RenderError::Eval(EvalError::VariableNotFound(_)))
+        ));
+
+        struct Full;
+        impl Write for Full {
+            fn write(&mut self, _: &[u8]) -> io::Result<usize> {
+                Err(io::ErrorKind::WriteZero.into())
+            }
+            fn flush(&mut self) -> io::Result<()> {
+                Ok(())
+            }
+        }
+        let program = compile("name + \"!\" + name", &[]).unwrap();
+        assert!(matches!(
+            render(&program, &data(), &mut Full),
+            Err(RenderError::Io(_))
+        ));
+    }
+
+    #[test]
+    fn test_render_deep_templates() {
+        // Nested past NATIVE_DEPTH on the right, and long on the left
+        let nested = format!("{}name{}", "\"(\" + (".repeat(100), ") + \")\"".repeat(100));
+        let long = vec!["name"; 5_000].join(" + \", \" + ");
+        for source in [nested, long] {
+            let program = compile(&source, &[]).unwrap();
+            let expected = evaluate(&program, &data()).unwrap().to_string();
+            assert_eq!(rendered(&source).unwrap(), expected);
+        }
+    }
+}
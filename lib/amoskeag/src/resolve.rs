@@ -0,0 +1,648 @@
+//! Name resolution
+//!
+//! `compile` lowers the parsed AST into a `Node` tree in which every function
+//! call carries its function id and every literal is already a `Value`. The
+//! interpreter evaluates this tree, so evaluation never compares a function
+//! name or rebuilds a literal. Arrays and dictionaries whose elements are all
+//! literals become literals themselves, `contains` on a large literal array
+//! becomes a lookup in a set built once at compile time, and chains of
+//! collection calls are fused into pipelines (see `pipeline`). A chain of
+//! `+`, such as a template built from many strings, becomes one `Node::Add`
+//! that adds each operand to a single sum in place.
+
+use crate::pipeline::{self, Sink, Stage};
+use crate::profile::Sites;
+use crate::{functions, CompileError};
+use amoskeag_parser::{BinaryOp, Expr, UnaryOp};
+use amoskeag_stdlib_functions::ValueSet;
+use amoskeag_stdlib_operators::Value;
+use std::cell::RefCell;
+use std::collections::{HashMap, HashSet};
+
+/// Smallest literal array that `contains` looks up through a hash set;
+/// scanning is as fast below this
+const MEMBER_SET_MIN_LEN: usize = 8;
+
+/// A resolved expression
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) enum Node {
+    /// A number, string, boolean, nil, or symbol literal
+    Literal(Value),
+    Array(Vec<Node>),
+    Dictionary(Vec<(String, Node)>),
+    Variable(Vec<String>),
+    /// A stdlib call; `func` is an index into `functions::FUNCTIONS`
+    Call {
+        func: usize,
+        args: Vec<Node>,
+    },
+    /// A fused chain of collection calls, such as `map('price') | sort | first`
+    Pipeline {
+        source: Box<Node>,
+        stages: Vec<Stage>,
+        sink: Sink,
+    },
+    /// `contains(array, value)` with a literal `array`, as a set lookup
+    Member {
+        set: ValueSet,
+        value: Box<Node>,
+    },
+    Let {
+        name: String,
+        value: Box<Node>,
+        body: Box<Node>,
+    },
+    If {
+        condition: Box<Node>,
+        then_branch: Box<Node>,
+        else_branch: Box<Node>,
+    },
+    Binary {
+        op: BinaryOp,
+        left: Box<Node>,
+        right: Box<Node>,
+    },
+    /// A chain of `+`, `a + b + c + ...`, with at least three operands;
+    /// evaluated left to right as the nested operators would be, but into
+    /// one sum, so a string is extended in place rather than copied at
+    /// every step
+    Add(Vec<Node>),
+    Unary {
+        op: UnaryOp,
+        operand: Box<Node>,
+    },
+    /// A node of a profiled program; `site` indexes its `Sites` table
+    Probe {
+        site: usize,
+        node: Box<Node>,
+    },
+    /// A subexpression shared by the rules of a `RuleSet`, evaluated at most
+    /// once per record; `usize` indexes its shared nodes
+    Shared(usize),
+    /// An expression that can only fail at run time, such as an invalid pipe
+    /// target; evaluating it raises a type error
+    Invalid {
+        expected: String,
+        got: String,
+    },
+}
+
+/// Validate an AST against the symbol table and resolve it
+pub(crate) fn resolve(expr: &Expr, symbols: &HashSet<String>) -> Result<Node, CompileError> {
+    Resolver {
+        symbols: Some(symbols),
+        sites: None,
+        shared: None,
+    }
+    .node(expr)
+}
+
+/// Validate an AST against the symbol table without resolving it
+///
+/// Reports the same first error as `resolve`, but builds no nodes: no
+/// literal is folded, no set built and no pipeline fused. The walk keeps its
+/// own stack, so long chains take no native stack.
+pub(crate) fn validate(expr: &Expr, symbols: &HashSet<String>) -> Result<(), CompileError> {
+    /// An expression to check, or a call to check once its arguments are
+    enum Check<'e> {
+        Expr(&'e Expr),
+        Call(&'e str, usize),
+    }
+
+    // Pushed in reverse, so expressions are checked left to right and calls
+    // after their arguments, in the order `resolve` reports them
+    let mut stack = vec![Check::Expr(expr)];
+    while let Some(check) = stack.pop() {
+        let expr = match check {
+            Check::Expr(expr) => expr,
+            Check::Call(name, argc) => {
+                functions::resolve(name, argc)?;
+                continue;
+            }
+        };
+        match expr {
+            Expr::Number(_) | Expr::String(_) | Expr::Boolean(_) | Expr::Nil => {}
+            Expr::Variable(_) => {}
+            Expr::Symbol(s) => {
+                if !symbols.contains(s) {
+                    return Err(CompileError::UndefinedSymbol { symbol: s.clone() });
+                }
+            }
+            Expr::Array(exprs) => stack.extend(exprs.iter().rev().map(Check::Expr)),
+            Expr::Dictionary(pairs) => {
+                stack.extend(pairs.iter().rev().map(|(_, e)| Check::Expr(e)))
+            }
+            Expr::FunctionCall { name, args } => {
+                stack.push(Check::Call(name, args.len()));
+                stack.extend(args.iter().rev().map(Check::Expr));
+            }
+            Expr::Let { value, body, .. } => {
+                stack.push(Check::Expr(body));
+                stack.push(Check::Expr(value));
+            }
+            Expr::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => {
+                stack.push(Check::Expr(else_branch));
+                stack.push(Check::Expr(then_branch));
+                stack.push(Check::Expr(condition));
+            }
+            Expr::Binary { left, right, .. } => {
+                stack.push(Check::Expr(right));
+                stack.push(Check::Expr(left));
+            }
+            Expr::Unary { operand, .. } => stack.push(Check::Expr(operand)),
+            // An invalid pipe target is a run-time error, as in `lower`
+            Expr::Pipe { left, right } => match right.as_ref() {
+                Expr::FunctionCall { name, args } => {
+                    stack.push(Check::Call(name, args.len() + 1));
+                    stack.extend(args.iter().rev().map(Check::Expr));
+                    stack.push(Check::Expr(left));
+                }
+                Expr::Variable(path) if path.len() == 1 => {
+                    stack.push(Check::Call(&path[0], 1));
+                    stack.push(Check::Expr(left));
+                }
+                _ => {}
+            },
+        }
+    }
+    Ok(())
+}
+
+/// Resolve an AST without validating it
+///
+/// Undefined functions and arity mismatches become `Node::Invalid` so they
+/// are reported when evaluation reaches them, as with any other run-time
+/// error. Symbols are not checked.
+pub(crate) fn resolve_unchecked(expr: &Expr) -> Node {
+    Resolver {
+        symbols: None,
+        sites: None,
+        shared: None,
+    }
+    .node(expr)
+    .expect("unchecked resolution cannot fail")
+}
+
+/// Resolve an AST without validating it, wrapping every node that isn't a
+/// literal in a `Probe`
+///
+/// Expressions are registered in `sites` in pre-order, as they are visited.
+pub(crate) fn resolve_probed(expr: &Expr, sites: Sites) -> (Node, Sites) {
+    let sites = RefCell::new(sites);
+    let node = Resolver {
+        symbols: None,
+        sites: Some(&sites),
+        shared: None,
+    }
+    .node(expr)
+    .expect("unchecked resolution cannot fail");
+    (node, sites.into_inner())
+}
+
+/// Resolve an AST without validating it, replacing each subexpression in
+/// `shared` by a `Node::Shared` of its slot
+///
+/// Subexpressions are identified by address, so `shared` must point into
+/// `expr` itself. With `definition`, `expr` is the subexpression a slot
+/// stands for and is lowered without being replaced by its own slot.
+pub(crate) fn resolve_shared(
+    expr: &Expr,
+    shared: &HashMap<*const Expr, usize>,
+    definition: bool,
+) -> Node {
+    let resolver = Resolver {
+        symbols: None,
+        sites: None,
+        shared: Some(shared),
+    };
+    if definition {
+        resolver.lower(expr)
+    } else {
+        resolver.node(expr)
+    }
+    .expect("unchecked resolution cannot fail")
+}
+
+struct Resolver<'s> {
+    /// The symbol table, or `None` to skip validation
+    symbols: Option<&'s HashSet<String>>,
+    /// Where to register probes, when resolving for the profiler
+    sites: Option<&'s RefCell<Sites>>,
+    /// The slots of the subexpressions a `RuleSet` shares, by address
+    shared: Option<&'s HashMap<*const Expr, usize>>,
+}
+
+/// An expression on a chain, waiting for the next expression along it
+enum Link<'e> {
+    /// A `let` waiting for its body
+    Let { name: &'e str, value: Node },
+    /// An `if` waiting for its `else` branch
+    If { condition: Node, then_branch: Node },
+    /// A binary operator waiting for its left operand
+    Binary { op: BinaryOp, right: &'e Expr },
+}
+
+impl Resolver<'_> {
+    fn node(&self, expr: &Expr) -> Result<Node, CompileError> {
+        if let Some(slot) = self.slot(expr) {
+            return Ok(Node::Shared(slot));
+        }
+        match (expr, self.sites) {
+            (Expr::Let { .. } | Expr::If { .. } | Expr::Binary { .. }, _) => self.chain(expr),
+            (_, None) => self.lower(expr),
+            (_, Some(sites)) => self.probed(sites, expr),
+        }
+    }
+
+    /// Lower a chain of `let` bodies, `else` branches and left operands in
+    /// a loop
+    ///
+    /// Generated rules chain hundreds of these, such as long `else if`
+    /// ladders and sums, and lowering each link recursively would take
+    /// native stack in proportion. Only the other subexpressions recurse.
+    /// Sites are registered in the same pre-order as by `probed`.
+    #[inline(never)]
+    fn chain(&self, mut expr: &Expr) -> Result<Node, CompileError> {
+        let mut links = Vec::new();
+        loop {
+            let site = self.sites.map(|sites| sites.borrow_mut().enter(expr));
+            let (link, next) = match expr {
+                Expr::Let { name, value, body } => (
+                    Link::Let {
+                        name,
+                        value: self.node(value)?,
+                    },
+                    body,
+                ),
+                Expr::If {
+                    condition,
+                    then_branch,
+                    else_branch,
+                } => (
+                    Link::If {
+                        condition: self.node(condition)?,
+                        then_branch: self.node(then_branch)?,
+                    },
+                    else_branch,
+                ),
+                Expr::Binary { op, left, right } => (Link::Binary { op: *op, right }, left),
+                _ => unreachable!("only chain links are registered"),
+            };
+            links.push((link, site));
+            expr = next;
+            if !matches!(
+                expr,
+                Expr::Let { .. } | Expr::If { .. } | Expr::Binary { .. }
+            ) || self.slot(expr).is_some()
+            {
+                break;
+            }
+        }
+
+        let mut node = self.node(expr)?;
+        for (link, site) in links.into_iter().rev() {
+            node = match link {
+                Link::Let { name, value } => Node::Let {
+                    name: name.to_string(),
+                    value: Box::new(value),
+                    body: Box::new(node),
+                },
+                Link::If {
+                    condition,
+                    then_branch,
+                } => Node::If {
+                    condition: Box::new(condition),
+                    then_branch: Box::new(then_branch),
+                    else_branch: Box::new(node),
+                },
+                // Probed programs keep every operator, to time each one
+                Link::Binary {
+                    op: BinaryOp::Add,
+                    right,
+                } if site.is_none() => add(node, self.node(right)?),
+                Link::Binary { op, right } => Node::Binary {
+                    op,
+                    left: Box::new(node),
+                    right: Box::new(self.node(right)?),
+                },
+            };
+            if let Some(site) = site {
+                self.sites
+                    .expect("sites are registered")
+                    .borrow_mut()
+                    .exit();
+                node = Node::Probe {
+                    site,
+                    node: Box::new(node),
+                };
+            }
+        }
+        Ok(node)
+    }
+
+    /// The slot of a shared subexpression
+    fn slot(&self, expr: &Expr) -> Option<usize> {
+        self.shared?.get(&(expr as *const Expr)).copied()
+    }
+
+    /// Lower an expression, registering it as a site and wrapping it in its
+    /// probe
+    ///
+    /// Sites are registered before their subexpressions, in pre-order.
+    #[inline(never)]
+    fn probed(&self, sites: &RefCell<Sites>, expr: &Expr) -> Result<Node, CompileError> {
+        let site = sites.borrow_mut().enter(expr);
+        let node = self.lower(expr)?;
+        sites.borrow_mut().exit();
+        Ok(match node {
+            // Literals cost nothing to evaluate
+            Node::Literal(_) => node,
+            node => Node::Probe {
+                site,
+                node: Box::new(node),
+            },
+        })
+    }
+
+    fn lower(&self, expr: &Expr) -> Result<Node, CompileError> {
+        Ok(match expr {
+            Expr::Number(n) => Node::Literal(Value::Number(*n)),
+            Expr::String(s) => Node::Literal(Value::String(s.clone())),
+            Expr::Boolean(b) => Node::Literal(Value::Boolean(*b)),
+            Expr::Nil => Node::Literal(Value::Nil),
+            Expr::Symbol(s) => {
+                if let Some(symbols) = self.symbols {
+                    if !symbols.contains(s) {
+                        return Err(CompileError::UndefinedSymbol { symbol: s.clone() });
+                    }
+                }
+                Node::Literal(Value::Symbol(s.into()))
+            }
+
+            Expr::Array(exprs) => {
+                let nodes = self.nodes(exprs)?;
+                if nodes.iter().all(|n| matches!(n, Node::Literal(_))) {
+                    Node::Literal(Value::Array(nodes.into_iter().map(literal).collect()))
+                } else {
+                    Node::Array(nodes)
+                }
+            }
+
+            Expr::Dictionary(pairs) => {
+                let pairs: Vec<(String, Node)> = pairs
+                    .iter()
+                    .map(|(key, e)| Ok((key.clone(), self.node(e)?)))
+                    .collect::<Result<_, CompileError>>()?;
+                if pairs.iter().all(|(_, n)| matches!(n, Node::Literal(_))) {
+                    let map: HashMap<String, Value> =
+                        pairs.into_iter().map(|(k, n)| (k, literal(n))).collect();
+                    Node::Literal(Value::Dictionary(map))
+                } else {
+                    Node::Dictionary(pairs)
+                }
+            }
+
+            Expr::Variable(path) => Node::Variable(path.clone()),
+
+            Expr::FunctionCall { name, args } => {
+                let args = self.nodes(args)?;
+                self.call(name, args)?
+            }
+
+            Expr::Let { .. } | Expr::If { .. } | Expr::Binary { .. } => self.chain(expr)?,
+
+            Expr::Unary { op, operand } => Node::Unary {
+                op: *op,
+                operand: Box::new(self.node(operand)?),
+            },
+
+            // The parser desugars pipes into calls; this handles hand-built
+            // ASTs by prepending the left value as the first argument
+            Expr::Pipe { left, right } => match right.as_ref() {
+                Expr::FunctionCall { name, args } => {
+                    let mut new_args = Vec::with_capacity(args.len() + 1);
+                    new_args.push(self.node(left)?);
+                    for arg in args {
+                        new_args.push(self.node(arg)?);
+                    }
+                    self.call(name, new_args)?
+                }
+                Expr::Variable(path) if path.len() == 1 => {
+                    let left = self.node(left)?;
+                    self.call(&path[0], vec![left])?
+                }
+                _ => Node::Invalid {
+                    expected: "function call".to_string(),
+                    got: "expression".to_string(),
+                },
+            },
+        })
+    }
+
+    fn nodes(&self, exprs: &[Expr]) -> Result<Vec<Node>, CompileError> {
+        exprs.iter().map(|e| self.node(e)).collect()
+    }
+
+    fn call(&self, name: &str, args: Vec<Node>) -> Result<Node, CompileError> {
+        match functions::resolve(name, args.len()) {
+            Ok(func) => Ok(member(func, args)
+                .or_else(|args| pipeline::fuse(func, args))
+                .unwrap_or_else(|args| Node::Call { func, args })),
+            Err(e) if self.symbols.is_some() => Err(e),
+            Err(CompileError::ArityMismatch {
+                expected, actual, ..
+            }) => Ok(Node::Invalid {
+                expected: format!("{} arguments", expected),
+                got: format!("{} arguments", actual),
+            }),
+            Err(_) => Ok(Node::Invalid {
+                expected: "known function".to_string(),
+                got: name.to_string(),
+            }),
+        }
+    }
+}
+
+/// Turn `contains` on a large literal array into a `Member` lookup, or give
+/// the arguments back
+fn member(func: usize, mut args: Vec<Node>) -> Result<Node, Vec<Node>> {
+    let is_candidate = matches!(
+        args.as_slice(),
+        [Node::Literal(Value::Array(items)), _] if items.len() >= MEMBER_SET_MIN_LEN
+    );
+    if !is_candidate || functions::lookup("contains") != Some(func) {
+        return Err(args);
+    }
+
+    let value = args.pop().expect("two arguments");
+    let Some(Node::Literal(Value::Array(items))) = args.pop() else {
+        unreachable!("checked above");
+    };
+    Ok(Node::Member {
+        set: items.iter().collect(),
+        value: Box::new(value),
+    })
+}
+
+/// Add `right` to the chain of `+` that `left` ends, if it does
+fn add(left: Node, right: Node) -> Node {
+    match left {
+        Node::Add(mut operands) => {
+            operands.push(right);
+            Node::Add(operands)
+        }
+        Node::Binary {
+            op: BinaryOp::Add,
+            left,
+            right: middle,
+        } => Node::Add(vec![*left, *middle, right]),
+        left => Node::Binary {
+            op: BinaryOp::Add,
+            left: Box::new(left),
+            right: Box::new(right),
+        },
+    }
+}
+
+fn literal(node: Node) -> Value {
+    match node {
+        Node::Literal(value) => value,
+        _ => unreachable!("caller checked the node is a literal"),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use amoskeag_lexer::Lexer;
+    use amoskeag_parser::Parser;
+
+    fn parse(source: &str) -> Expr {
+        let tokens = Lexer::new(source).tokenize().unwrap();
+        Parser::new(tokens).parse().unwrap()
+    }
+
+    #[test]
+    fn test_calls_resolve_to_function_ids() {
+        let node = resolve(&parse("upcase(\"a\")"), &HashSet::new()).unwrap();
+        assert_eq!(
+            node,
+            Node::Call {
+                func: functions::lookup("upcase").unwrap(),
+                args: vec![Node::Literal(Value::String("a".to_string()))],
+            }
+        );
+    }
+
+    #[test]
+    fn test_resolve_validates() {
+        let symbols = HashSet::new();
+        assert!(matches!(
+            resolve(&parse(":approve"), &symbols),
+            Err(CompileError::UndefinedSymbol { .. })
+        ));
+        assert!(matches!(
+            resolve(&parse("nope(1)"), &symbols),
+            Err(CompileError::UndefinedFunction { .. })
+        ));
+        assert!(matches!(
+            resolve(&parse("upcase(1, 2)"), &symbols),
+            Err(CompileError::ArityMismatch { .. })
+        ));
+    }
+
+    #[test]
+    fn test_validate_reports_the_first_error_resolve_does() {
+        let symbols = HashSet::from(["ok".to_string()]);
+        for source in [
+            ":ok",
+            "[1, x, {'k': upcase(name)}] | contains(2)",
+            "nope(:missing)",
+            "upcase(1, 2) + :missing",
+            "if :missing then nope(1) else upcase(1, 2) end",
+            "let a = upcase(x) in a | nope",
+            "x + nope(1) + :missing",
+            "not :ok and (1 | upcase(2))",
+        ] {
+            let expr = parse(source);
+            assert_eq!(
+                validate(&expr, &symbols).map_err(|e| e.to_string()),
+                resolve(&expr, &symbols)
+                    .map(|_| ())
+                    .map_err(|e| e.to_string()),
+                "{}",
+                source
+            );
+        }
+    }
+
+    #[test]
+    fn test_resolve_unchecked_defers_errors() {
+        assert!(matches!(
+            resolve_unchecked(&parse("nope(1)")),
+            Node::Invalid { got, .. } if got == "nope"
+        ));
+        assert!(matches!(
+            resolve_unchecked(&parse(":anything")),
+            Node::Literal(Value::Symbol(_))
+        ));
+    }
+
+    #[test]
+    fn test_literal_collections_are_folded() {
+        let node = resolve_unchecked(&parse("[1, 'a', {'k': [nil]}]"));
+        assert!(matches!(node, Node::Literal(Value::Array(items)) if items.len() == 3));
+        assert!(matches!(
+            resolve_unchecked(&parse("[1, x]")),
+            Node::Array(_)
+        ));
+    }
+
+    #[test]
+    fn test_chains_of_addition_are_flattened() {
+        let node = resolve_unchecked(&parse("a + \"-\" + b + (c + d) + e"));
+        let Node::Add(operands) = node else {
+            panic!("expected a flattened chain, got {:?}", node);
+        };
+        assert_eq!(operands.len(), 5);
+        // Grouping on the right changes the order of the additions
+        assert!(matches!(
+            operands[3],
+            Node::Binary {
+                op: BinaryOp::Add,
+                ..
+            }
+        ));
+
+        assert!(matches!(
+            resolve_unchecked(&parse("a + b")),
+            Node::Binary { .. }
+        ));
+        assert!(matches!(
+            resolve_unchecked(&parse("a + b * c + d")),
+            Node::Add(operands) if operands.len() == 3
+        ));
+        assert!(matches!(
+            resolve_unchecked(&parse("a - b + c")),
+            Node::Binary {
+                op: BinaryOp::Add,
+                ..
+            }
+        ));
+    }
+
+    #[test]
+    fn test_contains_on_literal_array_uses_a_set() {
+        let node = resolve_unchecked(&parse("contains([1, 2, 3, 4, 5, 6, 7, 8], x)"));
+        assert!(matches!(node, Node::Member { set, .. } if set.len() == 8));
+        // Small arrays keep the plain call
+        assert!(matches!(
+            resolve_unchecked(&parse("contains([1, 2], x)")),
+            Node::Call { .. }
+        ));
+    }
+}
@@ -0,0 +1,700 @@
+//! Evaluating many rules together
+//!
+//! A `RuleSet` compiles a set of named rules and evaluates all of them
+//! against a record in one pass, returning a dictionary of their results
+//! keyed by rule name. Rules written against the same data tend to repeat
+//! the same subexpressions, such as a risk score or a derived field, and a
+//! rule set evaluates each of those once per record rather than once per
+//! rule that contains it.
+//!
+//! The optimized ASTs of the rules are hash-consed together, so two
+//! subexpressions are the same when they have the same structure, whatever
+//! rules they appear in. A subexpression is shared when it appears at least
+//! twice outside the other shared subexpressions, is more than a literal or
+//! a variable, calls no impure function such as `date_now`, and reads no
+//! variable bound by an enclosing `let`.
+//!
+//! A shared subexpression is evaluated the first time a rule reaches it, so
+//! one that only appears in branches not taken is never evaluated. Only
+//! values are kept: one that fails is evaluated again, and fails again,
+//! wherever it is reached, so every rule has the result `evaluate` gives it
+//! alone.
+//!
+//! ```
+//! use amoskeag::{AmoskeagValue as Value, RuleSet};
+//! use std::collections::HashMap;
+//!
+//! let rules = RuleSet::compile(
+//!     &[
+//!         ("premium", "base + ((age - 18) * 2 + claims * 10) * 5"),
+//!         ("flagged", "(age - 18) * 2 + claims * 10 > 50"),
+//!     ],
+//!     &[],
+//! )
+//! .unwrap();
+//! assert_eq!(rules.shared_count(), 1);
+//!
+//! let data = HashMap::from([
+//!     ("base".to_string(), Value::Number(500.0)),
+//!     ("age".to_string(), Value::Number(30.0)),
+//!     ("claims".to_string(), Value::Number(4.0)),
+//! ]);
+//! let Value::Dictionary(results) = rules.evaluate(&data).unwrap() else {
+//!     unreachable!()
+//! };
+//! assert_eq!(results["premium"], Value::Number(820.0));
+//! assert_eq!(results["flagged"], Value::Boolean(true));
+//! ```
+
+use crate::batch::{parallel_map, worker_count};
+use crate::optimize::IMPURE_FUNCTIONS;
+use crate::resolve::{self, Node};
+use crate::{compile, eval_node, machine, CompileError, Context, EvalError, NATIVE_DEPTH};
+use amoskeag_parser::{BinaryOp, Expr, UnaryOp};
+use amoskeag_stdlib_operators::Value;
+use std::cell::OnceCell;
+use std::collections::{HashMap, HashSet};
+use thiserror::Error;
+
+/// Errors that can occur compiling or evaluating a rule set
+#[derive(Error, Debug)]
+pub enum RuleSetError {
+    #[error("Rule '{rule}' failed to compile: {source}")]
+    Compile {
+        rule: String,
+        #[source]
+        source: CompileError,
+    },
+
+    #[error("Rule '{0}' is defined more than once")]
+    DuplicateRule(String),
+
+    #[error("Rule '{rule}' failed to evaluate: {source}")]
+    Eval {
+        rule: String,
+        #[source]
+        source: EvalError,
+    },
+}
+
+/// Named rules compiled to be evaluated together
+pub struct RuleSet {
+    names: Vec<String>,
+    /// Each rule, with its shared subexpressions replaced by `Node::Shared`
+    rules: Vec<Node>,
+    /// The shared subexpressions, by slot
+    shared: Vec<Node>,
+}
+
+impl RuleSet {
+    /// Compile the rules `(name, source)`, allowing the symbols in `symbols`
+    pub fn compile(rules: &[(&str, &str)], symbols: &[&str]) -> Result<Self, RuleSetError> {
+        let mut names = Vec::with_capacity(rules.len());
+        let mut programs = Vec::with_capacity(rules.len());
+        let mut seen = HashSet::with_capacity(rules.len());
+        for &(name, source) in rules {
+            if !seen.insert(name) {
+                return Err(RuleSetError::DuplicateRule(name.to_string()));
+            }
+            let program = compile(source, symbols).map_err(|source| RuleSetError::Compile {
+                rule: name.to_string(),
+                source,
+            })?;
+            names.push(name.to_string());
+            programs.push(program);
+        }
+
+        let asts: Vec<&Expr> = programs.iter().map(|program| program.ast()).collect();
+        let (rules, shared) = share(&asts);
+        Ok(Self {
+            names,
+            rules,
+            shared,
+        })
+    }
+
+    /// The names of the rules, in the order they were given
+    pub fn names(&self) -> &[String] {
+        &self.names
+    }
+
+    /// Number of subexpressions evaluated once per record for every rule
+    /// that contains them
+    pub fn shared_count(&self) -> usize {
+        self.shared.len()
+    }
+
+    /// Evaluate every rule against `data`
+    ///
+    /// Returns a dictionary of the results keyed by rule name, or the error
+    /// of the first rule, in order, that fails.
+    pub fn evaluate(&self, data: &HashMap<String, Value>) -> Result<Value, RuleSetError> {
+        let shared = Shared::new(&self.shared);
+        let context = Context {
+            shared: Some(&shared),
+            ..Context::new(data)
+        };
+        let mut results = HashMap::with_capacity(self.rules.len());
+        for (name, rule) in self.names.iter().zip(&self.rules) {
+            let value = eval_node(rule, &context).map_err(|source| RuleSetError::Eval {
+                rule: name.clone(),
+                source,
+            })?;
+            results.insert(name.clone(), value);
+        }
+        Ok(Value::Dictionary(results))
+    }
+
+    /// Evaluate every rule against `data`, returning the result of each, in
+    /// the order of `names`, whether or not the others fail
+    pub fn evaluate_each(&self, data: &HashMap<String, Value>) -> Vec<Result<Value, EvalError>> {
+        let shared = Shared::new(&self.shared);
+        let context = Context {
+            shared: Some(&shared),
+            ..Context::new(data)
+        };
+        self.rules
+            .iter()
+            .map(|rule| eval_node(rule, &context))
+            .collect()
+    }
+
+    /// Evaluate every rule against many records in parallel
+    ///
+    /// The result for `records[i]` is at index `i`, as `evaluate` gives it.
+    pub fn evaluate_batch(
+        &self,
+        records: &[HashMap<String, Value>],
+    ) -> Vec<Result<Value, RuleSetError>> {
+        parallel_map(records, worker_count(records.len()), |data| {
+            self.evaluate(data)
+        })
+    }
+}
+
+/// The shared subexpressions of a rule set, and their values for the
+/// record being evaluated
+pub(crate) struct Shared<'a> {
+    nodes: &'a [Node],
+    values: Vec<OnceCell<Value>>,
+}
+
+impl<'a> Shared<'a> {
+    fn new(nodes: &'a [Node]) -> Self {
+        Self {
+            nodes,
+            values: nodes.iter().map(|_| OnceCell::new()).collect(),
+        }
+    }
+}
+
+/// The value of shared subexpression `slot`, evaluating it at `depth` if no
+/// rule has reached it yet
+///
+/// A shared subexpression reads no local binding, so it is evaluated
+/// against the data alone, and the same value serves every rule.
+pub(crate) fn shared_value<'a>(
+    slot: usize,
+    context: &Context<'a>,
+    depth: usize,
+) -> Result<&'a Value, EvalError> {
+    let shared = context
+        .shared
+        .expect("shared nodes are only evaluated by a rule set");
+    if let Some(value) = shared.values[slot].get() {
+        return Ok(value);
+    }
+
+    let root = Context {
+        local: None,
+        parent: None,
+        ..*context
+    };
+    let node = &shared.nodes[slot];
+    let value = if depth >= NATIVE_DEPTH || root.budget.is_some() {
+        machine::eval_node_ref(node, &root, depth)
+    } else {
+        crate::eval_node_ref(node, &root, depth)
+    }?
+    .into_owned();
+    Ok(shared.values[slot].get_or_init(|| value))
+}
+
+/// Find the subexpressions the rules `asts` share, and resolve the rules
+/// and the shared subexpressions, by slot
+fn share(asts: &[&Expr]) -> (Vec<Node>, Vec<Node>) {
+    let mut classes = Classes::default();
+    for ast in asts {
+        classes.intern(ast);
+    }
+    let mut sites = Vec::new();
+    let mut scope = Vec::new();
+    for ast in asts {
+        classes.select(ast, &mut scope, &mut sites);
+    }
+
+    // Slots are numbered in the order their subexpressions first appear,
+    // and the first appearance is the one each slot evaluates
+    let mut slots = HashMap::new();
+    let mut definitions = Vec::new();
+    let mut shared = HashMap::new();
+    for (expr, class) in sites {
+        if classes.classes[class].uses < 2 {
+            continue;
+        }
+        let slot = *slots.entry(class).or_insert_with(|| {
+            definitions.push(expr);
+            definitions.len() - 1
+        });
+        shared.insert(expr as *const Expr, slot);
+    }
+
+    let rules = asts
+        .iter()
+        .map(|ast| resolve::resolve_shared(ast, &shared, false))
+        .collect();
+    let definitions = definitions
+        .into_iter()
+        .map(|expr| resolve::resolve_shared(expr, &shared, true))
+        .collect();
+    (rules, definitions)
+}
+
+/// The structure of a subexpression, with its subexpressions as class ids
+#[derive(PartialEq, Eq, Hash)]
+enum Key {
+    /// The bits of the number, so that every number has a key
+    Number(u64),
+    String(String),
+    Boolean(bool),
+    Nil,
+    Symbol(String),
+    Array(Vec<usize>),
+    Dictionary(Vec<(String, usize)>),
+    Variable(Vec<String>),
+    Call(String, Vec<usize>),
+    Let(String, usize, usize),
+    If(usize, usize, usize),
+    Binary(BinaryOp, usize, usize),
+    Unary(UnaryOp, usize),
+    Pipe(usize, usize),
+}
+
+/// Subexpressions with the same structure
+struct Class {
+    /// The variables it reads and doesn't bind itself, sorted
+    free: Vec<String>,
+    /// Whether it calls no impure function
+    pure: bool,
+    /// Whether it is a literal or a variable, which cost no more to
+    /// evaluate than to share
+    leaf: bool,
+    /// Number of subexpressions in the class
+    count: usize,
+    /// Number of its subexpressions that could be shared where they are,
+    /// outside the repeats of other shared classes
+    uses: usize,
+}
+
+/// The hash-consed subexpressions of a set of ASTs
+#[derive(Default)]
+struct Classes {
+    ids: HashMap<Key, usize>,
+    classes: Vec<Class>,
+    /// The class of every subexpression, by address
+    of: HashMap<*const Expr, usize>,
+}
+
+impl Classes {
+    /// Assign `expr` and its subexpressions to classes, returning the class
+    /// of `expr`
+    ///
+    /// A chain of `let` bodies, `else` branches and left operands is
+    /// interned in a loop from its far end, as `resolve` lowers it, so long
+    /// generated rules don't take native stack in proportion.
+    fn intern(&mut self, mut expr: &Expr) -> usize {
+        let mut links = Vec::new();
+        while let Some(next) = next_link(expr) {
+            links.push(expr);
+            expr = next;
+        }
+        let mut id = self.class_of(expr, None);
+        for link in links.into_iter().rev() {
+            id = self.class_of(link, Some(id));
+        }
+        id
+    }
+
+    /// Assign `expr` to its class, given the class of the next expression
+    /// along its chain
+    fn class_of(&mut self, expr: &Expr, next: Option<usize>) -> usize {
+        let key = self.key(expr, next);
+        let id = match self.ids.get(&key) {
+            Some(&id) => id,
+            None => {
+                let id = self.classes.len();
+                let class = self.class(&key);
+                self.classes.push(class);
+                self.ids.insert(key, id);
+                id
+            }
+        };
+        self.classes[id].count += 1;
+        self.of.insert(expr as *const Expr, id);
+        id
+    }
+
+    fn key(&mut self, expr: &Expr, next: Option<usize>) -> Key {
+        let next = || next.expect("chain links are interned after the next expression");
+        match expr {
+            Expr::Number(n) => Key::Number(n.to_bits()),
+            Expr::String(s) => Key::String(s.clone()),
+            Expr::Boolean(b) => Key::Boolean(*b),
+            Expr::Nil => Key::Nil,
+            Expr::Symbol(s) => Key::Symbol(s.clone()),
+            Expr::Array(items) => Key::Array(items.iter().map(|e| self.intern(e)).collect()),
+            Expr::Dictionary(pairs) => Key::Dictionary(
+                pairs
+                    .iter()
+                    .map(|(key, e)| (key.clone(), self.intern(e)))
+                    .collect(),
+            ),
+            Expr::Variable(path) => Key::Variable(path.clone()),
+            Expr::FunctionCall { name, args } => {
+                Key::Call(name.clone(), args.iter().map(|e| self.intern(e)).collect())
+            }
+            Expr::Let { name, value, .. } => Key::Let(name.clone(), self.intern(value), next()),
+            Expr::If {
+                condition,
+                then_branch,
+                ..
+            } => Key::If(self.intern(condition), self.intern(then_branch), next()),
+            Expr::Binary { op, right, .. } => Key::Binary(*op, next(), self.intern(right)),
+            Expr::Unary { op, operand } => Key::Unary(*op, self.intern(operand)),
+            Expr::Pipe { left, right } => Key::Pipe(self.intern(left), self.intern(right)),
+        }
+    }
+
+    /// A new class of subexpressions with structure `key`
+    fn class(&self, key: &Key) -> Class {
+        let (children, pure, leaf) = match key {
+            Key::Number(_)
+            | Key::String(_)
+            | Key::Boolean(_)
+            | Key::Nil
+            | Key::Symbol(_)
+            | Key::Variable(_) => (Vec::new(), true, true),
+            Key::Array(items) => (items.clone(), true, false),
+            Key::Dictionary(pairs) => (pairs.iter().map(|(_, id)| *id).collect(), true, false),
+            Key::Call(name, args) => (
+                args.clone(),
+                !IMPURE_FUNCTIONS.contains(&name.as_str()),
+                false,
+            ),
+            Key::Let(_, value, _) => (vec![*value], true, false),
+            Key::If(condition, then_branch, else_branch) => {
+                (vec![*condition, *then_branch, *else_branch], true, false)
+            }
+            Key::Binary(_, left, right) | Key::Pipe(left, right) => {
+                (vec![*left, *right], true, false)
+            }
+            Key::Unary(_, operand) => (vec![*operand], true, false),
+        };
+
+        let mut free: Vec<String> = children
+            .iter()
+            .flat_map(|&id| self.classes[id].free.iter().cloned())
+            .collect();
+        let mut pure = pure && children.iter().all(|&id| self.classes[id].pure);
+        match key {
+            Key::Variable(path) => free.extend(path.first().cloned()),
+            // A let reads what its body reads, except its own binding
+            Key::Let(name, _, body) => {
+                let body = &self.classes[*body];
+                free.extend(body.free.iter().filter(|v| *v != name).cloned());
+                pure &= body.pure;
+            }
+            _ => {}
+        }
+        free.sort_unstable();
+        free.dedup();
+
+        Class {
+            free,
+            pure,
+            leaf,
+            count: 0,
+            uses: 0,
+        }
+    }
+
+    /// Count the uses of the classes `expr` and its subexpressions could be
+    /// shared in, recording each use in `sites`
+    ///
+    /// `scope` holds the names bound around `expr`. The subexpressions of a
+    /// repeated use are not visited, since they are evaluated with it.
+    /// Chains are followed in a loop, as by `intern`.
+    fn select<'e>(
+        &mut self,
+        mut expr: &'e Expr,
+        scope: &mut Vec<&'e str>,
+        sites: &mut Vec<(&'e Expr, usize)>,
+    ) {
+        let len = scope.len();
+        while self.visit(expr, scope, sites) {
+            match expr {
+                Expr::Let { name, value, body } => {
+                    self.select(value, scope, sites);
+                    scope.push(name);
+                    expr = body;
+                }
+                Expr::If {
+                    condition,
+                    then_branch,
+                    else_branch,
+                } => {
+                    self.select(condition, scope, sites);
+                    self.select(then_branch, scope, sites);
+                    expr = else_branch;
+                }
+                Expr::Binary { left, right, .. } => {
+                    self.select(right, scope, sites);
+                    expr = left;
+                }
+                Expr::Array(exprs) | Expr::FunctionCall { args: exprs, .. } => {
+                    for e in exprs {
+                        self.select(e, scope, sites);
+                    }
+                    break;
+                }
+                Expr::Dictionary(pairs) => {
+                    for (_, e) in pairs {
+                        self.select(e, scope, sites);
+                    }
+                    break;
+                }
+                Expr::Unary { operand, .. } => {
+                    self.select(operand, scope, sites);
+                    break;
+                }
+                Expr::Pipe { left, right } => {
+                    self.select(left, scope, sites);
+                    self.select(right, scope, sites);
+                    break;
+                }
+                _ => break,
+            }
+        }
+        scope.truncate(len);
+    }
+
+    /// Count a use of `expr` if it could be shared where it is, returning
+    /// whether to visit its subexpressions
+    fn visit<'e>(
+        &mut self,
+        expr: &'e Expr,
+        scope: &[&str],
+        sites: &mut Vec<(&'e Expr, usize)>,
+    ) -> bool {
+        let id = self.of[&(expr as *const Expr)];
+        let class = &mut self.classes[id];
+        let candidate = !class.leaf
+            && class.pure
+            && class.count > 1
+            && !class.free.iter().any(|name| scope.contains(&name.as_str()));
+        if !candidate {
+            return true;
+        }
+        class.uses += 1;
+        sites.push((expr, id));
+        class.uses == 1
+    }
+}
+
+/// The next expression along the chain `expr` is a link of, if it is one
+fn next_link(expr: &Expr) -> Option<&Expr> {
+    match expr {
+        Expr::Let { body, .. } => Some(body),
+        Expr::If { else_branch, .. } => Some(else_branch),
+        Expr::Binary { left, .. } => Some(left),
+        _ => None,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::evaluate;
+
+    fn data(pairs: &[(&str, Value)]) -> HashMap<String, Value> {
+        pairs
+            .iter()
+            .map(|(key, value)| (key.to_string(), value.clone()))
+            .collect()
+    }
+
+    fn results(rules: &RuleSet, data: &HashMap<String, Value>) -> HashMap<String, Value> {
+        match rules.evaluate(data).unwrap() {
+            Value::Dictionary(results) => results,
+            value => panic!("expected a dictionary, got {:?}", value),
+        }
+    }
+
+    #[test]
+    fn test_results_match_separate_evaluation() {
+        let sources = [
+            ("score", "(age - 18) * 2 + claims * 10"),
+            (
+                "band",
+                "if (age - 18) * 2 + claims * 10 > 50 then \"high\" else \"low\" end",
+            ),
+            (
+                "premium",
+                "round(base * (1 + ((age - 18) * 2 + claims * 10) / 100), 2)",
+            ),
+            ("names", "join(map(drivers, 'name'), \", \")"),
+            ("count", "size(map(drivers, 'name'))"),
+            ("local", "let s = claims * 10 in s + s"),
+        ];
+        let rules = RuleSet::compile(&sources, &[]).unwrap();
+        assert_eq!(rules.names().len(), sources.len());
+        assert!(rules.shared_count() >= 2, "{}", rules.shared_count());
+
+        let drivers = |names: &[&str]| {
+            Value::Array(
+                names
+                    .iter()
+                    .map(|name| {
+                        Value::Dictionary(HashMap::from([(
+                            "name".to_string(),
+                            Value::String(name.to_string()),
+                        )]))
+                    })
+                    .collect(),
+            )
+        };
+        for (age, claims, names) in [(30.0, 4.0, &["a", "b"][..]), (19.0, 0.0, &[][..])] {
+            let data = data(&[
+                ("age", Value::Number(age)),
+                ("claims", Value::Number(claims)),
+                ("base", Value::Number(420.0)),
+                ("drivers", drivers(names)),
+            ]);
+            let results = results(&rules, &data);
+            for (name, source) in sources {
+                let expected = evaluate(&compile(source, &[]).unwrap(), &data).unwrap();
+                assert_eq!(results[name], expected, "{}", name);
+            }
+        }
+    }
+
+    #[test]
+    fn test_shares_only_repeats() {
+        let rules = RuleSet::compile(&[("a", "x * 2 + 1"), ("b", "y * 2 + 1")], &[]).unwrap();
+        assert_eq!(rules.shared_count(), 0);
+
+        // `x * 2` only appears inside the shared `x * 2 + 1`
+        let rules = RuleSet::compile(&[("a", "x * 2 + 1"), ("b", "x * 2 + 1 > 3")], &[]).unwrap();
+        assert_eq!(rules.shared_count(), 1);
+
+        // Variables and literals are never shared
+        let rules = RuleSet::compile(&[("a", "x"), ("b", "x"), ("c", "[x, 1]")], &[]).unwrap();
+        assert_eq!(rules.shared_count(), 0);
+
+        // Nor are calls whose result changes from one call to the next
+        let rules =
+            RuleSet::compile(&[("a", "date_now() + 1"), ("b", "date_now() + 1")], &[]).unwrap();
+        assert_eq!(rules.shared_count(), 0);
+    }
+
+    #[test]
+    fn test_let_bound_variables_are_not_shared() {
+        let rules = RuleSet::compile(
+            &[
+                ("a", "let x = y + 1 in x * 10 + 1"),
+                ("b", "x * 10 + 1"),
+                ("c", "x * 10 + 1 > 0"),
+            ],
+            &[],
+        )
+        .unwrap();
+        assert_eq!(rules.shared_count(), 1);
+
+        let results = results(
+            &rules,
+            &data(&[("x", Value::Number(5.0)), ("y", Value::Number(1.0))]),
+        );
+        assert_eq!(results["a"], Value::Number(21.0));
+        assert_eq!(results["b"], Value::Number(51.0));
+        assert_eq!(results["c"], Value::Boolean(true));
+    }
+
+    #[test]
+    fn test_shared_subexpressions_are_evaluated_lazily() {
+        let rules = RuleSet::compile(
+            &[
+                ("a", "if ok then 10 / d else 0 end"),
+                ("b", "if ok then 10 / d + 1 else 1 end"),
+            ],
+            &[],
+        )
+        .unwrap();
+        assert_eq!(rules.shared_count(), 1);
+
+        // Never reached, so never fails
+        let skipped = data(&[
+            ("ok", Value::Boolean(false)),
+            ("d", Value::String("s".to_string())),
+        ]);
+        let results = results(&rules, &skipped);
+        assert_eq!(results["a"], Value::Number(0.0));
+        assert_eq!(results["b"], Value::Number(1.0));
+
+        // Fails for every rule that reaches it
+        let failing = data(&[
+            ("ok", Value::Boolean(true)),
+            ("d", Value::String("s".to_string())),
+        ]);
+        assert!(matches!(
+            rules.evaluate(&failing),
+            Err(RuleSetError::Eval { rule, .. }) if rule == "a"
+        ));
+        assert!(rules.evaluate_each(&failing).iter().all(Result::is_err));
+    }
+
+    #[test]
+    fn test_deep_rules() {
+        // Deeper than NATIVE_DEPTH, sharing each term
+        let sum = vec!["(x + 1) * 2"; 5_000].join(" + ");
+        let rules = RuleSet::compile(&[("a", &sum), ("b", "(x + 1) * 2")], &[]).unwrap();
+        assert_eq!(rules.shared_count(), 1);
+        let results = results(&rules, &data(&[("x", Value::Number(1.0))]));
+        assert_eq!(results["a"], Value::Number(20_000.0));
+        assert_eq!(results["b"], Value::Number(4.0));
+    }
+
+    #[test]
+    fn test_evaluate_batch() {
+        let rules = RuleSet::compile(&[("a", "x * 2 + 1"), ("b", "x * 2 + 1 > 100")], &[]).unwrap();
+        let records: Vec<_> = (0..200)
+            .map(|i| data(&[("x", Value::Number(i as f64))]))
+            .collect();
+        let results = rules.evaluate_batch(&records);
+        assert_eq!(results.len(), records.len());
+        for (result, data) in results.into_iter().zip(&records) {
+            assert_eq!(result.unwrap(), rules.evaluate(data).unwrap());
+        }
+    }
+
+    #[test]
+    fn test_errors_name_the_rule() {
+        assert!(matches!(
+            RuleSet::compile(&[("a", "1"), ("a", "2")], &[]),
+            Err(RuleSetError::DuplicateRule(name)) if name == "a"
+        ));
+        assert!(matches!(
+            RuleSet::compile(&[("a", "1"), ("b", ":nope")], &[]),
+            Err(RuleSetError::Compile { rule, .. }) if rule == "b"
+        ));
+    }
+}
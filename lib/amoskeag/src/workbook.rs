@@ -0,0 +1,550 @@
+//! Incremental recalculation of named formulas
+//!
+//! A `Workbook` is a sheet of named formulas and the inputs they read. Each
+//! formula is compiled once, and the names it reads are the top-level
+//! fields of its required paths. A formula that reads another formula's
+//! name depends on it, and the dependencies must not form a cycle.
+//!
+//! Results are kept from one recalculation to the next. When inputs change,
+//! `recalculate` evaluates only the formulas that read them, directly or
+//! through other formulas, in dependency order. Every formula that depends
+//! only on finished ones is evaluated in parallel. A formula whose result
+//! comes out the same as before doesn't make its own readers recalculate.
+//!
+//! ```
+//! use amoskeag::{AmoskeagValue as Value, Workbook};
+//!
+//! let mut book = Workbook::new(&[("total", "price * quantity"), ("tax", "total * 0.2")], &[])
+//!     .unwrap();
+//! book.set_input("price", Value::Number(5.0)).unwrap();
+//! book.set_input("quantity", Value::Number(4.0)).unwrap();
+//! assert_eq!(book.recalculate(), 2);
+//! assert_eq!(book.get("tax").unwrap().unwrap(), &Value::Number(4.0));
+//!
+//! // Only the formulas that read quantity, and their readers, run again
+//! book.set_input("quantity", Value::Number(5.0)).unwrap();
+//! assert_eq!(book.recalculate(), 2);
+//! assert_eq!(book.get("tax").unwrap().unwrap(), &Value::Number(5.0));
+//! ```
+
+use crate::batch::{parallel_map, worker_count};
+use crate::{compile, evaluate, CompileError, CompiledProgram, EvalError};
+use amoskeag_stdlib_operators::Value;
+use std::collections::{BTreeMap, HashMap};
+use std::mem;
+use thiserror::Error;
+
+/// Errors that can occur building or editing a workbook
+#[derive(Error, Debug)]
+pub enum WorkbookError {
+    #[error("Formula '{name}' failed to compile: {source}")]
+    Compile {
+        name: String,
+        #[source]
+        source: CompileError,
+    },
+
+    #[error("Formula '{0}' is defined more than once")]
+    DuplicateFormula(String),
+
+    #[error("Formulas depend on each other in a cycle: {}", .0.join(" -> "))]
+    Cycle(Vec<String>),
+
+    #[error("'{0}' is a formula, not an input")]
+    NotAnInput(String),
+}
+
+/// A named formula and the state of its last evaluation
+struct Cell {
+    name: String,
+    program: CompiledProgram,
+    /// The names the formula reads, inputs or formulas
+    reads: Vec<String>,
+    /// Length of the longest chain of formulas this one depends on
+    level: usize,
+    /// Why the last evaluation failed, if it did
+    error: Option<EvalError>,
+}
+
+/// A set of named formulas that recalculates incrementally
+pub struct Workbook {
+    symbols: Vec<String>,
+    cells: Vec<Cell>,
+    index: HashMap<String, usize>,
+    /// The formulas that read each name
+    readers: HashMap<String, Vec<usize>>,
+    /// Inputs, and the result of every formula that evaluated successfully
+    values: HashMap<String, Value>,
+    /// Whether each formula is to be evaluated at the next recalculation
+    dirty: Vec<bool>,
+    /// The formulas marked dirty since the last recalculation
+    queued: Vec<usize>,
+}
+
+impl Workbook {
+    /// Compile `formulas`, as (name, source) pairs, against `symbols`
+    ///
+    /// Nothing is evaluated until the first [`recalculate`](Self::recalculate).
+    ///
+    /// # Errors
+    /// Returns an error when a formula doesn't compile, when two formulas
+    /// have the same name, or when formulas depend on each other in a cycle.
+    pub fn new(formulas: &[(&str, &str)], symbols: &[&str]) -> Result<Self, WorkbookError> {
+        let mut book = Self {
+            symbols: symbols.iter().map(|s| s.to_string()).collect(),
+            cells: Vec::with_capacity(formulas.len()),
+            index: HashMap::with_capacity(formulas.len()),
+            readers: HashMap::new(),
+            values: HashMap::new(),
+            dirty: vec![true; formulas.len()],
+            queued: (0..formulas.len()).collect(),
+        };
+        for (name, source) in formulas {
+            if book.index.contains_key(*name) {
+                return Err(WorkbookError::DuplicateFormula(name.to_string()));
+            }
+            let cell = book.cell(name, source)?;
+            book.index.insert(name.to_string(), book.cells.len());
+            book.cells.push(cell);
+        }
+        book.link().map_err(WorkbookError::Cycle)?;
+        Ok(book)
+    }
+
+    /// Set the input `name`, marking the formulas that read it for
+    /// recalculation if its value changed
+    ///
+    /// # Errors
+    /// Returns an error if `name` is a formula.
+    pub fn set_input(&mut self, name: &str, value: Value) -> Result<(), WorkbookError> {
+        if self.index.contains_key(name) {
+            return Err(WorkbookError::NotAnInput(name.to_string()));
+        }
+        if self.values.get(name) == Some(&value) {
+            return Ok(());
+        }
+        self.values.insert(name.to_string(), value);
+        self.mark_readers(name);
+        Ok(())
+    }
+
+    /// Add the formula `name`, or replace it, marking it for recalculation
+    ///
+    /// An input of the same name becomes the formula, and the formulas that
+    /// read it are recalculated if the formula's result differs from it.
+    ///
+    /// # Errors
+    /// Returns an error, leaving the workbook as it was, if the formula
+    /// doesn't compile or would make formulas depend on each other in a
+    /// cycle.
+    pub fn set_formula(&mut self, name: &str, source: &str) -> Result<(), WorkbookError> {
+        let cell = self.cell(name, source)?;
+        let (id, replaced) = match self.index.get(name) {
+            Some(&id) => (id, Some(mem::replace(&mut self.cells[id], cell))),
+            None => {
+                self.index.insert(name.to_string(), self.cells.len());
+                self.cells.push(cell);
+                self.dirty.push(false);
+                (self.cells.len() - 1, None)
+            }
+        };
+
+        if let Err(cycle) = self.link() {
+            match replaced {
+                Some(old) => self.cells[id] = old,
+                None => {
+                    self.cells.pop();
+                    self.dirty.pop();
+                    self.index.remove(name);
+                }
+            }
+            self.link()
+                .expect("workbook was acyclic before the formula was set");
+            return Err(WorkbookError::Cycle(cycle));
+        }
+
+        self.mark(id);
+        Ok(())
+    }
+
+    /// Evaluate every formula affected by the changes since the last
+    /// recalculation, returning how many were evaluated
+    ///
+    /// A formula that fails keeps its error until it is next evaluated,
+    /// and the formulas that read it fail with
+    /// `EvalError::VariableNotFound` naming it.
+    pub fn recalculate(&mut self) -> usize {
+        let mut pending: BTreeMap<usize, Vec<usize>> = BTreeMap::new();
+        for id in self.queued.drain(..) {
+            pending.entry(self.cells[id].level).or_default().push(id);
+        }
+
+        // Each level only reads the results of lower levels, so all of its
+        // formulas can be evaluated at once against the current values
+        let mut evaluated = 0;
+        while let Some((_, ids)) = pending.pop_first() {
+            let results = parallel_map(&ids, worker_count(ids.len()), |&id| {
+                evaluate(&self.cells[id].program, &self.values)
+            });
+            evaluated += ids.len();
+
+            for (id, result) in ids.into_iter().zip(results) {
+                self.dirty[id] = false;
+                let cell = &mut self.cells[id];
+                let changed = match result {
+                    Ok(value) => {
+                        cell.error = None;
+                        if self.values.get(&cell.name) == Some(&value) {
+                            false
+                        } else {
+                            self.values.insert(cell.name.clone(), value);
+                            true
+                        }
+                    }
+                    Err(error) => {
+                        cell.error = Some(error);
+                        self.values.remove(&cell.name).is_some()
+                    }
+                };
+                if changed {
+                    for &reader in self.readers.get(&self.cells[id].name).into_iter().flatten() {
+                        if !self.dirty[reader] {
+                            self.dirty[reader] = true;
+                            pending
+                                .entry(self.cells[reader].level)
+                                .or_default()
+                                .push(reader);
+                        }
+                    }
+                }
+            }
+        }
+        evaluated
+    }
+
+    /// The value of the input or formula `name`
+    ///
+    /// Returns `None` if there is no such input or formula, or the formula
+    /// hasn't been evaluated yet, and the error if its last evaluation
+    /// failed.
+    pub fn get(&self, name: &str) -> Option<Result<&Value, &EvalError>> {
+        if let Some(error) = self
+            .index
+            .get(name)
+            .and_then(|&id| self.cells[id].error.as_ref())
+        {
+            return Some(Err(error));
+        }
+        self.values.get(name).map(Ok)
+    }
+
+    /// Names of the formulas, in the order they were added
+    pub fn formulas(&self) -> impl Iterator<Item = &str> {
+        self.cells.iter().map(|cell| cell.name.as_str())
+    }
+
+    /// Compile a formula
+    fn cell(&self, name: &str, source: &str) -> Result<Cell, WorkbookError> {
+        let symbols: Vec<&str> = self.symbols.iter().map(String::as_str).collect();
+        let program = compile(source, &symbols).map_err(|source| WorkbookError::Compile {
+            name: name.to_string(),
+            source,
+        })?;
+        let reads = program
+            .required_paths()
+            .fields()
+            .map(|(key, _)| key.to_string())
+            .collect();
+        Ok(Cell {
+            name: name.to_string(),
+            program,
+            reads,
+            level: 0,
+            error: None,
+        })
+    }
+
+    /// Mark the formula `id` for recalculation
+    fn mark(&mut self, id: usize) {
+        if !self.dirty[id] {
+            self.dirty[id] = true;
+            self.queued.push(id);
+        }
+    }
+
+    /// Mark the formulas that read `name` for recalculation
+    fn mark_readers(&mut self, name: &str) {
+        for &reader in self.readers.get(name).into_iter().flatten() {
+            if !self.dirty[reader] {
+                self.dirty[reader] = true;
+                self.queued.push(reader);
+            }
+        }
+    }
+
+    /// Rebuild the readers of every name and the level of every formula,
+    /// or return the names of a cycle of formulas, first and last the same
+    fn link(&mut self) -> Result<(), Vec<String>> {
+        self.readers.clear();
+        let mut waiting = vec![0; self.cells.len()];
+        for (id, cell) in self.cells.iter().enumerate() {
+            for name in &cell.reads {
+                self.readers.entry(name.clone()).or_default().push(id);
+                if self.index.contains_key(name) {
+                    waiting[id] += 1;
+                }
+            }
+        }
+
+        // Kahn's algorithm: a formula's level is settled once every formula
+        // it reads is
+        let mut ready: Vec<usize> = (0..self.cells.len())
+            .filter(|&id| waiting[id] == 0)
+            .collect();
+        let mut levels = vec![0; self.cells.len()];
+        let mut settled = 0;
+        while let Some(id) = ready.pop() {
+            settled += 1;
+            for &reader in self.readers.get(&self.cells[id].name).into_iter().flatten() {
+                levels[reader] = levels[reader].max(levels[id] + 1);
+                waiting[reader] -= 1;
+                if waiting[reader] == 0 {
+                    ready.push(reader);
+                }
+            }
+        }
+
+        if settled < self.cells.len() {
+            return Err(self.cycle(&waiting));
+        }
+        for (cell, level) in self.cells.iter_mut().zip(levels) {
+            cell.level = level;
+        }
+        Ok(())
+    }
+
+    /// A cycle among the formulas left `waiting` by `link`
+    ///
+    /// Every such formula reads another one, so following those reads from
+    /// any of them must come back to a formula already visited.
+    fn cycle(&self, waiting: &[usize]) -> Vec<String> {
+        let mut path = Vec::new();
+        let mut visited = vec![None; self.cells.len()];
+        let mut id = waiting
+            .iter()
+            .position(|&count| count > 0)
+            .expect("a cycle leaves formulas waiting");
+        while visited[id].is_none() {
+            visited[id] = Some(path.len());
+            path.push(id);
+            id = self.cells[id]
+                .reads
+                .iter()
+                .filter_map(|name| self.index.get(name).copied())
+                .find(|&dependency| waiting[dependency] > 0)
+                .expect("a waiting formula reads a waiting formula");
+        }
+        let start = visited[id].expect("loop ends on a visited formula");
+        path[start..]
+            .iter()
+            .chain([&id])
+            .map(|&id| self.cells[id].name.clone())
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn number(book: &Workbook, name: &str) -> f64 {
+        match book.get(name) {
+            Some(Ok(Value::Number(n))) => *n,
+            other => panic!("expected a number for {}, got {:?}", name, other),
+        }
+    }
+
+    #[test]
+    fn test_recalculates_only_affected_formulas() {
+        let mut book = Workbook::new(
+            &[
+                ("C1", "A1 + B1"),
+                ("C2", "C1 * 2"),
+                ("D1", "B2 * 10"),
+                ("E1", "C2 + D1"),
+            ],
+            &[],
+        )
+        .unwrap();
+        for (name, value) in [("A1", 1.0), ("B1", 2.0), ("B2", 3.0)] {
+            book.set_input(name, Value::Number(value)).unwrap();
+        }
+        assert!(book.get("C1").is_none());
+
+        assert_eq!(book.recalculate(), 4);
+        assert_eq!(number(&book, "E1"), 36.0);
+        assert_eq!(book.recalculate(), 0);
+
+        // B2 only reaches D1 and E1
+        book.set_input("B2", Value::Number(4.0)).unwrap();
+        assert_eq!(book.recalculate(), 2);
+        assert_eq!(number(&book, "E1"), 46.0);
+        assert_eq!(number(&book, "C2"), 6.0);
+
+        // Setting an input to the value it has changes nothing
+        book.set_input("A1", Value::Number(1.0)).unwrap();
+        assert_eq!(book.recalculate(), 0);
+    }
+
+    #[test]
+    fn test_unchanged_result_stops_propagation() {
+        let mut book = Workbook::new(
+            &[("rounded", "round(price, 0)"), ("total", "rounded * 3")],
+            &[],
+        )
+        .unwrap();
+        book.set_input("price", Value::Number(10.2)).unwrap();
+        assert_eq!(book.recalculate(), 2);
+
+        book.set_input("price", Value::Number(10.3)).unwrap();
+        assert_eq!(book.recalculate(), 1);
+        assert_eq!(number(&book, "total"), 30.0);
+
+        book.set_input("price", Value::Number(10.6)).unwrap();
+        assert_eq!(book.recalculate(), 2);
+        assert_eq!(number(&book, "total"), 33.0);
+    }
+
+    #[test]
+    fn test_let_bindings_are_not_dependencies() {
+        let mut book = Workbook::new(
+            &[("rate", "0.1"), ("grown", "let rate = 2 in base * rate")],
+            &[],
+        )
+        .unwrap();
+        book.set_input("base", Value::Number(50.0)).unwrap();
+        book.recalculate();
+        assert_eq!(number(&book, "grown"), 100.0);
+
+        book.set_formula("rate", "0.2").unwrap();
+        assert_eq!(book.recalculate(), 1);
+    }
+
+    #[test]
+    fn test_cycles_are_rejected() {
+        let result = Workbook::new(&[("A", "C + 1"), ("B", "A + 1"), ("C", "B + 1")], &[]);
+        match result {
+            Err(WorkbookError::Cycle(path)) => {
+                assert_eq!(path.len(), 4);
+                assert_eq!(path.first(), path.last());
+            }
+            other => panic!("expected a cycle, got {:?}", other.err()),
+        }
+
+        let result = Workbook::new(&[("A", "A + 1")], &[]);
+        assert!(matches!(result, Err(WorkbookError::Cycle(path)) if path == ["A", "A"]));
+
+        // A formula that would close a cycle is rejected, and the workbook
+        // keeps working as before
+        let mut book = Workbook::new(&[("A", "x + 1"), ("B", "A + 1")], &[]).unwrap();
+        let result = book.set_formula("A", "B + 1");
+        assert!(matches!(result, Err(WorkbookError::Cycle(_))));
+        let result = book.set_formula("x", "B");
+        assert!(matches!(result, Err(WorkbookError::Cycle(_))));
+        book.set_input("x", Value::Number(1.0)).unwrap();
+        assert_eq!(book.recalculate(), 2);
+        assert_eq!(number(&book, "B"), 3.0);
+    }
+
+    #[test]
+    fn test_set_formula() {
+        let mut book = Workbook::new(&[("total", "price * quantity")], &[]).unwrap();
+        book.set_input("price", Value::Number(2.0)).unwrap();
+        book.set_input("quantity", Value::Number(3.0)).unwrap();
+        book.recalculate();
+
+        // Replacing an input with a formula recalculates its readers
+        book.set_formula("quantity", "price + 2").unwrap();
+        assert_eq!(book.recalculate(), 2);
+        assert_eq!(number(&book, "total"), 8.0);
+        assert!(matches!(
+            book.set_input("quantity", Value::Number(1.0)),
+            Err(WorkbookError::NotAnInput(name)) if name == "quantity"
+        ));
+
+        book.set_formula("discounted", "total * 0.5").unwrap();
+        assert_eq!(book.recalculate(), 1);
+        assert_eq!(number(&book, "discounted"), 4.0);
+        assert_eq!(
+            book.formulas().collect::<Vec<_>>(),
+            ["total", "quantity", "discounted"]
+        );
+    }
+
+    #[test]
+    fn test_errors_propagate_and_recover() {
+        let mut book = Workbook::new(
+            &[
+                ("ratio", "a / b"),
+                ("label", "if ratio > 1 :high else :low end"),
+            ],
+            &["high", "low"],
+        )
+        .unwrap();
+        book.set_input("a", Value::Number(3.0)).unwrap();
+        book.set_input("b", Value::String("zero".to_string()))
+            .unwrap();
+        book.recalculate();
+        assert!(matches!(book.get("ratio"), Some(Err(_))));
+        assert!(matches!(
+            book.get("label"),
+            Some(Err(EvalError::VariableNotFound(name))) if name == "ratio"
+        ));
+
+        book.set_input("b", Value::Number(2.0)).unwrap();
+        assert_eq!(book.recalculate(), 2);
+        assert_eq!(
+            book.get("label").unwrap().unwrap(),
+            &Value::Symbol("high".into())
+        );
+
+        let result = Workbook::new(&[("a", "1"), ("a", "2")], &[]);
+        assert!(matches!(result, Err(WorkbookError::DuplicateFormula(name)) if name == "a"));
+        let result = Workbook::new(&[("bad", "1 +")], &[]);
+        assert!(matches!(result, Err(WorkbookError::Compile { name, .. }) if name == "bad"));
+    }
+
+    #[test]
+    fn test_wide_sheet_matches_direct_evaluation() {
+        // Enough formulas per level to be evaluated in parallel
+        let sources: Vec<(String, String)> = (0..2000)
+            .flat_map(|i| {
+                [
+                    (format!("r{}", i), format!("base * {} + offset", i)),
+                    (
+                        format!("s{}", i),
+                        format!("r{} * 2 + r{}", i, (i + 1) % 2000),
+                    ),
+                ]
+            })
+            .collect();
+        let formulas: Vec<(&str, &str)> = sources
+            .iter()
+            .map(|(name, source)| (name.as_str(), source.as_str()))
+            .collect();
+        let mut book = Workbook::new(&formulas, &[]).unwrap();
+        book.set_input("base", Value::Number(3.0)).unwrap();
+        book.set_input("offset", Value::Number(1.0)).unwrap();
+        assert_eq!(book.recalculate(), 4000);
+
+        book.set_input("offset", Value::Number(2.0)).unwrap();
+        assert_eq!(book.recalculate(), 4000);
+        for i in 0..2000 {
+            let r = |i: usize| 3.0 * i as f64 + 2.0;
+            assert_eq!(
+                number(&book, &format!("s{}", i)),
+                r(i) * 2.0 + r((i + 1) % 2000)
+            );
+        }
+    }
+}
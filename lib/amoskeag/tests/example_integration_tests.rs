@@ -122,7 +122,7 @@ fn test_08_symbols() {
     let data = HashMap::new();
     let result = evaluate(&program, &data).expect("Evaluation failed");
 
-    assert_eq!(result, Value::Symbol("approved".to_string()));
+    assert_eq!(result, Value::Symbol("approved".into()));
 }
 
 #[test]
@@ -133,7 +133,7 @@ fn test_09_business_rule_simple() {
     let data = HashMap::new();
     let result = evaluate(&program, &data).expect("Evaluation failed");
 
-    assert_eq!(result, Value::Symbol("approve".to_string()));
+    assert_eq!(result, Value::Symbol("approve".into()));
 }
 
 #[test]
@@ -209,7 +209,7 @@ fn test_10_business_rule_complex() {
 
     let result = evaluate(&program, &data).expect("Evaluation failed");
 
-    assert_eq!(result, Value::Symbol("manual_review".to_string()));
+    assert_eq!(result, Value::Symbol("manual_review".into()));
 }
 
 #[test]
@@ -535,7 +535,7 @@ fn test_25_validation_rule() {
     let data = HashMap::new();
     let result = evaluate(&program, &data).expect("Evaluation failed");
 
-    assert_eq!(result, Value::Symbol("valid".to_string()));
+    assert_eq!(result, Value::Symbol("valid".into()));
 }
 
 #[test]
@@ -749,11 +749,11 @@ fn test_variable_returns_symbol_value() {
     let program = compile(&source, &["active", "inactive"]).expect("Compilation failed");
 
     let mut data = HashMap::new();
-    data.insert("status".to_string(), Value::Symbol("active".to_string()));
+    data.insert("status".to_string(), Value::Symbol("active".into()));
 
     let result = evaluate(&program, &data).expect("Evaluation failed");
 
-    assert_eq!(result, Value::Symbol("active".to_string()));
+    assert_eq!(result, Value::Symbol("active".into()));
 }
 
 // Test: variable containing string should return the string